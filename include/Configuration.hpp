@@ -8,6 +8,8 @@
 #include <functional>
 #include <FreeRTOS.h>
 
+#define MAX_SNMP_TRAP_TARGETS 4         // Receivers of the SNMP notifications
+
 class DeviceConfiguration {
 public:
     /**
@@ -20,7 +22,28 @@ public:
         TEMPERATURE_ALARM,
         LOGIN_USER,
         LOGIN_PASS,
-        MAC_ADDRESS
+        MAC_ADDRESS,
+        SELF_TEST,
+        UPS_STATE,
+        SNMP_CACHE
+    };
+
+    /**
+     * Receiver of the SNMP notifications
+     */
+    struct SNMPTrapTarget {
+        /**
+         * Notification sent to the receiver
+         */
+        enum class Type : uint8_t {
+            V1 = 0,     //SNMPv1 Trap-PDU
+            V2C,        //SNMPv2c Trap
+            INFORM      //SNMPv2c Inform, retransmitted until acknowledged
+        };
+        IPAddress ip;
+        uint16_t port;
+        Type type;
+        std::string community;
     };
 
     DeviceConfiguration();
@@ -65,16 +88,16 @@ public:
     void getIPAddress(IPAddress& ip, IPAddress& subnet, IPAddress& gateway);
 
     /**
-     * Sets IP address to send SNMP traps
-     * @param ip IP address to send SNMP traps to
+     * Sets the receivers of the SNMP notifications
+     * @param targets Receivers (only the first MAX_SNMP_TRAP_TARGETS are kept)
      */
-    void setSNMPTrap(const IPAddress& ip);
+    void setSNMPTraps(const std::vector<SNMPTrapTarget>& targets);
 
     /**
-     * Gets IP address to send SNMP traps
-     * @param IP address to send SNMP traps to
+     * Gets the receivers of the SNMP notifications
+     * @param targets Receivers (empty if the notifications are disabled)
      */
-    void getSNMPTrap(IPAddress& ip);
+    void getSNMPTraps(std::vector<SNMPTrapTarget>& targets);
 
     /**
      * Sets the temperature alarm threshold
@@ -87,6 +110,47 @@ public:
      */
     double getTemperatureAlarm();
 
+    /**
+     * Sets the UPS self-test schedule
+     * @param intervalHours Hours between two tests of a UPS (0 disables scheduled tests)
+     * @param deep True for deep tests (battery runtime calibration), false for quick tests
+     */
+    void setSelfTest(uint32_t intervalHours, bool deep);
+
+    /**
+     * Gets the UPS self-test schedule
+     * @param intervalHours Hours between two tests of a UPS (0 if disabled)
+     * @param deep True for deep tests
+     */
+    void getSelfTest(uint32_t& intervalHours, bool& deep);
+
+    /**
+     * Sets the UPS state filtering
+     * @param debounceMs Time a condition must hold before the UPS state changes
+     * @param lowBattery Charge flagging a low battery (%, 0 to only use the UPS limit)
+     * @param hysteresis Charge or load change clearing a threshold condition (%)
+     */
+    void setStateFilter(uint32_t debounceMs, uint8_t lowBattery, uint8_t hysteresis);
+
+    /**
+     * Gets the UPS state filtering
+     * @param debounceMs Time a condition must hold before the UPS state changes
+     * @param lowBattery Charge flagging a low battery (%, 0 if only the UPS limit is used)
+     * @param hysteresis Charge or load change clearing a threshold condition (%)
+     */
+    void getStateFilter(uint32_t& debounceMs, uint8_t& lowBattery, uint8_t& hysteresis);
+
+    /**
+     * Sets how long the SNMP agent serves the same values
+     * @param windowMs Time an encoded value is reused (0 disables the cache)
+     */
+    void setSNMPCache(uint32_t windowMs);
+
+    /**
+     * Gets how long the SNMP agent serves the same values
+     */
+    uint32_t getSNMPCache();
+
     /**
      * Gets the MAC address
      */
@@ -165,7 +229,13 @@ private:
     IPAddress ip_;                              //!< Device IP (0 for DHCP)
     IPAddress subnet_;                          //!< Device Subnet if static IP
     IPAddress gateway_;                         //!< Next gateway if static IP
-    IPAddress snmpTrap_;                        //!< SNMP trap IP address
+    std::vector<SNMPTrapTarget> snmpTraps_;     //!< SNMP notification receivers
+    uint32_t selfTestInterval_;                 //!< Hours between two UPS self-tests (0 disabled)
+    bool selfTestDeep_;                         //!< Deep self-tests instead of quick ones
+    uint32_t stateDebounce_;                    //!< UPS state debounce (ms)
+    uint8_t lowBattery_;                        //!< Low battery charge (%, 0 for the UPS limit only)
+    uint8_t stateHysteresis_;                   //!< UPS state thresholds hysteresis (%)
+    uint32_t snmpCache_;                        //!< SNMP value cache window (ms, 0 disabled)
     std::string macAddress_;
     bool lastButton_;                           //!< Last button state
     bool cfgReset_;                             //!< Configuration reseted
@@ -0,0 +1,95 @@
+#ifndef _FIXED_POINT_HPP__
+#define _FIXED_POINT_HPP__
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+
+//Decimal fixed point helpers, a value is an integer scaled by 10^exponent
+//so the decode path never needs the (software emulated) double precision
+
+#define FIXED_MIN_EXPONENT  -9      // Smallest exponent of a value
+#define FIXED_MAX_EXPONENT  9       // Largest exponent of a value
+
+/**
+ * Gets 10^n as an integer
+ * @param n Power (0 to 18)
+ */
+inline int64_t fixedPow10(uint8_t n)
+{
+    int64_t ret = 1;
+    for(uint8_t i=0;i<n;++i){
+        ret *= 10;
+    }
+    return ret;
+}
+
+/**
+ * Saturates a 64 bits value to 32 bits
+ */
+inline int32_t fixedSaturate(int64_t value)
+{
+    if(value > std::numeric_limits<int32_t>::max()){
+        return std::numeric_limits<int32_t>::max();
+    }
+    if(value < std::numeric_limits<int32_t>::min()){
+        return std::numeric_limits<int32_t>::min();
+    }
+    return static_cast<int32_t>(value);
+}
+
+/**
+ * Expresses a value with another exponent (rounded half away from zero, saturated)
+ * @param value Value scaled by 10^from
+ * @param from Exponent of value
+ * @param to Exponent of the result
+ * @return Value scaled by 10^to
+ */
+inline int32_t fixedRescale(int32_t value, int8_t from, int8_t to)
+{
+    if(from >= to){
+        uint8_t shift = from - to;
+        if(shift > 9){
+            //Any non zero value overflows
+            return value == 0 ? 0 : (value > 0 ? std::numeric_limits<int32_t>::max() : std::numeric_limits<int32_t>::min());
+        }
+        return fixedSaturate(value * fixedPow10(shift));
+    }
+    uint8_t shift = to - from;
+    if(shift > 9){
+        return 0;
+    }
+    int64_t divisor = fixedPow10(shift);
+    int64_t half = divisor / 2;
+    return static_cast<int32_t>(value >= 0 ? (value + half) / divisor : (value - half) / divisor);
+}
+
+/**
+ * Writes a value as a decimal number (trailing zeros of the fraction removed)
+ * @param buffer Destination (24 bytes always fit)
+ * @param size Size of the destination
+ * @param value Value scaled by 10^exponent
+ * @param exponent Exponent of value
+ * @return Number of characters written (as snprintf)
+ */
+inline int fixedToString(char* buffer, size_t size, int32_t value, int8_t exponent)
+{
+    if(exponent >= 0){
+        return snprintf(buffer, size, "%lld", (long long)value * fixedPow10(exponent));
+    }
+    uint8_t decimals = -exponent;
+    int64_t divisor = fixedPow10(decimals);
+    int64_t magnitude = value < 0 ? -(int64_t)value : value;
+    int64_t fraction = magnitude % divisor;
+    while((decimals > 0) && (fraction % 10 == 0)){
+        fraction /= 10;
+        --decimals;
+    }
+    if(decimals == 0){
+        return snprintf(buffer, size, "%s%lld", value < 0 ? "-" : "", (long long)(magnitude / divisor));
+    }
+    return snprintf(buffer, size, "%s%lld.%0*lld", value < 0 ? "-" : "", (long long)(magnitude / divisor),
+                        (int)decimals, (long long)fraction);
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef _HID_UNITS_HPP__
+#define _HID_UNITS_HPP__
+#include <cstdint>
+
+#define HID_UNIT_OFFSET_EXPONENT    -2  // Exponent of HIDUnitConversion::offset (1/100th)
+
+/**
+ * Unit of a normalised value
+ */
+enum class HIDUnit : uint8_t {
+    None = 0,       //No unit (counter, state, identifier...)
+    Volt,
+    Ampere,
+    Hertz,
+    Second,
+    Celsius,
+    Percent,
+    Watt,
+    VoltAmpere,
+    Other           //Declared unit not normalised, value kept in physical units
+};
+
+/**
+ * Conversion from physical value to SI value
+ * SI value = physical value * 10^exponent + offset * 10^HID_UNIT_OFFSET_EXPONENT
+ */
+struct HIDUnitConversion {
+    HIDUnit unit;       //Unit of the SI value
+    int8_t exponent;    //Decimal exponent applied to the physical value
+    int32_t offset;     //Offset of the scale origin (Kelvin to Celsius)
+};
+
+/**
+ * Decodes the Unit and Unit Exponent items of a field
+ * Usages without declared unit get the unit of the Power Device usage tables
+ * @param usagePage Usage page
+ * @param usage Usage ID
+ * @param unit Unit item (nibbles: system, length, mass, time, temperature, current)
+ * @param unitExponent Unit Exponent item (4 bits signed)
+ * @return Conversion to apply to the physical value
+ */
+HIDUnitConversion hidUnitConversion(uint16_t usagePage, uint16_t usage, uint32_t unit, int32_t unitExponent);
+
+/**
+ * Gets the symbol of a unit
+ * @return Symbol or nullptr for HIDUnit::None and HIDUnit::Other
+ */
+const char* hidUnitSymbol(HIDUnit unit);
+
+#endif
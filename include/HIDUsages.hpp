@@ -0,0 +1,34 @@
+#ifndef _HID_USAGES_HPP__
+#define _HID_USAGES_HPP__
+#include <cstdint>
+#include <HIDUnits.hpp>
+
+/**
+ * Gets the name of an HID usage
+ * Covers the Power Device (0x84) and Battery System (0x85) pages
+ * @param usagePage Usage page
+ * @param usage Usage ID
+ * @return Name of the usage or nullptr if unknown
+ */
+const char* hidUsageName(uint16_t usagePage, uint16_t usage);
+
+/**
+ * Gets an HID usage from its name
+ * @param name Name of the usage (as returned by hidUsageName)
+ * @param usagePage Usage page
+ * @param usage Usage ID
+ * @return false if the name is unknown
+ */
+bool hidUsageFromName(const char* name, uint16_t& usagePage, uint16_t& usage);
+
+/**
+ * Gets the unit of an HID usage in the Power Device usage tables
+ * Used when the descriptor declares no unit, and to tell active power (W)
+ * from apparent power (VA)
+ * @param usagePage Usage page
+ * @param usage Usage ID
+ * @return HIDUnit::None if the usage has no unit
+ */
+HIDUnit hidUsageUnit(uint16_t usagePage, uint16_t usage);
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef _REPORT_CAPTURE_HPP__
+#define _REPORT_CAPTURE_HPP__
+#include <Arduino.h>
+#include <FreeRTOS.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <UPSHIDDevice.hpp>
+
+#define CAPTURE_RING_SLOTS      32768   // Reports kept (power of 2, 76 bytes each in PSRAM)
+#define CAPTURE_SLOT_DATA       64      // Largest report kept (interrupt and feature reports fit)
+#define CAPTURE_CHUNK_SIZE      1024    // Bytes handed to the writer at once
+#define CAPTURE_MAGIC           "UCAP"
+#define CAPTURE_VERSION         1
+
+/*Capture file format (little endian)
+    CaptureFileHeader
+    CaptureDeviceHeader, manufacturer, product, serial, report descriptor (deviceCount times)
+    CaptureRecordHeader, report data (up to the end of file, oldest first)
+**/
+
+/**
+ * Capture file header
+ */
+struct CaptureFileHeader {
+    char magic[4];              //CAPTURE_MAGIC
+    uint8_t version;            //CAPTURE_VERSION
+    uint8_t deviceCount;        //Device sections following
+    uint16_t reserved;
+    uint32_t captureCount;      //Reports captured since boot
+    uint32_t timeMs;            //Time of the download
+};
+
+/**
+ * Last enumeration of a device slot
+ */
+struct CaptureDeviceHeader {
+    uint8_t device;             //Device index in the bridge table
+    uint8_t manufacturerLength; //Strings are ASCII, not terminated
+    uint8_t productLength;
+    uint8_t serialLength;
+    uint16_t idVendor;
+    uint16_t idProduct;
+    uint16_t bcdDevice;
+    uint16_t descriptorLength;  //Report descriptor bytes
+};
+
+/**
+ * Captured event
+ */
+struct CaptureRecordHeader {
+    enum Type : uint8_t {
+        PLUG = 0,               //Report descriptor received (device enumerated)
+        INPUT_REPORT = 1,       //Interrupt IN report (report ID first)
+        OUTPUT_REPORT = 2,      //Report written (SET_REPORT or interrupt OUT, report ID first)
+        FEATURE_REPORT = 3,     //GET_REPORT(Feature) answer (report ID first)
+        REMOVED = 4             //Device removed
+    };
+    uint32_t timeMs;            //millis() of the callback
+    uint8_t device;             //Device index in the bridge table
+    uint8_t type;               //Type
+    uint16_t length;            //Report bytes following
+};
+
+static_assert(sizeof(CaptureFileHeader) == 16, "Capture file header layout");
+static_assert(sizeof(CaptureDeviceHeader) == 12, "Capture device header layout");
+static_assert(sizeof(CaptureRecordHeader) == 8, "Capture record header layout");
+
+/**
+ * Recorder of the raw HID traffic (to debug vendor quirks)
+ * Reports go to a ring of fixed size slots in PSRAM: a writer takes a slot
+ * with an index bump, copies the report and commits the slot sequence.
+ * There is no lock so capture can be left on, a reader skips the slots
+ * overwritten while it copies them.
+ */
+class ReportCapture
+{
+public:
+    /**
+     * Receives the capture file in chunks
+     * @return false to abort
+     */
+    typedef bool (*Writer)(void* context, const uint8_t* data, size_t len);
+
+    ReportCapture();
+    virtual ~ReportCapture() = default;
+
+    /**
+     * Allocates the ring (capture stays off without PSRAM)
+     */
+    void begin();
+
+    /**
+     * Gets if reports are captured
+     */
+    inline bool isEnabled() const { return slots_ != nullptr; }
+
+    /**
+     * Records a report (any task, never blocks)
+     * @param device Device index
+     * @param type Record type
+     * @param data Report (report ID first)
+     * @param len Report length (truncated to CAPTURE_SLOT_DATA)
+     */
+    void capture(uint8_t device, CaptureRecordHeader::Type type, const uint8_t* data, size_t len);
+
+    /**
+     * Keeps the device descriptor of the device
+     */
+    void setDeviceDescriptor(uint8_t device, uint16_t idVendor, uint16_t idProduct, uint16_t bcdDevice);
+
+    /**
+     * Keeps the strings of the device
+     */
+    void setStrings(uint8_t device, const char* manufacturer, const char* product, const char* serial);
+
+    /**
+     * Keeps the report descriptor of the device and records its enumeration
+     */
+    void setReportDescriptor(uint8_t device, const uint8_t* data, size_t len);
+
+    /**
+     * Writes the capture file
+     * @param writer Destination of the file chunks
+     * @param context Writer context
+     * @return false if the writer failed
+     */
+    bool dump(Writer writer, void* context) const;
+
+    /**
+     * Gets number of reports captured since boot
+     */
+    inline uint32_t getCaptureCount() const { return head_.load(std::memory_order_relaxed); }
+
+private:
+    /**
+     * Ring entry, sequence is the capture index + 1 once written (0 while written)
+     */
+    struct Slot {
+        std::atomic<uint32_t> sequence;
+        CaptureRecordHeader header;
+        uint8_t data[CAPTURE_SLOT_DATA];
+    };
+
+    /**
+     * Enumeration data of a device slot
+     */
+    struct Device {
+        bool valid;
+        uint16_t idVendor;
+        uint16_t idProduct;
+        uint16_t bcdDevice;
+        std::string manufacturer;
+        std::string product;
+        std::string serial;
+        std::vector<uint8_t> descriptor;
+    };
+
+    /**
+     * Copies a slot if it still holds the capture index
+     * @return false if the slot was overwritten
+     */
+    bool readSlot(uint32_t index, CaptureRecordHeader& header, uint8_t* data) const;
+
+    static_assert((CAPTURE_RING_SLOTS & (CAPTURE_RING_SLOTS - 1)) == 0, "CAPTURE_RING_SLOTS must be a power of 2");
+
+    Slot* slots_;
+    std::atomic<uint32_t> head_;            //Next capture index
+    Device devices_[UPS_MAX_DEVICES];
+    SemaphoreHandle_t mutexDevices_;        //Enumeration data (never taken by capture)
+};
+
+extern ReportCapture reportCapture;
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef _SNMP_BER_HPP__
+#define _SNMP_BER_HPP__
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define SNMP_OID_MAX_ARCS       32      // Longest OID decoded (arcs)
+#define SNMP_VERSION_1          0       // Version field of SNMPv1 messages
+#define SNMP_VERSION_2C         1       // Version field of SNMPv2c messages
+
+/**
+ * BER tags of the SNMP messages (RFC 1157, RFC 3416)
+ */
+enum BerTag : uint8_t {
+    BER_INTEGER = 0x02,
+    BER_OCTET_STRING = 0x04,
+    BER_NULL = 0x05,
+    BER_OID = 0x06,
+    BER_SEQUENCE = 0x30,
+    BER_IP_ADDRESS = 0x40,
+    BER_COUNTER32 = 0x41,
+    BER_GAUGE32 = 0x42,
+    BER_TIMETICKS = 0x43,
+    BER_NO_SUCH_OBJECT = 0x80,
+    BER_NO_SUCH_INSTANCE = 0x81,
+    BER_END_OF_MIB_VIEW = 0x82,
+    PDU_GET = 0xa0,
+    PDU_GET_NEXT = 0xa1,
+    PDU_RESPONSE = 0xa2,
+    PDU_SET = 0xa3,
+    PDU_TRAP_V1 = 0xa4,
+    PDU_GET_BULK = 0xa5,
+    PDU_INFORM = 0xa6,
+    PDU_TRAP_V2 = 0xa7
+};
+
+/**
+ * Error status of a response PDU (RFC 3416)
+ */
+enum SnmpError : uint8_t {
+    SNMP_NO_ERROR = 0,
+    SNMP_TOO_BIG = 1,
+    SNMP_NO_SUCH_NAME = 2,          //SNMPv1 only
+    SNMP_BAD_VALUE = 3,             //SNMPv1 only
+    SNMP_GEN_ERR = 5,
+    SNMP_NO_ACCESS = 6,
+    SNMP_WRONG_TYPE = 7,
+    SNMP_WRONG_LENGTH = 8,
+    SNMP_WRONG_VALUE = 10,
+    SNMP_NO_CREATION = 11,
+    SNMP_COMMIT_FAILED = 14,
+    SNMP_NOT_WRITABLE = 17
+};
+
+/**
+ * Gets the SNMPv1 error of an SNMPv2 error (RFC 3584)
+ */
+SnmpError snmpErrorToV1(SnmpError error);
+
+/**
+ * Object identifier
+ */
+struct SnmpOid {
+    uint8_t length;
+    uint32_t arcs[SNMP_OID_MAX_ARCS];
+
+    SnmpOid() : length(0) {}
+
+    /**
+     * Parses a dotted OID (leading dot optional)
+     * @return false if not a valid OID
+     */
+    bool parse(const char* str);
+
+    /**
+     * Converts to dotted notation (leading dot)
+     */
+    std::string toString() const;
+
+    /**
+     * Lexicographic comparison (an OID sorts before the OID it prefixes)
+     * @return <0, 0 or >0 like strcmp
+     */
+    int compare(const SnmpOid& other) const;
+
+    /**
+     * Gets if the first arcs are a prefix
+     */
+    bool startsWith(const SnmpOid& prefix) const;
+
+    /**
+     * Adds an arc
+     * @return false if the OID is full
+     */
+    bool append(uint32_t arc);
+};
+
+/**
+ * Reads the TLV of a BER buffer in order
+ * Every read fails without moving on malformed or truncated data
+ */
+class BerReader
+{
+public:
+    BerReader() : data_(nullptr), size_(0) {}
+    BerReader(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+    /**
+     * Reads any TLV
+     * @param tag Receives the tag
+     * @param content Reader of the value
+     */
+    bool read(uint8_t& tag, BerReader& content);
+
+    /**
+     * Reads a TLV of a given tag
+     * @param content Reader of the value
+     */
+    bool enter(uint8_t tag, BerReader& content);
+
+    /**
+     * Reads a whole TLV (tag and length included)
+     */
+    bool readRaw(const uint8_t*& tlv, size_t& length);
+
+    /**
+     * Reads an integer type (INTEGER, Counter32, Gauge32, TimeTicks...)
+     * @param tag Expected tag
+     */
+    bool readInteger(uint8_t tag, int64_t& value);
+
+    /**
+     * Reads an INTEGER fitting in 32 bits
+     */
+    bool readInteger(int32_t& value);
+
+    /**
+     * Reads an OCTET STRING (points in the buffer)
+     */
+    bool readString(const uint8_t*& str, size_t& length);
+
+    /**
+     * Reads an OBJECT IDENTIFIER
+     */
+    bool readOid(SnmpOid& oid);
+
+    inline bool atEnd() const { return size_ == 0; }
+    inline const uint8_t* position() const { return data_; }
+
+private:
+    /**
+     * Reads the tag and length of the next TLV
+     * @param header Receives the size of tag and length
+     */
+    bool header(uint8_t& tag, size_t& header, size_t& length) const;
+
+    const uint8_t* data_;
+    size_t size_;
+};
+
+/**
+ * Writes BER TLV in a fixed buffer
+ * Constructed values are opened with begin and closed with end, their
+ * length is written once known. Writes past the capacity are dropped and
+ * flagged, truncate goes back to a previous size.
+ */
+class BerWriter
+{
+public:
+    BerWriter(uint8_t* buffer, size_t capacity) : buffer_(buffer), capacity_(capacity), size_(0), overflow_(false) {}
+
+    /**
+     * Opens a constructed value (SEQUENCE, PDU)
+     * @return Mark to close it with
+     */
+    size_t begin(uint8_t tag);
+
+    /**
+     * Closes a constructed value
+     * @param mark Returned by begin
+     */
+    void end(size_t mark);
+
+    void writeInteger(uint8_t tag, int64_t value);
+    void writeString(uint8_t tag, const void* data, size_t length);
+    inline void writeString(const std::string& str) { writeString(BER_OCTET_STRING, str.data(), str.size()); }
+    void writeOid(const SnmpOid& oid);
+    void writeNull(uint8_t tag = BER_NULL);
+
+    /**
+     * Copies encoded TLV
+     */
+    void writeRaw(const uint8_t* data, size_t length);
+
+    /**
+     * Goes back to a previous size (clears the overflow)
+     */
+    void truncate(size_t size);
+
+    inline size_t size() const { return size_; }
+    inline bool overflow() const { return overflow_; }
+    inline const uint8_t* data() const { return buffer_; }
+
+private:
+    /**
+     * Writes a tag and a length
+     */
+    void header(uint8_t tag, size_t length);
+
+    /**
+     * Reserves bytes
+     * @return Pointer to write to or nullptr on overflow
+     */
+    uint8_t* reserve(size_t length);
+
+    uint8_t* buffer_;
+    size_t capacity_;
+    size_t size_;
+    bool overflow_;
+};
+
+#endif
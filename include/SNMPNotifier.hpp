@@ -0,0 +1,158 @@
+#ifndef _SNMP_NOTIFIER_HPP__
+#define _SNMP_NOTIFIER_HPP__
+#include <Arduino.h>
+#include <SNMPBer.hpp>
+#include <UPSHIDDevice.hpp>
+#include <Configuration.hpp>
+#include <ArduinoJson.h>
+#include <atomic>
+#include <vector>
+
+#define SNMP_TRAP_QUEUE_SIZE        16      // Notifications waiting for their holdoff
+#define SNMP_INFORM_PENDING         8       // INFORMs waiting for their response
+#define SNMP_NOTIFY_MAX_MESSAGE     256     // Largest notification message
+#if !defined(SNMP_TRAP_HOLDOFF_MS)
+     #define SNMP_TRAP_HOLDOFF_MS   10000   // Shortest time between two notifications of a UPS
+#endif
+#if !defined(SNMP_INFORM_TIMEOUT_MS)
+     #define SNMP_INFORM_TIMEOUT_MS 5000    // Wait for the response of an INFORM
+#endif
+#if !defined(SNMP_INFORM_RETRIES)
+     #define SNMP_INFORM_RETRIES    2       // INFORM retransmissions before giving up
+#endif
+
+/**
+ * Sends the UPS notifications to the configured receivers
+ * Notifications are queued by the agent task and sent when it services
+ * the queue, after the requests. A UPS sends at most one notification per
+ * holdoff: the ones raised in between (flapping) are merged in the queued
+ * one of the same kind, which then carries the latest values, and are sent
+ * in the order they were raised. INFORMs are kept until their response,
+ * retransmitted on timeout. Only the agent task calls it.
+ */
+class SNMPNotifier
+{
+public:
+    /**
+     * Notifications of RFC 1628 (arcs of upsTraps)
+     */
+    enum Trap : uint8_t {
+        TRAP_ON_BATTERY = 1,            //upsTrapOnBattery
+        TRAP_ALARM_ENTRY_ADDED = 3,     //upsTrapAlarmEntryAdded
+        TRAP_ALARM_ENTRY_REMOVED = 4    //upsTrapAlarmEntryRemoved
+    };
+
+    SNMPNotifier();
+    virtual ~SNMPNotifier() = default;
+
+    /**
+     * Sets the receivers
+     * @param targets Receivers (empty disables the notifications)
+     */
+    void setTargets(const std::vector<DeviceConfiguration::SNMPTrapTarget>& targets);
+
+    /**
+     * Gets if a receiver is configured
+     */
+    inline bool enabled() const { return !targets_.empty(); }
+
+    /**
+     * Queues a notification
+     * @param index UPS index
+     * @param trap Notification (enterprise specific trap of SNMPv1)
+     * @param minutesRemaining upsEstimatedMinutesRemaining (-1 if unknown)
+     * @param alarmId upsAlarmId of an alarm entry notification
+     * @param alarmType Arc of upsWellKnownAlarms of an alarm entry notification
+     */
+    void notify(uint8_t index, Trap trap, int32_t minutesRemaining, uint32_t alarmId = 0, uint8_t alarmType = 0);
+
+    /**
+     * Sends the notifications due and retransmits the INFORMs not acknowledged
+     * @param socket Agent socket (responses come back to the agent port)
+     * @param nowMs Current time
+     */
+    void service(int socket, uint32_t nowMs);
+
+    /**
+     * Gets the time until the next call to service
+     * @param nowMs Current time
+     * @return UINT32_MAX if nothing is pending
+     */
+    uint32_t nextDue(uint32_t nowMs) const;
+
+    /**
+     * Takes the response of an INFORM
+     * @param message Received message
+     * @param length Message size
+     * @param from Sender address (network order)
+     * @return false if the message is not a response (a request)
+     */
+    bool acknowledge(const uint8_t* message, size_t length, uint32_t from);
+
+    /**
+     * Adds the notification counters
+     * @param snmp JSON object to fill
+     */
+    void toJSON(JsonObject& snmp) const;
+
+private:
+    /**
+     * Notification waiting for the holdoff of its UPS
+     */
+    struct Notification {
+        bool queued;
+        uint8_t index;
+        Trap trap;
+        uint32_t timeCs;        //sysUpTime when raised
+        int32_t minutes;        //upsEstimatedMinutesRemaining (-1 if unknown)
+        uint32_t alarmId;       //upsAlarmId (alarm entry notifications)
+        uint8_t alarmType;      //Arc of upsWellKnownAlarms (alarm entry notifications)
+        uint16_t merged;        //Notifications merged in this one
+    };
+
+    /**
+     * INFORM waiting for its response
+     */
+    struct Inform {
+        bool active;
+        int32_t requestId;
+        uint32_t ip;            //Receiver (network order)
+        uint16_t port;
+        uint8_t retries;
+        uint32_t sentMs;
+        uint16_t length;
+        uint8_t message[SNMP_NOTIFY_MAX_MESSAGE];
+    };
+
+    /**
+     * Sends a notification to every receiver
+     */
+    void send(int socket, const Notification& notification, uint32_t nowMs);
+
+    /**
+     * Encodes a notification for a receiver
+     * @param writer Receives the message
+     * @return false if the message does not fit
+     */
+    bool encode(const DeviceConfiguration::SNMPTrapTarget& target, const Notification& notification,
+                    int32_t requestId, BerWriter& writer) const;
+
+    /**
+     * Sends a message
+     * @return false on socket error
+     */
+    static bool sendTo(int socket, uint32_t ip, uint16_t port, const uint8_t* message, size_t length);
+
+    std::vector<DeviceConfiguration::SNMPTrapTarget> targets_;
+    Notification queue_[SNMP_TRAP_QUEUE_SIZE];
+    Inform informs_[SNMP_INFORM_PENDING];
+    bool notified_[UPS_MAX_DEVICES];            //A notification was sent once
+    uint32_t lastSentMs_[UPS_MAX_DEVICES];
+    int32_t nextRequestId_;
+    std::atomic<uint32_t> sent_;
+    std::atomic<uint32_t> merged_;
+    std::atomic<uint32_t> dropped_;             //Queue full or INFORM not acknowledged
+    std::atomic<uint32_t> acknowledged_;
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef _SEQ_LOCK_HPP__
+#define _SEQ_LOCK_HPP__
+#include <atomic>
+#include <cstdint>
+#include <FreeRTOS.h>
+
+/**
+ * Single writer sequence lock
+ * The writer never blocks, readers copy the data and retry
+ * only if a publication happened during the copy.
+ * T must be trivially copyable
+ */
+template <typename T>
+class SeqLock{
+public:
+    SeqLock() : sequence_(0), data_() {}
+    virtual ~SeqLock() = default;
+
+    /**
+     * Publishes a new value (only one writer task allowed)
+     * @param value Value to publish
+     */
+    void write(const T& value){
+        uint32_t seq = sequence_.load(std::memory_order_relaxed);
+        sequence_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        data_ = value;
+        sequence_.store(seq + 2, std::memory_order_release);
+    }
+
+    /**
+     * Reads a consistent copy of the value
+     * @param value Destination of the copy
+     */
+    void read(T& value) const {
+        uint32_t spin = 0;
+        for(;;){
+            uint32_t before = sequence_.load(std::memory_order_acquire);
+            if((before & 1) == 0){
+                value = data_;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if(sequence_.load(std::memory_order_relaxed) == before){
+                    return;
+                }
+            }
+            //Writer may be preempted by us on the same core, let it finish
+            if(++spin >= MAX_SPIN){
+                spin = 0;
+                vTaskDelay(1);
+            }
+        }
+    }
+
+    /**
+     * Gets the publication counter (even when stable)
+     */
+    inline uint32_t getSequence() const { return sequence_.load(std::memory_order_acquire); }
+
+private:
+    static constexpr uint32_t MAX_SPIN = 8;
+    std::atomic<uint32_t> sequence_;
+    T data_;
+};
+
+#endif
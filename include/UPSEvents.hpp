@@ -0,0 +1,91 @@
+#ifndef _UPS_EVENTS_HPP__
+#define _UPS_EVENTS_HPP__
+#include <Arduino.h>
+#include <FreeRTOS.h>
+#include <atomic>
+#include <UPSHIDDevice.hpp>
+
+#define UPS_EVENT_MAX_SUBSCRIBERS   8   // Front-ends listening to the UPS
+
+/**
+ * Publish/subscribe bus of the UPS changes
+ * The HID decode path publishes only what actually changed. Each subscriber
+ * has its own pending set (coalesced until taken) and its task is woken by a
+ * task notification when the set goes from empty to not empty.
+ */
+class UPSEventBus
+{
+public:
+    /**
+     * Event kinds (a subscriber receives the kinds it subscribed to)
+     */
+    enum Event : uint8_t {
+        CONNECTION = 0x1,       //UPS connected, removed or field layout changed
+        READINGS = 0x2,         //One of the UpsSnapshot readings changed
+        VALUES = 0x4,           //Any field value changed
+        STATE = 0x8,            //Debounced UPS state changed (UPSState)
+        DECODE = 0x7,           //Events of the HID decode path
+        ALL = 0xF
+    };
+    static constexpr uint8_t EVENT_BITS = 4;    //Bits of each UPS in a pending set
+
+    typedef int8_t Subscriber;
+    static constexpr Subscriber INVALID_SUBSCRIBER = -1;
+
+    UPSEventBus();
+    virtual ~UPSEventBus() = default;
+
+    /**
+     * Registers a subscriber
+     * @param events Event kinds to receive (Event bits)
+     * @param task Task to notify (nullptr if the subscriber polls with take)
+     * @param holdoffMs Minimum time between two wait returns, changes in between are coalesced
+     * @return Subscriber handle or INVALID_SUBSCRIBER if the table is full
+     */
+    Subscriber subscribe(uint8_t events, TaskHandle_t task, uint32_t holdoffMs = 0);
+
+    /**
+     * Publishes events of a UPS (any task, never blocks)
+     * @param ups UPS index
+     * @param events Event bits
+     */
+    void publish(uint8_t ups, uint8_t events);
+
+    /**
+     * Takes and clears the pending events (never blocks)
+     * @param subscriber Subscriber handle
+     * @return Pending set, see getEvents
+     */
+    uint32_t take(Subscriber subscriber);
+
+    /**
+     * Waits for events (subscriber task only)
+     * @param subscriber Subscriber handle
+     * @param ticks Maximum time to wait
+     * @return Pending set (0 on timeout or if woken by another notification)
+     */
+    uint32_t wait(Subscriber subscriber, TickType_t ticks);
+
+    /**
+     * Gets the events of a UPS in a pending set
+     */
+    static inline uint8_t getEvents(uint32_t pending, uint8_t ups) { return (pending >> (ups * EVENT_BITS)) & ALL; }
+
+private:
+    static_assert(UPS_MAX_DEVICES * EVENT_BITS <= 32, "Pending set too small for UPS_MAX_DEVICES");
+
+    struct Entry {
+        std::atomic<uint32_t> filter;   //Event bits of each UPS (0 while registering)
+        std::atomic<uint32_t> pending;  //Events not taken yet
+        TaskHandle_t task;
+        uint32_t holdoffMs;
+        uint32_t lastTake;              //Time of the last take (subscriber task only)
+    };
+
+    Entry subscribers_[UPS_EVENT_MAX_SUBSCRIBERS];
+    std::atomic<uint8_t> subscriberCount_;
+};
+
+extern UPSEventBus upsEvents;
+
+#endif
@@ -3,96 +3,306 @@
 
 #include <Arduino.h>
 #include <OptionalData.hpp>
+#include <SeqLock.hpp>
+#include <FixedPoint.hpp>
+#include <HIDUnits.hpp>
 #include <FreeRTOS.h>
+#include <atomic>
 #include <string>
+#include <vector>
 #include <ArduinoJson.h>
 
 #define DAEMON_TASK_LOOP_DELAY  3 // ticks
-#define CLASS_TASK_LOOP_DELAY   3 // ticks
 #define DAEMON_TASK_COREID      0
 #define CLASS_TASK_COREID       0
 #include <usb_host_hid_bridge.h>
 
-void config_desc_cb(const usb_config_desc_t *config_desc);
-void device_info_cb(usb_device_info_t *dev_info);
-void hid_report_descriptor_cb(usb_transfer_t *transfer);
-void hid_report_cb(usb_transfer_t *transfer);
-void device_removed_cb();
+void config_desc_cb(uint8_t device, const usb_config_desc_t *config_desc);
+void device_info_cb(uint8_t device, usb_device_info_t *dev_info);
+void hid_report_descriptor_cb(uint8_t device, usb_transfer_t *transfer);
+void hid_report_cb(uint8_t device, usb_transfer_t *transfer);
+void hid_feature_report_cb(uint8_t device, usb_transfer_t *transfer);
+void device_removed_cb(uint8_t device);
+void device_desc_cb(uint8_t device, const usb_device_desc_t *dev_desc);
+bool hid_set_report_cb(uint8_t device, uint8_t *reportType, uint8_t *data, uint16_t *length);
+void set_idle_done_cb(uint8_t device, uint8_t duration, bool accepted);
+
+#define UPS_MAX_DEVICES         USB_HOST_MAX_DEVICES // One UPSHIDDevice per bridge device
+#define HID_MAX_FIELDS          128 // Registry capacity
+#define HID_MAX_OUTPUT_FIELDS   128 // Feature and Output fields commands can write
+#define HID_MAX_COLLECTIONS     256 // Distinct collection paths kept
+#define HID_MAX_GLOBAL_STACK    8   // Push items nesting depth
+#define HID_MAX_REPORT_BITS     0xFFFF  // Largest report layout (bit places are 16 bits)
+#define FEATURE_FAST_REFRESH_MS 5000    // Feature values following load and battery (ms)
+#define FEATURE_SLOW_REFRESH_MS 300000  // Feature configuration and identification values (ms)
+#define LAYOUT_CACHE_VERSION    3       // Bump when the cached layout format changes
+#define UPS_COMMAND_QUEUE_LENGTH    16  // Commands waiting for the HID task (per UPS)
+#define HID_IDLE_ONLINE_MS      0       // Input report rate on AC (SET_IDLE, 0 reports only on change)
+#define HID_IDLE_BATTERY_MS     500     // Input report rate on battery (SET_IDLE, 4 to 1020 ms)
+#define HID_MAX_REPORT_SLOTS    128     // Reports whose last reception time is kept
+#define HID_STALE_PERIODS       3       // Missed refreshes before the data is stale
+#define HID_STALE_MIN_MS        10000   // Shortest time without report before the data is stale (ms)
+#define HID_PROBE_MS            30000   // Input report read back when the UPS has no Feature report (ms)
+#define HID_LAYOUT_TIMEOUT_MS   30000   // Longest time from enumeration to a decoded layout (ms)
+#define HID_RESET_BACKOFF_MS    60000   // Delay before resetting a stale UPS again, doubled each time (ms)
+#define HID_RESET_BACKOFF_MAX   4       // Doublings of the reset delay (16 min)
+#define HID_NO_REPORT_SLOT      0xFF
+#define HID_NO_COLLECTION       0xFFFF
+
+/**
+ * HID report types (value used by GET_REPORT/SET_REPORT)
+ */
+enum class HIDReportType : uint8_t {Input = 1, Output = 2, Feature = 3};
+
+/**
+ * Result of a UPS command request
+ */
+enum class UPSCommandStatus : uint8_t {
+    Queued = 0,         //Written by the HID task with the next SET_REPORT
+    Disconnected,       //No UPS in this slot
+    UnknownUsage,       //Usage is not in a Feature or Output report
+    OutOfRange,         //Value is outside the logical range of the field
+    QueueFull,          //Too many commands waiting
+    Busy                //UPS is already running the requested operation
+};
+
+/**
+ * Gets the name of a command status
+ */
+const char* upsCommandStatusToString(UPSCommandStatus status);
+
+/**
+ * Precomputed extraction of one field inside a report
+ * Built once from the report descriptor so decoding a report
+ * is a word load, a shift, a mask and an integer multiply
+ */
+struct HIDDecodeStep {
+    uint16_t byteOffset;    //First byte of the field (report ID excluded)
+    uint8_t byteCount;      //Number of bytes spanned by the field
+    uint8_t shift;          //Position of bit 0 in the loaded word
+    uint32_t mask;          //Field mask once shifted
+    uint32_t signBit;       //Sign bit to extend (0 for unsigned fields)
+    int32_t logicalMin;     //Logical minimum
+    int32_t offset;         //Value of the logical minimum (scaled by 10^exponent)
+    int32_t scale;          //Logical to value factor (Q16.16)
+    uint16_t fieldIndex;    //Index of the field to update
+    int8_t exponent;        //Decimal exponent of the value
+    HIDUnit unit;           //Unit of the value
+};
+
+/**
+ * Field write waiting for the HID task
+ */
+struct HIDCommand {
+    uint32_t generation;        //Registry generation the field was resolved in
+    uint32_t bits;              //Logical value
+    uint16_t bitPlace;          //Bit 0 place in the report data
+    uint8_t bitWidth;
+    uint8_t reportId;
+    HIDReportType reportType;
+};
+
+/**
+ * Consistent copy of all UPS readings
+ * Published by the HID decode path, read by front-ends
+ */
+struct UpsSnapshot {
+    enum Reading : uint8_t {
+        REMAINING_CAPACITY = 0,
+        AC_PRESENT,
+        CHARGING,
+        DISCHARGING,
+        BATTERY_PRESENT,
+        NEEDS_REPLACEMENT,
+        RUN_TIME_TO_EMPTY,
+        TEST_RESULT,
+        BATTERY_VOLTAGE,
+        BELOW_CAPACITY_LIMIT,
+        OVERLOAD,
+        BOOST,
+        BUCK,
+        OUTPUT_LOAD,
+        INPUT_VOLTAGE,
+        INPUT_FREQUENCY,
+        INPUT_CURRENT,
+        INPUT_POWER,
+        OUTPUT_VOLTAGE,
+        OUTPUT_FREQUENCY,
+        OUTPUT_CURRENT,
+        OUTPUT_POWER,
+        BATTERY_CURRENT,
+        TEMPERATURE,
+        INTERNAL_FAILURE,
+        OVER_TEMPERATURE,
+        SHUTDOWN_REQUESTED,
+        SHUTDOWN_IMMINENT,
+        AWAITING_POWER,
+        READING_COUNT
+    };
+
+    bool connected;                             //UPS is connected and its descriptor parsed
+    uint32_t generation;                        //Field registry generation the values belong to
+    uint16_t fieldCount;                        //Number of fields in the registry
+    int16_t readingFields[READING_COUNT];       //Field index of each reading (-1 if not provided)
+    uint32_t boolMask;                          //Bit set for each boolean reading
+    uint32_t validMask[HID_MAX_FIELDS / 32];    //Bit set for each field already decoded
+    int32_t values[HID_MAX_FIELDS];             //Field values in SI units, scaled by 10^exponents
+    int8_t exponents[HID_MAX_FIELDS];           //Decimal exponent of each field value
+    HIDUnit units[HID_MAX_FIELDS];              //Unit of each field value
+    uint8_t reportSlots[HID_MAX_FIELDS];        //Reception time slot of the report of each field
+
+    /**
+     * Clears all readings
+     */
+    inline void clear() {
+        *this = UpsSnapshot{};
+        for(int16_t& field : readingFields){
+            field = -1;
+        }
+        memset(reportSlots, HID_NO_REPORT_SLOT, sizeof(reportSlots));
+    }
 
+    /**
+     * Gets if the reading is provided by the UPS
+     */
+    inline bool isUsed(Reading reading) const { return readingFields[reading] >= 0; }
+
+    /**
+     * Gets if the reading is a boolean
+     */
+    inline bool isBool(Reading reading) const { return boolMask & (1u << reading); }
+
+    /**
+     * Gets value of the reading (0 if not used)
+     * @param exponent Decimal exponent of the result (0 for units, -1 for tenths...)
+     */
+    inline int32_t getValue(Reading reading, int8_t exponent = 0) const {
+        return isUsed(reading) ? getFieldValue(readingFields[reading], exponent) : 0;
+    }
+
+    /**
+     * Gets unit of the reading (HIDUnit::None if not used)
+     */
+    inline HIDUnit getUnit(Reading reading) const { return isUsed(reading) ? units[readingFields[reading]] : HIDUnit::None; }
 
+    /**
+     * Gets value of a field
+     * @param exponent Decimal exponent of the result
+     */
+    inline int32_t getFieldValue(uint16_t field, int8_t exponent = 0) const {
+        return fixedRescale(values[field], exponents[field], exponent);
+    }
+
+    /**
+     * Gets if a field value was already decoded
+     */
+    inline bool isValid(uint16_t field) const { return validMask[field / 32] & (1u << (field % 32)); }
+};
+
+/**
+ * Collection of the report descriptor
+ * Collections with the same parent and usage are merged so
+ * a collection index identifies a collection path
+ */
+struct HIDCollection {
+    uint16_t usagePage;
+    uint16_t usage;
+    uint16_t parent;        //Parent collection index (HID_NO_COLLECTION for root)
+};
+
+/**
+ * Input or Feature field of the report descriptor (registry entry)
+ */
 class HIDData
 {
 public:
-    HIDData(uint8_t usagePage, uint8_t usage, const char* name);
+    HIDData();
     ~HIDData() = default;
 
     /**
      * Tests if the data match Usage page and usage combination
      */
-    bool match(uint8_t usagePage, uint8_t usage);
-    
+    inline bool match(uint16_t usagePage, uint16_t usage) const { return (usagePage_ == usagePage) && (usage_ == usage); };
+
     /**
-     * Sets if the data is used
+     * Tests if the data match the registry key
      */
-    void setUsed(bool used);
+    inline bool match(uint16_t collection, uint16_t usagePage, uint16_t usage) const { return (collection_ == collection) && match(usagePage, usage); };
 
     /**
-     * Gets if the data is used
+     * Sets usage of this data
+     * @param collection Index of the collection holding the data
+     * @param usagePage Usage page
+     * @param usage Usage ID
      */
-    bool isUsed() const;
+    inline void setUsage(uint16_t collection, uint16_t usagePage, uint16_t usage){ collection_ = collection; usagePage_ = usagePage; usage_ = usage; };
+
+    inline uint16_t getCollection() const { return collection_; };
+    inline uint16_t getUsagePage() const { return usagePage_; };
+    inline uint16_t getUsage() const { return usage_; };
 
     /**
-     * Sets report Id associated with this data
+     * Sets report associated with this data
      */
-    inline void setReportId(uint8_t reportId){ reportId_ = reportId; };
+    inline void setReport(HIDReportType type, uint8_t reportId){ reportType_ = type; reportId_ = reportId; };
 
     /**
      * Gets associated report ID
      */
     inline uint8_t getReportId() const { return reportId_; };
 
+    /**
+     * Gets associated report type
+     */
+    inline HIDReportType getReportType() const { return reportType_; };
+
     /**
      * Sets bits configuration
      * @param place Bit 0 place in the report data
      * @param count number of bits representing data
      */
-    inline void setBitsConfiguration(uint8_t place, uint8_t count) { bitPlace_ = place; bitWidth_ = count; };
+    inline void setBitsConfiguration(uint16_t place, uint8_t count) { bitPlace_ = place; bitWidth_ = count; };
 
     /**
      * Gets bits configuration
      * @param place Bit 0 place in the report data
      * @param count number of bits representing data
-     * TODO: Remove this and replace with a getValue
      */
-    inline void getBitsConfiguration(uint8_t& place, uint8_t& count) { place = bitPlace_; count = bitWidth_; };
+    inline void getBitsConfiguration(uint16_t& place, uint8_t& count) const { place = bitPlace_; count = bitWidth_; };
+
+    /**
+     * Sets name of the data (full collection path)
+     */
+    inline void setName(const char* name) { name_ = name; };
 
     /**
      * Gets name of the data
      */
     inline const char* getName() const { return name_; };
 
-    /*
-     * Sets value from the HID report buffer
-     * @param buffer HID report buffer (without reportId)
-     * @param len Size of the report buffer (without reportId)
+    /**
+     * Compiles the extraction step of this data
+     * The value is normalised to the SI unit of the Unit and Unit Exponent items
+     * @param step Step to fill (fieldIndex is left untouched)
      */
-    void setValue(const uint8_t* buffer, size_t len);
+    void compile(HIDDecodeStep& step) const;
 
     /**
-     * Gets value of the data
+     * Converts a value to the logical value of this data (inverse of the compiled step)
+     * @param value Value in SI units, scaled by 10^exponent
+     * @param exponent Decimal exponent of value
+     * @param bits Logical value, masked to the field width
+     * @return false if the value is outside the logical range
      */
-    double getValue() const;
+    bool encode(int32_t value, int8_t exponent, uint32_t& bits) const;
 
-    inline void setLogicalMinimum(const OptionalData<int32_t>& minimum){ logicalMinimum_ = minimum; };
-    inline void setLogicalMaximum(const OptionalData<int32_t>& maximum){ logicalMaximum_ = maximum; };
-    inline void setPhysicalMinimum(const OptionalData<int32_t>& minimum){ physicalMinimum_ = minimum; };
-    inline void setPhysicalMaximum(const OptionalData<int32_t>& maximum){ physicalMaximum_ = maximum; };
+    inline void setLogicalMinimum(const OptionalData<int32_t>& minimum){ logicalMinimum_ = minimum ? minimum.getValue() : 0; };
+    inline void setLogicalMaximum(const OptionalData<int32_t>& maximum){ logicalMaximum_ = maximum ? maximum.getValue() : 0; };
+    void setPhysical(const OptionalData<int32_t>& minimum, const OptionalData<int32_t>& maximum);
 
-    inline void setUnitExponent(const OptionalData<int32_t>& exponent){ unitExponent_ = exponent; };
-    inline void setUnit(const OptionalData<uint32_t>& unit){ unit_ = unit; };
+    inline void setUnitExponent(const OptionalData<int32_t>& exponent){ unitExponent_ = exponent ? exponent.getValue() : 0; };
+    inline void setUnit(const OptionalData<uint32_t>& unit){ unit_ = unit ? unit.getValue() : 0; };
 
-    void reset();
-    
     /**
      * Gets number of bits representing this data
      */
@@ -104,21 +314,21 @@ public:
     bool isBool() const;
 
 private:
-    uint8_t usagePage_;
-    uint8_t usage_;
+    uint16_t usagePage_;
+    uint16_t usage_;
+    uint16_t collection_;
+    uint16_t bitPlace_;
+    HIDReportType reportType_;
     uint8_t reportId_;
-    OptionalData<int32_t> logicalMinimum_;
-    OptionalData<int32_t> logicalMaximum_;
-    OptionalData<int32_t> physicalMinimum_;
-    OptionalData<int32_t> physicalMaximum_;
-    OptionalData<int32_t> unitExponent_;
-    OptionalData<uint32_t> unit_;
-    uint32_t bitPlace_;
-    uint32_t bitWidth_;
+    uint8_t bitWidth_;
+    bool hasPhysical_;
+    int8_t unitExponent_;
+    int32_t logicalMinimum_;
+    int32_t logicalMaximum_;
+    int32_t physicalMinimum_;
+    int32_t physicalMaximum_;
+    uint32_t unit_;
     const char* name_;
-    bool used_;
-    double value_;
-    SemaphoreHandle_t mutexData_;
 };
 
 class UPSHIDDevice
@@ -128,9 +338,14 @@ public:
     virtual ~UPSHIDDevice() = default;
 
     /**
-     * Begin
+     * Starts the HID bridge and binds each device slot to its UPS
      */
-    void begin();
+    static void begin();
+
+    /**
+     * Gets the UPS index (slot in the bridge device table)
+     */
+    inline uint8_t getIndex() const { return index_; }
 
     /**
      * Parse an HID report
@@ -144,56 +359,80 @@ public:
      */
     void hidReportData(const uint8_t* data, size_t len);
 
+    /**
+     * GET_REPORT(Feature) payload callback
+     */
+    void hidFeatureReportData(const uint8_t* data, size_t len);
+
     /**
      * USB device removed
      */
     void deviceRemoved();
 
     /**
-     * Gets remaining battery capacity
+     * SET_IDLE answered by the device
+     * @param duration Idle duration in 4 ms units
+     * @param accepted false if the device does not support SET_IDLE
      */
-    const HIDData& getRemainingCapacity() const;
+    void idleSet(uint8_t duration, bool accepted);
 
     /**
-     * Gets if AC is present
+     * Gets a consistent copy of all readings (never blocks the HID task)
+     * Values are in SI units, see UpsSnapshot::units
+     * @param snapshot Destination of the copy
      */
-    const HIDData& getACPresent() const;
+    inline void getSnapshot(UpsSnapshot& snapshot) const { snapshot_.read(snapshot); }
 
     /**
-     * Gets if battery is charging
+     * Gets the name of a reading
      */
-    const HIDData& getCharging() const;
+    inline const char* getReadingName(UpsSnapshot::Reading reading) const { return INTEREST_USAGES[reading].name; }
 
     /**
-     * Gets if battery is discharging
+     * Gets if the UPS is connected
      */
-    const HIDData& getDischarging() const;
+    inline bool isConnected() const { return connected_; }
 
     /**
-     * Gets if battery is present
+     * Checks the connected UPS still send reports (main loop)
+     * A UPS is stale after HID_STALE_PERIODS refresh periods without
+     * report, the bridge is then asked to enumerate it again. A UPS is
+     * also enumerated again when no layout is decoded from it. A layout
+     * decoded from the descriptor is saved to the cache from here.
      */
-    const HIDData& getBatteryPresent() const;
+    static void watchdog();
 
     /**
-     * Gets if battery needs replacement
+     * Gets if the UPS stopped sending reports
      */
-    const HIDData& getNeedReplacement() const;
+    inline bool isStale() const { return stale_; }
 
     /**
-     * Gets estimated runtime in seconds
+     * Gets the time since the last report (since the connection if none yet)
+     * @param nowMs Current time (millis())
      */
-    const HIDData& getRuntimeToEmpty() const;
+    uint32_t getDataAge(uint32_t nowMs) const;
 
     /**
-     * Gets if the UPS is connected
+     * Gets the time since the report holding a field was last received
+     * @param snapshot Snapshot the field belongs to
+     * @param field Field index
+     * @param nowMs Current time (millis())
+     * @return UINT32_MAX if the report was never received
      */
-    inline bool isConnected() const { return connected_; }
+    uint32_t getFieldAge(const UpsSnapshot& snapshot, uint16_t field, uint32_t nowMs) const;
 
     /**
      * Sets USB device information
      */
     void setDeviceInfo(usb_device_info_t *dev_info);
 
+    /**
+     * Sets USB device descriptor
+     * Restores the field layout cached for this device, if any
+     */
+    void setDeviceDescriptor(const usb_device_desc_t *dev_desc);
+
     /**
      * Gets USB manufacturer
      */
@@ -209,16 +448,52 @@ public:
      */
     inline const char* getSerial() const { return serial_.c_str(); };
 
+    /**
+     * Gets USB device release (bcdDevice, firmware version of most UPS)
+     */
+    inline uint16_t getDeviceRelease() const { return bcdDevice_; };
+
     /**
      * Gets status in JSON format
+     * @param ups Object receiving the UPS status
      */
-    void statusToJSON(JsonDocument& doc) const;
+    void statusToJSON(JsonObject ups) const;
+
+    /**
+     * Gets status of all connected UPS in JSON format (UPS array)
+     */
+    static void devicesToJSON(JsonDocument& doc);
     
     /**
      * Gets status in JSON format
      */
     void statusToJSONString(std::string& str) const;
 
+    /**
+     * Queues the write of a Feature or Output field (any task, never blocks)
+     * Commands are sent by the HID task between the report transfers
+     * @param usagePage Usage page of the field
+     * @param usage Usage ID of the field
+     * @param value Value in SI units, scaled by 10^exponent
+     * @param exponent Decimal exponent of value
+     */
+    UPSCommandStatus sendCommand(uint16_t usagePage, uint16_t usage, int32_t value, int8_t exponent = 0);
+
+    /**
+     * Gets if the UPS has a Feature or Output field of a usage
+     */
+    bool hasCommand(uint16_t usagePage, uint16_t usage) const;
+
+    /**
+     * Builds the next report to write from the queued commands (HID task)
+     * Consecutive commands on the same report are merged in one report
+     * @param type Report type to write
+     * @param data Report (report ID first)
+     * @param length Report length
+     * @param maxLength Size of data
+     * @return false if no command is waiting
+     */
+    bool nextSetReport(HIDReportType& type, uint8_t* data, uint16_t& length, uint16_t maxLength);
 
 private:
 
@@ -242,6 +517,9 @@ private:
      * Local item
      */
     struct HIDLocalItem {
+        static constexpr uint8_t MAX_USAGES = 32;
+        uint32_t usages[MAX_USAGES];            //Usages in declaration order (page in high word if extended)
+        uint8_t usageCount;
         OptionalData<uint32_t> usage;
         OptionalData<uint32_t> usageMinimum;
         OptionalData<uint32_t> usageMaximum;
@@ -253,7 +531,10 @@ private:
         OptionalData<uint32_t> stringMaximum;
         OptionalData<uint8_t> delimiter;
 
+        HIDLocalItem() : usageCount(0) {};
+
         inline void reset() {
+            usageCount = 0;
             usage.reset();
             usageMinimum.reset();
             usageMaximum.reset();
@@ -262,6 +543,7 @@ private:
             designatorMaximum.reset();
             stringIndex.reset();
             stringMinimum.reset();
+            stringMaximum.reset();
             delimiter.reset();
         };
     };
@@ -286,6 +568,9 @@ private:
             uint8_t data;
         } bTag;
 
+        //6.2.2.3 of HID 1.11 spec
+        static constexpr uint8_t LONG_ITEM = 0xfe;
+
         uint8_t raw;
         HIDReportItemPrefix(uint8_t item){
             raw = item;
@@ -309,18 +594,121 @@ private:
     for                     
     HID Power Devices
     **/
-    static constexpr uint8_t BATTERY_SYSTEM_PAGE = 0x85;
-
-    static constexpr uint8_t REMAINING_CAPACITY_USAGE = 0x66;
-    static constexpr uint8_t AC_PRESENT_USAGE = 0xd0;
-    static constexpr uint8_t CHARGING_USAGE = 0x44;
-    static constexpr uint8_t DISCHARGING_USAGE = 0x45;
-    static constexpr uint8_t BATTERY_PRESENT_USAGE = 0xd1;
-    static constexpr uint8_t NEEDS_REPLACEMENT_USAGE = 0x4b;
-    static constexpr uint8_t RUN_TIME_TO_EMPTY_USAGE = 0x68;
-    static constexpr uint8_t INTEREST_USAGES_COUNT = 7;
-
-    HIDData datas_[INTEREST_USAGES_COUNT];
+    static constexpr uint16_t POWER_DEVICE_PAGE = 0x84;
+    static constexpr uint16_t BATTERY_SYSTEM_PAGE = 0x85;
+
+    static constexpr uint16_t BATTERY_USAGE = 0x12;
+    static constexpr uint16_t INPUT_USAGE = 0x1a;
+    static constexpr uint16_t OUTPUT_USAGE = 0x1c;
+    static constexpr uint16_t VOLTAGE_USAGE = 0x30;
+    static constexpr uint16_t CURRENT_USAGE = 0x31;
+    static constexpr uint16_t FREQUENCY_USAGE = 0x32;
+    static constexpr uint16_t ACTIVE_POWER_USAGE = 0x34;
+    static constexpr uint16_t PERCENT_LOAD_USAGE = 0x35;
+    static constexpr uint16_t TEMPERATURE_USAGE = 0x36;
+    static constexpr uint16_t TEST_USAGE = 0x58;
+    static constexpr uint16_t INTERNAL_FAILURE_USAGE = 0x62;
+    static constexpr uint16_t OVERLOAD_USAGE = 0x65;
+    static constexpr uint16_t OVER_TEMPERATURE_USAGE = 0x67;
+    static constexpr uint16_t SHUTDOWN_REQUESTED_USAGE = 0x68;
+    static constexpr uint16_t SHUTDOWN_IMMINENT_USAGE = 0x69;
+    static constexpr uint16_t AWAITING_POWER_USAGE = 0x72;
+    static constexpr uint16_t BOOST_USAGE = 0x6e;
+    static constexpr uint16_t BUCK_USAGE = 0x6f;
+
+    static constexpr uint16_t BELOW_CAPACITY_LIMIT_USAGE = 0x42;
+    static constexpr uint16_t REMAINING_CAPACITY_USAGE = 0x66;
+    static constexpr uint16_t AC_PRESENT_USAGE = 0xd0;
+    static constexpr uint16_t CHARGING_USAGE = 0x44;
+    static constexpr uint16_t DISCHARGING_USAGE = 0x45;
+    static constexpr uint16_t BATTERY_PRESENT_USAGE = 0xd1;
+    static constexpr uint16_t NEEDS_REPLACEMENT_USAGE = 0x4b;
+    static constexpr uint16_t RUN_TIME_TO_EMPTY_USAGE = 0x68;
+    static constexpr uint8_t INTEREST_USAGES_COUNT = UpsSnapshot::READING_COUNT;
+    static_assert(INTEREST_USAGES_COUNT <= 32, "UpsSnapshot::boolMask has a bit per reading");
+
+    /**
+     * Range of decode steps used by a report ID
+     */
+    struct ReportPlan {
+        uint16_t first;
+        uint16_t count;
+        uint8_t timeSlot;       //Slot of its reception time (HID_NO_REPORT_SLOT if not kept)
+    };
+
+    /**
+     * Usage front-ends are interested in
+     */
+    struct InterestUsage {
+        uint16_t usagePage;
+        uint16_t usage;
+        const char* name;
+        uint16_t collectionUsage;   //Power Device usage of an enclosing collection (0 for any)
+    };
+    static const InterestUsage INTEREST_USAGES[INTEREST_USAGES_COUNT];  //Same order as UpsSnapshot::Reading
+
+    static constexpr uint8_t REPORT_TYPE_COUNT = 3;
+
+    /**
+     * Size of a Feature or Output report (report ID excluded)
+     */
+    struct ReportSize {
+        HIDReportType type;
+        uint8_t reportId;
+        uint16_t bytes;
+    };
+
+    /**
+     * Last content of a report commands write (report ID first)
+     * Sorted by type and report ID
+     */
+    struct ReportImage {
+        uint16_t key;           //Report type << 8 | report ID
+        uint16_t offset;        //First byte in imageData_
+        uint16_t size;
+    };
+
+    /**
+     * Layout cache file header
+     * Followed by collections, fields, writable fields, field name offsets, report sizes and names
+     */
+    struct LayoutCacheHeader {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t idVendor;
+        uint16_t idProduct;
+        uint16_t bcdDevice;
+        uint32_t descriptorHash;
+        uint16_t collectionCount;
+        uint16_t fieldCount;
+        uint16_t outputCount;
+        uint16_t reportSizeCount;
+        uint32_t namesSize;
+    };
+    static constexpr uint32_t LAYOUT_CACHE_MAGIC = 0x4C535055;    //"UPSL"
+
+    std::vector<HIDCollection> collections_;    //Collections of the descriptor
+    std::vector<HIDData> fields_;               //Input and Feature field registry
+    std::vector<char> fieldNames_;              //Nul separated names of the fields
+    std::vector<HIDData> outputs_;              //Feature and Output fields, for commands
+    std::vector<ReportSize> reportSizes_;       //Input, Output and Feature report sizes
+    std::vector<ReportImage> reportImages_;     //Reports commands write (HID task only)
+    std::vector<uint8_t> imageData_;            //Bytes of the report images
+    HIDCommand commands_[UPS_COMMAND_QUEUE_LENGTH]; //Commands waiting for the HID task
+    uint8_t commandFirst_;
+    uint8_t commandCount_;
+    SemaphoreHandle_t mutexCommands_;           //Protects the command queue
+    uint16_t idVendor_;
+    uint16_t idProduct_;
+    uint16_t bcdDevice_;
+    uint32_t descriptorHash_;                   //Hash of the descriptor of the active layout (0 if none)
+    uint32_t generation_;                       //Registry generation (incremented on each build)
+    SemaphoreHandle_t mutexFields_;             //Protects registry metadata against front-ends
+    ReportPlan reportPlans_[REPORT_TYPE_COUNT][256];    //Decode plans indexed by report type and ID
+    std::vector<HIDDecodeStep> decodeSteps_;    //Steps of all plans, grouped by report
+    UpsSnapshot working_;                       //Readings being decoded (HID task only)
+    uint32_t readingFieldMask_[HID_MAX_FIELDS / 32];    //Bit set for each field used by a reading
+    SeqLock<UpsSnapshot> snapshot_;             //Last published readings
     bool connected_;
     std::string manufacturer_;
     std::string model_;
@@ -338,6 +726,133 @@ private:
 
     static uint32_t toUnSignedInteger(const uint8_t* data, size_t len);
 
+    /**
+     * Gets if a collection or one of its parents is a Power Device collection
+     * @param collection Collection index
+     * @param usage Power Device usage of the collection
+     */
+    bool inCollection(uint16_t collection, uint16_t usage) const;
+
+    /**
+     * Gets the collection index matching a parent and usage (created if needed)
+     */
+    uint16_t openCollection(uint16_t parent, uint16_t usagePage, uint16_t usage);
+
+    /**
+     * Advances a report bit offset by the size of a main item
+     * (saturates at HID_MAX_REPORT_BITS)
+     */
+    static void advanceBitOffset(uint32_t& bitOffset, const HIDGlobalItems& globals);
+
+    /**
+     * Adds the fields of a main item to the registry (and to the writable fields)
+     * @param type Report type of the main item
+     * @param flags Main item data (Constant, Variable...)
+     * @param globals Current global items
+     * @param locals Local items of the main item
+     * @param collection Collection holding the main item
+     * @param bitOffset Bit offset in the report (advanced by the item size)
+     */
+    void addFields(HIDReportType type, uint32_t flags, const HIDGlobalItems& globals, const HIDLocalItem& locals,
+                        uint16_t collection, uint32_t& bitOffset);
+
+    /**
+     * Builds the full path name of all fields
+     */
+    void buildFieldNames();
+
+    /**
+     * Appends a usage name (hexadecimal if unknown)
+     */
+    static void appendUsageName(std::string& dest, uint16_t usagePage, uint16_t usage);
+
+    /**
+     * Compiles the per report decode plans from the registry
+     */
+    void compileDecodePlans();
+
+    /**
+     * Schedules polling of all reports holding Feature fields
+     */
+    void scheduleFeatureReports();
+
+    /**
+     * Allocates the images of the reports holding writable fields
+     */
+    void buildReportImages();
+
+    /**
+     * Gets the image of a report (nullptr if no writable field)
+     */
+    ReportImage* findReportImage(HIDReportType type, uint8_t reportId);
+
+    /**
+     * Writes a command in its report image
+     */
+    void applyCommand(const HIDCommand& command, const ReportImage& image);
+
+    /**
+     * Compiles the registry and publishes it as the active layout
+     * (fields mutex must be held)
+     */
+    void activateLayout();
+
+    /**
+     * Hashes a report descriptor (FNV-1a)
+     */
+    static uint32_t descriptorHash(const uint8_t* data, size_t len);
+
+    /**
+     * Gets the layout cache file name of the device (VID, PID and bcdDevice)
+     */
+    std::string layoutCacheFileName() const;
+
+    /**
+     * Restores the registry from the layout cache
+     * @return true if a layout was restored
+     */
+    bool loadLayout();
+
+    /**
+     * Checks the restored registry before it is used (the cache holds raw records)
+     * Collections must point to an earlier parent, fields to a known collection and
+     * report type, with their bits inside the report size.
+     */
+    bool layoutConsistent() const;
+
+    /**
+     * Saves the registry to the layout cache (main loop)
+     */
+    void saveLayout() const;
+
+    /**
+     * Gets the refresh interval of a Feature field
+     */
+    static uint32_t featureRefreshInterval(uint16_t usagePage, uint16_t usage);
+
+    /**
+     * Decodes a report with its compiled plan and publishes it
+     * @param type Report type
+     * @param data Report data (first byte is report ID)
+     * @param len Report length
+     */
+    void decodeReport(HIDReportType type, const uint8_t* data, size_t len);
+
+    /**
+     * Extracts and scales a field from a report
+     * @param step Extraction step
+     * @param buffer HID report buffer (without reportId)
+     * @param len Size of the report buffer (without reportId)
+     * @return Value scaled by 10^step.exponent
+     */
+    static int32_t decode(const HIDDecodeStep& step, const uint8_t* buffer, size_t len);
+
+    /**
+     * Publishes the working readings to readers and the event bus
+     * @param events Changes of the readings (UPSEventBus::Event bits)
+     */
+    void publish(uint8_t events);
+
     /**
      * Updates the GlobalItem store
      */
@@ -356,13 +871,65 @@ private:
     static void getStringDescriptor(const usb_str_desc_t *str_desc, std::string& dest);
 
     /**
-     * Adds to JSON
+     * Adds a field value to JSON (integer when the value has no fraction)
+     */
+    static void valueToJSON(JsonVariant dest, int32_t value, int8_t exponent);
+
+    /**
+     * Adds the unit of a value to the units object (nothing for values without unit)
+     * @param name Key of the value
+     */
+    static void unitToJSON(JsonObject ups, const char* name, HIDUnit unit);
+
+    /**
+     * Adds a reading to JSON
+     */
+    void addToJSON(const UpsSnapshot& snapshot, UpsSnapshot::Reading reading, JsonObject ups) const;
+
+    /**
+     * Adds all registry fields to JSON
+     */
+    void fieldsToJSON(const UpsSnapshot& snapshot, JsonObject ups) const;
+
+    /**
+     * Asks the Input report rate matching the power source (main loop)
+     * Reports only come on change while on AC, at a fast idle rate on
+     * battery. Follows the debounced ON_BATTERY state of UPSState.
+     */
+    void updateIdleRate();
+
+    /**
+     * Gets the time without report after which the UPS is stale
+     */
+    uint32_t staleTimeout() const;
+
+    /**
+     * Flags the UPS stale and resets it when it sends no more reports (main loop)
+     */
+    void checkStale(uint32_t nowMs);
+
+    /**
+     * Asks the bridge to enumerate the UPS again, spaced out while it stays silent (main loop)
      */
-    static void addToJSON(const HIDData& data, JsonDocument& doc);
+    void resetDevice(uint32_t nowMs);
 
-    UsbHostHidBridge hidBridge;
+    std::atomic<int16_t> idleRequested_;    //Last SET_IDLE duration asked (-1 to ask again)
+    std::atomic<bool> idleSupported_;       //Cleared when the device stalls SET_IDLE
+    std::atomic<int16_t> idleActive_;   //SET_IDLE duration accepted by the device (-1 if none)
+    std::atomic<bool> layoutUnsaved_;   //Layout built from the descriptor, not in the cache yet
+    //Reception times, only stored by the HID task (millis(), 0 if none since the connection)
+    std::atomic<uint32_t> reportTimes_[HID_MAX_REPORT_SLOTS];
+    std::atomic<uint32_t> lastReportMs_;
+    std::atomic<uint32_t> connectedMs_;     //Layout activation time
+    std::atomic<uint32_t> attachedMs_;      //Device descriptor reception time (0 if removed)
+    std::atomic<uint32_t> refreshMs_;       //Shortest Feature poll interval (0 if none)
+    std::atomic<bool> stale_;
+    uint32_t nextResetMs_;          //Earliest next reset (main loop only)
+    uint8_t resets_;                //Resets without a report since (main loop only)
+    uint8_t index_;                 //Slot in the bridge device table
 };
 
-extern UPSHIDDevice upsDevice;
+extern UsbHostHidBridge hidBridge;
+extern UPSHIDDevice upsDevices[UPS_MAX_DEVICES];
 
 #endif
\ No newline at end of file
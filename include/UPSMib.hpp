@@ -0,0 +1,201 @@
+#ifndef _UPS_MIB_HPP__
+#define _UPS_MIB_HPP__
+#include <Arduino.h>
+#include <SNMPBer.hpp>
+#include <UPSHIDDevice.hpp>
+#include <vector>
+
+/**
+ * Index of the objects served by the SNMP agent
+ * Objects are a static table sorted by OID, an OID is resolved by a binary
+ * search on the table then by its instance arcs. Objects of a UPS come and
+ * go with its fields: a bitmap per UPS holds the available ones, so a
+ * (re)connection only changes bits and the table never moves.
+ */
+class UPSMib
+{
+public:
+    /**
+     * Objects served, in OID order (same order as OBJECTS)
+     */
+    enum Object : uint8_t {
+        SYS_DESCR = 0,
+        SYS_UP_TIME,
+        SYS_NAME,
+        HR_SYSTEM_UPTIME,
+        IDENT_MANUFACTURER,
+        IDENT_MODEL,
+        IDENT_UPS_SOFTWARE,
+        IDENT_AGENT_SOFTWARE,
+        IDENT_NAME,
+        IDENT_ATTACHED_DEVICES,
+        BATTERY_STATUS,
+        SECONDS_ON_BATTERY,
+        MINUTES_REMAINING,
+        CHARGE_REMAINING,
+        BATTERY_VOLTAGE,
+        BATTERY_CURRENT,
+        BATTERY_TEMPERATURE,
+        INPUT_LINE_BADS,
+        INPUT_NUM_LINES,
+        INPUT_FREQUENCY,
+        INPUT_VOLTAGE,
+        INPUT_CURRENT,
+        INPUT_POWER,
+        OUTPUT_SOURCE,
+        OUTPUT_FREQUENCY,
+        OUTPUT_NUM_LINES,
+        OUTPUT_VOLTAGE,
+        OUTPUT_CURRENT,
+        OUTPUT_POWER,
+        OUTPUT_LOAD,
+        ALARMS_PRESENT,
+        ALARM_ID,
+        ALARM_DESCR,
+        ALARM_TIME,
+        TEST_RESULTS_SUMMARY,
+        TEST_RESULTS_DETAIL,
+        TEST_START_TIME,
+        SHUTDOWN_AFTER_DELAY,
+        STARTUP_AFTER_DELAY,
+        AUDIBLE_STATUS,
+        ENT_PHYSICAL_DESCR,
+        ENT_PHYSICAL_NAME,
+        ENT_PHYSICAL_SERIAL,
+        INTERNAL_TEMPERATURE,
+        PROBE_TEMPERATURE,
+        DATA_AGE,
+        OBJECT_COUNT
+    };
+    static_assert(OBJECT_COUNT <= 64, "Available objects are a 64 bits mask");
+
+    /**
+     * Instances of an object
+     * The first UPS is walked at its RFC 1628 instance, the others at their
+     * number. Aliases (legacy OID without instance, number of the first UPS)
+     * are only resolved by GET and SET.
+     */
+    enum class Instance : uint8_t {
+        Global,     //OID.0, alias OID
+        Scalar,     //First UPS at OID.0, UPS n at OID.n, aliases OID and OID.1
+        Column,     //Column OID with the line index for the first UPS, UPS n at OID.n, alias OID.1
+        Alarm       //upsAlarmTable column, row r of the first UPS at OID.r, of UPS n at OID.r.n, alias OID.r.1
+    };
+
+    /**
+     * Object of the MIB
+     */
+    struct ObjectInfo {
+        const char* oid;
+        Instance instance;
+        uint8_t syntax;                 //BER tag of the value
+        bool writable;
+        UpsSnapshot::Reading reading;   //Reading of the value (READING_COUNT if derived)
+        HIDUnit unit;                   //Unit the MIB expects
+        int8_t exponent;                //Decimal exponent of the MIB value (-1 for tenths)
+    };
+    static const ObjectInfo OBJECTS[OBJECT_COUNT];
+    static const char* const WELL_KNOWN_ALARMS;    //upsWellKnownAlarms, prefix of upsAlarmDescr values
+
+    /**
+     * Instance of an object resolved from an OID
+     */
+    struct Target {
+        Object object;
+        uint8_t index;                  //UPS index (0 for global objects)
+        uint32_t row;                   //upsAlarmId of an alarm column
+    };
+
+    /**
+     * Mask of an object in the available objects
+     */
+    static constexpr uint64_t bit(Object object) { return 1ull << object; }
+
+    UPSMib();
+    virtual ~UPSMib() = default;
+
+    /**
+     * Parses the OID of the table
+     */
+    void begin();
+
+    /**
+     * Sets the objects available for a UPS
+     * @param index UPS index
+     * @param objects Mask of the available objects (0 if disconnected)
+     */
+    inline void setAvailable(uint8_t index, uint64_t objects) { available_[index] = objects; }
+
+    /**
+     * Gets if an object is available for a UPS
+     * @param index UPS index
+     */
+    inline bool isAvailable(uint8_t index, Object object) const { return (available_[index] & bit(object)) != 0; }
+
+    /**
+     * Sets the rows of the alarm table of a UPS
+     * @param index UPS index
+     * @param rows upsAlarmId of the rows
+     */
+    void setAlarmRows(uint8_t index, const std::vector<uint32_t>& rows);
+
+    /**
+     * Resolves an OID (GET, SET)
+     * @param oid OID requested
+     * @param target Receives the object instance
+     * @return 0 if found, else BER_NO_SUCH_OBJECT or BER_NO_SUCH_INSTANCE
+     */
+    uint8_t find(const SnmpOid& oid, Target& target) const;
+
+    /**
+     * Resolves the first available OID after an OID (GETNEXT, GETBULK)
+     * @param oid OID requested, receives the OID found
+     * @param target Receives the object instance
+     * @return false at the end of the MIB
+     */
+    bool next(SnmpOid& oid, Target& target) const;
+
+private:
+    /**
+     * Instance arcs of an object
+     */
+    struct Suffix {
+        uint8_t length;
+        uint32_t arcs[2];
+        uint8_t index;
+        uint32_t row;
+    };
+
+    /**
+     * Calls a function on each available instance of an object
+     * @param object Object index
+     * @param aliases True to also visit the aliases of the instances (GET)
+     * @param visit Called with each instance, in no particular order
+     */
+    template<typename F>
+    void forEachInstance(uint8_t object, bool aliases, F visit) const;
+
+    /**
+     * Compares the arcs of an OID past a prefix with instance arcs
+     * @return <0, 0 or >0 like strcmp
+     */
+    static int compareSuffix(const SnmpOid& oid, uint8_t offset, const Suffix& suffix);
+
+    /**
+     * Gets if instance arcs sort before others
+     */
+    static bool before(const Suffix& a, const Suffix& b);
+
+    /**
+     * Gets the index of the last object not after an OID
+     * @return -1 if the OID is before the first object
+     */
+    int lowerObject(const SnmpOid& oid) const;
+
+    SnmpOid oids_[OBJECT_COUNT];
+    uint64_t global_;                                   //Available objects not related to a UPS
+    uint64_t available_[UPS_MAX_DEVICES];
+    std::vector<uint32_t> alarmRows_[UPS_MAX_DEVICES];
+};
+
+#endif
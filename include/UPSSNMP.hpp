@@ -1,31 +1,299 @@
 #ifndef _UPS_SNMP_AGENT_HPP__
 #define _UPS_SNMP_AGENT_HPP__
 #include <Arduino.h>
-#include <SNMPTrap.h>
-#include <SNMP_Agent.h>
 #include <ETH.h>
+#include <FreeRTOS.h>
+#include <SNMPBer.hpp>
+#include <SNMPNotifier.hpp>
+#include <UPSMib.hpp>
+#include <UPSHIDDevice.hpp>
+#include <UPSEvents.hpp>
+#include <ArduinoJson.h>
+#include <atomic>
+#include <string>
 #include <vector>
 
+#define SNMP_AGENT_SOFTWARE     "ESP32-UPS-SNMP " __DATE__  // upsIdentAgentSoftwareVersion
+#if !defined(SNMP_PORT)
+     #define SNMP_PORT              161                     // Agent UDP port
+#endif
+#define SNMP_MAX_MESSAGE        1472                        // Largest message (Ethernet MTU without IP/UDP headers)
+#define SNMP_READ_COMMUNITY     "public"                    // Community of GET, GETNEXT and GETBULK
+#define SNMP_WRITE_COMMUNITY    "private"                   // Community of SET (also allowed to read)
+#define SNMP_CACHE_VALUE_SIZE   16                          // Largest value TLV kept in the cache (bytes)
+#define SNMP_DRAIN_MAX          16                          // Datagrams handled per wakeup before the UPS changes
+#if !defined(SNMP_TASK_PRIORITY)
+     #define SNMP_TASK_PRIORITY     2                       // Above loop() so requests never wait for it
+#endif
+#if !defined(SNMP_TASK_COREID)
+     #define SNMP_TASK_COREID       1                       // USB tasks are on core 0
+#endif
+#if !defined(SNMP_TASK_WAKEUP_MS)
+     #define SNMP_TASK_WAKEUP_MS    1000                    // Longest wait before the UPS changes are taken
+#endif
+
+/**
+ * SNMP agent serving the RFC 1628 UPS-MIB of the connected UPS
+ * The agent runs in its own task blocked on the UDP socket, the MIB state
+ * is only touched by that task. Requests are resolved on the UPSMib index, connections only change the
+ * objects available. MIB values of a UPS are rendered from one snapshot
+ * the first time a PDU reads them, the other OID of the PDU read the
+ * rendered values. Encoded values are then reused by the next requests
+ * during the cache window, until the UPS reports a change. Notifications
+ * are queued on the UPS changes and sent by the task after the requests.
+ */
 class UPSSNMPAgent
 {
 public:
     UPSSNMPAgent();
     virtual ~UPSSNMPAgent() = default;
+    /**
+     * Subscribes to the UPS connection changes and starts the agent task
+     * (call before UPSHIDDevice::begin)
+     */
     void begin();
+
+    /**
+     * Opens the agent socket (network up)
+     */
     void start();
+
+    /**
+     * Closes the agent socket (network down)
+     */
     void stop();
-    void loop();
+
+    /**
+     * Adds the value cache and notification counters
+     * @param doc JSON document to fill
+     */
+    void countersToJSON(JsonDocument& doc) const;
 private:
-    void initializeOID();
-    void destroyOID();
-
-    SNMPAgent agent_;    
-    bool started_;
-    WiFiUDP* udp_;
-    unsigned long lastPoll_;
-    bool wasConnected_;
-    std::vector<ValueCallback*> callbacks_;
-    TimestampCallback* timestampCallback_;
-    SNMPTrap* upsTrap_;
+    /**
+     * Waits for requests, takes the UPS changes between them
+     */
+    static void serverTask(void* param);
+
+    /**
+     * Opens and binds the agent socket
+     * @return false on error (retried later)
+     */
+    bool openSocket();
+
+    /**
+     * Closes the agent socket
+     */
+    void closeSocket();
+
+    /**
+     * Takes the configuration and UPS changes
+     */
+    void update();
+
+    /**
+     * Sets the objects available for a connected UPS
+     * @param index UPS index
+     */
+    void initializeOID(uint8_t index);
+
+    /**
+     * Removes the objects of a disconnected UPS
+     * @param index UPS index
+     */
+    void destroyOID(uint8_t index);
+
+    /**
+     * String objects of upsIdent
+     */
+    enum MibString : uint8_t {
+        MANUFACTURER = 0,
+        MODEL,
+        UPS_SOFTWARE,
+        AGENT_SOFTWARE,
+        NAME,
+        ATTACHED_DEVICES,
+        MIB_STRING_COUNT
+    };
+
+    /**
+     * MIB values of a UPS, rendered once per PDU
+     */
+    struct MibSnapshot {
+        bool rendered;
+        int32_t integers[UPSMib::OBJECT_COUNT];     //Integer objects, by UPSMib::Object
+    };
+
+    /**
+     * Row of upsAlarmTable
+     */
+    struct Alarm {
+        uint32_t id;                    //upsAlarmId
+        uint8_t type;                   //Arc of upsWellKnownAlarms (upsAlarmDescr)
+        uint32_t timeCs;                //sysUpTime when the alarm was added (upsAlarmTime)
+        uint32_t timeMs;                //millis() when the alarm was added (upsSecondsOnBattery)
+    };
+
+    /**
+     * Renders the MIB values of a UPS if not done for this PDU
+     * @param index UPS index
+     */
+    const MibSnapshot& render(uint8_t index);
+
+    /**
+     * Updates the alarm table of a UPS from its state
+     * @param index UPS index
+     */
+    void updateAlarms(uint8_t index);
+
+    /**
+     * Settable object writing a UPS field
+     */
+    struct CommandOID {
+        UPSMib::Object object;
+        uint16_t usagePage;
+        uint16_t usage;
+        int32_t minimum;
+        int32_t maximum;
+        int32_t initial;    //Value read before any SET
+        int32_t value;      //Last value sent to the UPS
+    };
+    static constexpr uint8_t COMMAND_OID_COUNT = 3;
+
+    /**
+     * Gets the command of a settable object
+     * @return nullptr if the object is not settable
+     */
+    CommandOID* getCommand(const UPSMib::Target& target);
+
+    /**
+     * Handles the datagrams received (at most SNMP_DRAIN_MAX)
+     */
+    void receive();
+
+    /**
+     * Processes a request message
+     * @param request Received message
+     * @param length Message size
+     * @param response Receives the response message
+     * @return false if the message is dropped (malformed, unknown community...)
+     */
+    bool process(const uint8_t* request, size_t length, BerWriter& response);
+
+    /**
+     * Reads a variable binding of a request
+     * @param varbinds Reader of the variable binding list
+     * @param oid Receives the name
+     * @param value Receives the reader of the value
+     */
+    static bool readVarbind(BerReader& varbinds, SnmpOid& oid, BerReader& value);
+
+    /**
+     * Answers the variable bindings of a GET or GETNEXT
+     * @param next True for a GETNEXT
+     * @param v1 True for an SNMPv1 request (errors instead of exceptions)
+     * @param varbinds Variable binding list of the request
+     * @param response Receives the variable bindings
+     * @param error Receives the error status
+     * @param errorIndex Receives the variable binding in error
+     * @return false if the request is malformed
+     */
+    bool get(bool next, bool v1, BerReader varbinds, BerWriter& response, SnmpError& error, uint32_t& errorIndex);
+
+    /**
+     * Answers the variable bindings of a GETBULK
+     * Repetitions stop at the end of the MIB or when the response is full
+     * @return false if the request is malformed
+     */
+    bool getBulk(int32_t nonRepeaters, int32_t maxRepetitions, BerReader varbinds, BerWriter& response);
+
+    /**
+     * Checks then applies the variable bindings of a SET
+     * @return false if the request is malformed
+     */
+    bool set(BerReader varbinds, SnmpError& error, uint32_t& errorIndex);
+
+    /**
+     * Writes the variable binding of the instance after an OID
+     * @param oid OID requested
+     * @param response Receives the variable binding
+     * @return false at the end of the MIB (endOfMibView written)
+     */
+    bool writeNext(SnmpOid oid, BerWriter& response);
+
+    /**
+     * Writes the value of an object instance
+     * @param target Object instance
+     * @param writer Receives the value TLV
+     */
+    void writeValue(const UPSMib::Target& target, BerWriter& writer);
+
+    /**
+     * Checks the value of a SET
+     * @param target Object instance
+     * @param value Value TLV
+     * @param decoded Receives the value
+     * @return SNMP_NO_ERROR if the value can be set
+     */
+    SnmpError checkSet(const UPSMib::Target& target, BerReader value, int32_t& decoded);
+
+    /**
+     * Value of an object instance encoded by a previous request
+     */
+    struct CachedValue {
+        uint32_t timeMs;                        //When the value was encoded
+        uint8_t length;                         //TLV size (0 if not cached)
+        uint8_t tlv[SNMP_CACHE_VALUE_SIZE];
+    };
+
+    /**
+     * Writes the value of an object instance, from the cache if still fresh
+     * @param target Object instance
+     * @param writer Receives the value TLV
+     */
+    void writeCachedValue(const UPSMib::Target& target, BerWriter& writer);
+
+    /**
+     * Drops the cached values of a UPS
+     * @param index UPS index (global objects use the slots of the first UPS)
+     */
+    void invalidateCache(uint8_t index);
+
+    /**
+     * Keeps upsEstimatedMinutesRemaining of a UPS for its notifications
+     * (the values are gone once the UPS is removed)
+     * @param index UPS index
+     */
+    void trackMinutesRemaining(uint8_t index);
+
+    /**
+     * Gets sysUpTime
+     */
+    static inline uint32_t upTime() { return static_cast<uint32_t>(millis() / 10); }
+
+    UPSMib mib_;
+    std::atomic<bool> running_;
+    TaskHandle_t task_;
+    int socket_;
+    UPSEventBus::Subscriber events_;
+    bool wasConnected_[UPS_MAX_DEVICES];
+    MibSnapshot values_[UPS_MAX_DEVICES];
+    std::string identStrings_[UPS_MAX_DEVICES][MIB_STRING_COUNT];  //Fixed while connected
+    std::vector<Alarm> alarms_[UPS_MAX_DEVICES];
+    uint32_t nextAlarmId_[UPS_MAX_DEVICES];
+    uint32_t lineBads_[UPS_MAX_DEVICES];        //upsInputLineBads
+    CommandOID commands_[UPS_MAX_DEVICES][COMMAND_OID_COUNT];
+    CachedValue cache_[UPS_MAX_DEVICES][UPSMib::OBJECT_COUNT];
+    std::atomic<uint32_t> cacheWindowMs_;
+    std::atomic<bool> configChanged_;
+    std::atomic<uint32_t> cacheHits_;
+    std::atomic<uint32_t> cacheMisses_;
+    SNMPNotifier notifier_;
+    std::atomic<bool> trapsChanged_;
+    int32_t minutesRemaining_[UPS_MAX_DEVICES];     //Last known, -1 if not served
+    uint8_t rx_[SNMP_MAX_MESSAGE];
+    uint8_t tx_[SNMP_MAX_MESSAGE];
 };
-#endif
\ No newline at end of file
+
+extern UPSSNMPAgent snmpAgent;
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef _UPS_SELF_TEST_HPP__
+#define _UPS_SELF_TEST_HPP__
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FreeRTOS.h>
+#include <atomic>
+#include <string>
+#include <UPSHIDDevice.hpp>
+#include <UPSEvents.hpp>
+
+#define SELF_TEST_HISTORY           8           // Results kept per UPS
+#define SELF_TEST_START_TIMEOUT_MS  30000       // Time for the UPS to report the test in progress
+#define SELF_TEST_QUICK_TIMEOUT_MS  300000      // Longest quick test (aborted after)
+#define SELF_TEST_DEEP_TIMEOUT_MS   7200000     // Longest deep test (aborted after)
+#define SELF_TEST_RETRY_MS          600000      // Delay before retrying a test the UPS was not ready for
+#define SELF_TEST_MIN_CAPACITY      90          // Battery charge needed to start a scheduled test (%)
+
+/**
+ * Test result, same values as the HID Test usage and upsTestResultsSummary
+ */
+enum class SelfTestResult : uint8_t {
+    Passed = 1,
+    Warning,
+    Error,
+    Aborted,
+    InProgress,
+    NoTest
+};
+
+/**
+ * Gets the name of a test result
+ */
+const char* selfTestResultToString(SelfTestResult result);
+
+/**
+ * Test kept in the history (16 bytes)
+ */
+struct SelfTestRecord {
+    enum Flags : uint8_t {
+        DEEP = 0x1,                 //Deep test (runtime calibration)
+        SCHEDULED = 0x2,            //Started by the scheduler (else started by hand)
+        RUNTIME = 0x4,              //runtimeDropS is known
+        VOLTAGE = 0x8               //voltageSagMv is known
+    };
+    uint32_t startS;            //Uptime at the start
+    uint16_t durationS;         //Duration of the test
+    SelfTestResult result;
+    uint8_t flags;
+    int32_t runtimeDropS;       //Run time to empty lost during the test
+    int32_t voltageSagMv;       //Battery voltage sag during the test
+};
+
+/**
+ * Battery self-test scheduler
+ * Starts the tests of the connected UPS at the configured interval, one
+ * UPS at a time and only on a charged battery with AC present. Tests
+ * started by hand (with a Test command) are followed too. The result,
+ * the runtime drop and the voltage sag of each test go to a history.
+ * The first test of a gateway is spread over the interval (from the MAC
+ * address) so a fleet does not test all its UPS at once.
+ */
+class UPSSelfTest
+{
+public:
+    UPSSelfTest();
+    virtual ~UPSSelfTest() = default;
+
+    /**
+     * Subscribes to the UPS changes (call before UPSHIDDevice::begin)
+     */
+    void begin();
+
+    /**
+     * Runs the scheduler (main loop)
+     * @param nowMs Current time (millis())
+     */
+    void loop(uint32_t nowMs);
+
+    /**
+     * Starts a test now
+     * @param index UPS index
+     * @param deep True for a deep test
+     * @return Command status (Queued if the test is started)
+     */
+    UPSCommandStatus start(uint8_t index, bool deep);
+
+    /**
+     * Gets the summary of the last test (InProgress while a test runs)
+     * @param index UPS index
+     */
+    SelfTestResult getSummary(uint8_t index) const;
+
+    /**
+     * Gets the last finished test
+     * @param index UPS index
+     * @param record Last test
+     * @return false if the UPS was never tested
+     */
+    bool getLast(uint8_t index, SelfTestRecord& record) const;
+
+    /**
+     * Describes the last test (upsTestResultsDetail)
+     * @param index UPS index
+     */
+    std::string getDetail(uint8_t index) const;
+
+    /**
+     * Adds the test state and history of a UPS to its status
+     * @param index UPS index
+     * @param ups Status of the UPS
+     */
+    void toJSON(uint8_t index, JsonObject ups) const;
+
+    /**
+     * Adds the tests to the status of all UPS (UPS array of UPSHIDDevice::devicesToJSON)
+     */
+    void devicesToJSON(JsonDocument& doc) const;
+
+private:
+    enum class State : uint8_t {
+        Idle = 0,
+        Starting,               //Test command sent, waiting for the UPS
+        Running
+    };
+
+    /**
+     * Test of a UPS
+     */
+    struct Unit {
+        State state;
+        bool connected;
+        uint8_t flags;              //SelfTestRecord::Flags of the running test
+        uint8_t baselineResult;     //Test reading before the command
+        uint64_t startMs;           //Scheduler clock at the start
+        uint64_t nextTestMs;        //Next scheduled test (0 if none)
+        int32_t runtime;            //Run time to empty (s), before the test then lowest
+        int32_t voltage;            //Battery voltage (mV), before the test then lowest
+        int32_t baselineRuntime;
+        int32_t baselineVoltage;
+        SelfTestRecord history[SELF_TEST_HISTORY];
+        uint8_t historyFirst;
+        uint8_t historyCount;
+    };
+
+    /**
+     * Follows the readings of a UPS
+     */
+    void update(uint8_t index, const UpsSnapshot& snapshot);
+
+    /**
+     * Starts a scheduled test if due and the UPS is ready
+     */
+    void schedule(uint8_t index, const UpsSnapshot& snapshot);
+
+    /**
+     * Ends the running test and records it
+     */
+    void finish(uint8_t index, SelfTestResult result);
+
+    /**
+     * Starts the test of a UPS (mutex taken)
+     */
+    UPSCommandStatus startTest(uint8_t index, bool deep, bool scheduled, const UpsSnapshot& snapshot);
+
+    /**
+     * Gets the delay before the first test of a UPS
+     */
+    uint64_t firstTestDelay(uint8_t index) const;
+
+    Unit units_[UPS_MAX_DEVICES];
+    UPSEventBus::Subscriber events_;
+    uint64_t clockMs_;                  //Time since the first loop (millis() without wrap)
+    uint32_t lastLoopMs_;
+    uint64_t intervalMs_;               //Test interval (0 if scheduled tests are disabled)
+    bool deep_;
+    std::atomic<bool> configChanged_;
+    SemaphoreHandle_t mutex_;
+};
+
+extern UPSSelfTest upsSelfTest;
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef _UPS_STATE_HPP__
+#define _UPS_STATE_HPP__
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <atomic>
+#include <string>
+#include <UPSHIDDevice.hpp>
+#include <UPSEvents.hpp>
+
+#define UPS_STATE_OVERLOAD_LOAD     100     // Output load flagged as overload without the UPS flag (%)
+
+/**
+ * Derived state of the UPS
+ * Conditions are evaluated from the readings on each change, a condition
+ * must hold for the configured debounce time before the state changes.
+ * Charge and load thresholds are only left past the configured hysteresis.
+ * Front-ends read this state instead of the raw readings, a UPSEventBus::STATE
+ * event is published on each change.
+ */
+class UPSState
+{
+public:
+    /**
+     * Conditions of a UPS, several can hold at once (none while disconnected)
+     */
+    enum Flag : uint16_t {
+        ONLINE = 0x1,                   //Output powered by the utility
+        ON_BATTERY = 0x2,               //Output powered by the battery
+        LOW_BATTERY = 0x4,              //Charge below the UPS limit or the configured charge
+        REPLACE_BATTERY = 0x8,
+        NO_BATTERY = 0x10,
+        OVERLOAD = 0x20,
+        BOOST = 0x40,                   //Low input voltage raised
+        TRIM = 0x80,                    //High input voltage lowered
+        CHARGING = 0x100,
+        COMMUNICATION_LOST = 0x200,     //No report for a while (UPSHIDDevice::isStale)
+        OVER_TEMPERATURE = 0x400,
+        FAULT = 0x800,                  //Internal failure
+        SHUTDOWN_PENDING = 0x1000,      //Shutdown requested, output off after its delay
+        SHUTDOWN_IMMINENT = 0x2000,
+        AWAITING_POWER = 0x4000,        //Output off until the utility returns
+        TEST_IN_PROGRESS = 0x8000
+    };
+    static constexpr uint8_t FLAG_COUNT = 16;
+
+    /**
+     * Gets the name of a condition
+     */
+    static const char* flagToString(Flag flag);
+
+    /**
+     * Gets the names of the conditions, comma separated
+     */
+    static std::string flagsToString(uint16_t flags);
+
+    UPSState();
+    virtual ~UPSState() = default;
+
+    /**
+     * Subscribes to the UPS changes (call before UPSHIDDevice::begin)
+     */
+    void begin();
+
+    /**
+     * Evaluates the changed readings and commits the debounced conditions (main loop)
+     * @param nowMs Current time (millis())
+     */
+    void loop(uint32_t nowMs);
+
+    /**
+     * Gets the debounced conditions of a UPS (any task, never blocks)
+     * @param index UPS index
+     * @return Flag bits
+     */
+    inline uint16_t getFlags(uint8_t index) const {
+        return index < UPS_MAX_DEVICES ? units_[index].flags.load(std::memory_order_relaxed) : 0;
+    }
+
+    /**
+     * Gets if a condition holds
+     */
+    inline bool is(uint8_t index, Flag flag) const { return getFlags(index) & flag; }
+
+    /**
+     * Adds the state of a UPS to its status
+     * @param index UPS index
+     * @param ups Status of the UPS
+     */
+    void toJSON(uint8_t index, JsonObject ups) const;
+
+    /**
+     * Adds the state to the status of all UPS (UPS array of UPSHIDDevice::devicesToJSON)
+     */
+    void devicesToJSON(JsonDocument& doc) const;
+
+private:
+    /**
+     * State of a UPS
+     */
+    struct Unit {
+        std::atomic<uint16_t> flags;    //Debounced conditions
+        uint16_t raw;                   //Conditions of the last readings
+        uint32_t changeMs[FLAG_COUNT];  //Last change of each raw condition
+    };
+
+    /**
+     * Gets the conditions of the readings
+     * @param previous Conditions of the previous readings (for the hysteresis)
+     */
+    uint16_t evaluate(uint8_t index, const UpsSnapshot& snapshot, uint16_t previous) const;
+
+    Unit units_[UPS_MAX_DEVICES];
+    UPSEventBus::Subscriber events_;
+    uint32_t debounceMs_;
+    uint8_t lowBattery_;                //Low battery charge (%, 0 for the UPS limit only)
+    uint8_t hysteresis_;                //Threshold hysteresis (%)
+    std::atomic<bool> configChanged_;
+};
+
+extern UPSState upsState;
+
+#endif
@@ -2,8 +2,12 @@
 #define _UPS_WEB_SERVER_H__
 
 #include <esp_http_server.h>
+#include <FreeRTOS.h>
 #include <string>
 
+#define WEB_PUSH_HOLDOFF_MS     500     // Minimum time between two status pushes
+#define WEB_PUSH_MAX_CLIENTS    CONFIG_LWIP_MAX_SOCKETS // Client sockets checked at each push
+
 class Webserver{
 public:
     Webserver();
@@ -20,7 +24,7 @@ public:
     void stop();
 
     /**
-     * Setup
+     * Setup (starts the status push task)
      */
     void setup();
 
@@ -37,6 +41,35 @@ public:
 private:
     std::string authDigest_;
     httpd_handle_t server_;
+    TaskHandle_t pushTask_;
+
+    /**
+     * Status to push to the WebSocket clients
+     */
+    struct PushWork {
+        httpd_handle_t server;
+        std::string status;
+    };
+
+    /**
+     * Builds the status JSON (same for GET /status and pushes)
+     */
+    static void statusToJSONString(std::string& status);
+
+    /**
+     * Waits for UPS changes and queues the status push
+     */
+    static void statusPushTask(void* param);
+
+    /**
+     * Gets if a WebSocket client is connected
+     */
+    static bool hasStatusPushClients(httpd_handle_t server);
+
+    /**
+     * Sends the status to all WebSocket clients (HTTP server task)
+     */
+    static void statusPushWork(void* arg);
 
     /**
      * Checks authentication of the user
@@ -51,6 +84,9 @@ private:
     static esp_err_t cfg_get_handler( httpd_req_t *req );       //Handle configuration GET request
     static esp_err_t cfg_post_handler( httpd_req_t *req );      //Handle configuration POST request
     static esp_err_t status_get_handler( httpd_req_t *req );    //Handle status GET request
+    static esp_err_t command_post_handler( httpd_req_t *req );  //Handle UPS command POST request
+    static esp_err_t status_ws_handler( httpd_req_t *req );     //Handle status push WebSocket
+    static esp_err_t capture_get_handler( httpd_req_t *req );   //Handle raw reports capture download
 };
 
 extern Webserver webServer;
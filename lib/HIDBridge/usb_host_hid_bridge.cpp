@@ -17,6 +17,9 @@
 #include <Arduino.h>
 #include "usb_host_hid_bridge.h"
 
+//USB host side, the native build only takes the scheduler (usb_host_hid_schedule.cpp)
+#if defined(ARDUINO_ARCH_ESP32)
+
 // bit mask for async tasks
 #define ACTION_OPEN_DEV             0x01
 #define ACTION_GET_DEV_INFO         0x02
@@ -27,15 +30,61 @@
 #define ACTION_CLAIM_INTF                       0x0100
 #define ACTION_TRANSFER_CTRL_GET_REPORT_DESC    0x0200
 #define ACTION_TRANSFER_INTR_GET_REPORT         0x0400
+#define ACTION_TRANSFER_CTRL_GET_FEATURE        0x0800
+#define ACTION_RELEASE_REPORT_DESC              0x1000
+#define ACTION_TRANSFER_SET_REPORT              0x2000
+#define ACTION_TRANSFER_SET_IDLE                0x4000
+
+#define INTR_IN_TRANSFERS           2       // Interrupt IN transfers kept queued
+#define REPORT_DESC_TRANSFER_SIZE   2048    // HID report descriptor size when not advertised
+#define REPORT_DESC_RETRIES         4       // Report descriptor attempts before the device is reset
+#define REPORT_DESC_RETRY_MS        250     // Delay before the first retry, doubled by each failure
+#define SET_IDLE_RETRIES            3       // SET_IDLE attempts failing other than by a STALL
+
+// HID class descriptors (7.1 of HID 1.11 spec)
+#define HID_DESCRIPTOR_TYPE_HID         0x21
+#define HID_DESCRIPTOR_TYPE_REPORT      0x22
+
+// HID class requests (7.2 of HID 1.11 spec)
+#define HID_CLASS_REQUEST_GET_REPORT    0x01
+#define HID_CLASS_REQUEST_SET_REPORT    0x09
+#define HID_CLASS_REQUEST_SET_IDLE      0x0A
+#define HID_REPORT_TYPE_OUTPUT          0x02
+#define HID_REPORT_TYPE_FEATURE         0x03
+
+struct class_driver_s;
 
 typedef struct {
-    usb_host_client_handle_t client_hdl;
+    uint8_t index;              // slot in the device table, given to the callbacks
     uint8_t dev_addr;
     usb_device_handle_t dev_hdl;
     uint32_t actions;
     uint16_t bMaxPacketSize0;
+    uint8_t bInterfaceNumber;
+    uint16_t wDescriptorLength;  // report descriptor length from the HID descriptor
+    bool reports_started;
+    uint8_t desc_failures;      // report descriptor attempts failed in a row
+    bool desc_retry;            // report descriptor fetched again at desc_retry_at
+    TickType_t desc_retry_at;
+    uint8_t idle_failures;      // SET_IDLE attempts failed in a row (STALL excluded)
+    bool ctrl_busy;
+    bool out_busy;              // interrupt OUT transfer in flight
     usb_ep_desc_t *ep_in;
     usb_ep_desc_t *ep_out;
+    // transfer pool, allocated when the HID interface is claimed
+    usb_transfer_t *intr_in[INTR_IN_TRANSFERS];
+    usb_transfer_t *ctrl_desc;  // report descriptor, freed once received
+    usb_transfer_t *ctrl;       // class requests (GET_REPORT, SET_REPORT)
+    usb_transfer_t *intr_out;   // output reports, when there is an interrupt OUT endpoint
+    uint8_t in_flight;          // submitted transfers whose callback did not run yet
+    bool hid_claimed;
+    bool reopen;                // open the device again once closed (reset requested)
+    struct class_driver_s *driver;
+} hid_device_t;
+
+typedef struct class_driver_s {
+    usb_host_client_handle_t client_hdl;
+    hid_device_t devices[USB_HOST_MAX_DEVICES];
     UsbHostHidBridge *bdg;
 } class_driver_t;
 
@@ -50,16 +99,25 @@ static void client_event_cb(const usb_host_client_event_msg_t *event_msg, void *
     class_driver_t *driver_obj = (class_driver_t *)arg;
     switch (event_msg->event) {
         case USB_HOST_CLIENT_EVENT_NEW_DEV:
-            if (driver_obj->dev_addr == 0) {
-                driver_obj->dev_addr = event_msg->new_dev.address;
-                //Open the device next
-                driver_obj->actions |= ACTION_OPEN_DEV;
+            for (size_t i = 0; i < USB_HOST_MAX_DEVICES; i++) {
+                hid_device_t *dev_obj = &driver_obj->devices[i];
+                if (dev_obj->dev_addr == 0 && dev_obj->in_flight == 0) {
+                    dev_obj->dev_addr = event_msg->new_dev.address;
+                    //Open the device next
+                    dev_obj->actions |= ACTION_OPEN_DEV;
+                    return;
+                }
             }
+            ESP_LOGW(TAG_CLASS, "Device table full, device %d ignored", event_msg->new_dev.address);
             break;
         case USB_HOST_CLIENT_EVENT_DEV_GONE:
-            if (driver_obj->dev_hdl != NULL) {
-                //Cancel any other actions and close the device next
-                driver_obj->actions = ACTION_CLOSE_DEV;
+            for (size_t i = 0; i < USB_HOST_MAX_DEVICES; i++) {
+                hid_device_t *dev_obj = &driver_obj->devices[i];
+                if (dev_obj->dev_hdl != NULL && dev_obj->dev_hdl == event_msg->dev_gone.dev_hdl) {
+                    //Cancel any other actions and close the device next
+                    dev_obj->actions = ACTION_CLOSE_DEV;
+                    dev_obj->reopen = false;
+                }
             }
             break;
         default:
@@ -68,84 +126,164 @@ static void client_event_cb(const usb_host_client_event_msg_t *event_msg, void *
     }
 }
 
-static void action_open_dev(class_driver_t *driver_obj)
+static void transfer_free(usb_transfer_t **transfer)
 {
-    assert(driver_obj->dev_addr != 0);
-    ESP_LOGI(TAG_CLASS, "Opening device at address %d", driver_obj->dev_addr);
-    ESP_ERROR_CHECK(usb_host_device_open(driver_obj->client_hdl, driver_obj->dev_addr, &driver_obj->dev_hdl));
-    
+    if (*transfer != NULL) {
+        usb_host_transfer_free(*transfer);
+        *transfer = NULL;
+    }
+}
+
+/**
+ * Frees the transfer pool (no transfer must be in flight)
+ */
+static void transfer_pool_free(hid_device_t *dev_obj)
+{
+    for (size_t i = 0; i < INTR_IN_TRANSFERS; i++) {
+        transfer_free(&dev_obj->intr_in[i]);
+    }
+    transfer_free(&dev_obj->ctrl_desc);
+    transfer_free(&dev_obj->ctrl);
+    transfer_free(&dev_obj->intr_out);
+}
+
+/**
+ * Allocates the transfer pool of the opened device
+ * Sizes come from its descriptors: bMaxPacketSize0 for control transfers,
+ * interrupt endpoints wMaxPacketSize for reports
+ */
+static bool transfer_pool_alloc(hid_device_t *dev_obj)
+{
+    transfer_pool_free(dev_obj);
+    uint16_t mps0 = dev_obj->bMaxPacketSize0;
+    esp_err_t err = usb_host_transfer_alloc(USB_SETUP_PACKET_SIZE + usb_round_up_to_mps(dev_obj->wDescriptorLength, mps0), 0, &dev_obj->ctrl_desc);
+    if (err == ESP_OK) {
+        err = usb_host_transfer_alloc(USB_SETUP_PACKET_SIZE + usb_round_up_to_mps(FEATURE_REPORT_MAX_SIZE, mps0), 0, &dev_obj->ctrl);
+    }
+    for (size_t i = 0; (err == ESP_OK) && (dev_obj->ep_in != NULL) && (i < INTR_IN_TRANSFERS); i++) {
+        err = usb_host_transfer_alloc(dev_obj->ep_in->wMaxPacketSize, 0, &dev_obj->intr_in[i]);
+    }
+    if ((err == ESP_OK) && (dev_obj->ep_out != NULL)) {
+        err = usb_host_transfer_alloc(dev_obj->ep_out->wMaxPacketSize, 0, &dev_obj->intr_out);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_CLASS, "Unable to allocate transfers: %s", esp_err_to_name(err));
+        transfer_pool_free(dev_obj);
+        return false;
+    }
+    return true;
+}
+
+static void action_open_dev(hid_device_t *dev_obj)
+{
+    assert(dev_obj->dev_addr != 0);
+    ESP_LOGI(TAG_CLASS, "Opening device at address %d", dev_obj->dev_addr);
+    esp_err_t err = usb_host_device_open(dev_obj->driver->client_hdl, dev_obj->dev_addr, &dev_obj->dev_hdl);
+    if (err != ESP_OK) {
+        //Gone while it was reopened, give its slot back
+        ESP_LOGW(TAG_CLASS, "Unable to open device %d: %s", dev_obj->dev_addr, esp_err_to_name(err));
+        dev_obj->dev_hdl = NULL;
+        dev_obj->dev_addr = 0;
+        dev_obj->actions = 0;
+        return;
+    }
+
     //Get the device's information next
-    driver_obj->actions &= ~ACTION_OPEN_DEV;
-    driver_obj->actions |= ACTION_GET_DEV_INFO;
+    dev_obj->actions &= ~ACTION_OPEN_DEV;
+    dev_obj->actions |= ACTION_GET_DEV_INFO;
 }
 
-static void action_get_info(class_driver_t *driver_obj)
+static void action_get_info(hid_device_t *dev_obj)
 {
-    assert(driver_obj->dev_hdl != NULL);
+    assert(dev_obj->dev_hdl != NULL);
     ESP_LOGI(TAG_CLASS, "Getting device information");
     usb_device_info_t dev_info;
-    ESP_ERROR_CHECK(usb_host_device_info(driver_obj->dev_hdl, &dev_info));
+    ESP_ERROR_CHECK(usb_host_device_info(dev_obj->dev_hdl, &dev_info));
 
     // ESP_LOGI(TAG_CLASS, "\t%s speed", (dev_info.speed == USB_SPEED_LOW) ? "Low" : "Full");
     // ESP_LOGI(TAG_CLASS, "\tbConfigurationValue %d", dev_info.bConfigurationValue);
 
     //Get the device descriptor next
-    driver_obj->actions &= ~ACTION_GET_DEV_INFO;
-    driver_obj->actions |= ACTION_GET_DEV_DESC;
+    dev_obj->actions &= ~ACTION_GET_DEV_INFO;
+    dev_obj->actions |= ACTION_GET_DEV_DESC;
 }
 
-static void action_get_dev_desc(class_driver_t *driver_obj)
+static void action_get_dev_desc(hid_device_t *dev_obj)
 {
-    assert(driver_obj->dev_hdl != NULL);
+    assert(dev_obj->dev_hdl != NULL);
     ESP_LOGI(TAG_CLASS, "Getting device descriptor");
     const usb_device_desc_t *dev_desc;
-    ESP_ERROR_CHECK(usb_host_get_device_descriptor(driver_obj->dev_hdl, &dev_desc));
+    ESP_ERROR_CHECK(usb_host_get_device_descriptor(dev_obj->dev_hdl, &dev_desc));
 
-    driver_obj->bMaxPacketSize0 = dev_desc->bMaxPacketSize0; // shall be used in action_transfer_control()
+    dev_obj->bMaxPacketSize0 = dev_desc->bMaxPacketSize0; // shall be used in action_transfer_control()
+    UsbHostHidBridge *bdg = dev_obj->driver->bdg;
+    if (bdg->onDeviceDescriptorReceived != NULL) {
+        bdg->onDeviceDescriptorReceived(dev_obj->index, dev_desc);
+    }
     // ESP_LOGI(TAG_CLASS, "\tidVendor 0x%04x", dev_desc->idVendor);
     // ESP_LOGI(TAG_CLASS, "\tidProduct 0x%04x", dev_desc->idProduct);
     // usb_print_device_descriptor(dev_desc);
 
     //Get the device's config descriptor next
-    driver_obj->actions &= ~ACTION_GET_DEV_DESC;
-    driver_obj->actions |= ACTION_GET_CONFIG_DESC;
+    dev_obj->actions &= ~ACTION_GET_DEV_DESC;
+    dev_obj->actions |= ACTION_GET_CONFIG_DESC;
 }
 
-static void action_get_config_desc(class_driver_t *driver_obj)
+static void action_get_config_desc(hid_device_t *dev_obj)
 {
-    assert(driver_obj->dev_hdl != NULL);
+    assert(dev_obj->dev_hdl != NULL);
     ESP_LOGI(TAG_CLASS, "Getting config descriptor");
     const usb_config_desc_t *config_desc;
-    ESP_ERROR_CHECK(usb_host_get_active_config_descriptor(driver_obj->dev_hdl, &config_desc));
-    UsbHostHidBridge *bdg = (UsbHostHidBridge *)driver_obj->bdg;
+    ESP_ERROR_CHECK(usb_host_get_active_config_descriptor(dev_obj->dev_hdl, &config_desc));
+    UsbHostHidBridge *bdg = dev_obj->driver->bdg;
     if (bdg->onConfigDescriptorReceived != NULL) {
-        bdg->onConfigDescriptorReceived(config_desc);
+        bdg->onConfigDescriptorReceived(dev_obj->index, config_desc);
     }
     //Get the device's string descriptors next
-    driver_obj->actions &= ~ACTION_GET_CONFIG_DESC;
-    driver_obj->actions |= ACTION_GET_STR_DESC;
+    dev_obj->actions &= ~ACTION_GET_CONFIG_DESC;
+    dev_obj->actions |= ACTION_GET_STR_DESC;
 }
 
-static void action_get_str_desc(class_driver_t *driver_obj)
+static void action_get_str_desc(hid_device_t *dev_obj)
 {
-    assert(driver_obj->dev_hdl != NULL);
+    assert(dev_obj->dev_hdl != NULL);
     usb_device_info_t dev_info;
-    ESP_ERROR_CHECK(usb_host_device_info(driver_obj->dev_hdl, &dev_info));
-    UsbHostHidBridge *bdg = (UsbHostHidBridge *)driver_obj->bdg;
+    ESP_ERROR_CHECK(usb_host_device_info(dev_obj->dev_hdl, &dev_info));
+    UsbHostHidBridge *bdg = dev_obj->driver->bdg;
     if (bdg->onDeviceInfoReceived != NULL) {
-        bdg->onDeviceInfoReceived(&dev_info);
+        bdg->onDeviceInfoReceived(dev_obj->index, &dev_info);
     }
     //Claim the interface next
-    driver_obj->actions &= ~ACTION_GET_STR_DESC;
-    driver_obj->actions |= ACTION_CLAIM_INTF;
+    dev_obj->actions &= ~ACTION_GET_STR_DESC;
+    dev_obj->actions |= ACTION_CLAIM_INTF;
 }
 
-static void action_claim_interface(class_driver_t *driver_obj)
+/**
+ * Gets the report descriptor length advertised by the HID descriptor of an interface
+ * @return wDescriptorLength or 0 if not found
+ */
+static uint16_t hid_report_descriptor_length(const usb_config_desc_t *config_desc, const usb_intf_desc_t *intf, int offset)
 {
-    assert(driver_obj->dev_hdl != NULL);
+    const usb_standard_desc_t *desc = (const usb_standard_desc_t *)intf;
+    while ((desc = usb_parse_next_descriptor(desc, config_desc->wTotalLength, &offset)) != NULL) {
+        if (desc->bDescriptorType == USB_B_DESCRIPTOR_TYPE_INTERFACE) {
+            break;
+        }
+        // bLength, bDescriptorType, bcdHID, bCountryCode, bNumDescriptors, bDescriptorType, wDescriptorLength
+        const uint8_t *hid = (const uint8_t *)desc;
+        if (desc->bDescriptorType == HID_DESCRIPTOR_TYPE_HID && desc->bLength >= 9 && hid[6] == HID_DESCRIPTOR_TYPE_REPORT) {
+            return hid[7] | (hid[8] << 8);
+        }
+    }
+    return 0;
+}
+
+static void action_claim_interface(hid_device_t *dev_obj)
+{
+    assert(dev_obj->dev_hdl != NULL);
     ESP_LOGI(TAG_CLASS, "Getting config descriptor");
     const usb_config_desc_t *config_desc;
-    ESP_ERROR_CHECK(usb_host_get_active_config_descriptor(driver_obj->dev_hdl, &config_desc));
+    ESP_ERROR_CHECK(usb_host_get_active_config_descriptor(dev_obj->dev_hdl, &config_desc));
 
     bool hidIntfClaimed = false;
     int offset = 0;
@@ -173,59 +311,106 @@ static void action_claim_interface(class_driver_t *driver_obj)
                     }
                     if (ep->bEndpointAddress & 0x80) {
                         ep_in = ep;
-                        driver_obj->ep_in = (usb_ep_desc_t *)ep_in;
+                        dev_obj->ep_in = (usb_ep_desc_t *)ep_in;
                     } else {
                         ep_out = ep;
-                        driver_obj->ep_out = (usb_ep_desc_t *)ep_out;
+                        dev_obj->ep_out = (usb_ep_desc_t *)ep_out;
                     }
                 } else {
                     ESP_LOGW("", "error to parse endpoint by index; EP num: %d/%d, len: %d", i + 1, intf->bNumEndpoints, config_desc->wTotalLength);
                 }                
             }
-            esp_err_t err = usb_host_interface_claim(driver_obj->client_hdl, driver_obj->dev_hdl, n, 0);
+            esp_err_t err = usb_host_interface_claim(dev_obj->driver->client_hdl, dev_obj->dev_hdl, n, 0);
             if (err) {
                 ESP_LOGI("", "interface claim status: %d", err);
             } else {
                 ESP_LOGI(TAG_CLASS, "Claimed HID intf->bInterfaceNumber: 0x%02x \n", intf->bInterfaceNumber);
+                dev_obj->bInterfaceNumber = intf->bInterfaceNumber;
+                dev_obj->wDescriptorLength = hid_report_descriptor_length(config_desc, intf, offset);
+                if (dev_obj->wDescriptorLength == 0) {
+                    dev_obj->wDescriptorLength = REPORT_DESC_TRANSFER_SIZE;
+                }
+                ESP_LOGI(TAG_CLASS, "HID report descriptor length: %d", dev_obj->wDescriptorLength);
+                dev_obj->hid_claimed = true;
                 hidIntfClaimed = true;
             }
         }
     }
 
     //Get the HID's descriptors next
-    driver_obj->actions &= ~ACTION_CLAIM_INTF;
-    if (hidIntfClaimed)
+    dev_obj->actions &= ~ACTION_CLAIM_INTF;
+    if (hidIntfClaimed && transfer_pool_alloc(dev_obj))
     {
-        driver_obj->actions |= ACTION_TRANSFER_CTRL_GET_REPORT_DESC;
+        //Start reports along with the descriptor, a cached layout may decode them already
+        dev_obj->actions |= ACTION_TRANSFER_CTRL_GET_REPORT_DESC | ACTION_TRANSFER_INTR_GET_REPORT;
     }
+    else if (!hidIntfClaimed)
+    {
+        //Not an HID device (a hub for example), give its slot back
+        ESP_LOGI(TAG_CLASS, "No HID interface on device %d, closing it", dev_obj->dev_addr);
+        dev_obj->actions |= ACTION_CLOSE_DEV;
+    }
+}
+
+/**
+ * Fetches the report descriptor again after a failure, the delay doubles
+ * on each failure. The device is reset once the attempts are exhausted.
+ */
+static void report_descriptor_failed(hid_device_t *dev_obj)
+{
+    if (++dev_obj->desc_failures >= REPORT_DESC_RETRIES) {
+        ESP_LOGE(TAG_CLASS, "No HID report descriptor after %d attempts, resetting device %d", dev_obj->desc_failures, dev_obj->dev_addr);
+        dev_obj->desc_failures = 0;
+        dev_obj->driver->bdg->resetRequests[dev_obj->index] = true;
+        return;
+    }
+    dev_obj->desc_retry = true;
+    dev_obj->desc_retry_at = xTaskGetTickCount() + pdMS_TO_TICKS(REPORT_DESC_RETRY_MS << (dev_obj->desc_failures - 1));
+}
+
+/**
+ * Gets the number of ticks before the report descriptor is fetched again
+ * (portMAX_DELAY if no retry is pending)
+ */
+static TickType_t report_descriptor_wait(hid_device_t *dev_obj)
+{
+    if (!dev_obj->desc_retry || dev_obj->ctrl_busy) {
+        return portMAX_DELAY;
+    }
+    int32_t remaining = (int32_t)(dev_obj->desc_retry_at - xTaskGetTickCount());
+    return remaining > 0 ? (TickType_t)remaining : 0;
 }
 
 static void transfer_control_get_report_descriptor_cb(usb_transfer_t *transfer)
 {
     //This is function is called from within usb_host_client_handle_events(). Don't block and try to keep it short
-    //struct class_driver_control *class_driver_obj = (struct class_driver_control *)transfer->context;
-    class_driver_t *driver_obj = (class_driver_t *)transfer->context;
+    //struct class_driver_control *class_dev_obj = (struct class_driver_control *)transfer->context;
+    hid_device_t *dev_obj = (hid_device_t *)transfer->context;
+    dev_obj->in_flight--;
+    dev_obj->ctrl_busy = false;
+    if (transfer->status == USB_TRANSFER_STATUS_CANCELED || transfer->status == USB_TRANSFER_STATUS_NO_DEVICE) {
+        //Device closed meanwhile
+        return;
+    }
     if (transfer->status != USB_TRANSFER_STATUS_COMPLETED) {
         ESP_LOGW("", "Transfer control failed - Status %d \n", transfer->status);
+        report_descriptor_failed(dev_obj);
+        return;
     }
-    if (transfer->status == USB_TRANSFER_STATUS_COMPLETED) {
-        UsbHostHidBridge *bdg = (UsbHostHidBridge *)driver_obj->bdg;
-        if (transfer->actual_num_bytes > 0 && bdg->onHidReportDescriptorReceived != NULL) {
-            bdg->onHidReportDescriptorReceived(transfer);
-        }
-        driver_obj->actions |= ACTION_TRANSFER_INTR_GET_REPORT;
+    dev_obj->desc_failures = 0;
+    UsbHostHidBridge *bdg = dev_obj->driver->bdg;
+    if (transfer->actual_num_bytes > 0 && bdg->onHidReportDescriptorReceived != NULL) {
+        bdg->onHidReportDescriptorReceived(dev_obj->index, transfer);
     }
+    //Feature reports can be polled now the control pipe is free
+    dev_obj->reports_started = true;
+    dev_obj->actions |= ACTION_RELEASE_REPORT_DESC;
 }
 
-static void action_transfer_control_get_report_descriptor(class_driver_t *driver_obj)
+static void action_transfer_control_get_report_descriptor(hid_device_t *dev_obj)
 {
-    assert(driver_obj->dev_hdl != NULL);
-    static uint16_t mps = driver_obj->bMaxPacketSize0;
-    static uint16_t tps = usb_round_up_to_mps(2048, mps);
-    static usb_transfer_t *transfer;
-    if (!transfer) {
-        usb_host_transfer_alloc(tps, 0, &transfer);
-    }
+    assert(dev_obj->dev_hdl != NULL);
+    usb_transfer_t *transfer = dev_obj->ctrl_desc;
     usb_setup_packet_t stp;
 
     // 0x81,        // bmRequestType: Dir: D2H, Type: Standard, Recipient: Interface
@@ -236,86 +421,372 @@ static void action_transfer_control_get_report_descriptor(class_driver_t *driver
     // 0x40, 0x00,  // wLength = 64
     stp.bmRequestType = USB_BM_REQUEST_TYPE_DIR_IN | USB_BM_REQUEST_TYPE_TYPE_STANDARD | USB_BM_REQUEST_TYPE_RECIP_INTERFACE;
     stp.bRequest = USB_B_REQUEST_GET_DESCRIPTOR;
-    stp.wValue = 0x2200;
-    stp.wIndex = 0;
-    stp.wLength = tps - 8;
-    transfer->num_bytes = tps;
+    stp.wValue = HID_DESCRIPTOR_TYPE_REPORT << 8;
+    stp.wIndex = dev_obj->bInterfaceNumber;
+    stp.wLength = dev_obj->wDescriptorLength;
+    transfer->num_bytes = USB_SETUP_PACKET_SIZE + usb_round_up_to_mps(dev_obj->wDescriptorLength, dev_obj->bMaxPacketSize0);
 
     memcpy(transfer->data_buffer, &stp, USB_SETUP_PACKET_SIZE);
     transfer->bEndpointAddress = 0x00;
     ESP_LOGI("", "transfer->bEndpointAddress: 0x%02X \n", transfer->bEndpointAddress);
 
-    transfer->device_handle = driver_obj->dev_hdl;
+    transfer->device_handle = dev_obj->dev_hdl;
     transfer->callback = transfer_control_get_report_descriptor_cb;
-    transfer->context = (void *)driver_obj;
+    transfer->context = (void *)dev_obj;
     transfer->timeout_ms = 1000;
 
-    esp_err_t result = usb_host_transfer_submit_control(driver_obj->client_hdl, transfer);
+    // event queued, transfer_cb2 must be called eventually, clean actions flag
+    dev_obj->actions &= ~ACTION_TRANSFER_CTRL_GET_REPORT_DESC;
+    esp_err_t result = usb_host_transfer_submit_control(dev_obj->driver->client_hdl, transfer);
     if (result != ESP_OK) {
-        ESP_LOGW("", "attempting %s\n", esp_err_to_name(result));
+        ESP_LOGE(TAG_CLASS, "Unable to get HID report descriptor: %s", esp_err_to_name(result));
+        report_descriptor_failed(dev_obj);
     } else {
-        // event queued, transfer_cb2 must be called eventually, clean actions flag
-        driver_obj->actions &= ~ACTION_TRANSFER_CTRL_GET_REPORT_DESC;
+        dev_obj->in_flight++;
+        dev_obj->ctrl_busy = true;
     }
 }
 
+static void interrupt_get_report_submit(hid_device_t *dev_obj, usb_transfer_t *transfer);
+
 static void action_interrupt_get_report_cb(usb_transfer_t *transfer)
 {
     //This is function is called from within usb_host_client_handle_events(). Don't block and try to keep it short
-    //struct class_driver_control *class_driver_obj = (struct class_driver_control *)transfer->context;
-    class_driver_t *driver_obj = (class_driver_t *)transfer->context;
+    //struct class_driver_control *class_dev_obj = (struct class_driver_control *)transfer->context;
+    hid_device_t *dev_obj = (hid_device_t *)transfer->context;
+    dev_obj->in_flight--;
+    if (transfer->status == USB_TRANSFER_STATUS_CANCELED || transfer->status == USB_TRANSFER_STATUS_NO_DEVICE) {
+        //Endpoint flushed or device gone, it will be closed
+        return;
+    }
     if (transfer->status != USB_TRANSFER_STATUS_COMPLETED) {
         ESP_LOGW("", "Transfer failed - Status %d \n", transfer->status);
     }
     if (transfer->status == USB_TRANSFER_STATUS_COMPLETED) {
-        UsbHostHidBridge *bdg = (UsbHostHidBridge *)driver_obj->bdg;
+        UsbHostHidBridge *bdg = dev_obj->driver->bdg;
         if (transfer->actual_num_bytes > 0 && bdg->onReportReceived != NULL) {
-            bdg->onReportReceived(transfer);
+            bdg->onReportReceived(dev_obj->index, transfer);
         }
     }
-    driver_obj->actions |= ACTION_TRANSFER_INTR_GET_REPORT;
+    //Re-arm right away to not wait for the next loop pass
+    interrupt_get_report_submit(dev_obj, transfer);
+}
+
+static void interrupt_get_report_submit(hid_device_t *dev_obj, usb_transfer_t *transfer)
+{
+    transfer->num_bytes = dev_obj->ep_in->wMaxPacketSize;
+    memset(transfer->data_buffer, 0x00, transfer->num_bytes);
+    esp_err_t result = usb_host_transfer_submit(transfer);
+    if (result != ESP_OK) {
+        ESP_LOGW("", "attempting %s\n", esp_err_to_name(result));
+        dev_obj->actions = ACTION_CLOSE_DEV;
+    } else {
+        dev_obj->in_flight++;
+    }
+}
+
+static void action_interrupt_get_report(hid_device_t *dev_obj)
+{
+    assert(dev_obj->dev_hdl != NULL);
+    // completion callbacks re-arm the transfers from now on, clean actions flag
+    dev_obj->actions &= ~ACTION_TRANSFER_INTR_GET_REPORT;
+    if (dev_obj->ep_in == NULL) {
+        ESP_LOGW(TAG_CLASS, "No interrupt IN endpoint");
+        return;
+    }
+    //Keep several transfers queued so no report is lost while one is decoded
+    for (size_t i = 0; i < INTR_IN_TRANSFERS; i++) {
+        usb_transfer_t *transfer = dev_obj->intr_in[i];
+        transfer->bEndpointAddress = dev_obj->ep_in->bEndpointAddress;
+        // ESP_LOGI("", "transfer->bEndpointAddress: 0x%02X \n", transfer->bEndpointAddress);
+        transfer->device_handle = dev_obj->dev_hdl;
+        transfer->callback = action_interrupt_get_report_cb;
+        transfer->context = (void *)dev_obj;
+        transfer->timeout_ms = 1000;
+        interrupt_get_report_submit(dev_obj, transfer);
+    }
+}
+
+/**
+ * Gets the number of ticks before the next feature report must be polled
+ * (portMAX_DELAY if nothing to poll or a control transfer is in flight)
+ */
+static TickType_t feature_report_wait(hid_device_t *dev_obj)
+{
+    UsbHostHidBridge::FeatureSchedule &schedule = dev_obj->driver->bdg->featureSchedules[dev_obj->index];
+    if (!dev_obj->reports_started || dev_obj->ctrl_busy || schedule.count == 0) {
+        return portMAX_DELAY;
+    }
+    TickType_t now = xTaskGetTickCount();
+    TickType_t wait = portMAX_DELAY;
+    for (uint8_t i = 0; i < schedule.count; ++i) {
+        int32_t remaining = (int32_t)(schedule.reports[i].nextPoll - now);
+        if (remaining <= 0) {
+            return 0;
+        }
+        if ((TickType_t)remaining < wait) {
+            wait = remaining;
+        }
+    }
+    return wait;
+}
+
+static void transfer_control_get_feature_cb(usb_transfer_t *transfer)
+{
+    //This is function is called from within usb_host_client_handle_events(). Don't block and try to keep it short
+    hid_device_t *dev_obj = (hid_device_t *)transfer->context;
+    dev_obj->in_flight--;
+    dev_obj->ctrl_busy = false;
+    if (transfer->status != USB_TRANSFER_STATUS_COMPLETED) {
+        ESP_LOGD(TAG_CLASS, "GET_REPORT failed - Status %d", transfer->status);
+        return;
+    }
+    UsbHostHidBridge *bdg = dev_obj->driver->bdg;
+    if (transfer->actual_num_bytes > USB_SETUP_PACKET_SIZE && bdg->onFeatureReportReceived != NULL) {
+        bdg->onFeatureReportReceived(dev_obj->index, transfer);
+    }
 }
 
-static void action_interrupt_get_report(class_driver_t *driver_obj)
+static void action_transfer_control_get_feature(hid_device_t *dev_obj)
 {
-    assert(driver_obj->dev_hdl != NULL);
-    static uint16_t mps = driver_obj->ep_in->wMaxPacketSize;
-    // static uint16_t tps = usb_round_up_to_mps(mps, mps);
-    static usb_transfer_t *transfer;
-    if (!transfer) {
-        usb_host_transfer_alloc(mps, 0, &transfer);
-        memset(transfer->data_buffer, 0x00, mps);
+    assert(dev_obj->dev_hdl != NULL);
+    dev_obj->actions &= ~ACTION_TRANSFER_CTRL_GET_FEATURE;
+    UsbHostHidBridge::FeatureSchedule &schedule = dev_obj->driver->bdg->featureSchedules[dev_obj->index];
+
+    //Poll the most overdue report, the interrupt pipe keeps running meanwhile
+    TickType_t now = xTaskGetTickCount();
+    UsbHostHidBridge::FeatureReportSlot *slot = NULL;
+    int32_t lateness = -1;
+    for (uint8_t i = 0; i < schedule.count; ++i) {
+        int32_t late = (int32_t)(now - schedule.reports[i].nextPoll);
+        if (late > lateness) {
+            lateness = late;
+            slot = &schedule.reports[i];
+        }
+    }
+    if (slot == NULL) {
+        return;
     }
-    transfer->num_bytes = mps;
-    memset(transfer->data_buffer, 0x00, mps);
-    transfer->bEndpointAddress = driver_obj->ep_in->bEndpointAddress;
-    // ESP_LOGI("", "transfer->bEndpointAddress: 0x%02X \n", transfer->bEndpointAddress);
-    transfer->device_handle = driver_obj->dev_hdl;
-    transfer->callback = action_interrupt_get_report_cb;
-    transfer->context = (void *)driver_obj;
+    slot->nextPoll = now + slot->interval;
+
+    uint16_t mps = dev_obj->bMaxPacketSize0;
+    usb_transfer_t *transfer = dev_obj->ctrl;
+    usb_setup_packet_t stp;
+    stp.bmRequestType = USB_BM_REQUEST_TYPE_DIR_IN | USB_BM_REQUEST_TYPE_TYPE_CLASS | USB_BM_REQUEST_TYPE_RECIP_INTERFACE;
+    stp.bRequest = HID_CLASS_REQUEST_GET_REPORT;
+    stp.wValue = (slot->reportType << 8) | slot->reportId;
+    stp.wIndex = dev_obj->bInterfaceNumber;
+    stp.wLength = slot->length;
+    transfer->num_bytes = USB_SETUP_PACKET_SIZE + usb_round_up_to_mps(slot->length, mps);
+
+    memcpy(transfer->data_buffer, &stp, USB_SETUP_PACKET_SIZE);
+    transfer->bEndpointAddress = 0x00;
+    transfer->device_handle = dev_obj->dev_hdl;
+    transfer->callback = transfer_control_get_feature_cb;
+    transfer->context = (void *)dev_obj;
     transfer->timeout_ms = 1000;
 
-    esp_err_t result = usb_host_transfer_submit(transfer);
+    esp_err_t result = usb_host_transfer_submit_control(dev_obj->driver->client_hdl, transfer);
     if (result != ESP_OK) {
-        ESP_LOGW("", "attempting %s\n", esp_err_to_name(result));
-        driver_obj->actions = ACTION_CLOSE_DEV;
+        ESP_LOGW(TAG_CLASS, "GET_REPORT(%d) 0x%02x not submitted: %s", slot->reportType, slot->reportId, esp_err_to_name(result));
+    } else {
+        dev_obj->in_flight++;
+        dev_obj->ctrl_busy = true;
+    }
+}
+
+/**
+ * Checks if a report write is requested and the pipes are free
+ */
+static bool set_report_ready(hid_device_t *dev_obj)
+{
+    return dev_obj->reports_started && !dev_obj->ctrl_busy && !dev_obj->out_busy &&
+            dev_obj->driver->bdg->setReportRequests[dev_obj->index].load();
+}
+
+static void transfer_set_report_cb(usb_transfer_t *transfer)
+{
+    //This is function is called from within usb_host_client_handle_events(). Don't block and try to keep it short
+    hid_device_t *dev_obj = (hid_device_t *)transfer->context;
+    dev_obj->in_flight--;
+    if (transfer == dev_obj->intr_out) {
+        dev_obj->out_busy = false;
     } else {
-        // event queued, transfer_cb2 must be called eventually, clean actions flag
-        driver_obj->actions &= ~ACTION_TRANSFER_INTR_GET_REPORT;
+        dev_obj->ctrl_busy = false;
     }
+    if (transfer->status != USB_TRANSFER_STATUS_COMPLETED) {
+        ESP_LOGW(TAG_CLASS, "SET_REPORT failed - Status %d", transfer->status);
+        return;
+    }
+    if (transfer != dev_obj->intr_out) {
+        //Read a written feature report back at once
+        const usb_setup_packet_t *stp = (const usb_setup_packet_t *)transfer->data_buffer;
+        if ((stp->wValue >> 8) == HID_REPORT_TYPE_FEATURE) {
+            UsbHostHidBridge::FeatureSchedule &schedule = dev_obj->driver->bdg->featureSchedules[dev_obj->index];
+            for (uint8_t i = 0; i < schedule.count; ++i) {
+                if ((schedule.reports[i].reportType == HID_REPORT_TYPE_FEATURE) && (schedule.reports[i].reportId == (stp->wValue & 0xFF))) {
+                    schedule.reports[i].nextPoll = xTaskGetTickCount();
+                }
+            }
+        }
+    }
+}
+
+static void action_transfer_set_report(hid_device_t *dev_obj)
+{
+    assert(dev_obj->dev_hdl != NULL);
+    dev_obj->actions &= ~ACTION_TRANSFER_SET_REPORT;
+    UsbHostHidBridge *bdg = dev_obj->driver->bdg;
+    bdg->setReportRequests[dev_obj->index] = false;
+    uint8_t data[FEATURE_REPORT_MAX_SIZE];
+    uint8_t reportType = 0;
+    uint16_t length = sizeof(data);
+    if (bdg->onSetReportRequired == NULL || !bdg->onSetReportRequired(dev_obj->index, &reportType, data, &length) || length == 0) {
+        return;
+    }
+    //More commands may be queued, ask again once this one is sent
+    bdg->setReportRequests[dev_obj->index] = true;
+    uint8_t reportId = data[0];
+    const uint8_t *report = data;
+    if (reportId == 0) {
+        //No report ID on the wire
+        report++;
+        length--;
+    }
+
+    esp_err_t result;
+    usb_transfer_t *transfer;
+    if (reportType == HID_REPORT_TYPE_OUTPUT && dev_obj->intr_out != NULL && length <= dev_obj->ep_out->wMaxPacketSize) {
+        transfer = dev_obj->intr_out;
+        memcpy(transfer->data_buffer, report, length);
+        transfer->num_bytes = length;
+        transfer->bEndpointAddress = dev_obj->ep_out->bEndpointAddress;
+    } else {
+        //Feature reports, or no interrupt OUT endpoint (7.2.2 of HID 1.11 spec)
+        transfer = dev_obj->ctrl;
+        usb_setup_packet_t stp;
+        stp.bmRequestType = USB_BM_REQUEST_TYPE_DIR_OUT | USB_BM_REQUEST_TYPE_TYPE_CLASS | USB_BM_REQUEST_TYPE_RECIP_INTERFACE;
+        stp.bRequest = HID_CLASS_REQUEST_SET_REPORT;
+        stp.wValue = (reportType << 8) | reportId;
+        stp.wIndex = dev_obj->bInterfaceNumber;
+        stp.wLength = length;
+        memcpy(transfer->data_buffer, &stp, USB_SETUP_PACKET_SIZE);
+        memcpy(transfer->data_buffer + USB_SETUP_PACKET_SIZE, report, length);
+        transfer->num_bytes = USB_SETUP_PACKET_SIZE + length;
+        transfer->bEndpointAddress = 0x00;
+    }
+    transfer->device_handle = dev_obj->dev_hdl;
+    transfer->callback = transfer_set_report_cb;
+    transfer->context = (void *)dev_obj;
+    transfer->timeout_ms = 1000;
+    if (transfer == dev_obj->intr_out) {
+        result = usb_host_transfer_submit(transfer);
+    } else {
+        result = usb_host_transfer_submit_control(dev_obj->driver->client_hdl, transfer);
+    }
+    if (result != ESP_OK) {
+        ESP_LOGW(TAG_CLASS, "SET_REPORT 0x%02x not submitted: %s", reportId, esp_err_to_name(result));
+    } else {
+        dev_obj->in_flight++;
+        if (transfer == dev_obj->intr_out) {
+            dev_obj->out_busy = true;
+        } else {
+            dev_obj->ctrl_busy = true;
+        }
+    }
+}
+
+/**
+ * Checks if an idle rate is requested and the control pipe is free
+ */
+static bool set_idle_ready(hid_device_t *dev_obj)
+{
+    return dev_obj->reports_started && !dev_obj->ctrl_busy &&
+            dev_obj->driver->bdg->idleRequests[dev_obj->index].load() >= 0;
 }
 
-static void action_close_dev(class_driver_t *driver_obj)
+/**
+ * Sends a SET_IDLE again after a failure other than a STALL (timeout, bus error)
+ * unless a newer duration is requested, up to SET_IDLE_RETRIES attempts
+ */
+static void set_idle_failed(hid_device_t *dev_obj, uint8_t duration)
+{
+    if (++dev_obj->idle_failures >= SET_IDLE_RETRIES) {
+        ESP_LOGW(TAG_CLASS, "SET_IDLE %d failed %d times, device %d keeps its rate", duration, dev_obj->idle_failures, dev_obj->dev_addr);
+        dev_obj->idle_failures = 0;
+        return;
+    }
+    int16_t none = -1;
+    dev_obj->driver->bdg->idleRequests[dev_obj->index].compare_exchange_strong(none, duration);
+}
+
+static void transfer_set_idle_cb(usb_transfer_t *transfer)
+{
+    //This is function is called from within usb_host_client_handle_events(). Don't block and try to keep it short
+    hid_device_t *dev_obj = (hid_device_t *)transfer->context;
+    dev_obj->in_flight--;
+    dev_obj->ctrl_busy = false;
+    if (transfer->status == USB_TRANSFER_STATUS_CANCELED || transfer->status == USB_TRANSFER_STATUS_NO_DEVICE) {
+        return;
+    }
+    const usb_setup_packet_t *stp = (const usb_setup_packet_t *)transfer->data_buffer;
+    uint8_t duration = stp->wValue >> 8;
+    if (transfer->status != USB_TRANSFER_STATUS_COMPLETED && transfer->status != USB_TRANSFER_STATUS_STALL) {
+        ESP_LOGW(TAG_CLASS, "SET_IDLE failed - Status %d", transfer->status);
+        set_idle_failed(dev_obj, duration);
+        return;
+    }
+    dev_obj->idle_failures = 0;
+    UsbHostHidBridge *bdg = dev_obj->driver->bdg;
+    if (bdg->onSetIdleDone != NULL) {
+        //Only a STALL tells the request is not supported
+        bdg->onSetIdleDone(dev_obj->index, duration, transfer->status == USB_TRANSFER_STATUS_COMPLETED);
+    }
+}
+
+static void action_transfer_set_idle(hid_device_t *dev_obj)
+{
+    assert(dev_obj->dev_hdl != NULL);
+    dev_obj->actions &= ~ACTION_TRANSFER_SET_IDLE;
+    int16_t duration = dev_obj->driver->bdg->idleRequests[dev_obj->index].exchange(-1);
+    if (duration < 0) {
+        return;
+    }
+    usb_transfer_t *transfer = dev_obj->ctrl;
+    usb_setup_packet_t stp;
+    stp.bmRequestType = USB_BM_REQUEST_TYPE_DIR_OUT | USB_BM_REQUEST_TYPE_TYPE_CLASS | USB_BM_REQUEST_TYPE_RECIP_INTERFACE;
+    stp.bRequest = HID_CLASS_REQUEST_SET_IDLE;
+    stp.wValue = duration << 8;     // all report IDs
+    stp.wIndex = dev_obj->bInterfaceNumber;
+    stp.wLength = 0;
+    memcpy(transfer->data_buffer, &stp, USB_SETUP_PACKET_SIZE);
+    transfer->num_bytes = USB_SETUP_PACKET_SIZE;
+    transfer->bEndpointAddress = 0x00;
+    transfer->device_handle = dev_obj->dev_hdl;
+    transfer->callback = transfer_set_idle_cb;
+    transfer->context = (void *)dev_obj;
+    transfer->timeout_ms = 1000;
+    esp_err_t result = usb_host_transfer_submit_control(dev_obj->driver->client_hdl, transfer);
+    if (result != ESP_OK) {
+        ESP_LOGW(TAG_CLASS, "SET_IDLE not submitted: %s", esp_err_to_name(result));
+        set_idle_failed(dev_obj, duration);
+    } else {
+        dev_obj->in_flight++;
+        dev_obj->ctrl_busy = true;
+    }
+}
+
+static void action_close_dev(hid_device_t *dev_obj)
 {
     const usb_config_desc_t *config_desc;
-    ESP_ERROR_CHECK(usb_host_get_active_config_descriptor(driver_obj->dev_hdl, &config_desc));
+    ESP_ERROR_CHECK(usb_host_get_active_config_descriptor(dev_obj->dev_hdl, &config_desc));
     
     int offset = 0;
     for (size_t n = 0; n < config_desc->bNumInterfaces; n++)
     {
         const usb_intf_desc_t *intf = usb_parse_interface_descriptor(config_desc, n, 0, &offset);
         ESP_LOGI(TAG_CLASS, "\nReleasing intf->bInterfaceNumber: 0x%02x \n", intf->bInterfaceNumber);
-        if (intf->bInterfaceClass == 0x03) // HID - https://www.usb.org/defined-class-codes
+        if (dev_obj->hid_claimed && intf->bInterfaceClass == 0x03) // HID - https://www.usb.org/defined-class-codes
         {
             ESP_LOGI(TAG_CLASS, "\nReleasing HID intf->bInterfaceClass: 0x%02x \n", intf->bInterfaceClass);
             const usb_ep_desc_t *ep_in = NULL;
@@ -332,26 +803,123 @@ static void action_close_dev(class_driver_t *driver_obj)
                     }
                     ESP_LOGI(TAG_CLASS, "\t > Halting EP num: %d/%d, len: %d, ", i + 1, intf->bNumEndpoints, config_desc->wTotalLength);
                     ESP_LOGI(TAG_CLASS, "\t   address: 0x%02x, EP max size: %d, dir: %s\n", ep->bEndpointAddress, ep->wMaxPacketSize, (ep->bEndpointAddress & 0x80) ? "IN" : "OUT");
-                    ESP_ERROR_CHECK(usb_host_endpoint_halt(driver_obj->dev_hdl, ep->bEndpointAddress));
-                    ESP_ERROR_CHECK(usb_host_endpoint_flush(driver_obj->dev_hdl, ep->bEndpointAddress));
-                    UsbHostHidBridge *bdg = (UsbHostHidBridge *)driver_obj->bdg;
-                    if (bdg->onDeviceRemoved != NULL) {
-                        bdg->onDeviceRemoved();
-                    }
+                    ESP_ERROR_CHECK(usb_host_endpoint_halt(dev_obj->dev_hdl, ep->bEndpointAddress));
+                    ESP_ERROR_CHECK(usb_host_endpoint_flush(dev_obj->dev_hdl, ep->bEndpointAddress));
                 }
             }
-            ESP_ERROR_CHECK(usb_host_interface_release(driver_obj->client_hdl, driver_obj->dev_hdl, n));
+            ESP_ERROR_CHECK(usb_host_interface_release(dev_obj->driver->client_hdl, dev_obj->dev_hdl, n));
         }
     }
 
-    ESP_ERROR_CHECK(usb_host_device_close(driver_obj->client_hdl, driver_obj->dev_hdl));
-    driver_obj->dev_hdl = NULL;
-    driver_obj->dev_addr = 0;
+    UsbHostHidBridge *bdg = dev_obj->driver->bdg;
+    if (dev_obj->hid_claimed && bdg->onDeviceRemoved != NULL) {
+        bdg->onDeviceRemoved(dev_obj->index);
+    }
+
+    ESP_ERROR_CHECK(usb_host_device_close(dev_obj->driver->client_hdl, dev_obj->dev_hdl));
+    dev_obj->dev_hdl = NULL;
+    if (!dev_obj->reopen) {
+        dev_obj->dev_addr = 0;
+    }
+    dev_obj->ep_in = NULL;
+    dev_obj->ep_out = NULL;
+    dev_obj->reports_started = false;
+    dev_obj->desc_failures = 0;
+    dev_obj->desc_retry = false;
+    dev_obj->idle_failures = 0;
+    dev_obj->ctrl_busy = false;
+    dev_obj->out_busy = false;
+    dev_obj->hid_claimed = false;
+    bdg->clearFeatureReports(dev_obj->index);
+    bdg->setReportRequests[dev_obj->index] = false;
+    bdg->idleRequests[dev_obj->index] = -1;
+    bdg->resetRequests[dev_obj->index] = false;
     
-    // driver_obj->actions &= ~ACTION_CLOSE_DEV;
-    // driver_obj->actions &= ~ACTION_TRANSFER_INTR_GET_REPORT;
+    // dev_obj->actions &= ~ACTION_CLOSE_DEV;
+    // dev_obj->actions &= ~ACTION_TRANSFER_INTR_GET_REPORT;
     //Reinit actions
-    driver_obj->actions = 0;
+    dev_obj->actions = 0;
+}
+
+/**
+ * Checks if a reset of the opened device is requested
+ */
+static bool reset_ready(hid_device_t *dev_obj)
+{
+    return dev_obj->dev_hdl != NULL && dev_obj->driver->bdg->resetRequests[dev_obj->index].load();
+}
+
+static void device_handle_actions(hid_device_t *dev_obj)
+{
+    if (reset_ready(dev_obj)) {
+        //Cancel any other actions, the device is opened again once its transfers are back
+        ESP_LOGW(TAG_CLASS, "Resetting device at address %d", dev_obj->dev_addr);
+        dev_obj->driver->bdg->resetRequests[dev_obj->index] = false;
+        dev_obj->reopen = true;
+        dev_obj->actions = ACTION_CLOSE_DEV;
+    }
+    if (report_descriptor_wait(dev_obj) == 0) {
+        dev_obj->desc_retry = false;
+        dev_obj->actions |= ACTION_TRANSFER_CTRL_GET_REPORT_DESC;
+    }
+    //Commands and the idle rate go before the polls sharing the control pipe
+    if (set_report_ready(dev_obj)) {
+        dev_obj->actions |= ACTION_TRANSFER_SET_REPORT;
+    } else if (set_idle_ready(dev_obj)) {
+        dev_obj->actions |= ACTION_TRANSFER_SET_IDLE;
+    } else if (feature_report_wait(dev_obj) == 0) {
+        dev_obj->actions |= ACTION_TRANSFER_CTRL_GET_FEATURE;
+    }
+    if (dev_obj->actions & ACTION_OPEN_DEV) {
+        action_open_dev(dev_obj);
+    }
+    if (dev_obj->actions & ACTION_GET_DEV_INFO) {
+        action_get_info(dev_obj);
+    }
+    if (dev_obj->actions & ACTION_GET_DEV_DESC) {
+        action_get_dev_desc(dev_obj);
+    }
+    if (dev_obj->actions & ACTION_GET_CONFIG_DESC) {
+        action_get_config_desc(dev_obj);
+    }
+    if (dev_obj->actions & ACTION_GET_STR_DESC) {
+        action_get_str_desc(dev_obj);
+    }
+    if (dev_obj->actions & ACTION_CLAIM_INTF) {
+        action_claim_interface(dev_obj);
+    }
+    if (dev_obj->actions & ACTION_TRANSFER_CTRL_GET_REPORT_DESC) {
+        action_transfer_control_get_report_descriptor(dev_obj);
+    }
+    if (dev_obj->actions & ACTION_TRANSFER_INTR_GET_REPORT) {
+        action_interrupt_get_report(dev_obj);
+    }
+    if (dev_obj->actions & ACTION_TRANSFER_SET_REPORT) {
+        action_transfer_set_report(dev_obj);
+    }
+    if (dev_obj->actions & ACTION_TRANSFER_SET_IDLE) {
+        action_transfer_set_idle(dev_obj);
+    }
+    if (dev_obj->actions & ACTION_TRANSFER_CTRL_GET_FEATURE) {
+        action_transfer_control_get_feature(dev_obj);
+    }
+    if (dev_obj->actions & ACTION_RELEASE_REPORT_DESC) {
+        //Report descriptor is received, its buffer is not needed anymore
+        dev_obj->actions &= ~ACTION_RELEASE_REPORT_DESC;
+        transfer_free(&dev_obj->ctrl_desc);
+    }
+    if (dev_obj->actions & ACTION_CLOSE_DEV) {
+        action_close_dev(dev_obj);
+    }
+    if (dev_obj->dev_hdl == NULL && dev_obj->in_flight == 0) {
+        //Cancelled transfers are all back, release the device pool
+        transfer_pool_free(dev_obj);
+        if (dev_obj->reopen) {
+            //Enumerate the device again from its address
+            dev_obj->reopen = false;
+            dev_obj->actions |= ACTION_OPEN_DEV;
+        }
+    }
 }
 
 static void usb_class_driver_task(void *pvParameters)
@@ -375,41 +943,36 @@ static void usb_class_driver_task(void *pvParameters)
     };
     ESP_ERROR_CHECK(usb_host_client_register(&client_config, &driver_obj.client_hdl));
     driver_obj.bdg = bdg;
+    for (size_t i = 0; i < USB_HOST_MAX_DEVICES; i++) {
+        driver_obj.devices[i].index = i;
+        driver_obj.devices[i].driver = &driver_obj;
+    }
     bdg->driver_ptr = &driver_obj;
 
     while (1) {
-        if (driver_obj.actions == 0) {
-            usb_host_client_handle_events(driver_obj.client_hdl, portMAX_DELAY);
-        } else {
-            if (driver_obj.actions & ACTION_OPEN_DEV) {
-                action_open_dev(&driver_obj);
-            }
-            if (driver_obj.actions & ACTION_GET_DEV_INFO) {
-                action_get_info(&driver_obj);
-            }
-            if (driver_obj.actions & ACTION_GET_DEV_DESC) {
-                action_get_dev_desc(&driver_obj);
-            }
-            if (driver_obj.actions & ACTION_GET_CONFIG_DESC) {
-                action_get_config_desc(&driver_obj);
-            }
-            if (driver_obj.actions & ACTION_GET_STR_DESC) {
-                action_get_str_desc(&driver_obj);
+        //Sleep until a client event, a transfer completion, a command or the next feature report
+        //Transfer callbacks run in here and queue the next actions
+        bool pending = false;
+        TickType_t wait = portMAX_DELAY;
+        for (size_t i = 0; i < USB_HOST_MAX_DEVICES; i++) {
+            pending |= (driver_obj.devices[i].actions != 0) || set_report_ready(&driver_obj.devices[i]) ||
+                        set_idle_ready(&driver_obj.devices[i]) || reset_ready(&driver_obj.devices[i]) ||
+                        driver_obj.devices[i].reopen;
+            TickType_t deviceWait = feature_report_wait(&driver_obj.devices[i]);
+            if (deviceWait < wait) {
+                wait = deviceWait;
             }
-            if (driver_obj.actions & ACTION_CLAIM_INTF) {
-                action_claim_interface(&driver_obj);
+            deviceWait = report_descriptor_wait(&driver_obj.devices[i]);
+            if (deviceWait < wait) {
+                wait = deviceWait;
             }
-            if (driver_obj.actions & ACTION_TRANSFER_CTRL_GET_REPORT_DESC) {
-                action_transfer_control_get_report_descriptor(&driver_obj);
-            }
-            if (driver_obj.actions & ACTION_TRANSFER_INTR_GET_REPORT) {
-                action_interrupt_get_report(&driver_obj);
-            }
-            if (driver_obj.actions & ACTION_CLOSE_DEV) {
-                action_close_dev(&driver_obj);
-            }            
         }
-        vTaskDelay(CLASS_TASK_LOOP_DELAY);
+        usb_host_client_handle_events(driver_obj.client_hdl, pending ? 0 : wait);
+
+        //Service every device, their transfers run concurrently
+        for (size_t i = 0; i < USB_HOST_MAX_DEVICES; i++) {
+            device_handle_actions(&driver_obj.devices[i]);
+        }
     } // end main loop
 
     ESP_LOGI(TAG_CLASS, "Deregistering Client");
@@ -445,7 +1008,6 @@ static void usb_host_lib_daemon_task(void *pvParameters)
         if (event_flags & USB_HOST_LIB_EVENT_FLAGS_ALL_FREE) {
             has_devices = false;
         }
-        vTaskDelay(DAEMON_TASK_LOOP_DELAY);
     } // end main loop
     ESP_LOGI(TAG_DAEMON, "No more clients and devices");
 
@@ -461,8 +1023,18 @@ UsbHostHidBridge::UsbHostHidBridge() :
     onDeviceInfoReceived( NULL ),
     onHidReportDescriptorReceived( NULL ),
     onReportReceived( NULL ),
-    onDeviceRemoved( NULL )
+    onDeviceRemoved( NULL ),
+    onFeatureReportReceived( NULL ),
+    onDeviceDescriptorReceived( NULL ),
+    onSetReportRequired( NULL ),
+    onSetIdleDone( NULL )
 {
+    for (size_t i = 0; i < USB_HOST_MAX_DEVICES; i++) {
+        featureSchedules[i].count = 0;
+        setReportRequests[i] = false;
+        idleRequests[i] = -1;
+        resetRequests[i] = false;
+    }
 }
 
 UsbHostHidBridge::~UsbHostHidBridge()
@@ -471,6 +1043,9 @@ UsbHostHidBridge::~UsbHostHidBridge()
 
 void UsbHostHidBridge::begin()
 {
+#if !defined(CONFIG_USB_HOST_HUBS_SUPPORTED)
+    ESP_LOGW(TAG_CLASS, "USB host built without hub support, only one UPS is handled (see custom_sdkconfig)");
+#endif
     //Create usb host lib daemon task
     xTaskCreatePinnedToCore(
         usb_host_lib_daemon_task,           /* Task function. */
@@ -494,8 +1069,40 @@ void UsbHostHidBridge::begin()
     vTaskDelay(500); //Add a short delay to let the tasks run
 }
 
+void UsbHostHidBridge::requestSetReport(uint8_t device)
+{
+    setReportRequests[device] = true;
+    class_driver_t *driver = (class_driver_t *)driver_ptr;
+    if (driver != NULL) {
+        //Wake the class driver task up
+        usb_host_client_unblock(driver->client_hdl);
+    }
+}
+
+void UsbHostHidBridge::requestSetIdle(uint8_t device, uint8_t duration)
+{
+    idleRequests[device] = duration;
+    class_driver_t *driver = (class_driver_t *)driver_ptr;
+    if (driver != NULL) {
+        //Wake the class driver task up
+        usb_host_client_unblock(driver->client_hdl);
+    }
+}
+
+void UsbHostHidBridge::requestReset(uint8_t device)
+{
+    resetRequests[device] = true;
+    class_driver_t *driver = (class_driver_t *)driver_ptr;
+    if (driver != NULL) {
+        //Wake the class driver task up
+        usb_host_client_unblock(driver->client_hdl);
+    }
+}
+
 void UsbHostHidBridge::end()
 {
     vTaskDelete(_class_driver_task_hdl);
     vTaskDelete(_daemon_task_hdl);
 }
+
+#endif
@@ -18,6 +18,7 @@
 #define ESP32_USB_HID_HOST_BRIDGE_H
 
 #include <Arduino.h>
+#include <atomic>
 #include <functional>
 #include <stdlib.h>
 #include <string.h>
@@ -43,11 +44,14 @@
 #if !defined(CLASS_TASK_COREID)
      #define CLASS_TASK_COREID        0
 #endif
-#if !defined(CLASS_TASK_LOOP_DELAY)
-     #define CLASS_TASK_LOOP_DELAY    5
-#endif
 
 #define CLIENT_NUM_EVENT_MSG    5  // usb_host_client_config_t.max_num_event_msg
+#if !defined(USB_HOST_MAX_DEVICES)
+     #define USB_HOST_MAX_DEVICES     4  // HID devices handled at once (behind a hub, needs CONFIG_USB_HOST_HUBS_SUPPORTED)
+#endif
+
+#define FEATURE_REPORT_SLOTS        64  // Number of feature reports the scheduler can poll
+#define FEATURE_REPORT_MAX_SIZE     64  // Largest feature report fetched (report ID included)
 
 class UsbHostHidBridge
 {
@@ -59,11 +63,85 @@ public:
     void end();
     bool hostInstalled;
     void* driver_ptr;
-    void (*onConfigDescriptorReceived)(const usb_config_desc_t *config_desc);
-    void (*onDeviceInfoReceived)(usb_device_info_t *dev_info);
-    void (*onHidReportDescriptorReceived)(usb_transfer_t *transfer);
-    void (*onReportReceived)(usb_transfer_t *transfer);
-    void (*onDeviceRemoved)();
+    // callbacks get the index of the device in the device table
+    void (*onConfigDescriptorReceived)(uint8_t device, const usb_config_desc_t *config_desc);
+    void (*onDeviceInfoReceived)(uint8_t device, usb_device_info_t *dev_info);
+    void (*onHidReportDescriptorReceived)(uint8_t device, usb_transfer_t *transfer);
+    void (*onReportReceived)(uint8_t device, usb_transfer_t *transfer);
+    void (*onDeviceRemoved)(uint8_t device);
+    void (*onFeatureReportReceived)(uint8_t device, usb_transfer_t *transfer);
+    void (*onDeviceDescriptorReceived)(uint8_t device, const usb_device_desc_t *dev_desc);
+    // fills the next report to write (report ID first), returns false when there is none
+    bool (*onSetReportRequired)(uint8_t device, uint8_t *reportType, uint8_t *data, uint16_t *length);
+    // SET_IDLE answered, accepted is false when the device stalled it (the request is optional)
+    void (*onSetIdleDone)(uint8_t device, uint8_t duration, bool accepted);
+
+    /**
+     * Polls a report with GET_REPORT control transfers, answered through
+     * onFeatureReportReceived (the setup packet tells the report type)
+     * Requests for the same report are merged in one transfer, keeping
+     * the shortest interval and the largest length.
+     * Must be called from the bridge callbacks (class driver task)
+     * @param device Device index
+     * @param reportType HID report type (3 for Feature, 1 to read an Input report back)
+     * @param reportId Report ID
+     * @param length Report length in bytes (report ID included)
+     * @param intervalMs Refresh interval in milliseconds
+     */
+    void scheduleFeatureReport(uint8_t device, uint8_t reportType, uint8_t reportId, uint16_t length, uint32_t intervalMs);
+
+    /**
+     * Stops polling all feature reports of a device
+     * @param device Device index
+     */
+    void clearFeatureReports(uint8_t device);
+
+    /**
+     * Feature report polled by the scheduler
+     */
+    struct FeatureReportSlot {
+        uint8_t reportType;
+        uint8_t reportId;
+        uint16_t length;
+        TickType_t interval;
+        TickType_t nextPoll;
+    };
+    struct FeatureSchedule {
+        FeatureReportSlot reports[FEATURE_REPORT_SLOTS];
+        uint8_t count;
+    };
+    FeatureSchedule featureSchedules[USB_HOST_MAX_DEVICES];
+
+    /**
+     * Asks for onSetReportRequired to be called until it returns false
+     * Reports are written one at a time ahead of the feature polls,
+     * with SET_REPORT or the interrupt OUT endpoint for output reports.
+     * Can be called from any task
+     * @param device Device index
+     */
+    void requestSetReport(uint8_t device);
+    std::atomic<bool> setReportRequests[USB_HOST_MAX_DEVICES];
+
+    /**
+     * Sets the Input report rate with a SET_IDLE request (7.2.4 of HID 1.11 spec)
+     * Sent ahead of the feature polls, only the last requested duration is sent.
+     * Failures other than a STALL are retried a few times.
+     * Can be called from any task
+     * @param device Device index
+     * @param duration Idle duration in 4 ms units (0 reports only on change)
+     */
+    void requestSetIdle(uint8_t device, uint8_t duration);
+    std::atomic<int16_t> idleRequests[USB_HOST_MAX_DEVICES];   // Duration to send (-1 if none)
+
+    /**
+     * Closes the device and opens it again (enumeration of the class driver)
+     * The interface is released and claimed again, its descriptors and
+     * report descriptor are read again and the transfers restarted.
+     * Can be called from any task
+     * @param device Device index
+     */
+    void requestReset(uint8_t device);
+    std::atomic<bool> resetRequests[USB_HOST_MAX_DEVICES];
 
 protected:
 
@@ -0,0 +1,48 @@
+/****************************************************************************************************************************
+  usb_host_hid_schedule.cpp
+  Feature report scheduler of the USB HID bridge
+
+  No USB host API here, the native build shares it with the target
+ *****************************************************************************************************************************/
+
+#include "usb_host_hid_bridge.h"
+
+static const char *TAG_CLASS = "CLASS";
+
+void UsbHostHidBridge::scheduleFeatureReport(uint8_t device, uint8_t reportType, uint8_t reportId, uint16_t length, uint32_t intervalMs)
+{
+    TickType_t interval = pdMS_TO_TICKS(intervalMs);
+    if (length > FEATURE_REPORT_MAX_SIZE) {
+        ESP_LOGW(TAG_CLASS, "Feature report 0x%02x truncated to %d bytes", reportId, FEATURE_REPORT_MAX_SIZE);
+        length = FEATURE_REPORT_MAX_SIZE;
+    }
+    FeatureSchedule &schedule = featureSchedules[device];
+    for (uint8_t i = 0; i < schedule.count; ++i) {
+        FeatureReportSlot &slot = schedule.reports[i];
+        if ((slot.reportType == reportType) && (slot.reportId == reportId)) {
+            //Merge with the already scheduled report
+            if (length > slot.length) {
+                slot.length = length;
+            }
+            if (interval < slot.interval) {
+                slot.interval = interval;
+            }
+            return;
+        }
+    }
+    if (schedule.count >= FEATURE_REPORT_SLOTS) {
+        ESP_LOGW(TAG_CLASS, "No slot left to poll feature report 0x%02x", reportId);
+        return;
+    }
+    FeatureReportSlot &slot = schedule.reports[schedule.count++];
+    slot.reportType = reportType;
+    slot.reportId = reportId;
+    slot.length = length;
+    slot.interval = interval;
+    slot.nextPoll = xTaskGetTickCount();    //Poll once as soon as possible
+}
+
+void UsbHostHidBridge::clearFeatureReports(uint8_t device)
+{
+    featureSchedules[device].count = 0;
+}
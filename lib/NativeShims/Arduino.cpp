@@ -0,0 +1,56 @@
+#include <Arduino.h>
+#include <chrono>
+#include <thread>
+#include <map>
+#include <mutex>
+
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+static std::map<uint8_t, int> pinLevels;
+static std::mutex pinMutex;
+
+unsigned long millis()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+unsigned long micros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void delay(unsigned long ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+int digitalRead(uint8_t pin)
+{
+    std::lock_guard<std::mutex> lock(pinMutex);
+    auto it = pinLevels.find(pin);
+    return it == pinLevels.end() ? HIGH : it->second;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+    nativeSetPin(pin, val);
+}
+
+void nativeSetPin(uint8_t pin, int val)
+{
+    std::lock_guard<std::mutex> lock(pinMutex);
+    pinLevels[pin] = val;
+}
+
+bool psramFound()
+{
+    return true;
+}
+
+void* ps_malloc(size_t size)
+{
+    return malloc(size);
+}
@@ -0,0 +1,62 @@
+/*
+**    This software license is not yet defined.
+**
+*/
+#ifndef _NATIVE_ARDUINO_H__
+#define _NATIVE_ARDUINO_H__
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <FreeRTOS.h>
+#include <esp_log.h>
+
+//Host replacement of the Arduino core, only what the firmware uses
+
+#define LOW     0
+#define HIGH    1
+#define INPUT   0x01
+#define OUTPUT  0x03
+
+typedef std::string String;
+
+/**
+ * Milliseconds since the program started
+ */
+unsigned long millis();
+
+/**
+ * Microseconds since the program started
+ */
+unsigned long micros();
+
+/**
+ * Sleeps the calling thread
+ * @param ms Time to sleep in milliseconds
+ */
+void delay(unsigned long ms);
+
+void pinMode(uint8_t pin, uint8_t mode);
+
+/**
+ * Reads a GPIO, pins are released (HIGH) on the host
+ * unless changed with nativeSetPin
+ */
+int digitalRead(uint8_t pin);
+
+void digitalWrite(uint8_t pin, uint8_t val);
+
+/**
+ * Sets the level returned by digitalRead (host only)
+ */
+void nativeSetPin(uint8_t pin, int val);
+
+/**
+ * PSRAM is found on the host, it is the ordinary heap
+ */
+bool psramFound();
+
+void* ps_malloc(size_t size);
+
+#endif
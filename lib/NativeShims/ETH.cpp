@@ -0,0 +1,34 @@
+#include <ETH.h>
+
+ETHClass ETH;
+
+static const uint8_t NATIVE_MAC[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+void ETHClass::macAddress(uint8_t* mac)
+{
+    memcpy(mac, NATIVE_MAC, sizeof(NATIVE_MAC));
+}
+
+String ETHClass::macAddress()
+{
+    char str[18];
+    snprintf(str, sizeof(str), "%02X:%02X:%02X:%02X:%02X:%02X",
+        NATIVE_MAC[0], NATIVE_MAC[1], NATIVE_MAC[2], NATIVE_MAC[3], NATIVE_MAC[4], NATIVE_MAC[5]);
+    return str;
+}
+
+bool ETHClass::setHostname(const char* hostname)
+{
+    hostname_ = hostname;
+    return true;
+}
+
+const char* ETHClass::getHostname()
+{
+    return hostname_.c_str();
+}
+
+IPAddress ETHClass::localIP()
+{
+    return IPAddress(127, 0, 0, 1);
+}
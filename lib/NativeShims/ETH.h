@@ -0,0 +1,31 @@
+/*
+**    This software license is not yet defined.
+**
+*/
+#ifndef _NATIVE_ETH_H__
+#define _NATIVE_ETH_H__
+#include <Arduino.h>
+#include <IPAddress.h>
+
+/**
+ * Host replacement of the Ethernet interface
+ * The MAC address is fixed (locally administered)
+ */
+class ETHClass {
+public:
+    ETHClass() = default;
+    ~ETHClass() = default;
+
+    void macAddress(uint8_t* mac);
+    String macAddress();
+    bool setHostname(const char* hostname);
+    const char* getHostname();
+    IPAddress localIP();
+
+private:
+    std::string hostname_;
+};
+
+extern ETHClass ETH;
+
+#endif
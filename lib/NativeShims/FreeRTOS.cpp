@@ -0,0 +1,119 @@
+#include <FreeRTOS.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <new>
+
+struct NativeSemaphore {
+    std::timed_mutex mutex;
+};
+
+struct NativeTask {
+    std::mutex mutex;
+    std::condition_variable notified;
+    uint32_t count = 0;
+};
+
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+TickType_t xTaskGetTickCount()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count() / portTICK_PERIOD_MS;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if(ticks == 0){
+        std::this_thread::yield();
+    }else{
+        std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+    }
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    return new(std::nothrow) NativeSemaphore();
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    if(sem == nullptr){
+        return pdFALSE;
+    }
+    if(ticks == portMAX_DELAY){
+        sem->mutex.lock();
+        return pdTRUE;
+    }
+    if(ticks == 0){
+        return sem->mutex.try_lock() ? pdTRUE : pdFALSE;
+    }
+    return sem->mutex.try_lock_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS)) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    if(sem != nullptr){
+        sem->mutex.unlock();
+    }
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    delete sem;
+}
+
+static thread_local NativeTask* currentTask = nullptr;
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    //Leaked on purpose, other threads may still notify an exited thread
+    if(currentTask == nullptr){
+        currentTask = new NativeTask();
+    }
+    return currentTask;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stackDepth, void* param,
+                                    UBaseType_t priority, TaskHandle_t* handle, BaseType_t coreId)
+{
+    NativeTask* task = new(std::nothrow) NativeTask();
+    if(task == nullptr){
+        return pdFAIL;
+    }
+    std::thread([task, function, param](){
+        currentTask = task;
+        function(param);
+    }).detach();
+    if(handle != nullptr){
+        *handle = task;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        ++task->count;
+    }
+    task->notified.notify_one();
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticks)
+{
+    NativeTask* task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> lock(task->mutex);
+    if(ticks == portMAX_DELAY){
+        task->notified.wait(lock, [task](){ return task->count != 0; });
+    }else{
+        task->notified.wait_for(lock, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), [task](){ return task->count != 0; });
+    }
+    uint32_t count = task->count;
+    if(count != 0){
+        task->count = clearCountOnExit ? 0 : count - 1;
+    }
+    return count;
+}
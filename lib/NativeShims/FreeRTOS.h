@@ -0,0 +1,6 @@
+#ifndef _NATIVE_FREERTOS_H__
+#define _NATIVE_FREERTOS_H__
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#endif
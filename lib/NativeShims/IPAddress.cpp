@@ -0,0 +1,57 @@
+#include <IPAddress.h>
+
+const IPAddress INADDR_NONE(0, 0, 0, 0);
+
+IPAddress::IPAddress() : address_(0)
+{
+}
+
+IPAddress::IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) :
+    address_(a | (b << 8) | (c << 16) | ((uint32_t)d << 24))
+{
+}
+
+IPAddress::IPAddress(uint32_t address) : address_(address)
+{
+}
+
+IPAddress::IPAddress(const char* address) : address_(0)
+{
+    fromString(address);
+}
+
+bool IPAddress::fromString(const char* address)
+{
+    uint32_t result = 0;
+    uint32_t octet = 0;
+    uint8_t dots = 0;
+    bool digit = false;
+    for(const char* c = address; *c != '\0'; ++c){
+        if((*c >= '0') && (*c <= '9')){
+            octet = octet * 10 + (*c - '0');
+            if(octet > 255){
+                return false;
+            }
+            digit = true;
+        }else if((*c == '.') && digit && (dots < 3)){
+            result |= octet << (8 * dots);
+            ++dots;
+            octet = 0;
+            digit = false;
+        }else{
+            return false;
+        }
+    }
+    if((dots != 3) || !digit){
+        return false;
+    }
+    address_ = result | (octet << 24);
+    return true;
+}
+
+String IPAddress::toString() const
+{
+    char str[16];
+    snprintf(str, sizeof(str), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+    return str;
+}
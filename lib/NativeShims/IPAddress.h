@@ -0,0 +1,43 @@
+/*
+**    This software license is not yet defined.
+**
+*/
+#ifndef _NATIVE_IP_ADDRESS_H__
+#define _NATIVE_IP_ADDRESS_H__
+#include <Arduino.h>
+
+/**
+ * Host replacement of the Arduino IPv4 address
+ */
+class IPAddress {
+public:
+    IPAddress();
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d);
+    IPAddress(uint32_t address);
+    IPAddress(const char* address);
+    ~IPAddress() = default;
+
+    /**
+     * Parses a dotted decimal address
+     * @return false if the string is not a valid address (address unchanged)
+     */
+    bool fromString(const char* address);
+    inline bool fromString(const String& address) { return fromString(address.c_str()); }
+
+    /**
+     * Converts to dotted decimal notation
+     */
+    String toString() const;
+
+    inline operator uint32_t() const { return address_; }
+    inline bool operator==(const IPAddress& other) const { return address_ == other.address_; }
+    inline bool operator!=(const IPAddress& other) const { return address_ != other.address_; }
+    inline uint8_t operator[](int index) const { return (address_ >> (8 * index)) & 0xFF; }
+
+private:
+    uint32_t address_;      //!< Address in network byte order (first octet in LSB)
+};
+
+extern const IPAddress INADDR_NONE;
+
+#endif
@@ -0,0 +1,104 @@
+#include <LittleFS.h>
+#include <sys/stat.h>
+
+LittleFSFS LittleFS;
+
+File::File(FILE* file)
+{
+    if(file != nullptr){
+        file_.reset(file, fclose);
+    }
+}
+
+size_t File::read(uint8_t* buffer, size_t len)
+{
+    return file_ ? fread(buffer, 1, len, file_.get()) : 0;
+}
+
+int File::read()
+{
+    return file_ ? fgetc(file_.get()) : EOF;
+}
+
+size_t File::readBytes(char* buffer, size_t len)
+{
+    return read((uint8_t*)buffer, len);
+}
+
+size_t File::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t File::write(const uint8_t* buffer, size_t len)
+{
+    return file_ ? fwrite(buffer, 1, len, file_.get()) : 0;
+}
+
+int File::available()
+{
+    if(!file_){
+        return 0;
+    }
+    long pos = ftell(file_.get());
+    return pos < 0 ? 0 : size() - pos;
+}
+
+size_t File::size()
+{
+    struct stat st;
+    if(!file_ || (fstat(fileno(file_.get()), &st) != 0)){
+        return 0;
+    }
+    return st.st_size;
+}
+
+void File::close()
+{
+    file_.reset();
+}
+
+bool LittleFSFS::begin(bool formatOnFail)
+{
+    std::string root = hostPath("");
+    struct stat st;
+    mounted_ = (stat(root.c_str(), &st) == 0) || (mkdir(root.c_str(), 0755) == 0);
+    return mounted_;
+}
+
+void LittleFSFS::end()
+{
+    mounted_ = false;
+}
+
+File LittleFSFS::open(const char* path, const char* mode)
+{
+    if(!mounted_){
+        return File();
+    }
+    //Binary mode, LittleFS doesn't translate line endings
+    std::string hostMode = mode;
+    hostMode += 'b';
+    return File(fopen(hostPath(path).c_str(), hostMode.c_str()));
+}
+
+bool LittleFSFS::exists(const char* path)
+{
+    struct stat st;
+    return mounted_ && (stat(hostPath(path).c_str(), &st) == 0);
+}
+
+bool LittleFSFS::remove(const char* path)
+{
+    return mounted_ && (::remove(hostPath(path).c_str()) == 0);
+}
+
+std::string LittleFSFS::hostPath(const char* path) const
+{
+    const char* root = getenv("LITTLEFS_ROOT");
+    if(root != nullptr){
+        return root + std::string(path);
+    }
+    const char* temp = getenv("TMPDIR");
+    return std::string((temp != nullptr) ? temp : "/tmp") + "/littlefs" + path;
+}
@@ -0,0 +1,62 @@
+/*
+**    This software license is not yet defined.
+**
+*/
+#ifndef _NATIVE_LITTLE_FS_H__
+#define _NATIVE_LITTLE_FS_H__
+#include <Arduino.h>
+#include <cstdio>
+#include <memory>
+
+/**
+ * Host replacement of the Arduino file, copies share the same stream
+ */
+class File {
+public:
+    File() = default;
+    explicit File(FILE* file);
+    ~File() = default;
+
+    inline explicit operator bool() const { return file_ != nullptr; }
+    size_t read(uint8_t* buffer, size_t len);
+    int read();
+    size_t readBytes(char* buffer, size_t len);
+    size_t write(uint8_t c);
+    size_t write(const uint8_t* buffer, size_t len);
+    int available();
+    size_t size();
+    void close();
+
+private:
+    std::shared_ptr<FILE> file_;
+};
+
+/**
+ * Host replacement of LittleFS
+ * Files live in the directory given by the LITTLEFS_ROOT
+ * environment variable ($TMPDIR/littlefs by default, out of the tree)
+ * Like on the target, files can't be opened before begin()
+ */
+class LittleFSFS {
+public:
+    LittleFSFS() : mounted_(false) {};
+    ~LittleFSFS() = default;
+
+    /**
+     * Creates the root directory if needed
+     * @param formatOnFail Ignored
+     */
+    bool begin(bool formatOnFail = false);
+    void end();
+    File open(const char* path, const char* mode = "r");
+    bool exists(const char* path);
+    bool remove(const char* path);
+
+private:
+    bool mounted_;
+    std::string hostPath(const char* path) const;
+};
+
+extern LittleFSFS LittleFS;
+
+#endif
@@ -0,0 +1,25 @@
+/*
+**    This software license is not yet defined.
+**
+*/
+#ifndef _NATIVE_TEMPERATURE_SENSOR_H__
+#define _NATIVE_TEMPERATURE_SENSOR_H__
+#include <esp_err.h>
+
+//Host replacement of the internal temperature sensor, always reads 25 degrees
+
+typedef struct NativeTemperatureSensor* temperature_sensor_handle_t;
+
+typedef struct {
+    int range_min;
+    int range_max;
+} temperature_sensor_config_t;
+
+#define TEMPERATURE_SENSOR_CONFIG_DEFAULT(min, max) {min, max}
+
+inline esp_err_t temperature_sensor_install(const temperature_sensor_config_t*, temperature_sensor_handle_t* handle) { *handle = nullptr; return ESP_OK; }
+inline esp_err_t temperature_sensor_enable(temperature_sensor_handle_t) { return ESP_OK; }
+inline esp_err_t temperature_sensor_disable(temperature_sensor_handle_t) { return ESP_OK; }
+inline esp_err_t temperature_sensor_get_celsius(temperature_sensor_handle_t, float* celsius) { *celsius = 25.0f; return ESP_OK; }
+
+#endif
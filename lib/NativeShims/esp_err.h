@@ -0,0 +1,20 @@
+/*
+**    This software license is not yet defined.
+**
+*/
+#ifndef _NATIVE_ESP_ERR_H__
+#define _NATIVE_ESP_ERR_H__
+
+//Host replacement of the ESP-IDF error codes
+
+typedef int esp_err_t;
+
+#define ESP_OK      0
+#define ESP_FAIL    -1
+
+/**
+ * Gets the name of an error code
+ */
+inline const char* esp_err_to_name(esp_err_t code) { return code == ESP_OK ? "ESP_OK" : "ESP_FAIL"; }
+
+#endif
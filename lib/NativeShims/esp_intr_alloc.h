@@ -0,0 +1,10 @@
+/*
+**    This software license is not yet defined.
+**
+*/
+#ifndef _NATIVE_ESP_INTR_ALLOC_H__
+#define _NATIVE_ESP_INTR_ALLOC_H__
+
+//Host replacement of the interrupt allocator, nothing is used on the host
+
+#endif
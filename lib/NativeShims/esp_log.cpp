@@ -0,0 +1,25 @@
+#include <esp_log.h>
+#include <Arduino.h>
+#include <cstdarg>
+#include <cstdio>
+
+static esp_log_level_t logLevel = ESP_LOG_INFO;
+
+void esp_log_level_set(const char* tag, esp_log_level_t level)
+{
+    logLevel = level;
+}
+
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...)
+{
+    static const char levels[] = "NEWIDV";
+    if(level > logLevel){
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "%c (%lu) %s: ", levels[level], millis(), tag);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
@@ -0,0 +1,25 @@
+/*
+**    This software license is not yet defined.
+**
+*/
+#ifndef _NATIVE_FREERTOS_FREERTOS_H__
+#define _NATIVE_FREERTOS_FREERTOS_H__
+#include <cstdint>
+
+//Host replacement of the FreeRTOS kernel types, one tick is one millisecond
+
+#define configTICK_RATE_HZ      1000
+#define portTICK_PERIOD_MS      (1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY           ((TickType_t)0xffffffffUL)
+#define pdMS_TO_TICKS(ms)       ((TickType_t)(((TickType_t)(ms) * configTICK_RATE_HZ) / 1000))
+
+#define pdFALSE     ((BaseType_t)0)
+#define pdTRUE      ((BaseType_t)1)
+#define pdPASS      pdTRUE
+#define pdFAIL      pdFALSE
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#endif
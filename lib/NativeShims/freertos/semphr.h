@@ -0,0 +1,30 @@
+#ifndef _NATIVE_FREERTOS_SEMPHR_H__
+#define _NATIVE_FREERTOS_SEMPHR_H__
+#include "freertos/FreeRTOS.h"
+
+typedef struct NativeSemaphore* SemaphoreHandle_t;
+
+/**
+ * Creates a (non recursive) mutex
+ * @return Mutex handle or NULL if out of memory
+ */
+SemaphoreHandle_t xSemaphoreCreateMutex();
+
+/**
+ * Takes a mutex
+ * @param sem Mutex handle
+ * @param ticks Maximum time to wait, portMAX_DELAY waits forever
+ * @return pdTRUE if taken, pdFALSE on timeout
+ */
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks);
+
+/**
+ * Gives back a mutex
+ * @param sem Mutex handle
+ * @return pdTRUE
+ */
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+
+void vSemaphoreDelete(SemaphoreHandle_t sem);
+
+#endif
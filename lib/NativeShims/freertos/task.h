@@ -0,0 +1,54 @@
+#ifndef _NATIVE_FREERTOS_TASK_H__
+#define _NATIVE_FREERTOS_TASK_H__
+#include "freertos/FreeRTOS.h"
+
+/**
+ * Ticks elapsed since the program started
+ */
+TickType_t xTaskGetTickCount();
+
+/**
+ * Sleeps the calling thread
+ * @param ticks Number of ticks to sleep
+ */
+void vTaskDelay(TickType_t ticks);
+
+typedef struct NativeTask* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+#define tskNO_AFFINITY  0x7FFFFFFF
+
+/**
+ * Runs a task in a detached thread (stack size, priority and core are ignored)
+ * @param handle Receives the task handle, valid before the task runs
+ * @return pdPASS, pdFAIL if out of memory
+ */
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char* name, uint32_t stackDepth, void* param,
+                                    UBaseType_t priority, TaskHandle_t* handle, BaseType_t coreId);
+
+inline BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stackDepth, void* param,
+                                UBaseType_t priority, TaskHandle_t* handle)
+{
+    return xTaskCreatePinnedToCore(function, name, stackDepth, param, priority, handle, tskNO_AFFINITY);
+}
+
+/**
+ * Gets the handle of the calling thread (created on first use, never freed)
+ */
+TaskHandle_t xTaskGetCurrentTaskHandle();
+
+/**
+ * Increments the notification count of a task and wakes it
+ * @return pdPASS
+ */
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+
+/**
+ * Waits for the notification count of the calling task to be non zero
+ * @param clearCountOnExit pdTRUE clears the count, pdFALSE decrements it
+ * @param ticks Maximum time to wait, portMAX_DELAY waits forever
+ * @return Notification count before it was cleared or decremented
+ */
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticks);
+
+#endif
@@ -0,0 +1,15 @@
+/*
+**    This software license is not yet defined.
+**
+*/
+#ifndef _NATIVE_LWIP_SOCKETS_H__
+#define _NATIVE_LWIP_SOCKETS_H__
+
+//Host replacement of the lwIP sockets, the BSD API they mimic
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <cerrno>
+
+#endif
@@ -0,0 +1,38 @@
+#include "mbedtls/aes.h"
+#include <cstring>
+
+#define MBEDTLS_ERR_AES_INVALID_INPUT_LENGTH -0x0022
+
+void mbedtls_aes_init(mbedtls_aes_context* ctx)
+{
+    ctx->keybits = 0;
+}
+
+void mbedtls_aes_free(mbedtls_aes_context* ctx)
+{
+    ctx->keybits = 0;
+}
+
+int mbedtls_aes_setkey_enc(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits)
+{
+    ctx->keybits = keybits;
+    return 0;
+}
+
+int mbedtls_aes_setkey_dec(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits)
+{
+    ctx->keybits = keybits;
+    return 0;
+}
+
+int mbedtls_aes_crypt_cbc(mbedtls_aes_context* ctx, int mode, size_t length, unsigned char iv[16],
+                            const unsigned char* input, unsigned char* output)
+{
+    if((length % 16) != 0){
+        return MBEDTLS_ERR_AES_INVALID_INPUT_LENGTH;
+    }
+    if((input != nullptr) && (output != nullptr)){
+        memmove(output, input, length);
+    }
+    return 0;
+}
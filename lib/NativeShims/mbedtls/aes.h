@@ -0,0 +1,26 @@
+/*
+**    This software license is not yet defined.
+**
+*/
+#ifndef _NATIVE_MBEDTLS_AES_H__
+#define _NATIVE_MBEDTLS_AES_H__
+#include <cstddef>
+
+//Host replacement of the mbedTLS AES API used by the configuration
+//WARNING: data is copied as is, nothing is encrypted on the host
+
+#define MBEDTLS_AES_ENCRYPT     1
+#define MBEDTLS_AES_DECRYPT     0
+
+typedef struct {
+    unsigned int keybits;
+} mbedtls_aes_context;
+
+void mbedtls_aes_init(mbedtls_aes_context* ctx);
+void mbedtls_aes_free(mbedtls_aes_context* ctx);
+int mbedtls_aes_setkey_enc(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits);
+int mbedtls_aes_setkey_dec(mbedtls_aes_context* ctx, const unsigned char* key, unsigned int keybits);
+int mbedtls_aes_crypt_cbc(mbedtls_aes_context* ctx, int mode, size_t length, unsigned char iv[16],
+                            const unsigned char* input, unsigned char* output);
+
+#endif
@@ -0,0 +1,4 @@
+#ifndef _NATIVE_MBEDTLS_CIPHER_H__
+#define _NATIVE_MBEDTLS_CIPHER_H__
+#include "mbedtls/aes.h"
+#endif
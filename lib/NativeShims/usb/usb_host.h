@@ -0,0 +1,143 @@
+/*
+**    This software license is not yet defined.
+**
+*/
+#ifndef _NATIVE_USB_HOST_H__
+#define _NATIVE_USB_HOST_H__
+#include <cstdint>
+#include <cstddef>
+
+//Host replacement of the ESP-IDF USB host types (chapter 9 descriptors and transfers)
+//Layouts match ESP-IDF so captured descriptors can be used as is
+
+#define USB_SETUP_PACKET_SIZE               8
+
+#define USB_BM_REQUEST_TYPE_DIR_OUT         (0 << 7)
+#define USB_BM_REQUEST_TYPE_DIR_IN          (1 << 7)
+#define USB_BM_REQUEST_TYPE_TYPE_STANDARD   (0 << 5)
+#define USB_BM_REQUEST_TYPE_TYPE_CLASS      (1 << 5)
+#define USB_BM_REQUEST_TYPE_RECIP_DEVICE    0x00
+#define USB_BM_REQUEST_TYPE_RECIP_INTERFACE 0x01
+
+#define USB_B_DESCRIPTOR_TYPE_DEVICE        0x01
+#define USB_B_DESCRIPTOR_TYPE_CONFIGURATION 0x02
+#define USB_B_DESCRIPTOR_TYPE_STRING        0x03
+#define USB_B_DESCRIPTOR_TYPE_INTERFACE     0x04
+#define USB_B_DESCRIPTOR_TYPE_ENDPOINT      0x05
+
+typedef struct usb_device_handle_s* usb_device_handle_t;
+
+typedef enum {
+    USB_SPEED_LOW = 0,
+    USB_SPEED_FULL,
+    USB_SPEED_HIGH,
+} usb_speed_t;
+
+typedef enum {
+    USB_TRANSFER_STATUS_COMPLETED,
+    USB_TRANSFER_STATUS_ERROR,
+    USB_TRANSFER_STATUS_TIMED_OUT,
+    USB_TRANSFER_STATUS_CANCELED,
+    USB_TRANSFER_STATUS_STALL,
+    USB_TRANSFER_STATUS_OVERFLOW,
+    USB_TRANSFER_STATUS_SKIPPED,
+    USB_TRANSFER_STATUS_NO_DEVICE,
+} usb_transfer_status_t;
+
+typedef struct usb_transfer_s usb_transfer_t;
+typedef void (*usb_transfer_cb_t)(usb_transfer_t* transfer);
+
+struct usb_transfer_s {
+    uint8_t* const data_buffer;
+    const size_t data_buffer_size;
+    int num_bytes;
+    int actual_num_bytes;
+    uint32_t flags;
+    usb_device_handle_t device_handle;
+    uint8_t bEndpointAddress;
+    usb_transfer_status_t status;
+    uint32_t timeout_ms;
+    usb_transfer_cb_t callback;
+    void* context;
+    const int num_isoc_packets;
+};
+
+typedef struct __attribute__((packed)) {
+    uint8_t bmRequestType;
+    uint8_t bRequest;
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint16_t wLength;
+} usb_setup_packet_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+} usb_standard_desc_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint16_t bcdUSB;
+    uint8_t bDeviceClass;
+    uint8_t bDeviceSubClass;
+    uint8_t bDeviceProtocol;
+    uint8_t bMaxPacketSize0;
+    uint16_t idVendor;
+    uint16_t idProduct;
+    uint16_t bcdDevice;
+    uint8_t iManufacturer;
+    uint8_t iProduct;
+    uint8_t iSerialNumber;
+    uint8_t bNumConfigurations;
+} usb_device_desc_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint16_t wTotalLength;
+    uint8_t bNumInterfaces;
+    uint8_t bConfigurationValue;
+    uint8_t iConfiguration;
+    uint8_t bmAttributes;
+    uint8_t bMaxPower;
+} usb_config_desc_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint8_t bInterfaceNumber;
+    uint8_t bAlternateSetting;
+    uint8_t bNumEndpoints;
+    uint8_t bInterfaceClass;
+    uint8_t bInterfaceSubClass;
+    uint8_t bInterfaceProtocol;
+    uint8_t iInterface;
+} usb_intf_desc_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint8_t bEndpointAddress;
+    uint8_t bmAttributes;
+    uint16_t wMaxPacketSize;
+    uint8_t bInterval;
+} usb_ep_desc_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint16_t wData[1];
+} usb_str_desc_t;
+
+typedef struct {
+    usb_speed_t speed;
+    uint8_t dev_addr;
+    uint8_t bMaxPacketSize0;
+    uint8_t bConfigurationValue;
+    const usb_str_desc_t* str_desc_manufacturer;
+    const usb_str_desc_t* str_desc_product;
+    const usb_str_desc_t* str_desc_serial_num;
+} usb_device_info_t;
+
+#endif
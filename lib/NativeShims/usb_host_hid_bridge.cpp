@@ -0,0 +1,55 @@
+#include "usb_host_hid_bridge.h"
+
+//Host half of the USB HID bridge (lib/HIDBridge): same API, no USB
+//Callbacks are invoked by whatever plays the device on the host, the
+//feature report scheduler is the one of the target
+
+UsbHostHidBridge::UsbHostHidBridge() :
+    hostInstalled( false ),
+    driver_ptr( NULL ),
+    onConfigDescriptorReceived( NULL ),
+    onDeviceInfoReceived( NULL ),
+    onHidReportDescriptorReceived( NULL ),
+    onReportReceived( NULL ),
+    onDeviceRemoved( NULL ),
+    onFeatureReportReceived( NULL ),
+    onDeviceDescriptorReceived( NULL ),
+    onSetReportRequired( NULL ),
+    onSetIdleDone( NULL )
+{
+    for (size_t i = 0; i < USB_HOST_MAX_DEVICES; i++) {
+        featureSchedules[i].count = 0;
+        setReportRequests[i] = false;
+        idleRequests[i] = -1;
+        resetRequests[i] = false;
+    }
+}
+
+UsbHostHidBridge::~UsbHostHidBridge()
+{
+}
+
+void UsbHostHidBridge::begin()
+{
+    hostInstalled = true;
+}
+
+void UsbHostHidBridge::end()
+{
+    hostInstalled = false;
+}
+
+void UsbHostHidBridge::requestSetReport(uint8_t device)
+{
+    setReportRequests[device] = true;
+}
+
+void UsbHostHidBridge::requestSetIdle(uint8_t device, uint8_t duration)
+{
+    idleRequests[device] = duration;
+}
+
+void UsbHostHidBridge::requestReset(uint8_t device)
+{
+    resetRequests[device] = true;
+}
@@ -0,0 +1,7 @@
+# Builds the native_fuzz environment with clang, libFuzzer and the sanitizers
+Import("env")
+
+SANITIZERS = ["-fsanitize=fuzzer,address,undefined", "-fno-sanitize-recover=undefined"]
+
+env.Replace(CC="clang", CXX="clang++")
+env.Append(CCFLAGS=SANITIZERS, LINKFLAGS=SANITIZERS)
@@ -1,6 +1,7 @@
 #include <Configuration.hpp>
 #include "esp_log.h"
 #include <LittleFS.h>
+#include <algorithm>
 
 #include <ETH.h>
 #include "mbedtls/aes.h"
@@ -10,6 +11,13 @@
 
 #define DEFAULT_DEVICE_NAME "UPS-SNMP"
 #define DEFAULT_TEMPERATURE_ALARM 65.0
+#define DEFAULT_SELF_TEST_INTERVAL 0    // Hours, scheduled self-tests are opt-in
+#define DEFAULT_STATE_DEBOUNCE 2000     // ms
+#define DEFAULT_LOW_BATTERY 0           // %, the UPS limit decides
+#define DEFAULT_STATE_HYSTERESIS 5      // %
+#define DEFAULT_SNMP_CACHE 500          // ms
+#define DEFAULT_SNMP_TRAP_PORT 162
+#define DEFAULT_SNMP_TRAP_COMMUNITY "public"
 #define DEFAULT_IP "10.10.10.200"
 #define DEFAULT_SUBNET "255.255.254.0"
 #define DEFAULT_GATEWAY "10.10.10.1"
@@ -27,7 +35,10 @@ DeviceConfiguration::DeviceConfiguration() :
         deviceName_(DEFAULT_DEVICE_NAME),
         lastChange_(0), tempAlarm_(DEFAULT_TEMPERATURE_ALARM),
         ip_(DEFAULT_IP), subnet_(DEFAULT_SUBNET), gateway_(DEFAULT_GATEWAY),
-        snmpTrap_(INADDR_NONE), lastButton_(false), lastPress_(0),
+        selfTestInterval_(DEFAULT_SELF_TEST_INTERVAL), selfTestDeep_(false),
+        stateDebounce_(DEFAULT_STATE_DEBOUNCE), lowBattery_(DEFAULT_LOW_BATTERY), stateHysteresis_(DEFAULT_STATE_HYSTERESIS),
+        snmpCache_(DEFAULT_SNMP_CACHE),
+        lastButton_(false), lastPress_(0),
         cfgReset_(false)
 {
     mutexData_ = xSemaphoreCreateMutex();
@@ -108,21 +119,61 @@ void DeviceConfiguration::fromJSON(const JsonDocument& doc)
         setTemperatureAlarm(doc["Temperature_max"]);
     }
 
-    if(doc["SNMP_trap"]){
+    if(doc["SNMP_traps"].is<JsonArrayConst>()){
+        std::vector<SNMPTrapTarget> targets;
+        for(JsonObjectConst entry : doc["SNMP_traps"].as<JsonArrayConst>()){
+            SNMPTrapTarget target;
+            if(!target.ip.fromString(entry["IP"] | "") || (target.ip == INADDR_NONE)){
+                continue;
+            }
+            target.port = entry["Port"] | DEFAULT_SNMP_TRAP_PORT;
+            std::string type = entry["Type"] | "v1";
+            if(type == "inform"){
+                target.type = SNMPTrapTarget::Type::INFORM;
+            }else if(type == "v2c"){
+                target.type = SNMPTrapTarget::Type::V2C;
+            }else{
+                target.type = SNMPTrapTarget::Type::V1;
+            }
+            target.community = entry["Community"] | DEFAULT_SNMP_TRAP_COMMUNITY;
+            targets.push_back(target);
+        }
+        setSNMPTraps(targets);
+    }else if(doc["SNMP_trap"]){
+        //Single SNMPv1 receiver of the previous releases
         String trapStr = doc["SNMP_trap"].as<String>();
+        std::vector<SNMPTrapTarget> targets;
         IPAddress snmpTrap;
-        if(trapStr.length() > 0){
-            snmpTrap.fromString(trapStr);
-        }else{
-            snmpTrap = INADDR_NONE;
+        if((trapStr.length() > 0) && snmpTrap.fromString(trapStr) && (snmpTrap != INADDR_NONE)){
+            targets.push_back({snmpTrap, DEFAULT_SNMP_TRAP_PORT, SNMPTrapTarget::Type::V1, DEFAULT_SNMP_TRAP_COMMUNITY});
         }
-        setSNMPTrap(snmpTrap);
+        setSNMPTraps(targets);
     }
 
     if(doc["MAC_address"]){
         std::string mac = doc["MAC_address"].as<std::string>();
         setMACAddress(mac);
     }
+
+    //0 disables the tests, test the key not the value
+    if(doc["Self_test_interval"].is<uint32_t>() || doc["Self_test_deep"].is<bool>()){
+        uint32_t interval;
+        bool deep;
+        getSelfTest(interval, deep);
+        setSelfTest(doc["Self_test_interval"] | interval, doc["Self_test_deep"] | deep);
+    }
+
+    if(doc["State_debounce"].is<uint32_t>() || doc["Low_battery"].is<uint8_t>() || doc["State_hysteresis"].is<uint8_t>()){
+        uint32_t debounce;
+        uint8_t lowBattery, hysteresis;
+        getStateFilter(debounce, lowBattery, hysteresis);
+        setStateFilter(doc["State_debounce"] | debounce, doc["Low_battery"] | lowBattery, doc["State_hysteresis"] | hysteresis);
+    }
+
+    //0 disables the cache, test the key not the value
+    if(doc["SNMP_cache"].is<uint32_t>()){
+        setSNMPCache(doc["SNMP_cache"]);
+    }
 }
 
 void DeviceConfiguration::setMACAddress(const std::string& mac)
@@ -187,14 +238,14 @@ void DeviceConfiguration::getIPAddress(IPAddress& ip, IPAddress& subnet, IPAddre
 }
 
 /**
- * Sets IP address to send SNMP traps
- * @param ip IP address to send SNMP traps to
+ * Sets the receivers of the SNMP notifications
+ * @param targets Receivers (only the first MAX_SNMP_TRAP_TARGETS are kept)
  */
-void DeviceConfiguration::setSNMPTrap(const IPAddress& ip)
+void DeviceConfiguration::setSNMPTraps(const std::vector<SNMPTrapTarget>& targets)
 {
     if(xSemaphoreTake(mutexData_, portMAX_DELAY ) == pdTRUE)
     {
-        snmpTrap_ = ip;
+        snmpTraps_.assign(targets.begin(), targets.begin() + std::min<size_t>(targets.size(), MAX_SNMP_TRAP_TARGETS));
         lastChange_ = millis();
         xSemaphoreGive(mutexData_);
         notifyListeners(Parameter::SNMP_TRAP_IP);
@@ -202,14 +253,14 @@ void DeviceConfiguration::setSNMPTrap(const IPAddress& ip)
 }
 
 /**
- * Gets IP address to send SNMP traps
- * @param IP address to send SNMP traps to
+ * Gets the receivers of the SNMP notifications
+ * @param targets Receivers (empty if the notifications are disabled)
  */
-void DeviceConfiguration::getSNMPTrap(IPAddress& ip)
+void DeviceConfiguration::getSNMPTraps(std::vector<SNMPTrapTarget>& targets)
 {
     if(xSemaphoreTake(mutexData_, portMAX_DELAY ) == pdTRUE)
     {
-        ip = snmpTrap_;
+        targets = snmpTraps_;
         xSemaphoreGive(mutexData_);
     }
 }
@@ -243,6 +294,74 @@ double DeviceConfiguration::getTemperatureAlarm()
     return ret;
 }
 
+void DeviceConfiguration::setSelfTest(uint32_t intervalHours, bool deep)
+{
+    if(xSemaphoreTake(mutexData_, portMAX_DELAY ) == pdTRUE)
+    {
+        selfTestInterval_ = intervalHours;
+        selfTestDeep_ = deep;
+        lastChange_ = millis();
+        xSemaphoreGive(mutexData_);
+        notifyListeners(Parameter::SELF_TEST);
+    }
+}
+
+void DeviceConfiguration::getSelfTest(uint32_t& intervalHours, bool& deep)
+{
+    if(xSemaphoreTake(mutexData_, portMAX_DELAY ) == pdTRUE)
+    {
+        intervalHours = selfTestInterval_;
+        deep = selfTestDeep_;
+        xSemaphoreGive(mutexData_);
+    }
+}
+
+void DeviceConfiguration::setStateFilter(uint32_t debounceMs, uint8_t lowBattery, uint8_t hysteresis)
+{
+    if(xSemaphoreTake(mutexData_, portMAX_DELAY ) == pdTRUE)
+    {
+        stateDebounce_ = debounceMs;
+        lowBattery_ = std::min<uint8_t>(lowBattery, 100);
+        stateHysteresis_ = std::min<uint8_t>(hysteresis, 100);
+        lastChange_ = millis();
+        xSemaphoreGive(mutexData_);
+        notifyListeners(Parameter::UPS_STATE);
+    }
+}
+
+void DeviceConfiguration::getStateFilter(uint32_t& debounceMs, uint8_t& lowBattery, uint8_t& hysteresis)
+{
+    if(xSemaphoreTake(mutexData_, portMAX_DELAY ) == pdTRUE)
+    {
+        debounceMs = stateDebounce_;
+        lowBattery = lowBattery_;
+        hysteresis = stateHysteresis_;
+        xSemaphoreGive(mutexData_);
+    }
+}
+
+void DeviceConfiguration::setSNMPCache(uint32_t windowMs)
+{
+    if(xSemaphoreTake(mutexData_, portMAX_DELAY ) == pdTRUE)
+    {
+        snmpCache_ = windowMs;
+        lastChange_ = millis();
+        xSemaphoreGive(mutexData_);
+        notifyListeners(Parameter::SNMP_CACHE);
+    }
+}
+
+uint32_t DeviceConfiguration::getSNMPCache()
+{
+    uint32_t ret = 0;
+    if(xSemaphoreTake(mutexData_, portMAX_DELAY ) == pdTRUE)
+    {
+        ret = snmpCache_;
+        xSemaphoreGive(mutexData_);
+    }
+    return ret;
+}
+
 void DeviceConfiguration::getMACAddress(std::string& mac)
 {
     if(xSemaphoreTake(mutexData_, portMAX_DELAY ) == pdTRUE)
@@ -310,6 +429,21 @@ void DeviceConfiguration::toJSON(JsonDocument& doc, bool includeLogin)
         doc["Subnet"] = subnet_ == INADDR_NONE ? "DHCP" : subnet_.toString();
         doc["Gateway"] = subnet_ == INADDR_NONE ? "DHCP" : gateway_.toString();
         doc["Temperature_max"] = tempAlarm_;
+        doc["Self_test_interval"] = selfTestInterval_;
+        doc["Self_test_deep"] = selfTestDeep_;
+        doc["State_debounce"] = stateDebounce_;
+        doc["Low_battery"] = lowBattery_;
+        doc["State_hysteresis"] = stateHysteresis_;
+        doc["SNMP_cache"] = snmpCache_;
+        JsonArray traps = doc["SNMP_traps"].to<JsonArray>();
+        for(const SNMPTrapTarget& target : snmpTraps_){
+            static const char* TYPES[] = {"v1", "v2c", "inform"};
+            JsonObject entry = traps.add<JsonObject>();
+            entry["IP"] = target.ip.toString();
+            entry["Port"] = target.port;
+            entry["Type"] = TYPES[static_cast<uint8_t>(target.type)];
+            entry["Community"] = target.community;
+        }
         if(includeLogin){
             doc["Username"] = userName_;
             doc["Password"] = password_;
@@ -377,7 +511,7 @@ std::string DeviceConfiguration::encrypt(const std::string& input)
 	mbedtls_aes_context aes;
 	mbedtls_aes_init(&aes);
 	mbedtls_aes_setkey_enc(&aes, key, 128);
-	mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_ENCRYPT, cipherLen, iv, (const unsigned char*)input.c_str(), out);
+	mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_ENCRYPT, cipherLen, iv, (const unsigned char*)inData.c_str(), out);
 	mbedtls_aes_free(&aes);
 
     std::string ret;
@@ -385,6 +519,7 @@ std::string DeviceConfiguration::encrypt(const std::string& input)
     for(int i=0;i<cipherLen;++i){
         sprintf(&ret[i*2], "%02X", out[i]);        
     }
+    free(out);
     return ret;
 }
 
@@ -404,7 +539,7 @@ std::string DeviceConfiguration::decrypt(const std::string& input)
     }else{
         for(int i=0;i<dataSize;++i){
             char data[3] = {input[i*2], input[i*2+1], '\0'};
-            sscanf(data, "%02X", &in[i]);
+            sscanf(data, "%02hhX", &in[i]);
         }
     }
     mbedtls_aes_context aes;
@@ -412,6 +547,7 @@ std::string DeviceConfiguration::decrypt(const std::string& input)
 	mbedtls_aes_setkey_enc(&aes, key, 128);
 	mbedtls_aes_crypt_cbc(&aes, MBEDTLS_AES_DECRYPT, dataSize, iv, in, (unsigned char*)&ret[0]);
 	mbedtls_aes_free(&aes);
+    free(in);
     return ret;
 }
 
@@ -475,4 +611,8 @@ void DeviceConfiguration::resetToDefault()
     setUserName("");
     setPassword("");
     setTemperatureAlarm(DEFAULT_TEMPERATURE_ALARM);
+    setSelfTest(DEFAULT_SELF_TEST_INTERVAL, false);
+    setStateFilter(DEFAULT_STATE_DEBOUNCE, DEFAULT_LOW_BATTERY, DEFAULT_STATE_HYSTERESIS);
+    setSNMPCache(DEFAULT_SNMP_CACHE);
+    setSNMPTraps({});
 }
\ No newline at end of file
@@ -0,0 +1,97 @@
+#include <HIDUnits.hpp>
+#include <HIDUsages.hpp>
+
+/**
+ * Gets a 4 bits signed nibble (page 37 of HID 1.11)
+ * @param value Item data
+ * @param index Nibble index (0 is the system)
+ */
+static inline int8_t nibble(uint32_t value, uint8_t index)
+{
+    int8_t ret = (value >> (index * 4)) & 0xF;
+    return ret >= 8 ? ret - 16 : ret;
+}
+
+/**
+ * Builds the Unit item of an SI Linear unit from its dimensions
+ */
+static constexpr uint32_t siLinear(int8_t length, int8_t mass, int8_t time, int8_t temperature, int8_t current)
+{
+    return 0x1 | ((length & 0xFu) << 4) | ((mass & 0xFu) << 8) | ((time & 0xFu) << 12) |
+                ((temperature & 0xFu) << 16) | ((current & 0xFu) << 20);
+}
+
+static constexpr uint32_t UNIT_VOLT = siLinear(2, 1, -3, 0, -1);        //cm²·g·s⁻³·A⁻¹
+static constexpr uint32_t UNIT_AMPERE = siLinear(0, 0, 0, 0, 1);
+static constexpr uint32_t UNIT_HERTZ = siLinear(0, 0, -1, 0, 0);
+static constexpr uint32_t UNIT_SECOND = siLinear(0, 0, 1, 0, 0);
+static constexpr uint32_t UNIT_KELVIN = siLinear(0, 0, 0, 1, 0);
+static constexpr uint32_t UNIT_POWER = siLinear(2, 1, -3, 0, 0);        //cm²·g·s⁻³ (W or VA)
+static_assert(UNIT_VOLT == 0x00F0D121, "Volt unit item");
+
+HIDUnitConversion hidUnitConversion(uint16_t usagePage, uint16_t usage, uint32_t unit, int32_t unitExponent)
+{
+    HIDUnitConversion ret = {HIDUnit::None, 0, 0};
+    //Luminous intensity and reserved nibbles are not part of any supported unit
+    uint32_t dimensions = unit & 0x00FFFFFF;
+    if(dimensions == 0){
+        //No unit declared, the unit exponent is meaningless
+        ret.unit = hidUsageUnit(usagePage, usage);
+        return ret;
+    }
+    ret.unit = HIDUnit::Other;
+    if(unit != dimensions){
+        return ret;
+    }
+    //Only SI Linear units are normalised
+    switch(dimensions){
+        case UNIT_VOLT:
+            ret.unit = HIDUnit::Volt;
+            break;
+        case UNIT_AMPERE:
+            ret.unit = HIDUnit::Ampere;
+            break;
+        case UNIT_HERTZ:
+            ret.unit = HIDUnit::Hertz;
+            break;
+        case UNIT_SECOND:
+            ret.unit = HIDUnit::Second;
+            break;
+        case UNIT_KELVIN:
+            ret.unit = HIDUnit::Celsius;
+            ret.offset = -27315;
+            break;
+        case UNIT_POWER:
+            ret.unit = hidUsageUnit(usagePage, usage) == HIDUnit::VoltAmpere ? HIDUnit::VoltAmpere : HIDUnit::Watt;
+            break;
+        default:
+            return ret;
+    }
+    //Base units are cm and g, SI units use m and kg
+    ret.exponent = nibble(unitExponent, 0) - 2 * nibble(unit, 1) - 3 * nibble(unit, 2);
+    return ret;
+}
+
+const char* hidUnitSymbol(HIDUnit unit)
+{
+    switch(unit){
+        case HIDUnit::Volt:
+            return "V";
+        case HIDUnit::Ampere:
+            return "A";
+        case HIDUnit::Hertz:
+            return "Hz";
+        case HIDUnit::Second:
+            return "s";
+        case HIDUnit::Celsius:
+            return "°C";
+        case HIDUnit::Percent:
+            return "%";
+        case HIDUnit::Watt:
+            return "W";
+        case HIDUnit::VoltAmpere:
+            return "VA";
+        default:
+            return nullptr;
+    }
+}
@@ -0,0 +1,251 @@
+#include <HIDUsages.hpp>
+#include <cstddef>
+#include <cstring>
+
+/**
+ * Usage entry, id is (usage page << 16) | usage
+ */
+struct HIDUsageEntry {
+    uint32_t id;
+    const char* name;
+    HIDUnit unit;       //Unit of the usage tables, used when the descriptor declares none
+};
+
+#define POWER_DEVICE(usage, name)               {(0x84u << 16) | (usage), name, HIDUnit::None}
+#define BATTERY_SYSTEM(usage, name)             {(0x85u << 16) | (usage), name, HIDUnit::None}
+#define POWER_DEVICE_UNIT(usage, name, unit)    {(0x84u << 16) | (usage), name, HIDUnit::unit}
+#define BATTERY_SYSTEM_UNIT(usage, name, unit)  {(0x85u << 16) | (usage), name, HIDUnit::unit}
+
+/*Names and units taken from
+Universal Serial Bus
+Usage Tables
+for
+HID Power Devices (Release 1.0)
+Table must stay sorted by id
+**/
+static constexpr HIDUsageEntry USAGE_NAMES[] = {
+    POWER_DEVICE(0x01, "iName"),
+    POWER_DEVICE(0x02, "PresentStatus"),
+    POWER_DEVICE(0x03, "ChangedStatus"),
+    POWER_DEVICE(0x04, "UPS"),
+    POWER_DEVICE(0x05, "PowerSupply"),
+    POWER_DEVICE(0x10, "BatterySystem"),
+    POWER_DEVICE(0x11, "BatterySystemID"),
+    POWER_DEVICE(0x12, "Battery"),
+    POWER_DEVICE(0x13, "BatteryID"),
+    POWER_DEVICE(0x14, "Charger"),
+    POWER_DEVICE(0x15, "ChargerID"),
+    POWER_DEVICE(0x16, "PowerConverter"),
+    POWER_DEVICE(0x17, "PowerConverterID"),
+    POWER_DEVICE(0x18, "OutletSystem"),
+    POWER_DEVICE(0x19, "OutletSystemID"),
+    POWER_DEVICE(0x1a, "Input"),
+    POWER_DEVICE(0x1b, "InputID"),
+    POWER_DEVICE(0x1c, "Output"),
+    POWER_DEVICE(0x1d, "OutputID"),
+    POWER_DEVICE(0x1e, "Flow"),
+    POWER_DEVICE(0x1f, "FlowID"),
+    POWER_DEVICE(0x20, "Outlet"),
+    POWER_DEVICE(0x21, "OutletID"),
+    POWER_DEVICE(0x22, "Gang"),
+    POWER_DEVICE(0x23, "GangID"),
+    POWER_DEVICE(0x24, "PowerSummary"),
+    POWER_DEVICE(0x25, "PowerSummaryID"),
+    POWER_DEVICE_UNIT(0x30, "Voltage", Volt),
+    POWER_DEVICE_UNIT(0x31, "Current", Ampere),
+    POWER_DEVICE_UNIT(0x32, "Frequency", Hertz),
+    POWER_DEVICE_UNIT(0x33, "ApparentPower", VoltAmpere),
+    POWER_DEVICE_UNIT(0x34, "ActivePower", Watt),
+    POWER_DEVICE_UNIT(0x35, "PercentLoad", Percent),
+    POWER_DEVICE(0x36, "Temperature"),
+    POWER_DEVICE(0x37, "Humidity"),
+    POWER_DEVICE(0x38, "BadCount"),
+    POWER_DEVICE_UNIT(0x40, "ConfigVoltage", Volt),
+    POWER_DEVICE_UNIT(0x41, "ConfigCurrent", Ampere),
+    POWER_DEVICE_UNIT(0x42, "ConfigFrequency", Hertz),
+    POWER_DEVICE_UNIT(0x43, "ConfigApparentPower", VoltAmpere),
+    POWER_DEVICE_UNIT(0x44, "ConfigActivePower", Watt),
+    POWER_DEVICE_UNIT(0x45, "ConfigPercentLoad", Percent),
+    POWER_DEVICE(0x46, "ConfigTemperature"),
+    POWER_DEVICE(0x47, "ConfigHumidity"),
+    POWER_DEVICE(0x50, "SwitchOnControl"),
+    POWER_DEVICE(0x51, "SwitchOffControl"),
+    POWER_DEVICE(0x52, "ToggleControl"),
+    POWER_DEVICE_UNIT(0x53, "LowVoltageTransfer", Volt),
+    POWER_DEVICE_UNIT(0x54, "HighVoltageTransfer", Volt),
+    POWER_DEVICE_UNIT(0x55, "DelayBeforeReboot", Second),
+    POWER_DEVICE_UNIT(0x56, "DelayBeforeStartup", Second),
+    POWER_DEVICE_UNIT(0x57, "DelayBeforeShutdown", Second),
+    POWER_DEVICE(0x58, "Test"),
+    POWER_DEVICE(0x59, "ModuleReset"),
+    POWER_DEVICE(0x5a, "AudibleAlarmControl"),
+    POWER_DEVICE(0x60, "Present"),
+    POWER_DEVICE(0x61, "Good"),
+    POWER_DEVICE(0x62, "InternalFailure"),
+    POWER_DEVICE(0x63, "VoltageOutOfRange"),
+    POWER_DEVICE(0x64, "FrequencyOutOfRange"),
+    POWER_DEVICE(0x65, "Overload"),
+    POWER_DEVICE(0x66, "OverCharged"),
+    POWER_DEVICE(0x67, "OverTemperature"),
+    POWER_DEVICE(0x68, "ShutdownRequested"),
+    POWER_DEVICE(0x69, "ShutdownImminent"),
+    POWER_DEVICE(0x6b, "SwitchOnOff"),
+    POWER_DEVICE(0x6c, "Switchable"),
+    POWER_DEVICE(0x6d, "Used"),
+    POWER_DEVICE(0x6e, "Boost"),
+    POWER_DEVICE(0x6f, "Buck"),
+    POWER_DEVICE(0x70, "Initialized"),
+    POWER_DEVICE(0x71, "Tested"),
+    POWER_DEVICE(0x72, "AwaitingPower"),
+    POWER_DEVICE(0x73, "CommunicationLost"),
+    POWER_DEVICE(0xfd, "iManufacturer"),
+    POWER_DEVICE(0xfe, "iProduct"),
+    POWER_DEVICE(0xff, "iSerialNumber"),
+    BATTERY_SYSTEM(0x01, "SMBBatteryMode"),
+    BATTERY_SYSTEM(0x02, "SMBBatteryStatus"),
+    BATTERY_SYSTEM(0x03, "SMBAlarmWarning"),
+    BATTERY_SYSTEM(0x04, "SMBChargerMode"),
+    BATTERY_SYSTEM(0x05, "SMBChargerStatus"),
+    BATTERY_SYSTEM(0x06, "SMBChargerSpecInfo"),
+    BATTERY_SYSTEM(0x07, "SMBSelectorState"),
+    BATTERY_SYSTEM(0x08, "SMBSelectorPresets"),
+    BATTERY_SYSTEM(0x09, "SMBSelectorInfo"),
+    BATTERY_SYSTEM(0x10, "OptionalMfgFunction1"),
+    BATTERY_SYSTEM(0x11, "OptionalMfgFunction2"),
+    BATTERY_SYSTEM(0x12, "OptionalMfgFunction3"),
+    BATTERY_SYSTEM(0x13, "OptionalMfgFunction4"),
+    BATTERY_SYSTEM(0x14, "OptionalMfgFunction5"),
+    BATTERY_SYSTEM(0x15, "ConnectionToSMBus"),
+    BATTERY_SYSTEM(0x16, "OutputConnection"),
+    BATTERY_SYSTEM(0x17, "ChargerConnection"),
+    BATTERY_SYSTEM(0x18, "BatteryInsertion"),
+    BATTERY_SYSTEM(0x19, "UseNext"),
+    BATTERY_SYSTEM(0x1a, "OKToUse"),
+    BATTERY_SYSTEM(0x1b, "BatterySupported"),
+    BATTERY_SYSTEM(0x1c, "SelectorRevision"),
+    BATTERY_SYSTEM(0x1d, "ChargingIndicator"),
+    BATTERY_SYSTEM(0x28, "ManufacturerAccess"),
+    BATTERY_SYSTEM_UNIT(0x29, "RemainingCapacityLimit", Percent),
+    BATTERY_SYSTEM_UNIT(0x2a, "RemainingTimeLimit", Second),
+    BATTERY_SYSTEM(0x2b, "AtRate"),
+    BATTERY_SYSTEM(0x2c, "CapacityMode"),
+    BATTERY_SYSTEM(0x2d, "BroadcastToCharger"),
+    BATTERY_SYSTEM(0x2e, "PrimaryBattery"),
+    BATTERY_SYSTEM(0x2f, "ChargeController"),
+    BATTERY_SYSTEM(0x40, "TerminateCharge"),
+    BATTERY_SYSTEM(0x41, "TerminateDischarge"),
+    BATTERY_SYSTEM(0x42, "BelowRemainingCapacityLimit"),
+    BATTERY_SYSTEM(0x43, "RemainingTimeLimitExpired"),
+    BATTERY_SYSTEM(0x44, "Charging"),
+    BATTERY_SYSTEM(0x45, "Discharging"),
+    BATTERY_SYSTEM(0x46, "FullyCharged"),
+    BATTERY_SYSTEM(0x47, "FullyDischarged"),
+    BATTERY_SYSTEM(0x48, "ConditioningFlag"),
+    BATTERY_SYSTEM(0x49, "AtRateOK"),
+    BATTERY_SYSTEM(0x4a, "SMBErrorCode"),
+    BATTERY_SYSTEM(0x4b, "NeedReplacement"),
+    BATTERY_SYSTEM(0x60, "AtRateTimeToFull"),
+    BATTERY_SYSTEM(0x61, "AtRateTimeToEmpty"),
+    BATTERY_SYSTEM(0x62, "AverageCurrent"),
+    BATTERY_SYSTEM(0x63, "MaxError"),
+    BATTERY_SYSTEM_UNIT(0x64, "RelativeStateOfCharge", Percent),
+    BATTERY_SYSTEM_UNIT(0x65, "AbsoluteStateOfCharge", Percent),
+    BATTERY_SYSTEM_UNIT(0x66, "RemainingCapacity", Percent),
+    BATTERY_SYSTEM_UNIT(0x67, "FullChargeCapacity", Percent),
+    BATTERY_SYSTEM_UNIT(0x68, "RunTimeToEmpty", Second),
+    BATTERY_SYSTEM_UNIT(0x69, "AverageTimeToEmpty", Second),
+    BATTERY_SYSTEM_UNIT(0x6a, "AverageTimeToFull", Second),
+    BATTERY_SYSTEM(0x6b, "CycleCount"),
+    BATTERY_SYSTEM(0x80, "BattPackModelLevel"),
+    BATTERY_SYSTEM(0x81, "InternalChargeController"),
+    BATTERY_SYSTEM(0x82, "PrimaryBatterySupport"),
+    BATTERY_SYSTEM_UNIT(0x83, "DesignCapacity", Percent),
+    BATTERY_SYSTEM(0x84, "SpecificationInfo"),
+    BATTERY_SYSTEM(0x85, "ManufacturerDate"),
+    BATTERY_SYSTEM(0x86, "SerialNumber"),
+    BATTERY_SYSTEM(0x87, "iManufacturerName"),
+    BATTERY_SYSTEM(0x88, "iDeviceName"),
+    BATTERY_SYSTEM(0x89, "iDeviceChemistry"),
+    BATTERY_SYSTEM(0x8a, "ManufacturerData"),
+    BATTERY_SYSTEM(0x8b, "Rechargeable"),
+    BATTERY_SYSTEM_UNIT(0x8c, "WarningCapacityLimit", Percent),
+    BATTERY_SYSTEM_UNIT(0x8d, "CapacityGranularity1", Percent),
+    BATTERY_SYSTEM_UNIT(0x8e, "CapacityGranularity2", Percent),
+    BATTERY_SYSTEM(0x8f, "iOEMInformation"),
+    BATTERY_SYSTEM(0xc0, "InhibitCharge"),
+    BATTERY_SYSTEM(0xc1, "EnablePolling"),
+    BATTERY_SYSTEM(0xc2, "ResetToZero"),
+    BATTERY_SYSTEM(0xd0, "ACPresent"),
+    BATTERY_SYSTEM(0xd1, "BatteryPresent"),
+    BATTERY_SYSTEM(0xd2, "PowerFail"),
+    BATTERY_SYSTEM(0xd3, "AlarmInhibited"),
+    BATTERY_SYSTEM(0xd4, "ThermistorUnderRange"),
+    BATTERY_SYSTEM(0xd5, "ThermistorHot"),
+    BATTERY_SYSTEM(0xd6, "ThermistorCold"),
+    BATTERY_SYSTEM(0xd7, "ThermistorOverRange"),
+    BATTERY_SYSTEM(0xd8, "VoltageOutOfRange"),
+    BATTERY_SYSTEM(0xd9, "CurrentOutOfRange"),
+    BATTERY_SYSTEM(0xda, "CurrentNotRegulated"),
+    BATTERY_SYSTEM(0xdb, "VoltageNotRegulated"),
+    BATTERY_SYSTEM(0xdc, "MasterMode"),
+    BATTERY_SYSTEM(0xf0, "ChargerSelectorSupport"),
+    BATTERY_SYSTEM(0xf1, "ChargerSpec"),
+    BATTERY_SYSTEM(0xf2, "Level2"),
+    BATTERY_SYSTEM(0xf3, "Level3"),
+};
+
+static constexpr size_t USAGE_NAMES_COUNT = sizeof(USAGE_NAMES) / sizeof(USAGE_NAMES[0]);
+
+static constexpr bool isSorted(size_t index = 1)
+{
+    return index >= USAGE_NAMES_COUNT ? true :
+        ((USAGE_NAMES[index - 1].id < USAGE_NAMES[index].id) && isSorted(index + 1));
+}
+static_assert(isSorted(), "USAGE_NAMES must be sorted by id for binary search");
+
+/**
+ * Gets the entry of a usage (nullptr if unknown)
+ */
+static const HIDUsageEntry* findUsage(uint16_t usagePage, uint16_t usage)
+{
+    uint32_t id = (static_cast<uint32_t>(usagePage) << 16) | usage;
+    size_t low = 0;
+    size_t high = USAGE_NAMES_COUNT;
+    while(low < high){
+        size_t middle = low + (high - low) / 2;
+        if(USAGE_NAMES[middle].id < id){
+            low = middle + 1;
+        }else{
+            high = middle;
+        }
+    }
+    if((low < USAGE_NAMES_COUNT) && (USAGE_NAMES[low].id == id)){
+        return &USAGE_NAMES[low];
+    }
+    return nullptr;
+}
+
+const char* hidUsageName(uint16_t usagePage, uint16_t usage)
+{
+    const HIDUsageEntry* entry = findUsage(usagePage, usage);
+    return entry ? entry->name : nullptr;
+}
+
+HIDUnit hidUsageUnit(uint16_t usagePage, uint16_t usage)
+{
+    const HIDUsageEntry* entry = findUsage(usagePage, usage);
+    return entry ? entry->unit : HIDUnit::None;
+}
+
+bool hidUsageFromName(const char* name, uint16_t& usagePage, uint16_t& usage)
+{
+    //Only used by commands, a linear scan is enough
+    for(const HIDUsageEntry& entry : USAGE_NAMES){
+        if(strcmp(entry.name, name) == 0){
+            usagePage = entry.id >> 16;
+            usage = entry.id & 0xFFFF;
+            return true;
+        }
+    }
+    return false;
+}
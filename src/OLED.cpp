@@ -10,15 +10,46 @@
 #include <ETH.h>
 #include <Temperature.hpp>
 #include <UPSHIDDevice.hpp>
+#include <UPSEvents.hpp>
+#include <UPSState.hpp>
 #include <DevicePins.hpp>
 
 #define SCREEN_WIDTH 128 // OLED display width, in pixels
 #define SCREEN_HEIGHT 32 // OLED display height, in pixels
 #define OLED_RESET     -1 // Reset pin # (or -1 if sharing Arduino reset pin)
 #define SCREEN_ADDRESS 0x3C ///< See datasheet for Address; 0x3D for 128x64, 0x3C for 128x32
+#define OLED_UPS_HOLDOFF_MS 200     // Minimum time between two redraws caused by the UPS
+#define OLED_IDLE_REFRESH_MS 1000   // Redraw period without events (temperature)
 
 static const char* TAG = "OLED";
 
+static TaskHandle_t oledTaskHandle = nullptr;
+
+/**
+ * User button changed, wakes the display task
+ */
+static void IRAM_ATTR buttonISR()
+{
+    BaseType_t woken = pdFALSE;
+    if(oledTaskHandle != nullptr){
+        vTaskNotifyGiveFromISR(oledTaskHandle, &woken);
+    }
+    portYIELD_FROM_ISR(woken);
+}
+
+/**
+ * Gets the page of the first connected UPS from an index (0 if none)
+ */
+static uint8_t nextUPSPage(uint8_t fromIndex)
+{
+    for(uint8_t i=fromIndex;i<UPS_MAX_DEVICES;++i){
+        if(upsDevices[i].isConnected()){
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
 LogoAnimation::LogoAnimation() : step_(0)
 {
 
@@ -96,6 +127,12 @@ void Display::oledTask(void* param)
     display->display_.setTextColor(SSD1306_WHITE); // Draw white text
     display->display_.cp437(true);          // Use full 256 char 'Code Page 437' font
 
+    //Woken by the UPS changes and the button instead of polling
+    oledTaskHandle = xTaskGetCurrentTaskHandle();
+    UPSEventBus::Subscriber events = upsEvents.subscribe(UPSEventBus::CONNECTION | UPSEventBus::READINGS | UPSEventBus::STATE,
+                                                            oledTaskHandle, OLED_UPS_HOLDOFF_MS);
+    attachInterrupt(digitalPinToInterrupt(USER_BUTTON_PIN), buttonISR, CHANGE);
+
     uint8_t actualPage = 0;                 //Actual displayed page
     uint8_t nextPage = 0;                   //Next page to be displayed
     uint32_t lastPageChange = millis();     //Last page change timestamp
@@ -118,36 +155,50 @@ void Display::oledTask(void* param)
                         display->display_.printf("Temperature: -- C");
                     }
                     display->display_.setCursor(0, 24);
-                    bool upsConnected = upsDevice.isConnected();
-                    display->display_.printf("UPS: %s", upsConnected ? "CONNECTED" : "DISCONNECTED");
-                    pageDelay = 3000;
-                    if(upsConnected){
-                        nextPage = 1;
+                    uint8_t upsConnected = 0;
+                    for(const UPSHIDDevice& ups : upsDevices){
+                        upsConnected += ups.isConnected() ? 1 : 0;
+                    }
+                    if(upsConnected > 1){
+                        display->display_.printf("UPS: %u CONNECTED", upsConnected);
                     }else{
-                        nextPage = actualPage;
+                        display->display_.printf("UPS: %s", upsConnected ? "CONNECTED" : "DISCONNECTED");
                     }
+                    pageDelay = 3000;
+                    nextPage = nextUPSPage(0);
                 }
                 break;
-            case 1:
+            case 1 ... UPS_MAX_DEVICES:
                 {
+                    //One page per connected UPS
+                    uint8_t index = actualPage - 1;
+                    UpsSnapshot snapshot;
+                    upsDevices[index].getSnapshot(snapshot);
+                    uint16_t state = upsState.getFlags(index);
                     display->display_.setCursor(0, 0);
-                    if(upsDevice.getACPresent().isUsed()){
-                        display->display_.printf("AC : %s", upsDevice.getACPresent().getValue() ? "PRESENT" : "NOT PRESENT");
+                    if(state & (UPSState::ONLINE | UPSState::ON_BATTERY)){
+                        display->display_.printf("UPS %u AC: %s", index + 1, (state & UPSState::ONLINE) ? "PRESENT" : "NOT PRESENT");
                     }
                     display->display_.setCursor(0, 12);
-                    if(upsDevice.getBatteryPresent().isUsed()){
-                        display->display_.printf("Battery : %s", upsDevice.getBatteryPresent().getValue() ? "PRESENT" : "MISSING");
+                    if(state & UPSState::NO_BATTERY){
+                        display->display_.printf("Battery : MISSING");
+                    }else if(state & UPSState::REPLACE_BATTERY){
+                        display->display_.printf("Battery : REPLACE");
+                    }else if(state & UPSState::LOW_BATTERY){
+                        display->display_.printf("Battery : LOW");
+                    }else if(snapshot.isUsed(UpsSnapshot::BATTERY_PRESENT)){
+                        display->display_.printf("Battery : PRESENT");
                     }
                     display->display_.setCursor(0, 24);
-                    if(upsDevice.getRemainingCapacity().isUsed()){
-                        display->display_.printf("Capacity : %d %%", (int32_t)upsDevice.getRemainingCapacity().getValue());
+                    if(snapshot.isUsed(UpsSnapshot::REMAINING_CAPACITY)){
+                        display->display_.printf("Capacity : %d %%", (int)snapshot.getValue(UpsSnapshot::REMAINING_CAPACITY));
                     }
-                    if(!upsDevice.isConnected()){
+                    if(!snapshot.connected){
                         pageDelay = 0;
                     }else{
                         pageDelay = 3000;
                     }
-                    nextPage = 0;
+                    nextPage = nextUPSPage(index + 1);
                 }
                 break;
            default:
@@ -177,8 +228,9 @@ void Display::oledTask(void* param)
                 btnPressed = false;
             }
         }else{
-            //Refresh every 50ms
-            delay(50);
+            //Sleep until a UPS change, the button, the page end or the idle refresh
+            uint32_t remaining = std::min<uint32_t>(pageDelay - (now - lastPageChange), OLED_IDLE_REFRESH_MS);
+            upsEvents.wait(events, pdMS_TO_TICKS(remaining) + 1);
         }
         lastButton = btnState;
         
@@ -0,0 +1,215 @@
+#include <ReportCapture.hpp>
+#include "esp_log.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+static const char* TAG = "ReportCapture";
+
+ReportCapture reportCapture;
+
+/**
+ * Groups the small writes of a dump in chunks
+ */
+class ChunkWriter
+{
+public:
+    ChunkWriter(ReportCapture::Writer writer, void* context) : writer_(writer), context_(context), ok_(true)
+    {
+        buffer_.reserve(CAPTURE_CHUNK_SIZE);
+    }
+
+    /**
+     * Appends data, the chunk is written when full
+     * @return false if the writer failed
+     */
+    bool write(const void* data, size_t len)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        while(ok_ && (len > 0)){
+            size_t count = std::min(len, CAPTURE_CHUNK_SIZE - buffer_.size());
+            buffer_.insert(buffer_.end(), bytes, bytes + count);
+            bytes += count;
+            len -= count;
+            if(buffer_.size() == CAPTURE_CHUNK_SIZE){
+                flush();
+            }
+        }
+        return ok_;
+    }
+
+    /**
+     * Writes the pending chunk
+     * @return false if the writer failed
+     */
+    bool flush()
+    {
+        if(ok_ && !buffer_.empty()){
+            ok_ = writer_(context_, buffer_.data(), buffer_.size());
+            buffer_.clear();
+        }
+        return ok_;
+    }
+
+private:
+    ReportCapture::Writer writer_;
+    void* context_;
+    std::vector<uint8_t> buffer_;
+    bool ok_;
+};
+
+ReportCapture::ReportCapture() : slots_(nullptr), head_(0)
+{
+    for(Device& device : devices_){
+        device.valid = false;
+        device.idVendor = 0;
+        device.idProduct = 0;
+        device.bcdDevice = 0;
+    }
+    mutexDevices_ = xSemaphoreCreateMutex();
+    if(mutexDevices_ == NULL){
+        ESP_LOGE(TAG, "Unable to create devices mutex");
+    }
+}
+
+void ReportCapture::begin()
+{
+    if(slots_ != nullptr){
+        return;
+    }
+    if(!psramFound()){
+        ESP_LOGW(TAG, "No PSRAM, reports are not captured");
+        return;
+    }
+    Slot* slots = static_cast<Slot*>(ps_malloc(sizeof(Slot) * CAPTURE_RING_SLOTS));
+    if(slots == nullptr){
+        ESP_LOGE(TAG, "Unable to allocate %u capture slots", CAPTURE_RING_SLOTS);
+        return;
+    }
+    for(uint32_t i=0;i<CAPTURE_RING_SLOTS;++i){
+        new (&slots[i].sequence) std::atomic<uint32_t>(0);
+    }
+    slots_ = slots;
+    ESP_LOGI(TAG, "Capturing the last %u reports (%u bytes)", CAPTURE_RING_SLOTS, (unsigned)(sizeof(Slot) * CAPTURE_RING_SLOTS));
+}
+
+void ReportCapture::capture(uint8_t device, CaptureRecordHeader::Type type, const uint8_t* data, size_t len)
+{
+    if(slots_ == nullptr){
+        return;
+    }
+    uint32_t index = head_.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = slots_[index & (CAPTURE_RING_SLOTS - 1)];
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    uint16_t length = std::min<size_t>(len, CAPTURE_SLOT_DATA);
+    slot.header = {static_cast<uint32_t>(millis()), device, type, length};
+    if(length > 0){
+        memcpy(slot.data, data, length);
+    }
+    slot.sequence.store(index + 1, std::memory_order_release);
+}
+
+void ReportCapture::setDeviceDescriptor(uint8_t device, uint16_t idVendor, uint16_t idProduct, uint16_t bcdDevice)
+{
+    if((device >= UPS_MAX_DEVICES) || (xSemaphoreTake(mutexDevices_, portMAX_DELAY) != pdTRUE)){
+        return;
+    }
+    //New enumeration, the report descriptor validates it
+    devices_[device].valid = false;
+    devices_[device].idVendor = idVendor;
+    devices_[device].idProduct = idProduct;
+    devices_[device].bcdDevice = bcdDevice;
+    xSemaphoreGive(mutexDevices_);
+}
+
+void ReportCapture::setStrings(uint8_t device, const char* manufacturer, const char* product, const char* serial)
+{
+    if((device >= UPS_MAX_DEVICES) || (xSemaphoreTake(mutexDevices_, portMAX_DELAY) != pdTRUE)){
+        return;
+    }
+    //Lengths are stored on a byte
+    devices_[device].manufacturer.assign(manufacturer, std::min<size_t>(strlen(manufacturer), UINT8_MAX));
+    devices_[device].product.assign(product, std::min<size_t>(strlen(product), UINT8_MAX));
+    devices_[device].serial.assign(serial, std::min<size_t>(strlen(serial), UINT8_MAX));
+    xSemaphoreGive(mutexDevices_);
+}
+
+void ReportCapture::setReportDescriptor(uint8_t device, const uint8_t* data, size_t len)
+{
+    if((device >= UPS_MAX_DEVICES) || (xSemaphoreTake(mutexDevices_, portMAX_DELAY) != pdTRUE)){
+        return;
+    }
+    devices_[device].descriptor.assign(data, data + std::min<size_t>(len, UINT16_MAX));
+    devices_[device].valid = true;
+    xSemaphoreGive(mutexDevices_);
+    capture(device, CaptureRecordHeader::PLUG, nullptr, 0);
+}
+
+bool ReportCapture::readSlot(uint32_t index, CaptureRecordHeader& header, uint8_t* data) const
+{
+    const Slot& slot = slots_[index & (CAPTURE_RING_SLOTS - 1)];
+    if(slot.sequence.load(std::memory_order_acquire) != index + 1){
+        return false;
+    }
+    header = slot.header;
+    memcpy(data, slot.data, std::min<size_t>(header.length, CAPTURE_SLOT_DATA));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.sequence.load(std::memory_order_relaxed) == index + 1;
+}
+
+bool ReportCapture::dump(Writer writer, void* context) const
+{
+    //Enumeration data is copied so the USB task never waits for the network
+    std::vector<std::pair<uint8_t, Device>> devices;
+    if(xSemaphoreTake(mutexDevices_, portMAX_DELAY) == pdTRUE){
+        for(uint8_t i=0;i<UPS_MAX_DEVICES;++i){
+            if(devices_[i].valid){
+                devices.emplace_back(i, devices_[i]);
+            }
+        }
+        xSemaphoreGive(mutexDevices_);
+    }
+
+    ChunkWriter out(writer, context);
+    uint32_t end = head_.load(std::memory_order_acquire);
+    CaptureFileHeader fileHeader = {};
+    memcpy(fileHeader.magic, CAPTURE_MAGIC, sizeof(fileHeader.magic));
+    fileHeader.version = CAPTURE_VERSION;
+    fileHeader.deviceCount = devices.size();
+    fileHeader.captureCount = end;
+    fileHeader.timeMs = millis();
+    out.write(&fileHeader, sizeof(fileHeader));
+    for(const auto& entry : devices){
+        const Device& device = entry.second;
+        CaptureDeviceHeader deviceHeader = {
+            entry.first, (uint8_t)device.manufacturer.size(), (uint8_t)device.product.size(), (uint8_t)device.serial.size(),
+            device.idVendor, device.idProduct, device.bcdDevice, (uint16_t)device.descriptor.size()
+        };
+        out.write(&deviceHeader, sizeof(deviceHeader));
+        out.write(device.manufacturer.data(), device.manufacturer.size());
+        out.write(device.product.data(), device.product.size());
+        out.write(device.serial.data(), device.serial.size());
+        out.write(device.descriptor.data(), device.descriptor.size());
+    }
+
+    if(slots_ != nullptr){
+        //Slots overwritten while we copy (or still written) are skipped
+        uint32_t skipped = 0;
+        uint8_t data[CAPTURE_SLOT_DATA];
+        CaptureRecordHeader header;
+        for(uint32_t index=(end > CAPTURE_RING_SLOTS ? end - CAPTURE_RING_SLOTS : 0);index!=end;++index){
+            if(!readSlot(index, header, data)){
+                ++skipped;
+                continue;
+            }
+            if(!out.write(&header, sizeof(header)) || !out.write(data, header.length)){
+                break;
+            }
+        }
+        if(skipped > 0){
+            ESP_LOGW(TAG, "%u reports overwritten during the dump", skipped);
+        }
+    }
+    return out.flush();
+}
@@ -0,0 +1,359 @@
+#include <SNMPBer.hpp>
+#include <cstdlib>
+#include <cstring>
+
+SnmpError snmpErrorToV1(SnmpError error)
+{
+    switch(error){
+        case SNMP_NO_ERROR:
+        case SNMP_TOO_BIG:
+        case SNMP_NO_SUCH_NAME:
+        case SNMP_BAD_VALUE:
+        case SNMP_GEN_ERR:
+            return error;
+        case SNMP_NO_ACCESS:
+        case SNMP_NO_CREATION:
+        case SNMP_NOT_WRITABLE:
+            return SNMP_NO_SUCH_NAME;
+        case SNMP_WRONG_TYPE:
+        case SNMP_WRONG_LENGTH:
+        case SNMP_WRONG_VALUE:
+            return SNMP_BAD_VALUE;
+        default:
+            return SNMP_GEN_ERR;
+    }
+}
+
+bool SnmpOid::parse(const char* str)
+{
+    SnmpOid oid;
+    if(*str == '.'){
+        ++str;
+    }
+    while(*str != '\0'){
+        char* end;
+        unsigned long arc = strtoul(str, &end, 10);
+        if((end == str) || (arc > UINT32_MAX) || !oid.append(arc)){
+            return false;
+        }
+        if(*end == '.'){
+            ++end;
+            if(*end == '\0'){
+                return false;
+            }
+        }else if(*end != '\0'){
+            return false;
+        }
+        str = end;
+    }
+    *this = oid;
+    return true;
+}
+
+std::string SnmpOid::toString() const
+{
+    std::string str;
+    for(uint8_t i=0;i<length;++i){
+        str += "." + std::to_string(arcs[i]);
+    }
+    return str;
+}
+
+int SnmpOid::compare(const SnmpOid& other) const
+{
+    uint8_t common = length < other.length ? length : other.length;
+    for(uint8_t i=0;i<common;++i){
+        if(arcs[i] != other.arcs[i]){
+            return arcs[i] < other.arcs[i] ? -1 : 1;
+        }
+    }
+    return static_cast<int>(length) - static_cast<int>(other.length);
+}
+
+bool SnmpOid::startsWith(const SnmpOid& prefix) const
+{
+    if(prefix.length > length){
+        return false;
+    }
+    return memcmp(arcs, prefix.arcs, prefix.length * sizeof(arcs[0])) == 0;
+}
+
+bool SnmpOid::append(uint32_t arc)
+{
+    if(length >= SNMP_OID_MAX_ARCS){
+        return false;
+    }
+    arcs[length++] = arc;
+    return true;
+}
+
+bool BerReader::header(uint8_t& tag, size_t& header, size_t& length) const
+{
+    if((size_ < 2) || ((data_[0] & 0x1f) == 0x1f)){
+        //Truncated or multi-byte tag (not used by SNMP)
+        return false;
+    }
+    tag = data_[0];
+    if(data_[1] < 0x80){
+        header = 2;
+        length = data_[1];
+    }else{
+        //Long form, indefinite length is not allowed
+        size_t count = data_[1] & 0x7f;
+        if((count == 0) || (count > 4) || (size_ < 2 + count)){
+            return false;
+        }
+        length = 0;
+        for(size_t i=0;i<count;++i){
+            length = (length << 8) | data_[2 + i];
+        }
+        header = 2 + count;
+    }
+    return length <= size_ - header;
+}
+
+bool BerReader::read(uint8_t& tag, BerReader& content)
+{
+    size_t head, length;
+    if(!header(tag, head, length)){
+        return false;
+    }
+    content = BerReader(data_ + head, length);
+    data_ += head + length;
+    size_ -= head + length;
+    return true;
+}
+
+bool BerReader::enter(uint8_t tag, BerReader& content)
+{
+    uint8_t found;
+    size_t head, length;
+    if(!header(found, head, length) || (found != tag)){
+        return false;
+    }
+    return read(found, content);
+}
+
+bool BerReader::readRaw(const uint8_t*& tlv, size_t& length)
+{
+    const uint8_t* start = data_;
+    uint8_t tag;
+    BerReader content;
+    if(!read(tag, content)){
+        return false;
+    }
+    tlv = start;
+    length = data_ - start;
+    return true;
+}
+
+bool BerReader::readInteger(uint8_t tag, int64_t& value)
+{
+    BerReader content;
+    BerReader next = *this;
+    //Unsigned types may have a leading zero on top of 8 bytes
+    if(!next.enter(tag, content) || (content.size_ == 0) || (content.size_ > 9) ||
+        ((content.size_ == 9) && (content.data_[0] != 0))){
+        return false;
+    }
+    uint64_t raw = (content.data_[0] & 0x80) ? UINT64_MAX : 0;
+    for(size_t i=0;i<content.size_;++i){
+        raw = (raw << 8) | content.data_[i];
+    }
+    value = static_cast<int64_t>(raw);
+    *this = next;
+    return true;
+}
+
+bool BerReader::readInteger(int32_t& value)
+{
+    BerReader next = *this;
+    int64_t wide;
+    if(!next.readInteger(BER_INTEGER, wide) || (wide < INT32_MIN) || (wide > INT32_MAX)){
+        return false;
+    }
+    value = wide;
+    *this = next;
+    return true;
+}
+
+bool BerReader::readString(const uint8_t*& str, size_t& length)
+{
+    BerReader content;
+    if(!enter(BER_OCTET_STRING, content)){
+        return false;
+    }
+    str = content.data_;
+    length = content.size_;
+    return true;
+}
+
+bool BerReader::readOid(SnmpOid& oid)
+{
+    BerReader content;
+    BerReader next = *this;
+    if(!next.enter(BER_OID, content)){
+        return false;
+    }
+    SnmpOid decoded;
+    uint64_t arc = 0;
+    for(size_t i=0;i<content.size_;++i){
+        arc = (arc << 7) | (content.data_[i] & 0x7f);
+        if(arc > UINT32_MAX + 80ull){
+            return false;
+        }
+        if(content.data_[i] & 0x80){
+            continue;
+        }
+        if(decoded.length == 0){
+            //First subidentifier holds the first two arcs
+            uint32_t first = arc < 40 ? 0 : (arc < 80 ? 1 : 2);
+            decoded.append(first);
+            arc -= first * 40;
+        }
+        if((arc > UINT32_MAX) || !decoded.append(arc)){
+            return false;
+        }
+        arc = 0;
+    }
+    if((content.size_ != 0) && (content.data_[content.size_ - 1] & 0x80)){
+        //Last subidentifier not terminated
+        return false;
+    }
+    oid = decoded;
+    *this = next;
+    return true;
+}
+
+uint8_t* BerWriter::reserve(size_t length)
+{
+    if(overflow_ || (length > capacity_ - size_)){
+        overflow_ = true;
+        return nullptr;
+    }
+    uint8_t* ptr = buffer_ + size_;
+    size_ += length;
+    return ptr;
+}
+
+void BerWriter::header(uint8_t tag, size_t length)
+{
+    size_t count = length < 0x80 ? 0 : (length <= 0xff ? 1 : 2);
+    uint8_t* ptr = reserve(2 + count);
+    if(ptr == nullptr){
+        return;
+    }
+    ptr[0] = tag;
+    if(count == 0){
+        ptr[1] = length;
+    }else{
+        ptr[1] = 0x80 | count;
+        for(size_t i=0;i<count;++i){
+            ptr[2 + i] = length >> (8 * (count - 1 - i));
+        }
+    }
+}
+
+size_t BerWriter::begin(uint8_t tag)
+{
+    //Length written by end, one byte until then
+    size_t mark = size_ + 1;
+    uint8_t* ptr = reserve(2);
+    if(ptr != nullptr){
+        ptr[0] = tag;
+    }
+    return mark;
+}
+
+void BerWriter::end(size_t mark)
+{
+    if(overflow_){
+        return;
+    }
+    size_t length = size_ - mark - 1;
+    size_t count = length < 0x80 ? 0 : (length <= 0xff ? 1 : 2);
+    if(count != 0){
+        //Long form, the value moves after the length bytes
+        if(reserve(count) == nullptr){
+            return;
+        }
+        memmove(buffer_ + mark + 1 + count, buffer_ + mark + 1, length);
+        buffer_[mark] = 0x80 | count;
+        for(size_t i=0;i<count;++i){
+            buffer_[mark + 1 + i] = length >> (8 * (count - 1 - i));
+        }
+    }else{
+        buffer_[mark] = length;
+    }
+}
+
+void BerWriter::writeInteger(uint8_t tag, int64_t value)
+{
+    //Shortest two's complement encoding
+    size_t count = 1;
+    while((count < 8) && ((value < -(INT64_C(1) << (8 * count - 1))) || (value >= (INT64_C(1) << (8 * count - 1))))){
+        ++count;
+    }
+    header(tag, count);
+    uint8_t* ptr = reserve(count);
+    if(ptr == nullptr){
+        return;
+    }
+    for(size_t i=0;i<count;++i){
+        ptr[i] = static_cast<uint64_t>(value) >> (8 * (count - 1 - i));
+    }
+}
+
+void BerWriter::writeString(uint8_t tag, const void* data, size_t length)
+{
+    header(tag, length);
+    uint8_t* ptr = reserve(length);
+    if((ptr != nullptr) && (length != 0)){
+        memcpy(ptr, data, length);
+    }
+}
+
+void BerWriter::writeOid(const SnmpOid& oid)
+{
+    uint8_t encoded[SNMP_OID_MAX_ARCS * 5];
+    size_t length = 0;
+    auto encode = [&encoded, &length](uint64_t arc){
+        uint8_t bytes[10];
+        size_t count = 0;
+        do{
+            bytes[count++] = arc & 0x7f;
+            arc >>= 7;
+        }while(arc != 0);
+        while(count > 0){
+            --count;
+            encoded[length++] = bytes[count] | (count != 0 ? 0x80 : 0);
+        }
+    };
+    //First two arcs share a subidentifier (0.0 for shorter OID)
+    encode((oid.length > 0 ? oid.arcs[0] * 40ull : 0) + (oid.length > 1 ? oid.arcs[1] : 0));
+    for(uint8_t i=2;i<oid.length;++i){
+        encode(oid.arcs[i]);
+    }
+    writeString(BER_OID, encoded, length);
+}
+
+void BerWriter::writeNull(uint8_t tag)
+{
+    header(tag, 0);
+}
+
+void BerWriter::writeRaw(const uint8_t* data, size_t length)
+{
+    uint8_t* ptr = reserve(length);
+    if(ptr != nullptr){
+        memcpy(ptr, data, length);
+    }
+}
+
+void BerWriter::truncate(size_t size)
+{
+    if(size <= size_){
+        size_ = size;
+    }
+    overflow_ = false;
+}
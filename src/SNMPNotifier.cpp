@@ -0,0 +1,307 @@
+#include <SNMPNotifier.hpp>
+#include <UPSMib.hpp>
+#include <ETH.h>
+#include <esp_log.h>
+#include <algorithm>
+#include <cstring>
+#include <lwip/sockets.h>
+
+static const char* TAG = "SNMP";
+
+static const char* TRAP_OID = ".1.3.6.1.2.1.33.2";                  //upsTraps
+static const char* SNMP_TRAP_OID = ".1.3.6.1.6.3.1.1.4.1.0";        //snmpTrapOID.0
+
+SNMPNotifier::SNMPNotifier() : queue_{}, informs_{}, notified_{}, lastSentMs_{}, nextRequestId_(1),
+                    sent_(0), merged_(0), dropped_(0), acknowledged_(0)
+{
+}
+
+void SNMPNotifier::setTargets(const std::vector<DeviceConfiguration::SNMPTrapTarget>& targets)
+{
+    targets_ = targets;
+    ESP_LOGI(TAG, "%u notification receiver(s)", static_cast<unsigned>(targets_.size()));
+}
+
+void SNMPNotifier::notify(uint8_t index, Trap trap, int32_t minutesRemaining, uint32_t alarmId, uint8_t alarmType)
+{
+    if(!enabled()){
+        return;
+    }
+    uint32_t timeCs = millis() / 10;
+    Notification* free = nullptr;
+    Notification* oldest = nullptr;
+    for(Notification& notification : queue_){
+        if(!notification.queued){
+            free = free != nullptr ? free : &notification;
+            continue;
+        }
+        if((notification.index == index) && (notification.trap == trap) && (notification.alarmType == alarmType)){
+            //Still in the holdoff, sent once with the latest values
+            notification.timeCs = timeCs;
+            notification.minutes = minutesRemaining;
+            notification.alarmId = alarmId;
+            ++notification.merged;
+            ++merged_;
+            return;
+        }
+        if((oldest == nullptr) || (timeCs - notification.timeCs > timeCs - oldest->timeCs)){
+            oldest = &notification;
+        }
+    }
+    if(free == nullptr){
+        ESP_LOGW(TAG, "Notification queue full, UPS %u trap %u dropped", oldest->index + 1, oldest->trap);
+        ++dropped_;
+        free = oldest;
+    }
+    *free = {true, index, trap, timeCs, minutesRemaining, alarmId, alarmType, 0};
+}
+
+void SNMPNotifier::service(int socket, uint32_t nowMs)
+{
+    for(Inform& inform : informs_){
+        if(!inform.active || (nowMs - inform.sentMs < SNMP_INFORM_TIMEOUT_MS)){
+            continue;
+        }
+        if(inform.retries >= SNMP_INFORM_RETRIES){
+            ESP_LOGW(TAG, "INFORM %d not acknowledged", inform.requestId);
+            inform.active = false;
+            ++dropped_;
+            continue;
+        }
+        ++inform.retries;
+        inform.sentMs = nowMs;
+        sendTo(socket, inform.ip, inform.port, inform.message, inform.length);
+    }
+
+    //Every notification of a UPS out of its holdoff goes, then the holdoff starts again
+    bool due[UPS_MAX_DEVICES];
+    for(uint8_t i=0;i<UPS_MAX_DEVICES;++i){
+        due[i] = !notified_[i] || (nowMs - lastSentMs_[i] >= SNMP_TRAP_HOLDOFF_MS);
+    }
+    uint32_t nowCs = nowMs / 10;
+    for(;;){
+        //Oldest first, an alarm removed after it was added
+        Notification* oldest = nullptr;
+        for(Notification& notification : queue_){
+            if(notification.queued && due[notification.index] &&
+                ((oldest == nullptr) || (nowCs - notification.timeCs > nowCs - oldest->timeCs))){
+                oldest = &notification;
+            }
+        }
+        if(oldest == nullptr){
+            break;
+        }
+        send(socket, *oldest, nowMs);
+        oldest->queued = false;
+        notified_[oldest->index] = true;
+        lastSentMs_[oldest->index] = nowMs;
+    }
+}
+
+uint32_t SNMPNotifier::nextDue(uint32_t nowMs) const
+{
+    uint32_t next = UINT32_MAX;
+    for(const Inform& inform : informs_){
+        if(inform.active){
+            uint32_t elapsed = nowMs - inform.sentMs;
+            next = std::min(next, elapsed < SNMP_INFORM_TIMEOUT_MS ? SNMP_INFORM_TIMEOUT_MS - elapsed : 0);
+        }
+    }
+    for(const Notification& notification : queue_){
+        if(notification.queued){
+            uint32_t elapsed = nowMs - lastSentMs_[notification.index];
+            bool held = notified_[notification.index] && (elapsed < SNMP_TRAP_HOLDOFF_MS);
+            next = std::min(next, held ? SNMP_TRAP_HOLDOFF_MS - elapsed : 0);
+        }
+    }
+    return next;
+}
+
+bool SNMPNotifier::acknowledge(const uint8_t* message, size_t length, uint32_t from)
+{
+    BerReader reader(message, length);
+    BerReader fields, pdu;
+    int32_t version, requestId;
+    const uint8_t* community;
+    size_t communityLength;
+    uint8_t type;
+    if(!reader.enter(BER_SEQUENCE, fields) || !fields.readInteger(version) ||
+        !fields.readString(community, communityLength) || !fields.read(type, pdu) || (type != PDU_RESPONSE)){
+        return false;
+    }
+    if((version != SNMP_VERSION_2C) || !pdu.readInteger(requestId)){
+        return true;
+    }
+    for(Inform& inform : informs_){
+        if(inform.active && (inform.requestId == requestId) && (inform.ip == from)){
+            ESP_LOGD(TAG, "INFORM %d acknowledged", requestId);
+            inform.active = false;
+            ++acknowledged_;
+            break;
+        }
+    }
+    return true;
+}
+
+void SNMPNotifier::toJSON(JsonObject& snmp) const
+{
+    snmp["Traps_sent"] = sent_.load(std::memory_order_relaxed);
+    snmp["Traps_merged"] = merged_.load(std::memory_order_relaxed);
+    snmp["Traps_dropped"] = dropped_.load(std::memory_order_relaxed);
+    snmp["Informs_acknowledged"] = acknowledged_.load(std::memory_order_relaxed);
+}
+
+void SNMPNotifier::send(int socket, const Notification& notification, uint32_t nowMs)
+{
+    if(notification.merged != 0){
+        ESP_LOGI(TAG, "UPS %u trap %u, %u merged", notification.index + 1, notification.trap, notification.merged);
+    }
+    for(const DeviceConfiguration::SNMPTrapTarget& target : targets_){
+        int32_t requestId = nextRequestId_;
+        nextRequestId_ = (nextRequestId_ == INT32_MAX) ? 1 : nextRequestId_ + 1;
+        uint8_t buffer[SNMP_NOTIFY_MAX_MESSAGE];
+        BerWriter writer(buffer, sizeof(buffer));
+        if(!encode(target, notification, requestId, writer)){
+            ESP_LOGE(TAG, "Notification too long for %s", target.ip.toString().c_str());
+            continue;
+        }
+        uint32_t ip = static_cast<uint32_t>(target.ip);
+        if(target.type == DeviceConfiguration::SNMPTrapTarget::Type::INFORM){
+            Inform* slot = nullptr;
+            for(Inform& inform : informs_){
+                if(!inform.active){
+                    slot = &inform;
+                    break;
+                }
+                if((slot == nullptr) || (nowMs - inform.sentMs > nowMs - slot->sentMs)){
+                    slot = &inform;
+                }
+            }
+            if(slot->active){
+                ESP_LOGW(TAG, "Too many INFORMs pending, INFORM %d dropped", slot->requestId);
+                ++dropped_;
+            }
+            slot->active = true;
+            slot->requestId = requestId;
+            slot->ip = ip;
+            slot->port = target.port;
+            slot->retries = 0;
+            slot->sentMs = nowMs;
+            slot->length = writer.size();
+            memcpy(slot->message, writer.data(), writer.size());
+        }
+        if(sendTo(socket, ip, target.port, writer.data(), writer.size())){
+            ++sent_;
+        }
+    }
+}
+
+bool SNMPNotifier::encode(const DeviceConfiguration::SNMPTrapTarget& target, const Notification& notification,
+                    int32_t requestId, BerWriter& writer) const
+{
+    bool v1 = (target.type == DeviceConfiguration::SNMPTrapTarget::Type::V1);
+    size_t message = writer.begin(BER_SEQUENCE);
+    writer.writeInteger(BER_INTEGER, v1 ? SNMP_VERSION_1 : SNMP_VERSION_2C);
+    writer.writeString(target.community);
+    SnmpOid oid;
+    size_t pdu;
+    if(v1){
+        //Trap-PDU, enterprise specific trap of upsTraps (RFC 3584 translation of the SMIv2 notification)
+        pdu = writer.begin(PDU_TRAP_V1);
+        oid.parse(TRAP_OID);
+        writer.writeOid(oid);
+        IPAddress local = ETH.localIP();
+        uint8_t agentAddress[4] = {local[0], local[1], local[2], local[3]};
+        writer.writeString(BER_IP_ADDRESS, agentAddress, sizeof(agentAddress));
+        writer.writeInteger(BER_INTEGER, 6);    //enterpriseSpecific
+        writer.writeInteger(BER_INTEGER, notification.trap);
+        writer.writeInteger(BER_TIMETICKS, notification.timeCs);
+    }else{
+        pdu = writer.begin(target.type == DeviceConfiguration::SNMPTrapTarget::Type::INFORM ? PDU_INFORM : PDU_TRAP_V2);
+        writer.writeInteger(BER_INTEGER, requestId);
+        writer.writeInteger(BER_INTEGER, SNMP_NO_ERROR);
+        writer.writeInteger(BER_INTEGER, 0);
+    }
+    size_t list = writer.begin(BER_SEQUENCE);
+    if(!v1){
+        size_t varbind = writer.begin(BER_SEQUENCE);
+        oid.parse(UPSMib::OBJECTS[UPSMib::SYS_UP_TIME].oid);
+        oid.append(0);
+        writer.writeOid(oid);
+        writer.writeInteger(BER_TIMETICKS, notification.timeCs);
+        writer.end(varbind);
+        varbind = writer.begin(BER_SEQUENCE);
+        oid.parse(SNMP_TRAP_OID);
+        writer.writeOid(oid);
+        oid.parse(TRAP_OID);
+        oid.append(notification.trap);
+        writer.writeOid(oid);
+        writer.end(varbind);
+    }
+    if(notification.minutes >= 0){
+        //RFC 1628 instance for the first UPS, UPS number for the others
+        size_t varbind = writer.begin(BER_SEQUENCE);
+        oid.parse(UPSMib::OBJECTS[UPSMib::MINUTES_REMAINING].oid);
+        oid.append(notification.index == 0 ? 0 : notification.index + 1);
+        writer.writeOid(oid);
+        writer.writeInteger(BER_INTEGER, notification.minutes);
+        writer.end(varbind);
+    }
+    if(notification.trap != TRAP_ON_BATTERY){
+        //upsAlarmId and upsAlarmDescr of the row, instance of upsAlarmTable
+        size_t varbind = writer.begin(BER_SEQUENCE);
+        oid.parse(UPSMib::OBJECTS[UPSMib::ALARM_ID].oid);
+        oid.append(notification.alarmId);
+        if(notification.index != 0){
+            oid.append(notification.index + 1);
+        }
+        writer.writeOid(oid);
+        writer.writeInteger(BER_INTEGER, notification.alarmId);
+        writer.end(varbind);
+        varbind = writer.begin(BER_SEQUENCE);
+        oid.parse(UPSMib::OBJECTS[UPSMib::ALARM_DESCR].oid);
+        oid.append(notification.alarmId);
+        if(notification.index != 0){
+            oid.append(notification.index + 1);
+        }
+        writer.writeOid(oid);
+        SnmpOid descr;
+        descr.parse(UPSMib::WELL_KNOWN_ALARMS);
+        descr.append(notification.alarmType);
+        writer.writeOid(descr);
+        writer.end(varbind);
+    }
+    size_t varbind = writer.begin(BER_SEQUENCE);
+    oid.parse(UPSMib::OBJECTS[UPSMib::SYS_NAME].oid);
+    oid.append(0);
+    writer.writeOid(oid);
+    const char* name = ETH.getHostname();
+    writer.writeString(BER_OCTET_STRING, name, strlen(name));
+    writer.end(varbind);
+    if(v1){
+        //sysUpTime is the time-stamp of the Trap-PDU, listed for the receivers reading the variable bindings only
+        varbind = writer.begin(BER_SEQUENCE);
+        oid.parse(UPSMib::OBJECTS[UPSMib::SYS_UP_TIME].oid);
+        oid.append(0);
+        writer.writeOid(oid);
+        writer.writeInteger(BER_TIMETICKS, notification.timeCs);
+        writer.end(varbind);
+    }
+    writer.end(list);
+    writer.end(pdu);
+    writer.end(message);
+    return !writer.overflow();
+}
+
+bool SNMPNotifier::sendTo(int socket, uint32_t ip, uint16_t port, const uint8_t* message, size_t length)
+{
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = ip;
+    if(sendto(socket, message, length, 0, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0){
+        ESP_LOGW(TAG, "Unable to send notification (%d)", errno);
+        return false;
+    }
+    return true;
+}
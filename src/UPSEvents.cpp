@@ -0,0 +1,92 @@
+#include <UPSEvents.hpp>
+#include "esp_log.h"
+#include <algorithm>
+
+static const char* TAG = "UPSEvents";
+
+UPSEventBus upsEvents;
+
+UPSEventBus::UPSEventBus() : subscriberCount_(0)
+{
+    for(Entry& entry : subscribers_){
+        entry.filter = 0;
+        entry.pending = 0;
+        entry.task = nullptr;
+        entry.holdoffMs = 0;
+        entry.lastTake = 0;
+    }
+}
+
+UPSEventBus::Subscriber UPSEventBus::subscribe(uint8_t events, TaskHandle_t task, uint32_t holdoffMs)
+{
+    uint8_t slot = subscriberCount_.fetch_add(1);
+    if(slot >= UPS_EVENT_MAX_SUBSCRIBERS){
+        subscriberCount_ = UPS_EVENT_MAX_SUBSCRIBERS;
+        ESP_LOGE(TAG, "Too many subscribers");
+        return INVALID_SUBSCRIBER;
+    }
+    Entry& entry = subscribers_[slot];
+    entry.task = task;
+    entry.holdoffMs = holdoffMs;
+    entry.lastTake = millis() - holdoffMs;
+    //Same event bits for each UPS, published last so publish sees a complete entry
+    uint32_t filter = 0;
+    for(uint8_t i=0;i<UPS_MAX_DEVICES;++i){
+        filter |= (uint32_t)(events & ALL) << (i * EVENT_BITS);
+    }
+    entry.filter.store(filter, std::memory_order_release);
+    return slot;
+}
+
+void UPSEventBus::publish(uint8_t ups, uint8_t events)
+{
+    if((events == 0) || (ups >= UPS_MAX_DEVICES)){
+        return;
+    }
+    uint32_t bits = (uint32_t)events << (ups * EVENT_BITS);
+    uint8_t count = std::min<uint8_t>(subscriberCount_.load(std::memory_order_acquire), UPS_EVENT_MAX_SUBSCRIBERS);
+    for(uint8_t i=0;i<count;++i){
+        Entry& entry = subscribers_[i];
+        uint32_t wanted = bits & entry.filter.load(std::memory_order_acquire);
+        if(wanted == 0){
+            continue;
+        }
+        //Only the first event of a set wakes the subscriber, others are coalesced
+        uint32_t previous = entry.pending.fetch_or(wanted, std::memory_order_acq_rel);
+        if((previous == 0) && (entry.task != nullptr)){
+            xTaskNotifyGive(entry.task);
+        }
+    }
+}
+
+uint32_t UPSEventBus::take(Subscriber subscriber)
+{
+    if((subscriber < 0) || (subscriber >= UPS_EVENT_MAX_SUBSCRIBERS)){
+        return 0;
+    }
+    Entry& entry = subscribers_[subscriber];
+    uint32_t pending = entry.pending.exchange(0, std::memory_order_acq_rel);
+    if(pending != 0){
+        entry.lastTake = millis();
+    }
+    return pending;
+}
+
+uint32_t UPSEventBus::wait(Subscriber subscriber, TickType_t ticks)
+{
+    if((subscriber < 0) || (subscriber >= UPS_EVENT_MAX_SUBSCRIBERS)){
+        return 0;
+    }
+    Entry& entry = subscribers_[subscriber];
+    //Clears a notification left by a set already taken
+    ulTaskNotifyTake(pdTRUE, entry.pending.load(std::memory_order_acquire) != 0 ? 0 : ticks);
+    if(entry.pending.load(std::memory_order_acquire) == 0){
+        return 0;
+    }
+    uint32_t elapsed = millis() - entry.lastTake;
+    if(elapsed < entry.holdoffMs){
+        //Let the changes of the hold-off period pile up in the set
+        vTaskDelay(pdMS_TO_TICKS(entry.holdoffMs - elapsed));
+    }
+    return take(subscriber);
+}
@@ -1,147 +1,250 @@
 #include <UPSHIDDevice.hpp>
+#include <HIDUsages.hpp>
+#include <UPSEvents.hpp>
+#include <UPSState.hpp>
+#include <ReportCapture.hpp>
 #include "esp_log.h"
 #include <limits>
+#include <algorithm>
 #include <ArduinoJson.h>
+#include <LittleFS.h>
+#include <type_traits>
 
 static const char *TAG = "UPSHID";
 
-UPSHIDDevice upsDevice;
+UsbHostHidBridge hidBridge;
+UPSHIDDevice upsDevices[UPS_MAX_DEVICES];
 
 /**
  * Configuration descriptor callback
  */
-void config_desc_cb(const usb_config_desc_t *config_desc) {
+void config_desc_cb(uint8_t device, const usb_config_desc_t *config_desc) {
     // usb_print_config_descriptor(config_desc, NULL);
 }
 
 /**
  * Device info callback
  */
-void device_info_cb(usb_device_info_t *dev_info) {
-    upsDevice.setDeviceInfo(dev_info);
+void device_info_cb(uint8_t device, usb_device_info_t *dev_info) {
+    upsDevices[device].setDeviceInfo(dev_info);
+    reportCapture.setStrings(device, upsDevices[device].getManufacturer(), upsDevices[device].getModel(), upsDevices[device].getSerial());
 }
 
-void hid_report_descriptor_cb(usb_transfer_t *transfer) {
+void hid_report_descriptor_cb(uint8_t device, usb_transfer_t *transfer) {
+    if(transfer->actual_num_bytes < USB_SETUP_PACKET_SIZE){
+        return;
+    }
     uint8_t *const data = (uint8_t *const)(transfer->data_buffer + USB_SETUP_PACKET_SIZE);
     size_t len = transfer->actual_num_bytes - USB_SETUP_PACKET_SIZE;
-    upsDevice.buildFromHIDReport(data, len);
+    reportCapture.setReportDescriptor(device, data, len);
+    upsDevices[device].buildFromHIDReport(data, len);
 }
 
-void hid_report_cb(usb_transfer_t *transfer) {
+void hid_report_cb(uint8_t device, usb_transfer_t *transfer) {
     //
     // check HID Report Descriptor for usage
     //
     uint8_t *data = (uint8_t *)(transfer->data_buffer);
-    upsDevice.hidReportData(data, transfer->actual_num_bytes);
+    reportCapture.capture(device, CaptureRecordHeader::INPUT_REPORT, data, transfer->actual_num_bytes);
+    upsDevices[device].hidReportData(data, transfer->actual_num_bytes);
+}
+
+void hid_feature_report_cb(uint8_t device, usb_transfer_t *transfer) {
+    if(transfer->actual_num_bytes < USB_SETUP_PACKET_SIZE){
+        return;
+    }
+    uint8_t *data = (uint8_t *)(transfer->data_buffer + USB_SETUP_PACKET_SIZE);
+    size_t len = transfer->actual_num_bytes - USB_SETUP_PACKET_SIZE;
+    const usb_setup_packet_t *stp = (const usb_setup_packet_t *)transfer->data_buffer;
+    if((stp->wValue >> 8) == static_cast<uint8_t>(HIDReportType::Input)){
+        //Input report read back by the probe
+        reportCapture.capture(device, CaptureRecordHeader::INPUT_REPORT, data, len);
+        upsDevices[device].hidReportData(data, len);
+        return;
+    }
+    reportCapture.capture(device, CaptureRecordHeader::FEATURE_REPORT, data, len);
+    upsDevices[device].hidFeatureReportData(data, len);
+}
+
+/**
+ * Device descriptor callback
+ */
+void device_desc_cb(uint8_t device, const usb_device_desc_t *dev_desc) {
+    reportCapture.setDeviceDescriptor(device, dev_desc->idVendor, dev_desc->idProduct, dev_desc->bcdDevice);
+    upsDevices[device].setDeviceDescriptor(dev_desc);
+}
+
+/**
+ * Next report to write callback (class driver task)
+ */
+bool hid_set_report_cb(uint8_t device, uint8_t *reportType, uint8_t *data, uint16_t *length) {
+    HIDReportType type;
+    if(!upsDevices[device].nextSetReport(type, data, *length, FEATURE_REPORT_MAX_SIZE)){
+        return false;
+    }
+    *reportType = static_cast<uint8_t>(type);
+    reportCapture.capture(device, CaptureRecordHeader::OUTPUT_REPORT, data, *length);
+    return true;
+}
+
+/**
+ * SET_IDLE answer callback (class driver task)
+ */
+void set_idle_done_cb(uint8_t device, uint8_t duration, bool accepted) {
+    upsDevices[device].idleSet(duration, accepted);
 }
 
 /**
  * Callback when USB device is removed
  */
-void device_removed_cb() {
-    upsDevice.deviceRemoved();
+void device_removed_cb(uint8_t device) {
+    reportCapture.capture(device, CaptureRecordHeader::REMOVED, nullptr, 0);
+    upsDevices[device].deviceRemoved();
 }
 
-HIDData::HIDData(uint8_t usagePage, uint8_t usage, const char* name) : 
-    usagePage_(usagePage), usage_(usage), reportId_(0),
-    bitPlace_(0), bitWidth_(0), name_(name), used_(false), value_(0.0)
-    
+const char* upsCommandStatusToString(UPSCommandStatus status)
 {
-    mutexData_ = xSemaphoreCreateMutex();
-    if(mutexData_ == NULL){
-        ESP_LOGE(TAG, "Unable to create data mutex");
+    switch(status){
+        case UPSCommandStatus::Queued:
+            return "queued";
+        case UPSCommandStatus::Disconnected:
+            return "disconnected";
+        case UPSCommandStatus::UnknownUsage:
+            return "unknown usage";
+        case UPSCommandStatus::OutOfRange:
+            return "out of range";
+        case UPSCommandStatus::QueueFull:
+            return "queue full";
+        case UPSCommandStatus::Busy:
+            return "busy";
     }
+    return "";
 }
-    
-bool HIDData::match(uint8_t usagePage, uint8_t usage)
+
+HIDData::HIDData() : 
+    usagePage_(0), usage_(0), collection_(HID_NO_COLLECTION), bitPlace_(0),
+    reportType_(HIDReportType::Input), reportId_(0), bitWidth_(0), hasPhysical_(false),
+    unitExponent_(0), logicalMinimum_(0), logicalMaximum_(0), physicalMinimum_(0), physicalMaximum_(0),
+    unit_(0), name_("")
 {
-    return (usagePage_ == usagePage) && (usage == usage_);
 }
 
-void HIDData::setValue(const uint8_t* buffer, size_t len)
+void HIDData::setPhysical(const OptionalData<int32_t>& minimum, const OptionalData<int32_t>& maximum)
 {
-    if(xSemaphoreTake(mutexData_, portMAX_DELAY ) == pdTRUE)
-    {
-        int32_t ret = 0;
-        //TODO: Maybe we don't need to recompute this every time
+    hasPhysical_ = minimum && maximum && ((minimum.getValue() != 0) || (maximum.getValue() != 0));
+    physicalMinimum_ = minimum ? minimum.getValue() : 0;
+    physicalMaximum_ = maximum ? maximum.getValue() : 0;
+}
 
-        int32_t physicalMin = 0;
-        int32_t physicalMax = 0;
-        int32_t unitExponent = 0;
-        if((!physicalMaximum_) || (!physicalMinimum_) || ((physicalMaximum_.getValue() == 0) && (physicalMinimum_.getValue() == 0))){
-            physicalMin = logicalMinimum_.getValue();
-            physicalMax = logicalMaximum_.getValue();
-        }
-        if(unitExponent_){
-            unitExponent = unitExponent_.getValue();
-        }
-        double factor = ((double)physicalMax - (double)physicalMin) / ((double)logicalMaximum_.getValue() - (double)logicalMinimum_.getValue());
+void HIDData::compile(HIDDecodeStep& step) const
+{
+    //Physical is logical when not declared
+    int32_t physicalMin = hasPhysical_ ? physicalMinimum_ : logicalMinimum_;
+    int32_t physicalMax = hasPhysical_ ? physicalMaximum_ : logicalMaximum_;
 
-        //TODO: Handle signed/unsigned (page 38 of HID 1.11)
-        uint8_t byteNumber = bitPlace_ / 8;
-        uint8_t startBit = bitPlace_ - (byteNumber*8);
-        uint32_t bitMask = (1<<bitWidth_)-1;
-        
-        for(int i=0;i<bitWidth_;++i){
-            ret |= ((buffer[byteNumber] >> startBit) & 0x1) << i;
-            ++startBit;
-            if(startBit >= 8){
-                startBit = 0;
-                ++byteNumber;
-            }
+    step.byteOffset = bitPlace_ / 8;
+    step.shift = bitPlace_ % 8;
+    step.byteCount = (step.shift + bitWidth_ + 7) / 8;
+    step.mask = bitWidth_ >= 32 ? 0xFFFFFFFF : ((1u << bitWidth_) - 1);
+    //Field is signed if logical minimum is negative (page 38 of HID 1.11)
+    step.signBit = ((logicalMinimum_ < 0) && (bitWidth_ > 0) && (bitWidth_ < 32)) ? (1u << (bitWidth_ - 1)) : 0;
+    step.logicalMin = logicalMinimum_;
+
+    //Decimal exponent: add decimals until the factor is exact or keeps two digits per logical step
+    int64_t physicalRange = (int64_t)physicalMax - physicalMin;
+    int64_t logicalRange = (int64_t)logicalMaximum_ - logicalMinimum_;
+    if(logicalRange == 0){
+        physicalRange = 1;
+        logicalRange = 1;
+    }
+    if(logicalRange < 0){
+        physicalRange = -physicalRange;
+        logicalRange = -logicalRange;
+    }
+    int8_t exponent = 0;
+    while((exponent > FIXED_MIN_EXPONENT) && (physicalRange != 0)){
+        int64_t range = physicalRange * fixedPow10(-exponent);
+        if(((range % logicalRange) == 0) || (llabs(range) >= 10 * logicalRange)){
+            break;
         }
-        value_ = (double)((ret - logicalMinimum_.getValue()) * factor) + physicalMin;
-        // ESP_LOGI(TAG, "%s [ID: 0x%02x] Byte number : %u, mask : 0x%0x, value: %f (unit: 0x%x)", name_, reportId_, byteNumber, bitMask, value_, unit_ ? unit_.getValue() : 0);
-        xSemaphoreGive(mutexData_);
+        --exponent;
     }
-}
-
-void HIDData::setUsed(bool used)
-{
-    if(xSemaphoreTake(mutexData_, portMAX_DELAY ) == pdTRUE)
-    {
-        used_ = used;
-        xSemaphoreGive(mutexData_);
+    //Remove decimals (or add tens) until the values and the factor fit
+    int64_t magnitude = std::max(llabs(physicalMin), llabs(physicalMax));
+    auto scaled = [](int64_t value, int8_t exponent)->int64_t{
+        return exponent <= 0 ? value * fixedPow10(-exponent) : value / fixedPow10(exponent);
+    };
+    while((exponent < FIXED_MAX_EXPONENT) && ((scaled(magnitude, exponent) > std::numeric_limits<int32_t>::max()) ||
+            (llabs(scaled(physicalRange, exponent)) / logicalRange >= 0x8000))){
+        ++exponent;
     }
-};
-
-bool HIDData::isUsed() const
-{
-    bool ret = false;
-    if(xSemaphoreTake(mutexData_, portMAX_DELAY ) == pdTRUE)
-    {
-        ret = used_;
-        xSemaphoreGive(mutexData_);
+    int64_t offset = scaled(physicalMin, exponent);
+    int64_t scale;
+    if(exponent <= 0){
+        scale = (physicalRange * fixedPow10(-exponent) * 65536) / logicalRange;
+    }else{
+        scale = (physicalRange * 65536) / (logicalRange * fixedPow10(exponent));
     }
-    return ret;
-}
 
-double HIDData::getValue() const
-{
-    double ret;
-    if(xSemaphoreTake(mutexData_, portMAX_DELAY ) == pdTRUE)
-    {
-        ret = used_ ? value_ : 0.0;
-        xSemaphoreGive(mutexData_);
+    //SI unit: the value is unchanged, only its exponent moves (a scale origin needs decimals)
+    HIDUnitConversion conversion = hidUnitConversion(usagePage_, usage_, unit_, unitExponent_);
+    int32_t siExponent = exponent + conversion.exponent;
+    int64_t siOffset = offset;
+    int64_t siScale = scale;
+    if((conversion.offset != 0) && (siExponent > HID_UNIT_OFFSET_EXPONENT) && (siExponent - HID_UNIT_OFFSET_EXPONENT <= 9)){
+        int64_t factor = fixedPow10(siExponent - HID_UNIT_OFFSET_EXPONENT);
+        siOffset *= factor;
+        siScale *= factor;
+        siExponent = HID_UNIT_OFFSET_EXPONENT;
     }
-    return ret;
+    if(siExponent < FIXED_MIN_EXPONENT){
+        int64_t divisor = fixedPow10(std::min(FIXED_MIN_EXPONENT - siExponent, 18));
+        siOffset /= divisor;
+        siScale /= divisor;
+        siExponent = FIXED_MIN_EXPONENT;
+    }
+    if((conversion.offset != 0) && (siExponent <= HID_UNIT_OFFSET_EXPONENT)){
+        siOffset += (int64_t)conversion.offset * fixedPow10(HID_UNIT_OFFSET_EXPONENT - siExponent);
+    }
+    step.unit = conversion.unit;
+    if((siExponent > FIXED_MAX_EXPONENT) || ((conversion.offset != 0) && (siExponent > HID_UNIT_OFFSET_EXPONENT)) || (siOffset != fixedSaturate(siOffset)) || (siScale != fixedSaturate(siScale))){
+        //Not representable, keep the physical value
+        step.unit = HIDUnit::Other;
+    }else{
+        exponent = siExponent;
+        offset = siOffset;
+        scale = siScale;
+    }
+    step.exponent = exponent;
+    step.offset = fixedSaturate(offset);
+    step.scale = static_cast<int32_t>(scale);
 }
 
-void HIDData::reset()
+bool HIDData::encode(int32_t value, int8_t exponent, uint32_t& bits) const
 {
-    if(xSemaphoreTake(mutexData_, portMAX_DELAY ) == pdTRUE)
-    {
-        used_ = false;
-        reportId_ = 0;
-        logicalMinimum_.reset();
-        logicalMaximum_.reset();
-        physicalMinimum_.reset();
-        physicalMaximum_.reset();
-        unitExponent_.reset();
-        bitPlace_ = 0;
-        bitWidth_ = 0;
-        xSemaphoreGive(mutexData_);
+    HIDDecodeStep step;
+    compile(step);
+    //Inverse of UPSHIDDevice::decode, rounded to the nearest logical step
+    int64_t logical = logicalMinimum_;
+    if(step.scale != 0){
+        int64_t numerator = ((int64_t)fixedRescale(value, exponent, step.exponent) - step.offset) * 65536;
+        int64_t denominator = step.scale;
+        if(denominator < 0){
+            numerator = -numerator;
+            denominator = -denominator;
+        }
+        logical += numerator >= 0 ? (numerator + denominator / 2) / denominator : (numerator - denominator / 2) / denominator;
+    }
+    if(logicalMinimum_ != logicalMaximum_){
+        if((logical < std::min(logicalMinimum_, logicalMaximum_)) || (logical > std::max(logicalMinimum_, logicalMaximum_))){
+            return false;
+        }
+    }else if((logical < (step.signBit ? -(int64_t)step.signBit : 0)) || (logical > (int64_t)(step.signBit ? step.signBit - 1 : step.mask))){
+        //No logical range declared, the value must fit the field
+        return false;
     }
+    bits = static_cast<uint32_t>(logical) & step.mask;
+    return true;
 }
 
 bool HIDData::isBool() const
@@ -150,35 +253,84 @@ bool HIDData::isBool() const
         return true;
     }
     //Assume a value between 1 and 0 to be boolean
-    if(logicalMinimum_ && (logicalMinimum_.getValue() == 0) && 
-        logicalMaximum_ && (logicalMaximum_.getValue() == 1)){
-            return true;
+    if((logicalMinimum_ == 0) && (logicalMaximum_ == 1)){
+        return true;
     }
 
     return false;
 }
 
+const UPSHIDDevice::InterestUsage UPSHIDDevice::INTEREST_USAGES[INTEREST_USAGES_COUNT] = {
+    //List what can be interresting
+    {BATTERY_SYSTEM_PAGE, REMAINING_CAPACITY_USAGE, "Remaining Capacity", 0},
+    {BATTERY_SYSTEM_PAGE, AC_PRESENT_USAGE, "AC present", 0},
+    {BATTERY_SYSTEM_PAGE, CHARGING_USAGE, "Charging", 0},
+    {BATTERY_SYSTEM_PAGE, DISCHARGING_USAGE, "Discharging", 0},
+    {BATTERY_SYSTEM_PAGE, BATTERY_PRESENT_USAGE, "Battery present", 0},
+    {BATTERY_SYSTEM_PAGE, NEEDS_REPLACEMENT_USAGE, "Needs replacement", 0},
+    {BATTERY_SYSTEM_PAGE, RUN_TIME_TO_EMPTY_USAGE, "Run time to empty", 0},
+    {POWER_DEVICE_PAGE, TEST_USAGE, "Test result", 0},
+    {POWER_DEVICE_PAGE, VOLTAGE_USAGE, "Battery voltage", BATTERY_USAGE},  //Input and output have a Voltage too
+    {BATTERY_SYSTEM_PAGE, BELOW_CAPACITY_LIMIT_USAGE, "Below capacity limit", 0},
+    {POWER_DEVICE_PAGE, OVERLOAD_USAGE, "Overload", 0},
+    {POWER_DEVICE_PAGE, BOOST_USAGE, "Boost", 0},
+    {POWER_DEVICE_PAGE, BUCK_USAGE, "Buck", 0},
+    {POWER_DEVICE_PAGE, PERCENT_LOAD_USAGE, "Output load", OUTPUT_USAGE},
+    {POWER_DEVICE_PAGE, VOLTAGE_USAGE, "Input voltage", INPUT_USAGE},
+    {POWER_DEVICE_PAGE, FREQUENCY_USAGE, "Input frequency", INPUT_USAGE},
+    {POWER_DEVICE_PAGE, CURRENT_USAGE, "Input current", INPUT_USAGE},
+    {POWER_DEVICE_PAGE, ACTIVE_POWER_USAGE, "Input power", INPUT_USAGE},
+    {POWER_DEVICE_PAGE, VOLTAGE_USAGE, "Output voltage", OUTPUT_USAGE},
+    {POWER_DEVICE_PAGE, FREQUENCY_USAGE, "Output frequency", OUTPUT_USAGE},
+    {POWER_DEVICE_PAGE, CURRENT_USAGE, "Output current", OUTPUT_USAGE},
+    {POWER_DEVICE_PAGE, ACTIVE_POWER_USAGE, "Output power", OUTPUT_USAGE},
+    {POWER_DEVICE_PAGE, CURRENT_USAGE, "Battery current", BATTERY_USAGE},
+    {POWER_DEVICE_PAGE, TEMPERATURE_USAGE, "Temperature", 0},
+    {POWER_DEVICE_PAGE, INTERNAL_FAILURE_USAGE, "Internal failure", 0},
+    {POWER_DEVICE_PAGE, OVER_TEMPERATURE_USAGE, "Over temperature", 0},
+    {POWER_DEVICE_PAGE, SHUTDOWN_REQUESTED_USAGE, "Shutdown requested", 0},
+    {POWER_DEVICE_PAGE, SHUTDOWN_IMMINENT_USAGE, "Shutdown imminent", 0},
+    {POWER_DEVICE_PAGE, AWAITING_POWER_USAGE, "Awaiting power", 0}
+};
+
 UPSHIDDevice::UPSHIDDevice() : 
-    datas_{
-        //List what can be interresting
-        HIDData(BATTERY_SYSTEM_PAGE, REMAINING_CAPACITY_USAGE, "Remaining Capacity"),
-        HIDData(BATTERY_SYSTEM_PAGE, AC_PRESENT_USAGE, "AC present"),
-        HIDData(BATTERY_SYSTEM_PAGE, CHARGING_USAGE, "Charging"),
-        HIDData(BATTERY_SYSTEM_PAGE, DISCHARGING_USAGE, "Discharging"),
-        HIDData(BATTERY_SYSTEM_PAGE, BATTERY_PRESENT_USAGE, "Battery present"),
-        HIDData(BATTERY_SYSTEM_PAGE, NEEDS_REPLACEMENT_USAGE, "Needs replacement"),
-        HIDData(BATTERY_SYSTEM_PAGE, RUN_TIME_TO_EMPTY_USAGE, "Run time to empty")
-    }, connected_(false)
+    idVendor_(0), idProduct_(0), bcdDevice_(0), descriptorHash_(0),
+    generation_(0), connected_(false), idleRequested_(-1), idleSupported_(true), idleActive_(-1),
+    layoutUnsaved_(false), lastReportMs_(0), connectedMs_(0), attachedMs_(0), refreshMs_(0), stale_(false), nextResetMs_(0), resets_(0), index_(0)
 {
+    for(std::atomic<uint32_t>& time : reportTimes_){
+        time = 0;
+    }
+    mutexFields_ = xSemaphoreCreateMutex();
+    if(mutexFields_ == NULL){
+        ESP_LOGE(TAG, "Unable to create fields mutex");
+    }
+    commandFirst_ = 0;
+    commandCount_ = 0;
+    mutexCommands_ = xSemaphoreCreateMutex();
+    if(mutexCommands_ == NULL){
+        ESP_LOGE(TAG, "Unable to create commands mutex");
+    }
+    memset(reportPlans_, 0, sizeof(reportPlans_));
+    memset(readingFieldMask_, 0, sizeof(readingFieldMask_));
+    working_.clear();
+    fields_.reserve(HID_MAX_FIELDS);
 }
 
 void UPSHIDDevice::begin()
 {
+    for(uint8_t i=0;i<UPS_MAX_DEVICES;++i){
+        upsDevices[i].index_ = i;
+    }
     hidBridge.onConfigDescriptorReceived = config_desc_cb;
     hidBridge.onDeviceInfoReceived = device_info_cb;
     hidBridge.onHidReportDescriptorReceived = hid_report_descriptor_cb;
     hidBridge.onReportReceived = hid_report_cb;
+    hidBridge.onFeatureReportReceived = hid_feature_report_cb;
     hidBridge.onDeviceRemoved = device_removed_cb;
+    hidBridge.onDeviceDescriptorReceived = device_desc_cb;
+    hidBridge.onSetReportRequired = hid_set_report_cb;
+    hidBridge.onSetIdleDone = set_idle_done_cb;
     hidBridge.begin();
 }
 
@@ -186,102 +338,787 @@ void UPSHIDDevice::buildFromHIDReport(const uint8_t* data, size_t dataLen)
 {
     HIDGlobalItems globalItems;
     HIDLocalItem localItems;
-    uint32_t actualBit = 0;
+    std::vector<HIDGlobalItems> globalStack;
+    std::vector<uint16_t> collectionStack;
+    //Bit offset of each report (each type and report ID has its own layout)
+    std::vector<uint32_t> bitOffsets(REPORT_TYPE_COUNT * 256, 0);
+
+    uint32_t hash = descriptorHash(data, dataLen);
+    if(connected_ && (hash == descriptorHash_)){
+        ESP_LOGI(TAG, "UPS %u cached layout is up to date", index_ + 1);
+        return;
+    }
+    if(xSemaphoreTake(mutexFields_, portMAX_DELAY ) != pdTRUE){
+        return;
+    }
+    collections_.clear();
+    fields_.clear();
+    outputs_.clear();
     for(size_t i=0;i<dataLen;++i){
+        if(data[i] == HIDReportItemPrefix::LONG_ITEM){
+            //Long items have no defined tag yet (6.2.2.3 of HID 1.11 spec), skip them
+            if((i + 2 >= dataLen) || (data[i+1] > dataLen - i - 3)){
+                ESP_LOGW(TAG, "Truncated long item at offset %u", (unsigned)i);
+                break;
+            }
+            i += 2 + data[i+1];
+            continue;
+        }
         HIDReportItemPrefix prefix(data[i]);
+        if(prefix.bSize > dataLen - i - 1){
+            ESP_LOGW(TAG, "Truncated item 0x%02x at offset %u", prefix.raw, (unsigned)i);
+            break;
+        }
+        if(prefix.bType == HIDReportItemPrefix::BTYPE::Global){
+            if(prefix.bTag.globalTag == HIDReportItemPrefix::GlobalTag::Push){
+                if(globalStack.size() < HID_MAX_GLOBAL_STACK){
+                    globalStack.push_back(globalItems);
+                }else{
+                    ESP_LOGW(TAG, "Global items stack overflow");
+                }
+            }else if(prefix.bTag.globalTag == HIDReportItemPrefix::GlobalTag::Pop){
+                if(!globalStack.empty()){
+                    globalItems = globalStack.back();
+                    globalStack.pop_back();
+                }
+            }
+        }
         updateGlobalItems(globalItems, prefix, &data[i+1]);
         updateLocalItems(localItems, prefix, &data[i+1]);
-        if(prefix.bType == HIDReportItemPrefix::BTYPE::Global && prefix.bTag.globalTag == HIDReportItemPrefix::GlobalTag::ReportID){
-            actualBit = 0;
-        }else if(prefix.bType == HIDReportItemPrefix::BTYPE::Main){
-            if(prefix.bTag.mainTag == HIDReportItemPrefix::MainTag::Input){
-                for(int j=0;j<sizeof(datas_)/sizeof(HIDData);++j){
-                    if(globalItems.usagePage && localItems.usage && datas_[j].match(globalItems.usagePage.getValue(), localItems.usage.getValue()) && !datas_[j].isUsed()){                        
-                        datas_[j].setUsed(true);
-                        datas_[j].setReportId(globalItems.reportID.getValue());
-                        datas_[j].setBitsConfiguration(actualBit, globalItems.reportSize.getValue());
-                        datas_[j].setLogicalMaximum(globalItems.logicalMaximum);
-                        datas_[j].setLogicalMinimum(globalItems.logicalMinimum);
-                        datas_[j].setPhysicalMaximum(globalItems.physicalMaximum);
-                        datas_[j].setPhysicalMinimum(globalItems.physicalMinimum);
-                        datas_[j].setUnitExponent(globalItems.unitExponent);
-                        datas_[j].setUnit(globalItems.unit);
-
-                        connected_ = true;
+        if(prefix.bType == HIDReportItemPrefix::BTYPE::Main){
+            uint32_t itemData = toUnSignedInteger(&data[i+1], prefix.bSize);
+            uint16_t collection = collectionStack.empty() ? HID_NO_COLLECTION : collectionStack.back();
+            uint8_t reportId = globalItems.reportID ? globalItems.reportID.getValue() : 0;
+            switch(prefix.bTag.mainTag){
+                case HIDReportItemPrefix::MainTag::Collection:
+                    {
+                        uint32_t usage = localItems.usageCount > 0 ? localItems.usages[0] : 0;
+                        uint16_t usagePage = (usage >> 16) ? (usage >> 16) : (globalItems.usagePage ? globalItems.usagePage.getValue() : 0);
+                        collectionStack.push_back(openCollection(collection, usagePage, usage & 0xFFFF));
                     }
-                }
-                actualBit += globalItems.reportCount * globalItems.reportSize;
+                    break;
+                case HIDReportItemPrefix::MainTag::EndCollection:
+                    if(!collectionStack.empty()){
+                        collectionStack.pop_back();
+                    }
+                    break;
+                case HIDReportItemPrefix::MainTag::Input:
+                    addFields(HIDReportType::Input, itemData, globalItems, localItems, collection,
+                                bitOffsets[(static_cast<uint8_t>(HIDReportType::Input) - 1) * 256 + reportId]);
+                    break;
+                case HIDReportItemPrefix::MainTag::Output:
+                    addFields(HIDReportType::Output, itemData, globalItems, localItems, collection,
+                                bitOffsets[(static_cast<uint8_t>(HIDReportType::Output) - 1) * 256 + reportId]);
+                    break;
+                case HIDReportItemPrefix::MainTag::Feature:
+                    addFields(HIDReportType::Feature, itemData, globalItems, localItems, collection,
+                                bitOffsets[(static_cast<uint8_t>(HIDReportType::Feature) - 1) * 256 + reportId]);
+                    break;
             }
             localItems.reset();
         }
         //Advance in buffer
         i += prefix.bSize;
     }
+    reportSizes_.clear();
+    for(HIDReportType type : {HIDReportType::Input, HIDReportType::Output, HIDReportType::Feature}){
+        const uint32_t* reportBits = &bitOffsets[(static_cast<uint8_t>(type) - 1) * 256];
+        for(uint16_t id=0;id<256;++id){
+            if(reportBits[id] > 0){
+                reportSizes_.push_back({type, static_cast<uint8_t>(id), static_cast<uint16_t>(std::min<uint32_t>((reportBits[id] + 7) / 8, UINT16_MAX))});
+            }
+        }
+    }
+    buildFieldNames();
+    descriptorHash_ = hash;
+    activateLayout();
+    xSemaphoreGive(mutexFields_);
+    ESP_LOGI(TAG, "Registered %u fields in %u collections", fields_.size(), collections_.size());
+    publish(UPSEventBus::DECODE);
+    //Flash writes need more stack than the USB task has, the main loop saves it
+    layoutUnsaved_ = true;
+}
+
+void UPSHIDDevice::activateLayout()
+{
+    compileDecodePlans();
+    scheduleFeatureReports();
+    buildReportImages();
+
+    //Reception times belong to the report slots of the previous layout
+    for(std::atomic<uint32_t>& time : reportTimes_){
+        time.store(0, std::memory_order_relaxed);
+    }
+    lastReportMs_.store(0, std::memory_order_relaxed);
+    connectedMs_.store(millis(), std::memory_order_relaxed);
+
+    connected_ = !fields_.empty();
+    ++generation_;
+    working_.clear();
+    working_.connected = connected_;
+    working_.generation = generation_;
+    working_.fieldCount = fields_.size();
+    for(const HIDDecodeStep& step : decodeSteps_){
+        working_.exponents[step.fieldIndex] = step.exponent;
+        working_.units[step.fieldIndex] = step.unit;
+    }
+    for(uint16_t j=0;j<fields_.size();++j){
+        working_.reportSlots[j] = reportPlans_[static_cast<uint8_t>(fields_[j].getReportType()) - 1][fields_[j].getReportId()].timeSlot;
+    }
+    memset(readingFieldMask_, 0, sizeof(readingFieldMask_));
+    for(uint8_t r=0;r<INTEREST_USAGES_COUNT;++r){
+        //First field of the usage, prefer Input over Feature
+        for(uint16_t j=0;j<fields_.size();++j){
+            if(fields_[j].match(INTEREST_USAGES[r].usagePage, INTEREST_USAGES[r].usage) &&
+                ((INTEREST_USAGES[r].collectionUsage == 0) || inCollection(fields_[j].getCollection(), INTEREST_USAGES[r].collectionUsage))){
+                if((working_.readingFields[r] < 0) || 
+                    ((fields_[j].getReportType() == HIDReportType::Input) && (fields_[working_.readingFields[r]].getReportType() != HIDReportType::Input))){
+                    working_.readingFields[r] = j;
+                }
+            }
+        }
+        if(working_.readingFields[r] < 0){
+            continue;
+        }
+        readingFieldMask_[working_.readingFields[r] / 32] |= 1u << (working_.readingFields[r] % 32);
+        if(fields_[working_.readingFields[r]].isBool()){
+            working_.boolMask |= 1u << r;
+        }
+    }
+    //New layout, the main loop asks the idle rate again
+    idleRequested_ = -1;
+}
+
+bool UPSHIDDevice::inCollection(uint16_t collection, uint16_t usage) const
+{
+    //Parents always come first, the walk ends at the root
+    while(collection < collections_.size()){
+        const HIDCollection& current = collections_[collection];
+        if((current.usagePage == POWER_DEVICE_PAGE) && (current.usage == usage)){
+            return true;
+        }
+        if(current.parent >= collection){
+            break;
+        }
+        collection = current.parent;
+    }
+    return false;
+}
+
+uint16_t UPSHIDDevice::openCollection(uint16_t parent, uint16_t usagePage, uint16_t usage)
+{
+    for(uint16_t j=0;j<collections_.size();++j){
+        const HIDCollection& collection = collections_[j];
+        if((collection.parent == parent) && (collection.usagePage == usagePage) && (collection.usage == usage)){
+            return j;
+        }
+    }
+    if(collections_.size() >= HID_MAX_COLLECTIONS){
+        //Keep nesting balanced, fields land in the parent collection
+        ESP_LOGW(TAG, "Too many collections, ignoring usage 0x%04x:0x%04x", usagePage, usage);
+        return parent;
+    }
+    collections_.push_back({usagePage, usage, parent});
+    return collections_.size() - 1;
+}
+
+void UPSHIDDevice::advanceBitOffset(uint32_t& bitOffset, const HIDGlobalItems& globals)
+{
+    uint64_t itemBits = (uint64_t)(globals.reportSize ? globals.reportSize.getValue() : 0) * (globals.reportCount ? globals.reportCount.getValue() : 0);
+    bitOffset = std::min<uint64_t>(bitOffset + itemBits, HID_MAX_REPORT_BITS);
+}
+
+void UPSHIDDevice::addFields(HIDReportType type, uint32_t flags, const HIDGlobalItems& globals, const HIDLocalItem& locals,
+                                uint16_t collection, uint32_t& bitOffset)
+{
+    uint32_t reportSize = globals.reportSize ? globals.reportSize.getValue() : 0;
+    uint32_t reportCount = globals.reportCount ? globals.reportCount.getValue() : 0;
+    uint32_t firstBit = bitOffset;
+    advanceBitOffset(bitOffset, globals);
+
+    //Only data variable fields are registered (6.2.2.5 of HID 1.11 spec)
+    bool constant = flags & 0x1;
+    bool variable = flags & 0x2;
+    if(constant || !variable || (reportSize == 0) || (reportSize > 32)){
+        return;
+    }
+    //Fields past the last declared usage repeat it and are never registered
+    uint32_t usageCount = 0;
+    if(locals.usageCount > 0){
+        usageCount = locals.usageCount;
+    }else if(locals.usageMinimum && locals.usageMaximum){
+        usageCount = locals.usageMaximum.getValue() >= locals.usageMinimum.getValue() ? 
+                        locals.usageMaximum.getValue() - locals.usageMinimum.getValue() + 1 : 1;
+    }
+    uint16_t currentPage = globals.usagePage ? globals.usagePage.getValue() : 0;
+    for(uint32_t k=0;(k<reportCount) && (k<usageCount);++k){
+        if(firstBit + (uint64_t)(k + 1) * reportSize > HID_MAX_REPORT_BITS){
+            ESP_LOGW(TAG, "Field out of report bounds, ignored");
+            break;
+        }
+        uint32_t usage = 0;
+        if(locals.usageCount > 0){
+            usage = locals.usages[k];
+        }else{
+            usage = std::min(locals.usageMinimum.getValue() + k, locals.usageMaximum.getValue());
+        }
+        uint16_t usagePage = (usage >> 16) ? (usage >> 16) : currentPage;
+        HIDData data;
+        data.setUsage(collection, usagePage, usage & 0xFFFF);
+        data.setReport(type, globals.reportID ? globals.reportID.getValue() : 0);
+        data.setBitsConfiguration(firstBit + k * reportSize, reportSize);
+        data.setLogicalMinimum(globals.logicalMinimum);
+        data.setLogicalMaximum(globals.logicalMaximum);
+        data.setPhysical(globals.physicalMinimum, globals.physicalMaximum);
+        data.setUnitExponent(globals.unitExponent);
+        data.setUnit(globals.unit);
+        if(type != HIDReportType::Input){
+            //Commands write Feature and Output fields, even if an Input field reads the usage
+            if(outputs_.size() < HID_MAX_OUTPUT_FIELDS){
+                outputs_.push_back(data);
+            }else{
+                ESP_LOGW(TAG, "Too many writable fields, ignoring usage 0x%04x:0x%04x", usagePage, usage & 0xFFFF);
+            }
+            if(type == HIDReportType::Output){
+                //Never received, not in the registry
+                continue;
+            }
+        }
+        HIDData* field = nullptr;
+        for(HIDData& existing : fields_){
+            if(existing.match(collection, usagePage, usage & 0xFFFF)){
+                field = &existing;
+                break;
+            }
+        }
+        if(field){
+            //Already known, prefer Input over Feature
+            if((type != HIDReportType::Input) || (field->getReportType() == HIDReportType::Input)){
+                continue;
+            }
+        }else{
+            if(fields_.size() >= HID_MAX_FIELDS){
+                ESP_LOGW(TAG, "Field registry full, ignoring usage 0x%04x:0x%04x", usagePage, usage & 0xFFFF);
+                continue;
+            }
+            fields_.emplace_back();
+            field = &fields_.back();
+        }
+        *field = data;
+    }
+}
+
+void UPSHIDDevice::appendUsageName(std::string& dest, uint16_t usagePage, uint16_t usage)
+{
+    const char* name = hidUsageName(usagePage, usage);
+    if(name){
+        dest += name;
+    }else{
+        char hex[11];
+        snprintf(hex, sizeof(hex), "0x%04x%04x", usagePage, usage);
+        dest += hex;
+    }
+}
+
+void UPSHIDDevice::buildFieldNames()
+{
+    std::vector<size_t> offsets;
+    std::string names;
+    std::string path;
+    std::vector<uint16_t> collectionPath;
+    offsets.reserve(fields_.size());
+    for(const HIDData& field : fields_){
+        //Walk collection parents (root first)
+        collectionPath.clear();
+        for(uint16_t c=field.getCollection();c!=HID_NO_COLLECTION;c=collections_[c].parent){
+            collectionPath.push_back(c);
+        }
+        path.clear();
+        for(auto it=collectionPath.rbegin();it!=collectionPath.rend();++it){
+            appendUsageName(path, collections_[*it].usagePage, collections_[*it].usage);
+            path += '.';
+        }
+        appendUsageName(path, field.getUsagePage(), field.getUsage());
+        offsets.push_back(names.size());
+        names.append(path.c_str(), path.size() + 1);
+    }
+    //Names are stored in one block, pointers are set once it is complete
+    fieldNames_.assign(names.begin(), names.end());
+    for(size_t j=0;j<fields_.size();++j){
+        fields_[j].setName(&fieldNames_[offsets[j]]);
+    }
+}
+
+void UPSHIDDevice::compileDecodePlans()
+{
+    memset(reportPlans_, 0, sizeof(reportPlans_));
+    decodeSteps_.clear();
+    //Count steps of each report
+    for(const HIDData& field : fields_){
+        ++reportPlans_[static_cast<uint8_t>(field.getReportType()) - 1][field.getReportId()].count;
+    }
+    //Lay plans out one after the other, reports with fields get a reception time slot
+    uint16_t first = 0;
+    uint8_t slots = 0;
+    for(auto& plans : reportPlans_){
+        for(ReportPlan& plan : plans){
+            plan.first = first;
+            plan.timeSlot = (plan.count > 0) && (slots < HID_MAX_REPORT_SLOTS) ? slots++ : HID_NO_REPORT_SLOT;
+            first += plan.count;
+            plan.count = 0;
+        }
+    }
+    decodeSteps_.resize(first);
+    for(uint16_t j=0;j<fields_.size();++j){
+        ReportPlan& plan = reportPlans_[static_cast<uint8_t>(fields_[j].getReportType()) - 1][fields_[j].getReportId()];
+        HIDDecodeStep& step = decodeSteps_[plan.first + plan.count];
+        fields_[j].compile(step);
+        step.fieldIndex = j;
+        ++plan.count;
+    }
+}
+
+void UPSHIDDevice::scheduleFeatureReports()
+{
+    hidBridge.clearFeatureReports(index_);
+    uint32_t refresh = 0;
+    uint16_t featureBytes[256] = {0};
+    for(const ReportSize& report : reportSizes_){
+        if(report.type == HIDReportType::Feature){
+            featureBytes[report.reportId] = report.bytes;
+        }
+    }
+    for(const HIDData& field : fields_){
+        if(field.getReportType() != HIDReportType::Feature){
+            continue;
+        }
+        //Report ID byte followed by the report bytes
+        uint8_t reportId = field.getReportId();
+        uint16_t length = 1 + featureBytes[reportId];
+        uint32_t interval = featureRefreshInterval(field.getUsagePage(), field.getUsage());
+        hidBridge.scheduleFeatureReport(index_, static_cast<uint8_t>(HIDReportType::Feature), reportId, length, interval);
+        refresh = (refresh == 0) ? interval : std::min(refresh, interval);
+    }
+    if(refresh == 0){
+        //Nothing is polled and Input reports may only come on change, read one back so silence means a dead UPS
+        for(const ReportSize& report : reportSizes_){
+            if(report.type == HIDReportType::Input){
+                hidBridge.scheduleFeatureReport(index_, static_cast<uint8_t>(HIDReportType::Input), report.reportId, 1 + report.bytes, HID_PROBE_MS);
+                refresh = HID_PROBE_MS;
+                break;
+            }
+        }
+    }
+    refreshMs_ = refresh;
+}
+
+uint32_t UPSHIDDevice::featureRefreshInterval(uint16_t usagePage, uint16_t usage)
+{
+    switch(usagePage){
+        case 0x84:
+            //Voltage to Humidity, Test and PresentStatus flags
+            if(((usage >= 0x30) && (usage <= 0x37)) || (usage == 0x58) || ((usage >= 0x60) && (usage <= 0x73))){
+                return FEATURE_FAST_REFRESH_MS;
+            }
+            break;
+        case 0x85:
+            //Battery status, capacity and run time
+            if(((usage >= 0x40) && (usage <= 0x4B)) || ((usage >= 0x60) && (usage <= 0x6A)) || 
+                ((usage >= 0xD0) && (usage <= 0xDB))){
+                return FEATURE_FAST_REFRESH_MS;
+            }
+            break;
+    }
+    return FEATURE_SLOW_REFRESH_MS;
 }
 
 void UPSHIDDevice::hidReportData(const uint8_t* data, size_t len)
 {
-    uint8_t reportID = data[0];
-    // ESP_LOGI(TAG, "Got Report ID : %u", reportID);
-    //Got trough interresting data to check if the Id report match
-    for(int j=0;j<sizeof(datas_)/sizeof(HIDData);++j){
-        if(reportID == datas_[j].getReportId()){
-            datas_[j].setValue(&data[1], len-1);
+    decodeReport(HIDReportType::Input, data, len);
+}
+
+void UPSHIDDevice::hidFeatureReportData(const uint8_t* data, size_t len)
+{
+    if(len > 0){
+        //Commands modify the report as last read
+        ReportImage* image = findReportImage(HIDReportType::Feature, data[0]);
+        if(image != nullptr){
+            memcpy(&imageData_[image->offset], data, std::min<size_t>(len, image->size));
         }
     }
+    decodeReport(HIDReportType::Feature, data, len);
 }
 
-void UPSHIDDevice::deviceRemoved()
+void UPSHIDDevice::buildReportImages()
 {
-    ESP_LOGI(TAG, "Device removed");
-    connected_ = false;
-    //Reset existing reports
-    for(int j=0;j<sizeof(datas_)/sizeof(HIDData);++j){
-        datas_[j].reset();
+    reportImages_.clear();
+    for(const HIDData& output : outputs_){
+        uint16_t key = (static_cast<uint8_t>(output.getReportType()) << 8) | output.getReportId();
+        auto it = std::lower_bound(reportImages_.begin(), reportImages_.end(), key, [](const ReportImage& image, uint16_t key){
+            return image.key < key;
+        });
+        if((it != reportImages_.end()) && (it->key == key)){
+            continue;
+        }
+        //Report ID byte followed by the report bytes
+        uint16_t size = 1;
+        for(const ReportSize& report : reportSizes_){
+            if((report.type == output.getReportType()) && (report.reportId == output.getReportId())){
+                size = std::min<uint32_t>(1 + report.bytes, FEATURE_REPORT_MAX_SIZE);
+                break;
+            }
+        }
+        reportImages_.insert(it, {key, 0, size});
+    }
+    uint16_t offset = 0;
+    for(ReportImage& image : reportImages_){
+        image.offset = offset;
+        offset += image.size;
+    }
+    imageData_.assign(offset, 0);
+    for(const ReportImage& image : reportImages_){
+        imageData_[image.offset] = image.key & 0xFF;
     }
-    manufacturer_ = "";
-    model_ = "";
-    serial_ = "";
 }
 
-const HIDData& UPSHIDDevice::getRemainingCapacity() const
+UPSHIDDevice::ReportImage* UPSHIDDevice::findReportImage(HIDReportType type, uint8_t reportId)
 {
-    return datas_[0];
+    uint16_t key = (static_cast<uint8_t>(type) << 8) | reportId;
+    auto it = std::lower_bound(reportImages_.begin(), reportImages_.end(), key, [](const ReportImage& image, uint16_t key){
+        return image.key < key;
+    });
+    return ((it != reportImages_.end()) && (it->key == key)) ? &*it : nullptr;
 }
 
-/**
- * Gets if AC is present
- */
-const HIDData& UPSHIDDevice::getACPresent() const
+UPSCommandStatus UPSHIDDevice::sendCommand(uint16_t usagePage, uint16_t usage, int32_t value, int8_t exponent)
+{
+    HIDCommand command;
+    UPSCommandStatus status = UPSCommandStatus::UnknownUsage;
+    if(xSemaphoreTake(mutexFields_, portMAX_DELAY ) != pdTRUE){
+        return UPSCommandStatus::Disconnected;
+    }
+    if(!connected_){
+        status = UPSCommandStatus::Disconnected;
+    }else{
+        for(const HIDData& output : outputs_){
+            if(!output.match(usagePage, usage)){
+                continue;
+            }
+            if(!output.encode(value, exponent, command.bits)){
+                status = UPSCommandStatus::OutOfRange;
+                break;
+            }
+            command.generation = generation_;
+            output.getBitsConfiguration(command.bitPlace, command.bitWidth);
+            command.reportId = output.getReportId();
+            command.reportType = output.getReportType();
+            status = UPSCommandStatus::Queued;
+            break;
+        }
+    }
+    xSemaphoreGive(mutexFields_);
+    if(status != UPSCommandStatus::Queued){
+        return status;
+    }
+    if(xSemaphoreTake(mutexCommands_, portMAX_DELAY ) != pdTRUE){
+        return UPSCommandStatus::QueueFull;
+    }
+    if(commandCount_ >= UPS_COMMAND_QUEUE_LENGTH){
+        status = UPSCommandStatus::QueueFull;
+    }else{
+        commands_[(commandFirst_ + commandCount_++) % UPS_COMMAND_QUEUE_LENGTH] = command;
+    }
+    xSemaphoreGive(mutexCommands_);
+    if(status == UPSCommandStatus::Queued){
+        ESP_LOGI(TAG, "UPS %u command 0x%04x:0x%04x = 0x%x (report 0x%02x)", index_ + 1, usagePage, usage, command.bits, command.reportId);
+        hidBridge.requestSetReport(index_);
+    }
+    return status;
+}
+
+bool UPSHIDDevice::hasCommand(uint16_t usagePage, uint16_t usage) const
+{
+    bool ret = false;
+    if(xSemaphoreTake(mutexFields_, portMAX_DELAY ) == pdTRUE){
+        for(const HIDData& output : outputs_){
+            if(output.match(usagePage, usage)){
+                ret = true;
+                break;
+            }
+        }
+        xSemaphoreGive(mutexFields_);
+    }
+    return ret;
+}
+
+void UPSHIDDevice::applyCommand(const HIDCommand& command, const ReportImage& image)
+{
+    uint8_t* report = &imageData_[image.offset + 1];
+    size_t len = image.size - 1;
+    for(uint8_t b=0;b<command.bitWidth;++b){
+        size_t bit = command.bitPlace + b;
+        if(bit / 8 >= len){
+            break;
+        }
+        if(command.bits & (1u << b)){
+            report[bit / 8] |= 1u << (bit % 8);
+        }else{
+            report[bit / 8] &= ~(1u << (bit % 8));
+        }
+    }
+}
+
+bool UPSHIDDevice::nextSetReport(HIDReportType& type, uint8_t* data, uint16_t& length, uint16_t maxLength)
+{
+    if(xSemaphoreTake(mutexCommands_, portMAX_DELAY ) != pdTRUE){
+        return false;
+    }
+    const ReportImage* image = nullptr;
+    while((image == nullptr) && (commandCount_ > 0)){
+        const HIDCommand& command = commands_[commandFirst_];
+        //Commands resolved before a layout change are dropped
+        if(command.generation == generation_){
+            image = findReportImage(command.reportType, command.reportId);
+        }
+        if(image == nullptr){
+            ESP_LOGW(TAG, "UPS %u command on report 0x%02x dropped", index_ + 1, command.reportId);
+            commandFirst_ = (commandFirst_ + 1) % UPS_COMMAND_QUEUE_LENGTH;
+            --commandCount_;
+        }
+    }
+    if(image != nullptr){
+        //Following commands on the same report go in the same transfer
+        type = commands_[commandFirst_].reportType;
+        uint8_t reportId = commands_[commandFirst_].reportId;
+        while((commandCount_ > 0) && (commands_[commandFirst_].reportType == type) &&
+                (commands_[commandFirst_].reportId == reportId) && (commands_[commandFirst_].generation == generation_)){
+            applyCommand(commands_[commandFirst_], *image);
+            commandFirst_ = (commandFirst_ + 1) % UPS_COMMAND_QUEUE_LENGTH;
+            --commandCount_;
+        }
+        length = std::min(image->size, maxLength);
+        memcpy(data, &imageData_[image->offset], length);
+    }
+    xSemaphoreGive(mutexCommands_);
+    return image != nullptr;
+}
+
+void UPSHIDDevice::decodeReport(HIDReportType type, const uint8_t* data, size_t len)
+{
+    if(len == 0){
+        return;
+    }
+    //Reception times are plain stores, readers accept a time a report late
+    uint32_t now = millis();
+    lastReportMs_.store(now, std::memory_order_relaxed);
+    // ESP_LOGI(TAG, "Got Report ID : %u", data[0]);
+    const ReportPlan& plan = reportPlans_[static_cast<uint8_t>(type) - 1][data[0]];
+    if(plan.count == 0){
+        return;
+    }
+    if(plan.timeSlot != HID_NO_REPORT_SLOT){
+        reportTimes_[plan.timeSlot].store(now, std::memory_order_relaxed);
+    }
+    //Only values which changed (or are decoded for the first time) are published
+    uint8_t events = 0;
+    const HIDDecodeStep* step = decodeSteps_.data() + plan.first;
+    for(uint16_t j=0;j<plan.count;++j, ++step){
+        int32_t value = decode(*step, &data[1], len-1);
+        uint16_t word = step->fieldIndex / 32;
+        uint32_t bit = 1u << (step->fieldIndex % 32);
+        if((working_.values[step->fieldIndex] != value) || !(working_.validMask[word] & bit)){
+            working_.values[step->fieldIndex] = value;
+            working_.validMask[word] |= bit;
+            events |= (readingFieldMask_[word] & bit) ? (UPSEventBus::VALUES | UPSEventBus::READINGS) : UPSEventBus::VALUES;
+        }
+    }
+    if(events != 0){
+        publish(events);
+    }
+}
+
+void UPSHIDDevice::updateIdleRate()
 {
-    return datas_[1];
+    if(!connected_ || !idleSupported_){
+        return;
+    }
+    //Debounced, a flapping mains doesn't flood the UPS with SET_IDLE
+    bool onBattery = upsState.is(index_, UPSState::ON_BATTERY);
+    int16_t duration = (onBattery ? HID_IDLE_BATTERY_MS : HID_IDLE_ONLINE_MS) / 4;
+    if(duration != idleRequested_){
+        ESP_LOGI(TAG, "UPS %u %s, input reports %s", index_ + 1, onBattery ? "on battery" : "on AC",
+                    duration == 0 ? "on change only" : "at a fast rate");
+        idleRequested_ = duration;
+        hidBridge.requestSetIdle(index_, duration);
+    }
+}
+
+void UPSHIDDevice::idleSet(uint8_t duration, bool accepted)
+{
+    if(accepted){
+        idleActive_ = duration;
+        return;
+    }
+    //SET_IDLE is optional, the device keeps its own rate
+    ESP_LOGW(TAG, "UPS %u does not support SET_IDLE", index_ + 1);
+    idleSupported_ = false;
+    idleActive_ = -1;
+}
+
+uint32_t UPSHIDDevice::getDataAge(uint32_t nowMs) const
+{
+    uint32_t last = lastReportMs_.load(std::memory_order_relaxed);
+    //A report decoded after nowMs was read is not older than 0
+    int32_t age = nowMs - (last != 0 ? last : connectedMs_.load(std::memory_order_relaxed));
+    return std::max<int32_t>(age, 0);
+}
+
+uint32_t UPSHIDDevice::getFieldAge(const UpsSnapshot& snapshot, uint16_t field, uint32_t nowMs) const
+{
+    if((field >= HID_MAX_FIELDS) || (snapshot.reportSlots[field] == HID_NO_REPORT_SLOT)){
+        return UINT32_MAX;
+    }
+    uint32_t last = reportTimes_[snapshot.reportSlots[field]].load(std::memory_order_relaxed);
+    if(last == 0){
+        return UINT32_MAX;
+    }
+    return std::max<int32_t>(nowMs - last, 0);
 }
 
-const HIDData& UPSHIDDevice::getCharging() const
+uint32_t UPSHIDDevice::staleTimeout() const
 {
-    return datas_[2];
+    //Feature polls or the Input probe, and Input reports once an idle rate is set
+    uint32_t period = refreshMs_;
+    int16_t idle = idleActive_;
+    if((idle > 0) && ((period == 0) || ((uint32_t)idle * 4 < period))){
+        period = idle * 4;
+    }
+    if(period == 0){
+        //No readable report, the device is still expected to answer something
+        period = HID_PROBE_MS;
+    }
+    return std::max<uint32_t>(period * HID_STALE_PERIODS, HID_STALE_MIN_MS);
 }
 
-const HIDData& UPSHIDDevice::getDischarging() const
+void UPSHIDDevice::watchdog()
 {
-    return datas_[3];
+    uint32_t now = millis();
+    for(UPSHIDDevice& device : upsDevices){
+        device.checkStale(now);
+        device.updateIdleRate();
+        if(device.layoutUnsaved_.exchange(false)){
+            device.saveLayout();
+        }
+    }
 }
 
-const HIDData& UPSHIDDevice::getBatteryPresent() const
+void UPSHIDDevice::checkStale(uint32_t nowMs)
 {
-    return datas_[4];
+    if(!connected_){
+        //Disconnected is reported instead, a device enumerated without layout is enumerated again
+        stale_ = false;
+        uint32_t attached = attachedMs_.load(std::memory_order_relaxed);
+        if((attached != 0) && ((int32_t)(nowMs - attached) >= HID_LAYOUT_TIMEOUT_MS)){
+            if(resets_ == 0){
+                ESP_LOGW(TAG, "UPS %u gave no layout after %u ms", index_ + 1, (unsigned)(nowMs - attached));
+            }
+            resetDevice(nowMs);
+        }
+        return;
+    }
+    uint32_t timeout = staleTimeout();
+    bool reported = lastReportMs_.load(std::memory_order_relaxed) != 0;
+    uint32_t age = getDataAge(nowMs);
+    if(age < timeout){
+        if(stale_){
+            ESP_LOGI(TAG, "UPS %u reports again", index_ + 1);
+            stale_ = false;
+            upsEvents.publish(index_, UPSEventBus::READINGS);
+        }
+        if(reported){
+            resets_ = 0;
+        }
+        return;
+    }
+    if(!stale_){
+        ESP_LOGW(TAG, "UPS %u sent no report for %u ms, data is stale", index_ + 1, (unsigned)age);
+        stale_ = true;
+        upsEvents.publish(index_, UPSEventBus::READINGS);
+    }
+    resetDevice(nowMs);
 }
 
+void UPSHIDDevice::resetDevice(uint32_t nowMs)
+{
+    if((resets_ == 0) || ((int32_t)(nowMs - nextResetMs_) >= 0)){
+        //Enumerate again, the next attempts are spaced out while the UPS stays silent
+        ESP_LOGW(TAG, "Resetting UPS %u (attempt %u)", index_ + 1, resets_ + 1);
+        nextResetMs_ = nowMs + (HID_RESET_BACKOFF_MS << std::min<uint8_t>(resets_, HID_RESET_BACKOFF_MAX));
+        if(resets_ < UINT8_MAX){
+            ++resets_;
+        }
+        hidBridge.requestReset(index_);
+    }
+}
 
-const HIDData& UPSHIDDevice::getNeedReplacement() const
+void UPSHIDDevice::publish(uint8_t events)
 {
-    return datas_[5];
+    snapshot_.write(working_);
+    upsEvents.publish(index_, events);
 }
 
+int32_t UPSHIDDevice::decode(const HIDDecodeStep& step, const uint8_t* buffer, size_t len)
+{
+    //Load the bytes holding the field in one word (little endian)
+    uint64_t word = 0;
+    if(step.byteOffset + sizeof(word) <= len){
+        memcpy(&word, &buffer[step.byteOffset], sizeof(word));
+    }else{
+        for(size_t i=0;(i<step.byteCount) && ((step.byteOffset + i) < len);++i){
+            word |= (uint64_t)buffer[step.byteOffset + i] << (i*8);
+        }
+    }
+    uint32_t bits = static_cast<uint32_t>(word >> step.shift) & step.mask;
+    if(bits & step.signBit){
+        bits |= ~step.mask;
+    }
+    //Q16.16 product rounded to the value exponent
+    int64_t fixed = ((int64_t)static_cast<int32_t>(bits) - step.logicalMin) * step.scale;
+    return fixedSaturate(((fixed + 0x8000) >> 16) + step.offset);
+}
 
-const HIDData& UPSHIDDevice::getRuntimeToEmpty() const
+void UPSHIDDevice::deviceRemoved()
 {
-    return datas_[6];
+    ESP_LOGI(TAG, "UPS %u removed", index_ + 1);
+    connected_ = false;
+    attachedMs_.store(0, std::memory_order_relaxed);
+    layoutUnsaved_ = false;
+    //Reset the registry
+    if(xSemaphoreTake(mutexFields_, portMAX_DELAY ) == pdTRUE){
+        collections_.clear();
+        fields_.clear();
+        outputs_.clear();
+        fieldNames_.clear();
+        reportSizes_.clear();
+        descriptorHash_ = 0;
+        memset(reportPlans_, 0, sizeof(reportPlans_));
+        decodeSteps_.clear();
+        ++generation_;
+        xSemaphoreGive(mutexFields_);
+    }
+    working_.clear();
+    working_.generation = generation_;
+    memset(readingFieldMask_, 0, sizeof(readingFieldMask_));
+    idleRequested_ = -1;
+    idleSupported_ = true;
+    idleActive_ = -1;
+    refreshMs_ = 0;
+    reportImages_.clear();
+    imageData_.clear();
+    manufacturer_ = "";
+    model_ = "";
+    serial_ = "";
+    publish(UPSEventBus::DECODE);
 }
 
 void UPSHIDDevice::updateGlobalItems(HIDGlobalItems& store, const HIDReportItemPrefix& prefix, const uint8_t* data)
@@ -314,11 +1151,15 @@ void UPSHIDDevice::updateGlobalItems(HIDGlobalItems& store, const HIDReportItemP
                 store.reportSize.setValue(toUnSignedInteger(data, prefix.bSize));
                 break;
             case HIDReportItemPrefix::GlobalTag::ReportID:
-                store.reportID.setValue(data[0]);
+                store.reportID.setValue(toUnSignedInteger(data, prefix.bSize));
                 break;
             case HIDReportItemPrefix::GlobalTag::ReportCount:
                 store.reportCount.setValue(toUnSignedInteger(data, prefix.bSize));
                 break;
+            case HIDReportItemPrefix::GlobalTag::Push:
+            case HIDReportItemPrefix::GlobalTag::Pop:
+                //Stack is handled by the parser
+                break;
         }
     }
 }
@@ -329,6 +1170,10 @@ void UPSHIDDevice::updateLocalItems(HIDLocalItem& store, const HIDReportItemPref
         switch(prefix.bTag.localTag){
             case HIDReportItemPrefix::LocalTag::Usage:
                 store.usage.setValue(toUnSignedInteger(data, prefix.bSize));
+                if(store.usageCount < HIDLocalItem::MAX_USAGES){
+                    //Page in high word is only meaningful for 4 bytes usages
+                    store.usages[store.usageCount++] = prefix.bSize == 4 ? store.usage.getValue() : (store.usage.getValue() & 0xFFFF);
+                }
                 break;
             case HIDReportItemPrefix::LocalTag::UsageMin:
                 store.usageMinimum.setValue(toUnSignedInteger(data, prefix.bSize));
@@ -468,27 +1313,23 @@ const char* UPSHIDDevice::localTagToString(HIDReportItemPrefix::LocalTag localTa
 
 int32_t UPSHIDDevice::toSignedInteger(const uint8_t* data, size_t len)
 {
-    int32_t ret = 0;
-	int32_t shift = 24;
-	for(int i=len-1;i>=0;--i){       
-		ret |= data[i] << shift;
-		shift -= 8;
-	}
-    if(len != 4){
-	    int32_t divider = ((1<<((4-len)*8))-1);	
-	    return ret/divider;
+    if(len == 0){
+        return 0;
     }
-    return ret;
+    //Sign extend from the most significant byte
+    uint32_t ret = toUnSignedInteger(data, len);
+    if((len < 4) && (data[len-1] & 0x80)){
+        ret |= 0xFFFFFFFFu << (len * 8);
+    }
+    return static_cast<int32_t>(ret);
 }
 
 uint32_t UPSHIDDevice::toUnSignedInteger(const uint8_t* data, size_t len)
 {
     uint32_t ret = 0;
-    int32_t shift = 0;
-	for(int i=0;i<len;++i){       
-		ret |= data[i] << shift;
-		shift += 8;
-	}
+    for(size_t i=0;(i<len) && (i<4);++i){
+        ret |= (uint32_t)data[i] << (i*8);
+    }
     return ret;
 }
 
@@ -499,11 +1340,162 @@ void UPSHIDDevice::setDeviceInfo(usb_device_info_t *dev_info)
     getStringDescriptor(dev_info->str_desc_serial_num, serial_);
 }
 
+void UPSHIDDevice::setDeviceDescriptor(const usb_device_desc_t *dev_desc)
+{
+    idVendor_ = dev_desc->idVendor;
+    idProduct_ = dev_desc->idProduct;
+    bcdDevice_ = dev_desc->bcdDevice;
+    attachedMs_.store(std::max<uint32_t>(millis(), 1), std::memory_order_relaxed);
+    //Publish readings from the first report instead of waiting for the descriptor
+    if(loadLayout()){
+        publish(UPSEventBus::DECODE);
+    }
+}
+
+uint32_t UPSHIDDevice::descriptorHash(const uint8_t* data, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for(size_t i=0;i<len;++i){
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+std::string UPSHIDDevice::layoutCacheFileName() const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/hid_%04x_%04x_%04x.bin", idVendor_, idProduct_, bcdDevice_);
+    return name;
+}
+
+bool UPSHIDDevice::loadLayout()
+{
+    static_assert(std::is_trivially_copyable<HIDData>::value, "HIDData is cached as raw bytes");
+    static_assert(std::is_trivially_copyable<HIDCollection>::value, "HIDCollection is cached as raw bytes");
+    File file = LittleFS.open(layoutCacheFileName().c_str(), "r");
+    if(!file){
+        return false;
+    }
+    LayoutCacheHeader header;
+    bool valid = (file.read((uint8_t*)&header, sizeof(header)) == sizeof(header)) &&
+                    (header.magic == LAYOUT_CACHE_MAGIC) && (header.version == LAYOUT_CACHE_VERSION) &&
+                    (header.idVendor == idVendor_) && (header.idProduct == idProduct_) && (header.bcdDevice == bcdDevice_) &&
+                    (header.fieldCount > 0) && (header.fieldCount <= HID_MAX_FIELDS) && (header.namesSize > 0) &&
+                    (header.collectionCount <= HID_MAX_COLLECTIONS) && (header.outputCount <= HID_MAX_OUTPUT_FIELDS) &&
+                    (header.reportSizeCount <= REPORT_TYPE_COUNT * 256);
+    if(!valid || (xSemaphoreTake(mutexFields_, portMAX_DELAY ) != pdTRUE)){
+        file.close();
+        return false;
+    }
+    collections_.resize(header.collectionCount);
+    fields_.resize(header.fieldCount);
+    outputs_.resize(header.outputCount);
+    std::vector<uint32_t> nameOffsets(header.fieldCount);
+    reportSizes_.resize(header.reportSizeCount);
+    fieldNames_.resize(header.namesSize);
+    auto readAll = [&file](void* dest, size_t len)->bool{
+        return file.read((uint8_t*)dest, len) == len;
+    };
+    valid = readAll(collections_.data(), collections_.size() * sizeof(HIDCollection)) &&
+            readAll(fields_.data(), fields_.size() * sizeof(HIDData)) &&
+            readAll(outputs_.data(), outputs_.size() * sizeof(HIDData)) &&
+            readAll(nameOffsets.data(), nameOffsets.size() * sizeof(uint32_t)) &&
+            readAll(reportSizes_.data(), reportSizes_.size() * sizeof(ReportSize)) &&
+            readAll(fieldNames_.data(), fieldNames_.size()) &&
+            (fieldNames_.back() == '\0');
+    file.close();
+    for(uint16_t j=0;valid && (j<fields_.size());++j){
+        valid = nameOffsets[j] < fieldNames_.size();
+        fields_[j].setName(valid ? &fieldNames_[nameOffsets[j]] : "");
+    }
+    for(HIDData& output : outputs_){
+        output.setName("");
+    }
+    valid = valid && layoutConsistent();
+    if(valid){
+        descriptorHash_ = header.descriptorHash;
+        activateLayout();
+        ESP_LOGI(TAG, "UPS %u layout restored from cache (%u fields)", index_ + 1, fields_.size());
+    }else{
+        ESP_LOGW(TAG, "Invalid layout cache %s", layoutCacheFileName().c_str());
+        collections_.clear();
+        fields_.clear();
+        outputs_.clear();
+        fieldNames_.clear();
+        reportSizes_.clear();
+    }
+    xSemaphoreGive(mutexFields_);
+    return valid;
+}
+
+bool UPSHIDDevice::layoutConsistent() const
+{
+    //Parents come first, walking up to the root always ends
+    for(uint16_t j=0;j<collections_.size();++j){
+        if((collections_[j].parent != HID_NO_COLLECTION) && (collections_[j].parent >= j)){
+            return false;
+        }
+    }
+    std::vector<uint16_t> reportBytes(REPORT_TYPE_COUNT * 256, 0);
+    for(const ReportSize& report : reportSizes_){
+        uint8_t type = static_cast<uint8_t>(report.type);
+        if((type < 1) || (type > REPORT_TYPE_COUNT)){
+            return false;
+        }
+        reportBytes[(type - 1) * 256 + report.reportId] = report.bytes;
+    }
+    auto fieldValid = [this, &reportBytes](const HIDData& field){
+        uint8_t type = static_cast<uint8_t>(field.getReportType());
+        uint16_t place;
+        uint8_t width;
+        field.getBitsConfiguration(place, width);
+        return (type >= 1) && (type <= REPORT_TYPE_COUNT) &&
+                ((field.getCollection() == HID_NO_COLLECTION) || (field.getCollection() < collections_.size())) &&
+                (width > 0) && (width <= 32) && ((uint32_t)place + width <= (uint32_t)reportBytes[(type - 1) * 256 + field.getReportId()] * 8);
+    };
+    return std::all_of(fields_.begin(), fields_.end(), fieldValid) && std::all_of(outputs_.begin(), outputs_.end(), fieldValid);
+}
+
+void UPSHIDDevice::saveLayout() const
+{
+    if(xSemaphoreTake(mutexFields_, portMAX_DELAY ) != pdTRUE){
+        return;
+    }
+    if(fields_.empty()){
+        xSemaphoreGive(mutexFields_);
+        return;
+    }
+    LayoutCacheHeader header = {
+        LAYOUT_CACHE_MAGIC, LAYOUT_CACHE_VERSION, idVendor_, idProduct_, bcdDevice_, descriptorHash_,
+        static_cast<uint16_t>(collections_.size()), static_cast<uint16_t>(fields_.size()), static_cast<uint16_t>(outputs_.size()),
+        static_cast<uint16_t>(reportSizes_.size()), static_cast<uint32_t>(fieldNames_.size())
+    };
+    std::vector<uint32_t> nameOffsets(fields_.size());
+    for(uint16_t j=0;j<fields_.size();++j){
+        nameOffsets[j] = fields_[j].getName() - fieldNames_.data();
+    }
+    File file = LittleFS.open(layoutCacheFileName().c_str(), "w");
+    if(!file){
+        xSemaphoreGive(mutexFields_);
+        ESP_LOGW(TAG, "Unable to write layout cache");
+        return;
+    }
+    file.write((const uint8_t*)&header, sizeof(header));
+    file.write((const uint8_t*)collections_.data(), collections_.size() * sizeof(HIDCollection));
+    file.write((const uint8_t*)fields_.data(), fields_.size() * sizeof(HIDData));
+    file.write((const uint8_t*)outputs_.data(), outputs_.size() * sizeof(HIDData));
+    file.write((const uint8_t*)nameOffsets.data(), nameOffsets.size() * sizeof(uint32_t));
+    file.write((const uint8_t*)reportSizes_.data(), reportSizes_.size() * sizeof(ReportSize));
+    file.write((const uint8_t*)fieldNames_.data(), fieldNames_.size());
+    file.close();
+    xSemaphoreGive(mutexFields_);
+}
+
 void UPSHIDDevice::getStringDescriptor(const usb_str_desc_t *str_desc, std::string& dest)
 {
     dest = "";
     if(str_desc){
-        for (int i = 0; i < str_desc->bLength / 2; i++) {
+        for (int i = 0; i < (str_desc->bLength - 2) / 2; i++) {
             /*
             USB String descriptors of UTF-16.
             Right now We just skip any character larger than 0xFF to stay in BMP Basic Latin and Latin-1 Supplement range.
@@ -516,39 +1508,106 @@ void UPSHIDDevice::getStringDescriptor(const usb_str_desc_t *str_desc, std::stri
     }
 }
 
-void UPSHIDDevice::statusToJSON(JsonDocument& doc) const
+void UPSHIDDevice::statusToJSON(JsonObject ups) const
 {
-    if(isConnected()){
-        doc["UPS"]["status"] = "connected";
-        addToJSON(getRemainingCapacity(), doc);
-        addToJSON(getACPresent(), doc);
-        addToJSON(getCharging(), doc);
-        addToJSON(getDischarging(), doc);
-        addToJSON(getBatteryPresent(), doc);
-        addToJSON(getNeedReplacement(), doc);
-        addToJSON(getRuntimeToEmpty(), doc);
-        doc["UPS"]["model"] = getModel();
-        doc["UPS"]["serial"] = getSerial();
+    UpsSnapshot snapshot;
+    getSnapshot(snapshot);
+    ups["index"] = index_ + 1;
+    if(snapshot.connected){
+        ups["status"] = "connected";
+        for(uint8_t r=0;r<UpsSnapshot::READING_COUNT;++r){
+            addToJSON(snapshot, static_cast<UpsSnapshot::Reading>(r), ups);
+        }
+        ups["model"] = getModel();
+        ups["serial"] = getSerial();
+        int16_t idle = idleActive_;
+        if(idle >= 0){
+            //Input report period set with SET_IDLE (0 only on change)
+            ups["report_idle_ms"] = idle * 4;
+        }
+        uint32_t now = millis();
+        ups["data_age_ms"] = getDataAge(now);
+        ups["stale"] = isStale();
+        for(uint8_t r=0;r<UpsSnapshot::READING_COUNT;++r){
+            UpsSnapshot::Reading reading = static_cast<UpsSnapshot::Reading>(r);
+            uint32_t age = snapshot.isUsed(reading) ? getFieldAge(snapshot, snapshot.readingFields[r], now) : UINT32_MAX;
+            if(age != UINT32_MAX){
+                ups["reading_age_ms"][getReadingName(reading)] = age;
+            }
+        }
+        fieldsToJSON(snapshot, ups);
     }else{
-        doc["UPS"]["status"] = "disconnected";
+        ups["status"] = "disconnected";
+    }
+}
+
+void UPSHIDDevice::devicesToJSON(JsonDocument& doc)
+{
+    JsonArray devices = doc["UPS"].to<JsonArray>();
+    for(const UPSHIDDevice& device : upsDevices){
+        if(device.isConnected()){
+            device.statusToJSON(devices.add<JsonObject>());
+        }
     }
 }
 
 void UPSHIDDevice::statusToJSONString(std::string& str) const
 {
     JsonDocument doc;
-    statusToJSON(doc);
+    statusToJSON(doc.to<JsonObject>());
     serializeJson(doc, str);
 }
 
-void UPSHIDDevice::addToJSON(const HIDData& data, JsonDocument& doc)
+void UPSHIDDevice::valueToJSON(JsonVariant dest, int32_t value, int8_t exponent)
+{
+    if(exponent >= 0){
+        dest = (int64_t)value * fixedPow10(exponent);
+    }else{
+        char str[24];
+        fixedToString(str, sizeof(str), value, exponent);
+        dest = serialized(std::string(str));
+    }
+}
+
+void UPSHIDDevice::unitToJSON(JsonObject ups, const char* name, HIDUnit unit)
+{
+    const char* symbol = hidUnitSymbol(unit);
+    if(symbol != nullptr){
+        ups["units"][name] = symbol;
+    }
+}
+
+void UPSHIDDevice::addToJSON(const UpsSnapshot& snapshot, UpsSnapshot::Reading reading, JsonObject ups) const
 {
-    if(data.isUsed()){
-        if(data.isBool()){
+    if(snapshot.isUsed(reading)){
+        int16_t field = snapshot.readingFields[reading];
+        if(snapshot.isBool(reading)){
             //Boolean value
-            doc["UPS"][data.getName()] = data.getValue() == 0 ? false : true;
+            ups[getReadingName(reading)] = snapshot.values[field] == 0 ? false : true;
         }else{
-            doc["UPS"][data.getName()] = data.getValue();
+            valueToJSON(ups[getReadingName(reading)], snapshot.values[field], snapshot.exponents[field]);
+            unitToJSON(ups, getReadingName(reading), snapshot.units[field]);
         }
     }
-}
\ No newline at end of file
+}
+
+void UPSHIDDevice::fieldsToJSON(const UpsSnapshot& snapshot, JsonObject ups) const
+{
+    if(xSemaphoreTake(mutexFields_, portMAX_DELAY ) == pdTRUE){
+        //Values must belong to the registry we are looking at
+        if(snapshot.generation == generation_){
+            for(uint16_t j=0;(j<snapshot.fieldCount) && (j<fields_.size());++j){
+                if(!snapshot.isValid(j)){
+                    continue;
+                }
+                if(fields_[j].isBool()){
+                    ups["fields"][fields_[j].getName()] = snapshot.values[j] == 0 ? false : true;
+                }else{
+                    valueToJSON(ups["fields"][fields_[j].getName()], snapshot.values[j], snapshot.exponents[j]);
+                    unitToJSON(ups, fields_[j].getName(), snapshot.units[j]);
+                }
+            }
+        }
+        xSemaphoreGive(mutexFields_);
+    }
+}
@@ -0,0 +1,243 @@
+#include <UPSMib.hpp>
+#include "esp_log.h"
+
+static const char* TAG = "UPSMib";
+
+const UPSMib::ObjectInfo UPSMib::OBJECTS[OBJECT_COUNT] = {
+    //system and host resources
+    {".1.3.6.1.2.1.1.1", Instance::Global, BER_OCTET_STRING, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},  //sysDescr
+    {".1.3.6.1.2.1.1.3", Instance::Global, BER_TIMETICKS, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},     //sysUpTime
+    {".1.3.6.1.2.1.1.5", Instance::Global, BER_OCTET_STRING, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},  //sysName
+    {".1.3.6.1.2.1.25.1.1", Instance::Global, BER_TIMETICKS, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},  //hrSystemUptime
+    //upsIdent group
+    {".1.3.6.1.2.1.33.1.1.1", Instance::Scalar, BER_OCTET_STRING, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0}, //upsIdentManufacturer
+    {".1.3.6.1.2.1.33.1.1.2", Instance::Scalar, BER_OCTET_STRING, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0}, //upsIdentModel
+    {".1.3.6.1.2.1.33.1.1.3", Instance::Scalar, BER_OCTET_STRING, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0}, //upsIdentUPSSoftwareVersion
+    {".1.3.6.1.2.1.33.1.1.4", Instance::Scalar, BER_OCTET_STRING, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0}, //upsIdentAgentSoftwareVersion
+    {".1.3.6.1.2.1.33.1.1.5", Instance::Scalar, BER_OCTET_STRING, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0}, //upsIdentName
+    {".1.3.6.1.2.1.33.1.1.6", Instance::Scalar, BER_OCTET_STRING, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0}, //upsIdentAttachedDevices
+    //upsBattery group
+    {".1.3.6.1.2.1.33.1.2.1", Instance::Scalar, BER_INTEGER, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},           //upsBatteryStatus
+    {".1.3.6.1.2.1.33.1.2.2", Instance::Scalar, BER_INTEGER, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},           //upsSecondsOnBattery
+    {".1.3.6.1.2.1.33.1.2.3", Instance::Scalar, BER_INTEGER, false, UpsSnapshot::RUN_TIME_TO_EMPTY, HIDUnit::Second, 0},     //upsEstimatedMinutesRemaining
+    {".1.3.6.1.2.1.33.1.2.4", Instance::Scalar, BER_INTEGER, false, UpsSnapshot::REMAINING_CAPACITY, HIDUnit::Percent, 0},   //upsEstimatedChargeRemaining
+    {".1.3.6.1.2.1.33.1.2.5", Instance::Scalar, BER_INTEGER, false, UpsSnapshot::BATTERY_VOLTAGE, HIDUnit::Volt, -1},        //upsBatteryVoltage (0.1 V)
+    {".1.3.6.1.2.1.33.1.2.6", Instance::Scalar, BER_INTEGER, false, UpsSnapshot::BATTERY_CURRENT, HIDUnit::Ampere, -1},      //upsBatteryCurrent (0.1 A)
+    {".1.3.6.1.2.1.33.1.2.7", Instance::Scalar, BER_INTEGER, false, UpsSnapshot::TEMPERATURE, HIDUnit::Celsius, 0},          //upsBatteryTemperature
+    //upsInput group, one line
+    {".1.3.6.1.2.1.33.1.3.1", Instance::Scalar, BER_COUNTER32, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},         //upsInputLineBads
+    {".1.3.6.1.2.1.33.1.3.2", Instance::Scalar, BER_INTEGER, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},           //upsInputNumLines
+    {".1.3.6.1.2.1.33.1.3.3.1.2.1", Instance::Column, BER_INTEGER, false, UpsSnapshot::INPUT_FREQUENCY, HIDUnit::Hertz, -1}, //upsInputFrequency (0.1 Hz)
+    {".1.3.6.1.2.1.33.1.3.3.1.3.1", Instance::Column, BER_INTEGER, false, UpsSnapshot::INPUT_VOLTAGE, HIDUnit::Volt, 0},     //upsInputVoltage
+    {".1.3.6.1.2.1.33.1.3.3.1.4.1", Instance::Column, BER_INTEGER, false, UpsSnapshot::INPUT_CURRENT, HIDUnit::Ampere, -1},  //upsInputCurrent (0.1 A)
+    {".1.3.6.1.2.1.33.1.3.3.1.5.1", Instance::Column, BER_INTEGER, false, UpsSnapshot::INPUT_POWER, HIDUnit::Watt, 0},       //upsInputTruePower
+    //upsOutput group, one line
+    {".1.3.6.1.2.1.33.1.4.1", Instance::Scalar, BER_INTEGER, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},           //upsOutputSource
+    {".1.3.6.1.2.1.33.1.4.2", Instance::Scalar, BER_INTEGER, false, UpsSnapshot::OUTPUT_FREQUENCY, HIDUnit::Hertz, -1},      //upsOutputFrequency (0.1 Hz)
+    {".1.3.6.1.2.1.33.1.4.3", Instance::Scalar, BER_INTEGER, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},           //upsOutputNumLines
+    {".1.3.6.1.2.1.33.1.4.4.1.2.1", Instance::Column, BER_INTEGER, false, UpsSnapshot::OUTPUT_VOLTAGE, HIDUnit::Volt, 0},    //upsOutputVoltage
+    {".1.3.6.1.2.1.33.1.4.4.1.3.1", Instance::Column, BER_INTEGER, false, UpsSnapshot::OUTPUT_CURRENT, HIDUnit::Ampere, -1}, //upsOutputCurrent (0.1 A)
+    {".1.3.6.1.2.1.33.1.4.4.1.4.1", Instance::Column, BER_INTEGER, false, UpsSnapshot::OUTPUT_POWER, HIDUnit::Watt, 0},      //upsOutputPower
+    {".1.3.6.1.2.1.33.1.4.4.1.5.1", Instance::Column, BER_INTEGER, false, UpsSnapshot::OUTPUT_LOAD, HIDUnit::Percent, 0},    //upsOutputPercentLoad
+    //upsAlarm group
+    {".1.3.6.1.2.1.33.1.6.1", Instance::Scalar, BER_GAUGE32, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},           //upsAlarmsPresent
+    {".1.3.6.1.2.1.33.1.6.2.1.1", Instance::Alarm, BER_INTEGER, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},        //upsAlarmId
+    {".1.3.6.1.2.1.33.1.6.2.1.2", Instance::Alarm, BER_OID, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},            //upsAlarmDescr
+    {".1.3.6.1.2.1.33.1.6.2.1.3", Instance::Alarm, BER_TIMETICKS, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},      //upsAlarmTime
+    //upsTest group
+    {".1.3.6.1.2.1.33.1.7.3", Instance::Scalar, BER_INTEGER, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},           //upsTestResultsSummary
+    {".1.3.6.1.2.1.33.1.7.4", Instance::Scalar, BER_OCTET_STRING, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},      //upsTestResultsDetail
+    {".1.3.6.1.2.1.33.1.7.5", Instance::Scalar, BER_TIMETICKS, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},         //upsTestStartTime
+    //upsControl and upsConfig groups
+    {".1.3.6.1.2.1.33.1.8.2", Instance::Scalar, BER_INTEGER, true, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},            //upsShutdownAfterDelay
+    {".1.3.6.1.2.1.33.1.8.3", Instance::Scalar, BER_INTEGER, true, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},            //upsStartupAfterDelay
+    {".1.3.6.1.2.1.33.1.9.8", Instance::Scalar, BER_INTEGER, true, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},            //upsConfigAudibleStatus
+    //entity and sensors
+    {".1.3.6.1.2.1.47.1.1.1.1.2", Instance::Global, BER_OCTET_STRING, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},  //entPhysicalDescr
+    {".1.3.6.1.2.1.47.1.1.1.1.7", Instance::Global, BER_OCTET_STRING, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},  //entPhysicalName
+    {".1.3.6.1.2.1.47.1.1.1.1.11", Instance::Global, BER_OCTET_STRING, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0}, //entPhysicalSerialNum
+    {".1.3.6.1.2.1.99.1.1.1.4", Instance::Global, BER_INTEGER, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},         //Core internal temperature (0.1 C)
+    {".1.3.6.1.4.1.119.5.1.2.1.5.1", Instance::Global, BER_INTEGER, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0},    //Temperature probe (0.1 C)
+    //Data age (seconds since the last report of the UPS)
+    {".1.3.6.1.4.1.119.5.1.2.1.6", Instance::Scalar, BER_INTEGER, false, UpsSnapshot::READING_COUNT, HIDUnit::None, 0}
+};
+
+const char* const UPSMib::WELL_KNOWN_ALARMS = ".1.3.6.1.2.1.33.1.6.3";
+
+UPSMib::UPSMib() : global_(0), available_{}
+{
+}
+
+void UPSMib::begin()
+{
+    for(uint8_t i=0;i<OBJECT_COUNT;++i){
+        if(!oids_[i].parse(OBJECTS[i].oid)){
+            ESP_LOGE(TAG, "Invalid OID %s", OBJECTS[i].oid);
+        }
+        //Binary search needs the table sorted, an object can't prefix another
+        if((i > 0) && ((oids_[i - 1].compare(oids_[i]) >= 0) || oids_[i].startsWith(oids_[i - 1]))){
+            ESP_LOGE(TAG, "OID %s out of order", OBJECTS[i].oid);
+        }
+        if(OBJECTS[i].instance == Instance::Global){
+            global_ |= bit(static_cast<Object>(i));
+        }
+    }
+#ifdef NO_TEMP_PROBE
+    global_ &= ~bit(PROBE_TEMPERATURE);
+#endif
+}
+
+void UPSMib::setAlarmRows(uint8_t index, const std::vector<uint32_t>& rows)
+{
+    alarmRows_[index] = rows;
+}
+
+template<typename F>
+void UPSMib::forEachInstance(uint8_t object, bool aliases, F visit) const
+{
+    if(OBJECTS[object].instance == Instance::Global){
+        if(global_ & bit(static_cast<Object>(object))){
+            visit(Suffix{1, {0, 0}, 0, 0});
+            if(aliases){
+                visit(Suffix{0, {0, 0}, 0, 0});
+            }
+        }
+        return;
+    }
+    for(uint8_t i=0;i<UPS_MAX_DEVICES;++i){
+        if((available_[i] & bit(static_cast<Object>(object))) == 0){
+            continue;
+        }
+        uint32_t number = i + 1;
+        bool first = (i == 0);
+        switch(OBJECTS[object].instance){
+            case Instance::Scalar:
+                if(first){
+                    visit(Suffix{1, {0, 0}, i, 0});
+                }
+                if(!first || aliases){
+                    visit(Suffix{1, {number, 0}, i, 0});
+                }
+                if(first && aliases){
+                    visit(Suffix{0, {0, 0}, i, 0});
+                }
+                break;
+            case Instance::Column:
+                if(first){
+                    visit(Suffix{0, {0, 0}, i, 0});
+                }
+                if(!first || aliases){
+                    visit(Suffix{1, {number, 0}, i, 0});
+                }
+                break;
+            case Instance::Alarm:
+                for(uint32_t row : alarmRows_[i]){
+                    if(first){
+                        visit(Suffix{1, {row, 0}, i, row});
+                    }
+                    if(!first || aliases){
+                        visit(Suffix{2, {row, number}, i, row});
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+int UPSMib::compareSuffix(const SnmpOid& oid, uint8_t offset, const Suffix& suffix)
+{
+    uint8_t length = oid.length - offset;
+    uint8_t common = length < suffix.length ? length : suffix.length;
+    for(uint8_t i=0;i<common;++i){
+        if(oid.arcs[offset + i] != suffix.arcs[i]){
+            return oid.arcs[offset + i] < suffix.arcs[i] ? -1 : 1;
+        }
+    }
+    return static_cast<int>(length) - static_cast<int>(suffix.length);
+}
+
+bool UPSMib::before(const Suffix& a, const Suffix& b)
+{
+    uint8_t common = a.length < b.length ? a.length : b.length;
+    for(uint8_t i=0;i<common;++i){
+        if(a.arcs[i] != b.arcs[i]){
+            return a.arcs[i] < b.arcs[i];
+        }
+    }
+    return a.length < b.length;
+}
+
+int UPSMib::lowerObject(const SnmpOid& oid) const
+{
+    int low = 0;
+    int high = OBJECT_COUNT;
+    while(low < high){
+        int middle = (low + high) / 2;
+        if(oids_[middle].compare(oid) <= 0){
+            low = middle + 1;
+        }else{
+            high = middle;
+        }
+    }
+    return low - 1;
+}
+
+uint8_t UPSMib::find(const SnmpOid& oid, Target& target) const
+{
+    int object = lowerObject(oid);
+    if((object < 0) || !oid.startsWith(oids_[object])){
+        return BER_NO_SUCH_OBJECT;
+    }
+    uint8_t offset = oids_[object].length;
+    bool available = false;
+    bool found = false;
+    forEachInstance(object, true, [&](const Suffix& suffix){
+        available = true;
+        if(!found && (compareSuffix(oid, offset, suffix) == 0)){
+            target = {static_cast<Object>(object), suffix.index, suffix.row};
+            found = true;
+        }
+    });
+    if(found){
+        return 0;
+    }
+    return available ? BER_NO_SUCH_INSTANCE : BER_NO_SUCH_OBJECT;
+}
+
+bool UPSMib::next(SnmpOid& oid, Target& target) const
+{
+    int object = lowerObject(oid);
+    //Objects before are all before the OID, the one prefixing it may have instances after
+    bool within = (object >= 0) && oid.startsWith(oids_[object]);
+    if(!within){
+        ++object;
+    }
+    for(;object<OBJECT_COUNT;++object){
+        uint8_t offset = oids_[object].length;
+        bool found = false;
+        Suffix first = {};
+        //One instance per UPS and row, the aliases would repeat the values
+        forEachInstance(object, false, [&](const Suffix& suffix){
+            if(within && (compareSuffix(oid, offset, suffix) >= 0)){
+                return;
+            }
+            //Smallest instance after the OID
+            if(!found || before(suffix, first)){
+                first = suffix;
+                found = true;
+            }
+        });
+        within = false;
+        if(found){
+            oid = oids_[object];
+            for(uint8_t i=0;i<first.length;++i){
+                oid.append(first.arcs[i]);
+            }
+            target = {static_cast<Object>(object), first.index, first.row};
+            return true;
+        }
+    }
+    return false;
+}
@@ -1,152 +1,823 @@
 #include <UPSSNMP.hpp>
 #include <ETH.h>
 #include <UPSHIDDevice.hpp>
+#include <UPSEvents.hpp>
+#include <UPSSelfTest.hpp>
+#include <UPSState.hpp>
 #include <Arduino.h>
 #include <esp_log.h>
-#include <ETH.h>
 #include <Configuration.hpp>
 #include <Temperature.hpp>
+#include <algorithm>
+#include <cstring>
+#include <lwip/sockets.h>
+#include <unistd.h>
 
 static const char* TAG = "SNMP";
 
-UPSSNMPAgent::UPSSNMPAgent() : agent_("public", "private"), started_(false), udp_(nullptr),
-                    lastPoll_(0), wasConnected_(false)
+/*Settable objects of RFC 1628 mapped to Power Device usages
+upsTestId and upsRebootWithDuration have no matching field
+**/
+static const struct {
+    UPSMib::Object object;
+    uint16_t usagePage;
+    uint16_t usage;
+    int32_t minimum;
+    int32_t maximum;
+    int32_t initial;
+} COMMAND_OIDS[] = {
+    {UPSMib::SHUTDOWN_AFTER_DELAY, 0x84, 0x57, -1, INT32_MAX, -1},  //Seconds (-1 aborts), DelayBeforeShutdown
+    {UPSMib::STARTUP_AFTER_DELAY, 0x84, 0x56, -1, INT32_MAX, -1},   //Seconds (-1 aborts), DelayBeforeStartup
+    {UPSMib::AUDIBLE_STATUS, 0x84, 0x5a, 1, 3, 2},                  //1 disabled, 2 enabled, 3 muted, AudibleAlarmControl
+};
+
+/*Alarms of upsAlarmTable raised by the UPS state
+upsWellKnownAlarms arcs, several conditions may raise the same alarm
+**/
+static const struct {
+    uint16_t flags;
+    uint8_t type;
+} ALARM_STATES[] = {
+    {UPSState::REPLACE_BATTERY | UPSState::NO_BATTERY, 1},  //upsAlarmBatteryBad
+    {UPSState::ON_BATTERY, 2},                              //upsAlarmOnBattery
+    {UPSState::LOW_BATTERY, 3},                             //upsAlarmLowBattery
+    {UPSState::OVER_TEMPERATURE, 5},                        //upsAlarmTempBad
+    {UPSState::BOOST | UPSState::TRIM, 6},                  //upsAlarmInputBad (input out of tolerance)
+    {UPSState::OVERLOAD, 8},                                //upsAlarmOutputOverload
+    {UPSState::FAULT, 18},                                  //upsAlarmGeneralFault
+    {UPSState::COMMUNICATION_LOST, 20},                     //upsAlarmCommunicationsLost
+    {UPSState::AWAITING_POWER, 21},                         //upsAlarmAwaitingPower
+    {UPSState::SHUTDOWN_PENDING, 22},                       //upsAlarmShutdownPending
+    {UPSState::SHUTDOWN_IMMINENT, 23},                      //upsAlarmShutdownImminent
+    {UPSState::TEST_IN_PROGRESS, 24}                        //upsAlarmTestInProgress
+};
+static constexpr uint8_t ALARM_ON_BATTERY = 2;
+
+static constexpr uint8_t ALARM_COMMUNICATIONS_LOST = 20;
+
+UPSSNMPAgent::UPSSNMPAgent() : running_(false), task_(nullptr), socket_(-1), events_(UPSEventBus::INVALID_SUBSCRIBER),
+                    wasConnected_{}, values_{}, nextAlarmId_{}, lineBads_{}, cache_{}, cacheWindowMs_(0),
+                    configChanged_(true), cacheHits_(0), cacheMisses_(0), trapsChanged_(true)
 {
+    static_assert(sizeof(COMMAND_OIDS) / sizeof(COMMAND_OIDS[0]) == COMMAND_OID_COUNT, "COMMAND_OID_COUNT mismatch");
+    for(uint8_t i=0;i<UPS_MAX_DEVICES;++i){
+        for(uint8_t j=0;j<COMMAND_OID_COUNT;++j){
+            commands_[i][j] = {COMMAND_OIDS[j].object, COMMAND_OIDS[j].usagePage, COMMAND_OIDS[j].usage,
+                                COMMAND_OIDS[j].minimum, COMMAND_OIDS[j].maximum, COMMAND_OIDS[j].initial, COMMAND_OIDS[j].initial};
+        }
+        minutesRemaining_[i] = -1;
+    }
 }
 
 void UPSSNMPAgent::begin()
 {
+    mib_.begin();
+    //Changes are taken by the agent task between requests
+    events_ = upsEvents.subscribe(UPSEventBus::CONNECTION | UPSEventBus::READINGS | UPSEventBus::VALUES | UPSEventBus::STATE, nullptr);
+    Configuration.registerListener([this](DeviceConfiguration::Parameter what){
+        if(what == DeviceConfiguration::Parameter::SNMP_CACHE){
+            configChanged_ = true;
+        }else if(what == DeviceConfiguration::Parameter::SNMP_TRAP_IP){
+            trapsChanged_ = true;
+        }
+    });
+    if(task_ == nullptr){
+        xTaskCreatePinnedToCore(
+            serverTask,
+            "snmpTask",
+            6144,
+            (void*)this,
+            SNMP_TASK_PRIORITY,
+            &task_,
+            SNMP_TASK_COREID);
+    }
 }
 
 void UPSSNMPAgent::start()
 {
-    if(!started_){
-        if(udp_ == nullptr){
-            udp_ = new WiFiUDP();            
-            agent_.setUDP(udp_);
-            //sysDescr
-            agent_.addReadOnlyStaticStringHandler(".1.3.6.1.2.1.1.1", "UPS gateway");
-            //sysName
-            agent_.addDynamicReadOnlyStringHandler(".1.3.6.1.2.1.1.5", []()->const std::string{ return ETH.getHostname(); });
-            //entPhysicalDescr
-            agent_.addReadOnlyStaticStringHandler(".1.3.6.1.2.1.47.1.1.1.1.2", "USB UPS to SNMP gateway");
-            //entPhysicalName
-            agent_.addReadOnlyStaticStringHandler(".1.3.6.1.2.1.47.1.1.1.1.7", "UPS gateway");
-            //entPhysicalSerialNum
-            agent_.addDynamicReadOnlyStringHandler(".1.3.6.1.2.1.47.1.1.1.1.11", []()->const std::string{ return ETH.macAddress().c_str(); });
-            // sysUpTime 
-            timestampCallback_ = (TimestampCallback*)agent_.addDynamicReadOnlyTimestampHandler(".1.3.6.1.2.1.1.3", []()->uint32_t{
-                return static_cast<uint32_t>(millis()/10);
-            });
-            //hrSystemUptime
-            agent_.addDynamicReadOnlyTimestampHandler(".1.3.6.1.2.1.25.1.1", []()->uint32_t{
-                return static_cast<uint32_t>(millis()/10);
-            });
+    if(!running_.exchange(true) && (task_ != nullptr)){
+        xTaskNotifyGive(task_);
+    }
+}
 
+void UPSSNMPAgent::stop()
+{
+    //Socket closed by the task at its next wakeup
+    running_ = false;
+}
 
-#ifndef NO_TEMP_PROBE
-            //Temperature probe
-            agent_.addDynamicIntegerHandler(".1.3.6.1.4.1.119.5.1.2.1.5.1", []()->int{
-                return tempProbe.getTemperatureProbe() * 10.0;
-            });
-#endif
-            //Core internal temperature
-            //1.3.6.1.2.1.99.1.1.1.4
-            agent_.addDynamicIntegerHandler(".1.3.6.1.2.1.99.1.1.1.4", []()->int{
-                return tempProbe.getInternalTemperature() * 10.0;
-            });
+void UPSSNMPAgent::serverTask(void* param)
+{
+    UPSSNMPAgent* agent = static_cast<UPSSNMPAgent*>(param);
+    for(;;){
+        if(!agent->running_){
+            agent->closeSocket();
+            //Changes kept pending while stopped, woken by start
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        if((agent->socket_ < 0) && !agent->openSocket()){
+            vTaskDelay(pdMS_TO_TICKS(SNMP_TASK_WAKEUP_MS));
+            continue;
+        }
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(agent->socket_, &readable);
+        //Woken earlier for a notification holdoff or an INFORM timeout
+        uint32_t waitMs = std::min<uint32_t>(SNMP_TASK_WAKEUP_MS, agent->notifier_.nextDue(millis()));
+        timeval timeout = {};
+        timeout.tv_sec = waitMs / 1000;
+        timeout.tv_usec = (waitMs % 1000) * 1000;
+        int ready = select(agent->socket_ + 1, &readable, nullptr, nullptr, &timeout);
+        //Changes first, the requests then see an up to date cache
+        agent->update();
+        if(ready > 0){
+            agent->receive();
+        }else if(ready < 0){
+            ESP_LOGE(TAG, "Socket wait failed (%d)", errno);
+            agent->closeSocket();
+            continue;
+        }
+        //Notifications after the requests
+        agent->notifier_.service(agent->socket_, millis());
+    }
+}
 
-            upsTrap_ = new SNMPTrap("public", SNMP_VERSION_2C);
-            upsTrap_->setUDP(udp_); // give a pointer to our UDP object
-            upsTrap_->setTrapOID(new OIDType(".1.3.6.1.2.1.33.2")); // OID of the trap
-            upsTrap_->setSpecificTrap(1);
-            
-            // Set the uptime counter to use in the trap (required)
-            upsTrap_->setUptimeCallback(timestampCallback_);
+bool UPSSNMPAgent::openSocket()
+{
+    socket_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(socket_ < 0){
+        ESP_LOGE(TAG, "Unable to create socket (%d)", errno);
+        return false;
+    }
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(SNMP_PORT);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(bind(socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0){
+        ESP_LOGE(TAG, "Unable to bind port %u (%d)", SNMP_PORT, errno);
+        closeSocket();
+        return false;
+    }
+    ESP_LOGI(TAG, "Agent listening on port %u", SNMP_PORT);
+    return true;
+}
 
-            // Set some previously set OID Callbacks to send these values with the trap (optional)
+void UPSSNMPAgent::closeSocket()
+{
+    if(socket_ >= 0){
+        close(socket_);
+        socket_ = -1;
+    }
+}
 
-            //upsEstimatedMinutesRemaining 1.3.6.1.2.1.33.1.2.3
-            //upsTraps 1.3.6.1.2.1.33.2
-            //sysName 1.3.6.1.2.1.1.5
-            //1.3.6.1.2.1.1.3 (sysUpTime)
-            agent_.sortHandlers();
+void UPSSNMPAgent::update()
+{
+    if(trapsChanged_.exchange(false)){
+        std::vector<DeviceConfiguration::SNMPTrapTarget> targets;
+        Configuration.getSNMPTraps(targets);
+        notifier_.setTargets(targets);
+    }
+    if(configChanged_.exchange(false)){
+        cacheWindowMs_ = Configuration.getSNMPCache();
+        ESP_LOGI(TAG, "Value cache window %u ms", cacheWindowMs_.load());
+        for(uint8_t i=0;i<UPS_MAX_DEVICES;++i){
+            invalidateCache(i);
         }
-        if(upsTrap_)
-            upsTrap_->setIP(ETH.localIP()); // Set our Source IP
-        agent_.begin();
-        started_ = true;
+    }
+    uint32_t pending = upsEvents.take(events_);
+    for(uint8_t i=0;(pending != 0) && (i<UPS_MAX_DEVICES);++i){
+        uint8_t events = UPSEventBus::getEvents(pending, i);
+        if(events != 0){
+            invalidateCache(i);
+        }
+        if((events & UPSEventBus::CONNECTION) == 0){
+            if((events & UPSEventBus::STATE) && wasConnected_[i]){
+                updateAlarms(i);
+            }
+            if((events & UPSEventBus::READINGS) && wasConnected_[i]){
+                trackMinutesRemaining(i);
+            }
+            continue;
+        }
+        bool connected = upsDevices[i].isConnected();
+        if(wasConnected_[i]){
+            //Removed or new field layout
+            destroyOID(i);
+        }
+        if(connected){
+            ESP_LOGI(TAG, "UPS %u reconnected!", i + 1);
+            initializeOID(i);
+            trackMinutesRemaining(i);
+            updateAlarms(i);
+        }else if(wasConnected_[i]){
+            ESP_LOGI(TAG, "UPS %u disconnected!", i + 1);
+            //The UPS is unknown from now on, not on battery
+            notifier_.notify(i, SNMPNotifier::TRAP_ALARM_ENTRY_ADDED, minutesRemaining_[i], ++nextAlarmId_[i], ALARM_COMMUNICATIONS_LOST);
+            minutesRemaining_[i] = -1;
+        }
+        wasConnected_[i] = connected;
     }
 }
 
-void UPSSNMPAgent::stop()
+void UPSSNMPAgent::countersToJSON(JsonDocument& doc) const
+{
+    JsonObject snmp = doc["SNMP"].to<JsonObject>();
+    snmp["Cache_window"] = cacheWindowMs_;
+    snmp["Cache_hits"] = cacheHits_.load(std::memory_order_relaxed);
+    snmp["Cache_misses"] = cacheMisses_.load(std::memory_order_relaxed);
+    notifier_.toJSON(snmp);
+}
+
+void UPSSNMPAgent::receive()
+{
+    for(uint8_t i=0;i<SNMP_DRAIN_MAX;++i){
+        sockaddr_in from;
+        socklen_t fromLength = sizeof(from);
+        //A message longer than the buffer is truncated and dropped by the decoder
+        int length = recvfrom(socket_, rx_, sizeof(rx_), MSG_DONTWAIT, reinterpret_cast<sockaddr*>(&from), &fromLength);
+        if(length <= 0){
+            //Queue empty
+            return;
+        }
+        if(notifier_.acknowledge(rx_, length, from.sin_addr.s_addr)){
+            //Response to an INFORM
+            continue;
+        }
+        BerWriter response(tx_, sizeof(tx_));
+        if(process(rx_, length, response)){
+            sendto(socket_, response.data(), response.size(), 0, reinterpret_cast<sockaddr*>(&from), fromLength);
+        }
+    }
+}
+
+bool UPSSNMPAgent::process(const uint8_t* request, size_t length, BerWriter& response)
+{
+    BerReader message(request, length);
+    BerReader fields, pdu, varbinds;
+    int32_t version, requestId, nonRepeaters, maxRepetitions;
+    const uint8_t* community;
+    size_t communityLength;
+    uint8_t type;
+    if(!message.enter(BER_SEQUENCE, fields) || !fields.readInteger(version) ||
+        ((version != SNMP_VERSION_1) && (version != SNMP_VERSION_2C)) ||
+        !fields.readString(community, communityLength) || !fields.read(type, pdu)){
+        return false;
+    }
+    std::string name(reinterpret_cast<const char*>(community), communityLength);
+    bool writeAccess = (name == SNMP_WRITE_COMMUNITY);
+    if(!writeAccess && (name != SNMP_READ_COMMUNITY)){
+        ESP_LOGD(TAG, "Unknown community %s", name.c_str());
+        return false;
+    }
+    if((type != PDU_GET) && (type != PDU_GET_NEXT) && (type != PDU_SET) &&
+        ((type != PDU_GET_BULK) || (version == SNMP_VERSION_1))){
+        return false;
+    }
+    //Error status and index are non-repeaters and max-repetitions in a GETBULK
+    const uint8_t* list;
+    size_t listLength;
+    if(!pdu.readInteger(requestId) || !pdu.readInteger(nonRepeaters) || !pdu.readInteger(maxRepetitions)){
+        return false;
+    }
+    BerReader raw = pdu;
+    if(!raw.readRaw(list, listLength) || !pdu.enter(BER_SEQUENCE, varbinds)){
+        return false;
+    }
+
+    size_t messageMark = response.begin(BER_SEQUENCE);
+    response.writeInteger(BER_INTEGER, version);
+    response.writeString(BER_OCTET_STRING, community, communityLength);
+    size_t pduMark = response.begin(PDU_RESPONSE);
+    response.writeInteger(BER_INTEGER, requestId);
+    size_t status = response.size();
+    response.writeInteger(BER_INTEGER, SNMP_NO_ERROR);
+    response.writeInteger(BER_INTEGER, 0);
+    size_t listMark = response.begin(BER_SEQUENCE);
+
+    //Values are rendered again for each PDU
+    for(MibSnapshot& values : values_){
+        values.rendered = false;
+    }
+    SnmpError error = SNMP_NO_ERROR;
+    uint32_t errorIndex = 0;
+    bool valid;
+    bool copyRequest = false;
+    switch(type){
+        case PDU_GET_BULK:
+            valid = getBulk(nonRepeaters, maxRepetitions, varbinds, response);
+            break;
+        case PDU_SET:
+            //Response of a SET is the request variable bindings
+            copyRequest = true;
+            if(writeAccess){
+                valid = set(varbinds, error, errorIndex);
+            }else{
+                valid = true;
+                error = SNMP_NO_ACCESS;
+                errorIndex = varbinds.atEnd() ? 0 : 1;
+            }
+            break;
+        default:
+            valid = get(type == PDU_GET_NEXT, version == SNMP_VERSION_1, varbinds, response, error, errorIndex);
+            break;
+    }
+    if(!valid){
+        return false;
+    }
+    if(response.overflow()){
+        error = SNMP_TOO_BIG;
+        errorIndex = 0;
+    }
+    if(copyRequest || (error != SNMP_NO_ERROR)){
+        response.truncate(status);
+        response.writeInteger(BER_INTEGER, version == SNMP_VERSION_1 ? snmpErrorToV1(error) : error);
+        response.writeInteger(BER_INTEGER, errorIndex);
+        if(error == SNMP_TOO_BIG){
+            response.end(response.begin(BER_SEQUENCE));
+        }else{
+            response.writeRaw(list, listLength);
+        }
+    }else{
+        response.end(listMark);
+    }
+    response.end(pduMark);
+    response.end(messageMark);
+    return !response.overflow();
+}
+
+bool UPSSNMPAgent::readVarbind(BerReader& varbinds, SnmpOid& oid, BerReader& value)
+{
+    BerReader varbind;
+    if(!varbinds.enter(BER_SEQUENCE, varbind) || !varbind.readOid(oid)){
+        return false;
+    }
+    value = varbind;
+    return true;
+}
+
+bool UPSSNMPAgent::get(bool next, bool v1, BerReader varbinds, BerWriter& response, SnmpError& error, uint32_t& errorIndex)
+{
+    for(uint32_t i=1;!varbinds.atEnd();++i){
+        SnmpOid oid;
+        BerReader value;
+        if(!readVarbind(varbinds, oid, value)){
+            return false;
+        }
+        //SNMPv1 reports the first variable binding in error, the response is then the request
+        if(next){
+            if(!writeNext(oid, response) && v1){
+                error = SNMP_NO_SUCH_NAME;
+                errorIndex = i;
+                return true;
+            }
+            continue;
+        }
+        UPSMib::Target target;
+        uint8_t exception = mib_.find(oid, target);
+        if((exception != 0) && v1){
+            error = SNMP_NO_SUCH_NAME;
+            errorIndex = i;
+            return true;
+        }
+        size_t varbind = response.begin(BER_SEQUENCE);
+        response.writeOid(oid);
+        if(exception == 0){
+            writeCachedValue(target, response);
+        }else{
+            response.writeNull(exception);
+        }
+        response.end(varbind);
+    }
+    return true;
+}
+
+bool UPSSNMPAgent::getBulk(int32_t nonRepeaters, int32_t maxRepetitions, BerReader varbinds, BerWriter& response)
+{
+    std::vector<SnmpOid> repeaters;
+    for(int32_t i=0;!varbinds.atEnd();++i){
+        SnmpOid oid;
+        BerReader value;
+        if(!readVarbind(varbinds, oid, value)){
+            return false;
+        }
+        if(i < nonRepeaters){
+            size_t size = response.size();
+            writeNext(oid, response);
+            if(response.overflow()){
+                //Response is full, sent with the variable bindings that fit
+                response.truncate(size);
+                return true;
+            }
+        }else{
+            repeaters.push_back(oid);
+        }
+    }
+    for(int32_t r=0;(r<maxRepetitions) && !repeaters.empty();++r){
+        bool more = false;
+        for(SnmpOid& oid : repeaters){
+            size_t size = response.size();
+            UPSMib::Target target;
+            if(mib_.next(oid, target)){
+                size_t varbind = response.begin(BER_SEQUENCE);
+                response.writeOid(oid);
+                writeCachedValue(target, response);
+                response.end(varbind);
+                more = true;
+            }else{
+                size_t varbind = response.begin(BER_SEQUENCE);
+                response.writeOid(oid);
+                response.writeNull(BER_END_OF_MIB_VIEW);
+                response.end(varbind);
+            }
+            if(response.overflow()){
+                response.truncate(size);
+                return true;
+            }
+        }
+        if(!more){
+            //Every repeater is at the end of the MIB
+            break;
+        }
+    }
+    return true;
+}
+
+bool UPSSNMPAgent::set(BerReader varbinds, SnmpError& error, uint32_t& errorIndex)
+{
+    //Every value is checked before a command is sent
+    struct Write {
+        CommandOID* command;
+        uint8_t index;
+        int32_t value;
+    };
+    std::vector<Write> writes;
+    for(uint32_t i=1;!varbinds.atEnd();++i){
+        SnmpOid oid;
+        BerReader value;
+        if(!readVarbind(varbinds, oid, value)){
+            return false;
+        }
+        if(error != SNMP_NO_ERROR){
+            //Rest of the list only checked for malformed data
+            continue;
+        }
+        UPSMib::Target target;
+        int32_t decoded = 0;
+        if(mib_.find(oid, target) != 0){
+            error = SNMP_NO_CREATION;
+        }else if(!UPSMib::OBJECTS[target.object].writable){
+            error = SNMP_NOT_WRITABLE;
+        }else{
+            error = checkSet(target, value, decoded);
+        }
+        if(error != SNMP_NO_ERROR){
+            errorIndex = i;
+            continue;
+        }
+        writes.push_back({getCommand(target), target.index, decoded});
+    }
+    if(error != SNMP_NO_ERROR){
+        return true;
+    }
+    for(size_t i=0;i<writes.size();++i){
+        CommandOID& command = *writes[i].command;
+        //Same encoding as the field, values are in seconds or enumerations
+        UPSCommandStatus status = upsDevices[writes[i].index].sendCommand(command.usagePage, command.usage, writes[i].value);
+        ESP_LOGI(TAG, "UPS %u SET %s = %d: %s", writes[i].index + 1, UPSMib::OBJECTS[command.object].oid, writes[i].value,
+                    upsCommandStatusToString(status));
+        if(status != UPSCommandStatus::Queued){
+            //Commands already queued can't be undone
+            error = SNMP_COMMIT_FAILED;
+            errorIndex = i + 1;
+            return true;
+        }
+        command.value = writes[i].value;
+        invalidateCache(writes[i].index);
+    }
+    return true;
+}
+
+bool UPSSNMPAgent::writeNext(SnmpOid oid, BerWriter& response)
+{
+    UPSMib::Target target;
+    bool found = mib_.next(oid, target);
+    size_t varbind = response.begin(BER_SEQUENCE);
+    response.writeOid(oid);
+    if(found){
+        writeCachedValue(target, response);
+    }else{
+        response.writeNull(BER_END_OF_MIB_VIEW);
+    }
+    response.end(varbind);
+    return found;
+}
+
+UPSSNMPAgent::CommandOID* UPSSNMPAgent::getCommand(const UPSMib::Target& target)
+{
+    for(CommandOID& command : commands_[target.index]){
+        if(command.object == target.object){
+            return &command;
+        }
+    }
+    return nullptr;
+}
+
+SnmpError UPSSNMPAgent::checkSet(const UPSMib::Target& target, BerReader value, int32_t& decoded)
+{
+    CommandOID* command = getCommand(target);
+    if(command == nullptr){
+        return SNMP_NOT_WRITABLE;
+    }
+    int64_t wide;
+    if(!value.readInteger(BER_INTEGER, wide)){
+        return SNMP_WRONG_TYPE;
+    }
+    if((wide < command->minimum) || (wide > command->maximum)){
+        return SNMP_WRONG_VALUE;
+    }
+    decoded = wide;
+    return SNMP_NO_ERROR;
+}
+
+void UPSSNMPAgent::writeCachedValue(const UPSMib::Target& target, BerWriter& writer)
 {
-    if(started_){
-        started_ = false;
-        agent_.stop();
-    }
-}
-
-void UPSSNMPAgent::loop()
-{
-    if(started_){
-        agent_.loop();
-        //Poll UPS every seconds
-        unsigned long now = millis();
-        if((now - lastPoll_) > 100){
-            bool connected = upsDevice.isConnected();
-            if(connected && !wasConnected_){
-                ESP_LOGI(TAG, "UPS reconnected!");
-                initializeOID();
-            }else if(!connected && wasConnected_){
-                ESP_LOGI(TAG, "UPS disconnected!");
-                destroyOID();
-                //TODO: Check SNMP version
-                upsTrap_->setVersion(SNMP_VERSION_1);
-                upsTrap_->setInform(false);
-                IPAddress destinationIP;
-                Configuration.getSNMPTrap(destinationIP);
-                if(destinationIP != INADDR_NONE){
-                    if(agent_.sendTrapTo(upsTrap_, destinationIP, true, 2, 5000) != INVALID_SNMP_REQUEST_ID){ 
-                        ESP_LOGI(TAG, "Sent SNMP Trap");
-                    }
-                }
+    //Uptimes are cheap and used for rates, alarm rows are fixed
+    if((cacheWindowMs_ == 0) || (target.object == UPSMib::SYS_UP_TIME) || (target.object == UPSMib::HR_SYSTEM_UPTIME) ||
+        (UPSMib::OBJECTS[target.object].instance == UPSMib::Instance::Alarm)){
+        writeValue(target, writer);
+        return;
+    }
+    uint32_t nowMs = millis();
+    CachedValue& cached = cache_[target.index][target.object];
+    if((cached.length != 0) && (nowMs - cached.timeMs < cacheWindowMs_)){
+        writer.writeRaw(cached.tlv, cached.length);
+        cacheHits_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    cacheMisses_.fetch_add(1, std::memory_order_relaxed);
+    size_t start = writer.size();
+    writeValue(target, writer);
+    size_t length = writer.size() - start;
+    if(!writer.overflow() && (length <= SNMP_CACHE_VALUE_SIZE)){
+        memcpy(cached.tlv, writer.data() + start, length);
+        cached.length = length;
+        cached.timeMs = nowMs;
+    }
+}
+
+void UPSSNMPAgent::invalidateCache(uint8_t index)
+{
+    for(CachedValue& cached : cache_[index]){
+        cached.length = 0;
+    }
+}
+
+void UPSSNMPAgent::writeValue(const UPSMib::Target& target, BerWriter& writer)
+{
+    uint8_t index = target.index;
+    auto writeString = [&writer](const char* str){ writer.writeString(BER_OCTET_STRING, str, strlen(str)); };
+    switch(target.object){
+        case UPSMib::SYS_DESCR:
+            writeString("UPS gateway");
+            break;
+        case UPSMib::SYS_UP_TIME:
+        case UPSMib::HR_SYSTEM_UPTIME:
+            writer.writeInteger(BER_TIMETICKS, upTime());
+            break;
+        case UPSMib::SYS_NAME:
+            writeString(ETH.getHostname());
+            break;
+        case UPSMib::IDENT_MANUFACTURER:
+        case UPSMib::IDENT_MODEL:
+        case UPSMib::IDENT_UPS_SOFTWARE:
+        case UPSMib::IDENT_AGENT_SOFTWARE:
+        case UPSMib::IDENT_NAME:
+        case UPSMib::IDENT_ATTACHED_DEVICES:
+            writer.writeString(identStrings_[index][target.object - UPSMib::IDENT_MANUFACTURER]);
+            break;
+        case UPSMib::INPUT_LINE_BADS:
+            writer.writeInteger(BER_COUNTER32, lineBads_[index]);
+            break;
+        case UPSMib::ALARM_ID:
+        case UPSMib::ALARM_DESCR:
+        case UPSMib::ALARM_TIME: {
+            const std::vector<Alarm>& alarms = alarms_[index];
+            auto alarm = std::find_if(alarms.begin(), alarms.end(), [&target](const Alarm& a){ return a.id == target.row; });
+            if(alarm == alarms.end()){
+                writer.writeNull(BER_NO_SUCH_INSTANCE);
+            }else if(target.object == UPSMib::ALARM_ID){
+                writer.writeInteger(BER_INTEGER, alarm->id);
+            }else if(target.object == UPSMib::ALARM_DESCR){
+                SnmpOid descr;
+                descr.parse(UPSMib::WELL_KNOWN_ALARMS);
+                descr.append(alarm->type);
+                writer.writeOid(descr);
+            }else{
+                writer.writeInteger(BER_TIMETICKS, alarm->timeCs);
             }
-            wasConnected_ = connected;
+            break;
+        }
+        case UPSMib::TEST_RESULTS_SUMMARY:
+            writer.writeInteger(BER_INTEGER, static_cast<int>(upsSelfTest.getSummary(index)));
+            break;
+        case UPSMib::TEST_RESULTS_DETAIL:
+            writer.writeString(upsSelfTest.getDetail(index));
+            break;
+        case UPSMib::TEST_START_TIME: {
+            //Uptime in hundredths of second
+            SelfTestRecord record;
+            writer.writeInteger(BER_TIMETICKS, upsSelfTest.getLast(index, record) ? record.startS * 100 : 0);
+            break;
         }
+        case UPSMib::SHUTDOWN_AFTER_DELAY:
+        case UPSMib::STARTUP_AFTER_DELAY:
+        case UPSMib::AUDIBLE_STATUS: {
+            CommandOID* command = getCommand(target);
+            writer.writeInteger(BER_INTEGER, command != nullptr ? command->value : 0);
+            break;
+        }
+        case UPSMib::ENT_PHYSICAL_DESCR:
+            writeString("USB UPS to SNMP gateway");
+            break;
+        case UPSMib::ENT_PHYSICAL_NAME:
+            writeString("UPS gateway");
+            break;
+        case UPSMib::ENT_PHYSICAL_SERIAL:
+            writeString(ETH.macAddress().c_str());
+            break;
+        case UPSMib::INTERNAL_TEMPERATURE:
+            writer.writeInteger(BER_INTEGER, static_cast<int32_t>(tempProbe.getInternalTemperature() * 10.0));
+            break;
+#ifndef NO_TEMP_PROBE
+        case UPSMib::PROBE_TEMPERATURE:
+            writer.writeInteger(BER_INTEGER, static_cast<int32_t>(tempProbe.getTemperatureProbe() * 10.0));
+            break;
+#endif
+        default:
+            //Integer rendered from the UPS snapshot
+            writer.writeInteger(UPSMib::OBJECTS[target.object].syntax, render(index).integers[target.object]);
+            break;
     }
 }
 
-void UPSSNMPAgent::initializeOID()
+void UPSSNMPAgent::trackMinutesRemaining(uint8_t index)
 {
-    //upsEstimatedChargeRemaining OID
-    if(upsDevice.getRemainingCapacity().isUsed()){
-        callbacks_.push_back(agent_.addDynamicIntegerHandler(".1.3.6.1.2.1.33.1.2.4", []()->int{
-            return static_cast<int32_t>(upsDevice.getRemainingCapacity().getValue());
-        }));
+    if(!notifier_.enabled() || !mib_.isAvailable(index, UPSMib::MINUTES_REMAINING)){
+        minutesRemaining_[index] = -1;
+        return;
     }
+    //Rendered again by the next PDU
+    values_[index].rendered = false;
+    minutesRemaining_[index] = render(index).integers[UPSMib::MINUTES_REMAINING];
+}
 
-    //upsEstimatedMinutesRemaining OID
-    if(upsDevice.getRuntimeToEmpty().isUsed()){
-        callbacks_.push_back(agent_.addDynamicIntegerHandler(".1.3.6.1.2.1.33.1.2.3", []()->int{
-            return static_cast<int32_t>(upsDevice.getRuntimeToEmpty().getValue()/60);   //Convert seconds to minutes
-        }));
+const UPSSNMPAgent::MibSnapshot& UPSSNMPAgent::render(uint8_t index)
+{
+    MibSnapshot& mib = values_[index];
+    if(mib.rendered){
+        return mib;
     }
- 
-    if(upsDevice.getACPresent().isUsed()){
-        callbacks_.push_back(agent_.addDynamicIntegerHandler(".1.3.6.1.2.1.33.1.2.5", []()->int{
-            return static_cast<int32_t>(upsDevice.getACPresent().getValue());   //Convert seconds to minutes
-        }));
+    UpsSnapshot snapshot;
+    upsDevices[index].getSnapshot(snapshot);
+    //Units were checked when the objects were made available, values not decoded yet read 0
+    for(uint8_t i=0;i<UPSMib::OBJECT_COUNT;++i){
+        const UPSMib::ObjectInfo& object = UPSMib::OBJECTS[i];
+        bool known = (object.reading != UpsSnapshot::READING_COUNT) && snapshot.isUsed(object.reading) &&
+                        snapshot.isValid(snapshot.readingFields[object.reading]);
+        mib.integers[i] = known ? snapshot.getValue(object.reading, object.exponent) : 0;
     }
+    mib.integers[UPSMib::MINUTES_REMAINING] /= 60;
 
-    agent_.sortHandlers();
+    uint16_t state = upsState.getFlags(index);
+    uint32_t nowMs = millis();
+    if(state & UPSState::NO_BATTERY){
+        mib.integers[UPSMib::BATTERY_STATUS] = 4;   //batteryDepleted
+    }else if(state & UPSState::LOW_BATTERY){
+        mib.integers[UPSMib::BATTERY_STATUS] = 3;   //batteryLow
+    }else{
+        mib.integers[UPSMib::BATTERY_STATUS] = (state & (UPSState::ONLINE | UPSState::ON_BATTERY)) ? 2 : 1;    //batteryNormal, unknown
+    }
+    for(const Alarm& alarm : alarms_[index]){
+        if(alarm.type == ALARM_ON_BATTERY){
+            //Unsigned difference, right across the millis() wrap
+            mib.integers[UPSMib::SECONDS_ON_BATTERY] = (uint32_t)(nowMs - alarm.timeMs) / 1000;
+        }
+    }
+    if(state & UPSState::ON_BATTERY){
+        mib.integers[UPSMib::OUTPUT_SOURCE] = 5;    //battery
+    }else if(state & UPSState::BOOST){
+        mib.integers[UPSMib::OUTPUT_SOURCE] = 6;    //booster
+    }else if(state & UPSState::TRIM){
+        mib.integers[UPSMib::OUTPUT_SOURCE] = 7;    //reducer
+    }else if(state & UPSState::AWAITING_POWER){
+        mib.integers[UPSMib::OUTPUT_SOURCE] = 2;    //none
+    }else{
+        mib.integers[UPSMib::OUTPUT_SOURCE] = (state & UPSState::ONLINE) ? 3 : 1;  //normal, other
+    }
+    mib.integers[UPSMib::INPUT_NUM_LINES] = 1;
+    mib.integers[UPSMib::OUTPUT_NUM_LINES] = 1;
+    mib.integers[UPSMib::ALARMS_PRESENT] = alarms_[index].size();
+    mib.integers[UPSMib::DATA_AGE] = upsDevices[index].getDataAge(nowMs) / 1000;
+    mib.rendered = true;
+    return mib;
 }
 
-void UPSSNMPAgent::destroyOID()
+void UPSSNMPAgent::updateAlarms(uint8_t index)
 {
-    for(ValueCallback* cb : callbacks_){
-        agent_.removeHandler(cb);        
+    uint16_t state = upsState.getFlags(index);
+    std::vector<Alarm>& alarms = alarms_[index];
+    bool changed = false;
+    for(const auto& entry : ALARM_STATES){
+        auto alarm = std::find_if(alarms.begin(), alarms.end(), [&entry](const Alarm& a){ return a.type == entry.type; });
+        bool active = (state & entry.flags) != 0;
+        if(active && (alarm == alarms.end())){
+            alarms.push_back({++nextAlarmId_[index], entry.type, upTime(), millis()});
+            notifier_.notify(index, SNMPNotifier::TRAP_ALARM_ENTRY_ADDED, minutesRemaining_[index], nextAlarmId_[index], entry.type);
+            if(entry.type == ALARM_ON_BATTERY){
+                ++lineBads_[index];
+                notifier_.notify(index, SNMPNotifier::TRAP_ON_BATTERY, minutesRemaining_[index]);
+            }
+            changed = true;
+        }else if(!active && (alarm != alarms.end())){
+            notifier_.notify(index, SNMPNotifier::TRAP_ALARM_ENTRY_REMOVED, minutesRemaining_[index], alarm->id, alarm->type);
+            alarms.erase(alarm);
+            changed = true;
+        }
+    }
+    if(!changed){
+        return;
     }
-    callbacks_.clear();
-    agent_.sortHandlers();
-}
\ No newline at end of file
+    //Rows are few and change rarely (state is debounced)
+    std::vector<uint32_t> rows;
+    for(const Alarm& alarm : alarms){
+        rows.push_back(alarm.id);
+    }
+    mib_.setAlarmRows(index, rows);
+}
+
+void UPSSNMPAgent::initializeOID(uint8_t index)
+{
+    UpsSnapshot snapshot;
+    upsDevices[index].getSnapshot(snapshot);
+
+    //upsIdent group, fixed while connected
+    std::string* ident = identStrings_[index];
+    ident[MANUFACTURER] = upsDevices[index].getManufacturer();
+    ident[MODEL] = upsDevices[index].getModel();
+    char release[8];
+    uint16_t bcd = upsDevices[index].getDeviceRelease();
+    snprintf(release, sizeof(release), "%x.%02x", bcd >> 8, bcd & 0xff);
+    ident[UPS_SOFTWARE] = release;
+    ident[AGENT_SOFTWARE] = SNMP_AGENT_SOFTWARE;
+    Configuration.getDeviceName(ident[NAME]);
+    ident[ATTACHED_DEVICES] = "";
+    uint64_t objects = UPSMib::bit(UPSMib::IDENT_MANUFACTURER) | UPSMib::bit(UPSMib::IDENT_MODEL) |
+                        UPSMib::bit(UPSMib::IDENT_UPS_SOFTWARE) | UPSMib::bit(UPSMib::IDENT_AGENT_SOFTWARE) |
+                        UPSMib::bit(UPSMib::IDENT_NAME) | UPSMib::bit(UPSMib::IDENT_ATTACHED_DEVICES);
+
+    //Derived from the UPS state
+    objects |= UPSMib::bit(UPSMib::BATTERY_STATUS) | UPSMib::bit(UPSMib::OUTPUT_SOURCE) | UPSMib::bit(UPSMib::DATA_AGE) |
+                UPSMib::bit(UPSMib::ALARMS_PRESENT) | UPSMib::bit(UPSMib::ALARM_ID) | UPSMib::bit(UPSMib::ALARM_DESCR) |
+                UPSMib::bit(UPSMib::ALARM_TIME);
+
+    //Values are normalised to SI units, an object is only served when the unit matches the MIB
+    for(uint8_t i=0;i<UPSMib::OBJECT_COUNT;++i){
+        const UPSMib::ObjectInfo& object = UPSMib::OBJECTS[i];
+        if((object.reading != UpsSnapshot::READING_COUNT) && (snapshot.getUnit(object.reading) == object.unit)){
+            objects |= UPSMib::bit(static_cast<UPSMib::Object>(i));
+        }
+    }
+    uint64_t input = UPSMib::bit(UPSMib::INPUT_FREQUENCY) | UPSMib::bit(UPSMib::INPUT_VOLTAGE) |
+                        UPSMib::bit(UPSMib::INPUT_CURRENT) | UPSMib::bit(UPSMib::INPUT_POWER);
+    if(objects & input){
+        objects |= UPSMib::bit(UPSMib::INPUT_NUM_LINES);
+    }
+    uint64_t output = UPSMib::bit(UPSMib::OUTPUT_VOLTAGE) | UPSMib::bit(UPSMib::OUTPUT_CURRENT) |
+                        UPSMib::bit(UPSMib::OUTPUT_POWER) | UPSMib::bit(UPSMib::OUTPUT_LOAD);
+    if(objects & output){
+        objects |= UPSMib::bit(UPSMib::OUTPUT_NUM_LINES);
+    }
+    if(snapshot.isUsed(UpsSnapshot::AC_PRESENT) || snapshot.isUsed(UpsSnapshot::DISCHARGING)){
+        //upsSecondsOnBattery and upsInputLineBads (times on battery) follow the on battery alarm
+        objects |= UPSMib::bit(UPSMib::SECONDS_ON_BATTERY) | UPSMib::bit(UPSMib::INPUT_LINE_BADS);
+    }
+    if(snapshot.isUsed(UpsSnapshot::TEST_RESULT)){
+        objects |= UPSMib::bit(UPSMib::TEST_RESULTS_SUMMARY) | UPSMib::bit(UPSMib::TEST_RESULTS_DETAIL) |
+                    UPSMib::bit(UPSMib::TEST_START_TIME);
+    }
+    for(CommandOID& command : commands_[index]){
+        command.value = command.initial;
+        if(upsDevices[index].hasCommand(command.usagePage, command.usage)){
+            objects |= UPSMib::bit(command.object);
+        }
+    }
+    mib_.setAvailable(index, objects);
+}
+
+void UPSSNMPAgent::destroyOID(uint8_t index)
+{
+    mib_.setAvailable(index, 0);
+    alarms_[index].clear();
+    mib_.setAlarmRows(index, {});
+}
@@ -0,0 +1,400 @@
+#include <UPSSelfTest.hpp>
+#include <UPSState.hpp>
+#include <Configuration.hpp>
+#include <FixedPoint.hpp>
+#include <ETH.h>
+#include "esp_log.h"
+#include <algorithm>
+
+static const char* TAG = "SelfTest";
+
+static constexpr uint16_t POWER_DEVICE_PAGE = 0x84;
+static constexpr uint16_t TEST_USAGE = 0x58;
+static constexpr int32_t TEST_QUICK = 1;        //Test values to write (HID Power Devices 4.1)
+static constexpr int32_t TEST_DEEP = 2;
+static constexpr int32_t TEST_ABORT = 3;
+static constexpr uint32_t FIRST_TEST_MIN_DELAY_MS = 60000;  //Readings settle after a connection
+
+UPSSelfTest upsSelfTest;
+
+const char* selfTestResultToString(SelfTestResult result)
+{
+    switch(result){
+        case SelfTestResult::Passed:
+            return "passed";
+        case SelfTestResult::Warning:
+            return "warning";
+        case SelfTestResult::Error:
+            return "error";
+        case SelfTestResult::Aborted:
+            return "aborted";
+        case SelfTestResult::InProgress:
+            return "in progress";
+        case SelfTestResult::NoTest:
+            return "no test";
+    }
+    return "";
+}
+
+/**
+ * Gets if a Test reading is a test outcome
+ */
+static inline bool isFinished(int32_t result)
+{
+    return (result >= static_cast<int32_t>(SelfTestResult::Passed)) && (result <= static_cast<int32_t>(SelfTestResult::Aborted));
+}
+
+UPSSelfTest::UPSSelfTest() : events_(UPSEventBus::INVALID_SUBSCRIBER), clockMs_(0), lastLoopMs_(0),
+                                intervalMs_(0), deep_(false), configChanged_(true)
+{
+    for(Unit& unit : units_){
+        unit = Unit{};
+        unit.baselineResult = static_cast<uint8_t>(SelfTestResult::NoTest);
+    }
+    mutex_ = xSemaphoreCreateMutex();
+    if(mutex_ == NULL){
+        ESP_LOGE(TAG, "Unable to create mutex");
+    }
+}
+
+void UPSSelfTest::begin()
+{
+    events_ = upsEvents.subscribe(UPSEventBus::CONNECTION | UPSEventBus::READINGS, nullptr);
+    Configuration.registerListener([this](DeviceConfiguration::Parameter what){
+        if(what == DeviceConfiguration::Parameter::SELF_TEST){
+            configChanged_ = true;
+        }
+    });
+}
+
+void UPSSelfTest::loop(uint32_t nowMs)
+{
+    clockMs_ += nowMs - lastLoopMs_;
+    lastLoopMs_ = nowMs;
+    if(configChanged_.exchange(false)){
+        uint32_t hours;
+        bool deep;
+        Configuration.getSelfTest(hours, deep);
+        if(xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE){
+            intervalMs_ = (uint64_t)hours * 3600000;
+            deep_ = deep;
+            //New schedule from now on
+            for(uint8_t i=0;i<UPS_MAX_DEVICES;++i){
+                units_[i].nextTestMs = (units_[i].connected && (intervalMs_ != 0)) ? clockMs_ + firstTestDelay(i) : 0;
+            }
+            xSemaphoreGive(mutex_);
+        }
+        ESP_LOGI(TAG, "Self-test every %u hours (%s)", hours, deep ? "deep" : "quick");
+    }
+
+    uint32_t pending = upsEvents.take(events_);
+    for(uint8_t i=0;i<UPS_MAX_DEVICES;++i){
+        const Unit& unit = units_[i];
+        //Snapshot copies only on changes or when a deadline is reached
+        bool due = (unit.state != State::Idle) || ((unit.nextTestMs != 0) && (clockMs_ >= unit.nextTestMs));
+        if(!due && (UPSEventBus::getEvents(pending, i) == 0)){
+            continue;
+        }
+        UpsSnapshot snapshot;
+        upsDevices[i].getSnapshot(snapshot);
+        if(xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE){
+            update(i, snapshot);
+            schedule(i, snapshot);
+            xSemaphoreGive(mutex_);
+        }
+    }
+}
+
+void UPSSelfTest::update(uint8_t index, const UpsSnapshot& snapshot)
+{
+    Unit& unit = units_[index];
+    if(!snapshot.connected){
+        if(unit.state != State::Idle){
+            finish(index, SelfTestResult::Aborted);
+        }
+        unit.connected = false;
+        unit.nextTestMs = 0;
+        return;
+    }
+    if(!unit.connected){
+        unit.connected = true;
+        unit.baselineResult = static_cast<uint8_t>(SelfTestResult::NoTest);
+        unit.runtime = INT32_MIN;
+        unit.voltage = INT32_MIN;
+        unit.nextTestMs = intervalMs_ != 0 ? clockMs_ + firstTestDelay(index) : 0;
+    }
+    auto known = [&snapshot](UpsSnapshot::Reading reading){
+        return snapshot.isUsed(reading) && snapshot.isValid(snapshot.readingFields[reading]);
+    };
+    int32_t result = known(UpsSnapshot::TEST_RESULT) ? snapshot.getValue(UpsSnapshot::TEST_RESULT) : 0;
+    int32_t runtime = (known(UpsSnapshot::RUN_TIME_TO_EMPTY) && (snapshot.getUnit(UpsSnapshot::RUN_TIME_TO_EMPTY) == HIDUnit::Second)) ?
+                            snapshot.getValue(UpsSnapshot::RUN_TIME_TO_EMPTY) : INT32_MIN;
+    int32_t voltage = (known(UpsSnapshot::BATTERY_VOLTAGE) && (snapshot.getUnit(UpsSnapshot::BATTERY_VOLTAGE) == HIDUnit::Volt)) ?
+                            snapshot.getValue(UpsSnapshot::BATTERY_VOLTAGE, -3) : INT32_MIN;
+
+    switch(unit.state){
+        case State::Idle:
+            if(result == static_cast<int32_t>(SelfTestResult::InProgress)){
+                //Started by hand (front panel, vendor tool or Test command)
+                ESP_LOGI(TAG, "UPS %u test started by hand", index + 1);
+                unit.state = State::Running;
+                unit.flags = 0;
+                unit.startMs = clockMs_;
+                unit.baselineRuntime = unit.runtime;
+                unit.baselineVoltage = unit.voltage;
+            }else{
+                unit.baselineResult = result;
+                unit.runtime = runtime;
+                unit.voltage = voltage;
+                return;
+            }
+            break;
+        case State::Starting:
+            if(result == static_cast<int32_t>(SelfTestResult::InProgress)){
+                unit.state = State::Running;
+            }else if(isFinished(result) && (result != unit.baselineResult)){
+                //Over before we saw it running
+                finish(index, static_cast<SelfTestResult>(result));
+                return;
+            }else if(clockMs_ - unit.startMs >= SELF_TEST_START_TIMEOUT_MS){
+                //Some UPS never report the test in progress
+                finish(index, isFinished(result) ? static_cast<SelfTestResult>(result) : SelfTestResult::Aborted);
+                return;
+            }
+            break;
+        case State::Running:
+            if(isFinished(result)){
+                finish(index, static_cast<SelfTestResult>(result));
+                return;
+            }
+            if(clockMs_ - unit.startMs >= ((unit.flags & SelfTestRecord::DEEP) ? SELF_TEST_DEEP_TIMEOUT_MS : SELF_TEST_QUICK_TIMEOUT_MS)){
+                ESP_LOGW(TAG, "UPS %u test too long, aborting it", index + 1);
+                upsDevices[index].sendCommand(POWER_DEVICE_PAGE, TEST_USAGE, TEST_ABORT);
+                finish(index, SelfTestResult::Aborted);
+                return;
+            }
+            break;
+    }
+    //Lowest values during the test
+    if(runtime != INT32_MIN){
+        unit.runtime = unit.runtime == INT32_MIN ? runtime : std::min(unit.runtime, runtime);
+    }
+    if(voltage != INT32_MIN){
+        unit.voltage = unit.voltage == INT32_MIN ? voltage : std::min(unit.voltage, voltage);
+    }
+}
+
+void UPSSelfTest::schedule(uint8_t index, const UpsSnapshot& snapshot)
+{
+    Unit& unit = units_[index];
+    if((unit.state != State::Idle) || (unit.nextTestMs == 0) || (clockMs_ < unit.nextTestMs)){
+        return;
+    }
+    //One UPS at a time, a test runs on battery
+    const char* notReady = nullptr;
+    for(const Unit& other : units_){
+        if(other.state != State::Idle){
+            notReady = "another UPS is testing";
+        }
+    }
+    auto known = [&snapshot](UpsSnapshot::Reading reading){
+        return snapshot.isUsed(reading) && snapshot.isValid(snapshot.readingFields[reading]);
+    };
+    uint16_t state = upsState.getFlags(index);
+    if(state & UPSState::ON_BATTERY){
+        notReady = "on battery";
+    }else if(!(state & UPSState::ONLINE)){
+        notReady = "no AC";
+    }else if(known(UpsSnapshot::REMAINING_CAPACITY) && (snapshot.getUnit(UpsSnapshot::REMAINING_CAPACITY) == HIDUnit::Percent) &&
+                (snapshot.getValue(UpsSnapshot::REMAINING_CAPACITY) < SELF_TEST_MIN_CAPACITY)){
+        notReady = "battery not charged";
+    }
+    if(notReady == nullptr){
+        UPSCommandStatus status = startTest(index, deep_, true, snapshot);
+        if(status == UPSCommandStatus::Queued){
+            unit.nextTestMs = clockMs_ + intervalMs_;
+            return;
+        }
+        notReady = upsCommandStatusToString(status);
+    }
+    ESP_LOGI(TAG, "UPS %u scheduled test postponed: %s", index + 1, notReady);
+    unit.nextTestMs = clockMs_ + SELF_TEST_RETRY_MS;
+}
+
+UPSCommandStatus UPSSelfTest::startTest(uint8_t index, bool deep, bool scheduled, const UpsSnapshot& snapshot)
+{
+    Unit& unit = units_[index];
+    if(!snapshot.connected || !unit.connected){
+        return UPSCommandStatus::Disconnected;
+    }
+    if(!snapshot.isUsed(UpsSnapshot::TEST_RESULT)){
+        //No result to follow
+        return UPSCommandStatus::UnknownUsage;
+    }
+    if(unit.state != State::Idle){
+        return UPSCommandStatus::Busy;
+    }
+    UPSCommandStatus status = upsDevices[index].sendCommand(POWER_DEVICE_PAGE, TEST_USAGE, deep ? TEST_DEEP : TEST_QUICK);
+    if(status == UPSCommandStatus::Queued){
+        ESP_LOGI(TAG, "UPS %u %s %s test started", index + 1, scheduled ? "scheduled" : "manual", deep ? "deep" : "quick");
+        unit.state = State::Starting;
+        unit.flags = (deep ? SelfTestRecord::DEEP : 0) | (scheduled ? SelfTestRecord::SCHEDULED : 0);
+        unit.startMs = clockMs_;
+        unit.baselineRuntime = unit.runtime;
+        unit.baselineVoltage = unit.voltage;
+    }
+    return status;
+}
+
+UPSCommandStatus UPSSelfTest::start(uint8_t index, bool deep)
+{
+    if(index >= UPS_MAX_DEVICES){
+        return UPSCommandStatus::Disconnected;
+    }
+    UpsSnapshot snapshot;
+    upsDevices[index].getSnapshot(snapshot);
+    UPSCommandStatus status = UPSCommandStatus::Busy;
+    if(xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE){
+        status = startTest(index, deep, false, snapshot);
+        xSemaphoreGive(mutex_);
+    }
+    return status;
+}
+
+void UPSSelfTest::finish(uint8_t index, SelfTestResult result)
+{
+    Unit& unit = units_[index];
+    SelfTestRecord record = {};
+    record.startS = unit.startMs / 1000;
+    record.durationS = std::min<uint64_t>((clockMs_ - unit.startMs) / 1000, UINT16_MAX);
+    record.result = result;
+    record.flags = unit.flags;
+    if((unit.baselineRuntime != INT32_MIN) && (unit.runtime != INT32_MIN)){
+        record.flags |= SelfTestRecord::RUNTIME;
+        record.runtimeDropS = unit.baselineRuntime - unit.runtime;
+    }
+    if((unit.baselineVoltage != INT32_MIN) && (unit.voltage != INT32_MIN)){
+        record.flags |= SelfTestRecord::VOLTAGE;
+        record.voltageSagMv = unit.baselineVoltage - unit.voltage;
+    }
+    if(unit.historyCount < SELF_TEST_HISTORY){
+        unit.history[(unit.historyFirst + unit.historyCount++) % SELF_TEST_HISTORY] = record;
+    }else{
+        unit.history[unit.historyFirst] = record;
+        unit.historyFirst = (unit.historyFirst + 1) % SELF_TEST_HISTORY;
+    }
+    ESP_LOGI(TAG, "UPS %u test %s after %u s (runtime -%d s, battery -%d mV)", index + 1, selfTestResultToString(result),
+                record.durationS, record.runtimeDropS, record.voltageSagMv);
+    unit.state = State::Idle;
+    unit.baselineResult = static_cast<uint8_t>(result);
+    //Values after the test are the next baseline
+    unit.runtime = INT32_MIN;
+    unit.voltage = INT32_MIN;
+}
+
+uint64_t UPSSelfTest::firstTestDelay(uint8_t index) const
+{
+    //FNV-1a of the MAC address, stable across reboots and different between gateways
+    uint32_t hash = 2166136261u;
+    for(char c : std::string(ETH.macAddress().c_str())){
+        hash = (hash ^ (uint8_t)c) * 16777619u;
+    }
+    hash += index * 257;
+    return FIRST_TEST_MIN_DELAY_MS + intervalMs_ * (hash % 1024) / 1024;
+}
+
+SelfTestResult UPSSelfTest::getSummary(uint8_t index) const
+{
+    SelfTestResult ret = SelfTestResult::NoTest;
+    if((index < UPS_MAX_DEVICES) && (xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE)){
+        const Unit& unit = units_[index];
+        if(unit.state != State::Idle){
+            ret = SelfTestResult::InProgress;
+        }else if(unit.historyCount > 0){
+            ret = unit.history[(unit.historyFirst + unit.historyCount - 1) % SELF_TEST_HISTORY].result;
+        }
+        xSemaphoreGive(mutex_);
+    }
+    return ret;
+}
+
+bool UPSSelfTest::getLast(uint8_t index, SelfTestRecord& record) const
+{
+    bool ret = false;
+    if((index < UPS_MAX_DEVICES) && (xSemaphoreTake(mutex_, portMAX_DELAY) == pdTRUE)){
+        const Unit& unit = units_[index];
+        if(unit.historyCount > 0){
+            record = unit.history[(unit.historyFirst + unit.historyCount - 1) % SELF_TEST_HISTORY];
+            ret = true;
+        }
+        xSemaphoreGive(mutex_);
+    }
+    return ret;
+}
+
+std::string UPSSelfTest::getDetail(uint8_t index) const
+{
+    SelfTestRecord record;
+    if(getSummary(index) == SelfTestResult::InProgress){
+        return "Test in progress";
+    }
+    if(!getLast(index, record)){
+        return "No test initiated";
+    }
+    //upsTestResultsDetail is at most 255 characters
+    char detail[96];
+    int len = snprintf(detail, sizeof(detail), "%s %s test %s in %u s", (record.flags & SelfTestRecord::SCHEDULED) ? "Scheduled" : "Manual",
+                        (record.flags & SelfTestRecord::DEEP) ? "deep" : "quick", selfTestResultToString(record.result), record.durationS);
+    if((record.flags & SelfTestRecord::RUNTIME) && (len < (int)sizeof(detail))){
+        len += snprintf(detail + len, sizeof(detail) - len, ", runtime -%d s", record.runtimeDropS);
+    }
+    if((record.flags & SelfTestRecord::VOLTAGE) && (len < (int)sizeof(detail))){
+        char sag[24];
+        fixedToString(sag, sizeof(sag), record.voltageSagMv, -3);
+        snprintf(detail + len, sizeof(detail) - len, ", battery -%s V", sag);
+    }
+    return detail;
+}
+
+void UPSSelfTest::toJSON(uint8_t index, JsonObject ups) const
+{
+    if((index >= UPS_MAX_DEVICES) || (xSemaphoreTake(mutex_, portMAX_DELAY) != pdTRUE)){
+        return;
+    }
+    const Unit& unit = units_[index];
+    JsonObject test = ups["self_test"].to<JsonObject>();
+    test["state"] = unit.state == State::Idle ? "idle" : (unit.state == State::Starting ? "starting" : "running");
+    if(unit.nextTestMs != 0){
+        test["next_in_s"] = unit.nextTestMs > clockMs_ ? (unit.nextTestMs - clockMs_) / 1000 : 0;
+    }
+    //Newest first
+    JsonArray history = test["history"].to<JsonArray>();
+    for(uint8_t j=unit.historyCount;j>0;--j){
+        const SelfTestRecord& record = unit.history[(unit.historyFirst + j - 1) % SELF_TEST_HISTORY];
+        JsonObject entry = history.add<JsonObject>();
+        entry["start_s"] = record.startS;
+        entry["duration_s"] = record.durationS;
+        entry["result"] = selfTestResultToString(record.result);
+        entry["deep"] = (record.flags & SelfTestRecord::DEEP) != 0;
+        entry["scheduled"] = (record.flags & SelfTestRecord::SCHEDULED) != 0;
+        if(record.flags & SelfTestRecord::RUNTIME){
+            entry["runtime_drop_s"] = record.runtimeDropS;
+        }
+        if(record.flags & SelfTestRecord::VOLTAGE){
+            char sag[24];
+            fixedToString(sag, sizeof(sag), record.voltageSagMv, -3);
+            entry["voltage_sag_V"] = serialized(std::string(sag));
+        }
+    }
+    xSemaphoreGive(mutex_);
+}
+
+void UPSSelfTest::devicesToJSON(JsonDocument& doc) const
+{
+    for(JsonObject ups : doc["UPS"].as<JsonArray>()){
+        unsigned index = ups["index"] | 0u;
+        if((index >= 1) && (index <= UPS_MAX_DEVICES)){
+            toJSON(index - 1, ups);
+        }
+    }
+}
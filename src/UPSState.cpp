@@ -0,0 +1,234 @@
+#include <UPSState.hpp>
+#include <Configuration.hpp>
+#include <UPSSelfTest.hpp>
+#include "esp_log.h"
+
+static const char* TAG = "UPSState";
+
+UPSState upsState;
+
+const char* UPSState::flagToString(Flag flag)
+{
+    switch(flag){
+        case ONLINE:
+            return "online";
+        case ON_BATTERY:
+            return "on battery";
+        case LOW_BATTERY:
+            return "low battery";
+        case REPLACE_BATTERY:
+            return "replace battery";
+        case NO_BATTERY:
+            return "no battery";
+        case OVERLOAD:
+            return "overload";
+        case BOOST:
+            return "boost";
+        case TRIM:
+            return "trim";
+        case CHARGING:
+            return "charging";
+        case COMMUNICATION_LOST:
+            return "communication lost";
+        case OVER_TEMPERATURE:
+            return "over temperature";
+        case FAULT:
+            return "fault";
+        case SHUTDOWN_PENDING:
+            return "shutdown pending";
+        case SHUTDOWN_IMMINENT:
+            return "shutdown imminent";
+        case AWAITING_POWER:
+            return "awaiting power";
+        case TEST_IN_PROGRESS:
+            return "test in progress";
+    }
+    return "";
+}
+
+std::string UPSState::flagsToString(uint16_t flags)
+{
+    std::string str;
+    for(uint8_t b=0;b<FLAG_COUNT;++b){
+        if(flags & (1u << b)){
+            if(!str.empty()){
+                str += ", ";
+            }
+            str += flagToString(static_cast<Flag>(1u << b));
+        }
+    }
+    return str.empty() ? "none" : str;
+}
+
+UPSState::UPSState() : events_(UPSEventBus::INVALID_SUBSCRIBER), debounceMs_(0), lowBattery_(0),
+                        hysteresis_(0), configChanged_(true)
+{
+    for(Unit& unit : units_){
+        unit.flags = 0;
+        unit.raw = 0;
+        for(uint32_t& changeMs : unit.changeMs){
+            changeMs = 0;
+        }
+    }
+}
+
+void UPSState::begin()
+{
+    events_ = upsEvents.subscribe(UPSEventBus::CONNECTION | UPSEventBus::READINGS, nullptr);
+    Configuration.registerListener([this](DeviceConfiguration::Parameter what){
+        if(what == DeviceConfiguration::Parameter::UPS_STATE){
+            configChanged_ = true;
+        }
+    });
+}
+
+void UPSState::loop(uint32_t nowMs)
+{
+    if(configChanged_.exchange(false)){
+        Configuration.getStateFilter(debounceMs_, lowBattery_, hysteresis_);
+        ESP_LOGI(TAG, "State debounce %u ms, low battery at %u%%, hysteresis %u%%", debounceMs_, lowBattery_, hysteresis_);
+    }
+
+    uint32_t pending = upsEvents.take(events_);
+    for(uint8_t i=0;i<UPS_MAX_DEVICES;++i){
+        Unit& unit = units_[i];
+        uint16_t flags = unit.flags.load(std::memory_order_relaxed);
+        //Snapshot copies only on changes
+        if(UPSEventBus::getEvents(pending, i) != 0){
+            UpsSnapshot snapshot;
+            upsDevices[i].getSnapshot(snapshot);
+            if(!snapshot.connected){
+                //Nothing to debounce, the conditions are gone
+                unit.raw = 0;
+                if(flags != 0){
+                    ESP_LOGI(TAG, "UPS %u state: none (disconnected)", i + 1);
+                    unit.flags = 0;
+                    upsEvents.publish(i, UPSEventBus::STATE);
+                }
+                continue;
+            }
+            uint16_t raw = evaluate(i, snapshot, unit.raw);
+            for(uint8_t b=0;b<FLAG_COUNT;++b){
+                if((raw ^ unit.raw) & (1u << b)){
+                    unit.changeMs[b] = nowMs;
+                }
+            }
+            unit.raw = raw;
+        }
+        //A condition changes once held for the debounce time
+        uint16_t next = flags;
+        uint16_t changed = unit.raw ^ flags;
+        for(uint8_t b=0;changed!=0;++b, changed>>=1){
+            if((changed & 1) && (nowMs - unit.changeMs[b] >= debounceMs_)){
+                next ^= (1u << b);
+            }
+        }
+        if(next != flags){
+            ESP_LOGI(TAG, "UPS %u state: %s", i + 1, flagsToString(next).c_str());
+            unit.flags = next;
+            upsEvents.publish(i, UPSEventBus::STATE);
+        }
+    }
+}
+
+uint16_t UPSState::evaluate(uint8_t index, const UpsSnapshot& snapshot, uint16_t previous) const
+{
+    auto known = [&snapshot](UpsSnapshot::Reading reading){
+        return snapshot.isUsed(reading) && snapshot.isValid(snapshot.readingFields[reading]);
+    };
+    auto isSet = [&](UpsSnapshot::Reading reading){
+        return known(reading) && (snapshot.getValue(reading) != 0);
+    };
+    auto percent = [&](UpsSnapshot::Reading reading){
+        return (known(reading) && (snapshot.getUnit(reading) == HIDUnit::Percent)) ? snapshot.getValue(reading) : INT32_MIN;
+    };
+
+    uint16_t raw = 0;
+    if((known(UpsSnapshot::AC_PRESENT) && !snapshot.getValue(UpsSnapshot::AC_PRESENT)) || isSet(UpsSnapshot::DISCHARGING)){
+        raw |= ON_BATTERY;
+    }else if(known(UpsSnapshot::AC_PRESENT) || known(UpsSnapshot::DISCHARGING)){
+        raw |= ONLINE;
+    }
+    if(isSet(UpsSnapshot::CHARGING)){
+        raw |= CHARGING;
+    }
+    if(isSet(UpsSnapshot::NEEDS_REPLACEMENT)){
+        raw |= REPLACE_BATTERY;
+    }
+    if(known(UpsSnapshot::BATTERY_PRESENT) && !snapshot.getValue(UpsSnapshot::BATTERY_PRESENT)){
+        raw |= NO_BATTERY;
+    }
+    if(isSet(UpsSnapshot::BOOST)){
+        raw |= BOOST;
+    }
+    if(isSet(UpsSnapshot::BUCK)){
+        raw |= TRIM;
+    }
+    if(isSet(UpsSnapshot::OVER_TEMPERATURE)){
+        raw |= OVER_TEMPERATURE;
+    }
+    if(isSet(UpsSnapshot::INTERNAL_FAILURE)){
+        raw |= FAULT;
+    }
+    if(isSet(UpsSnapshot::SHUTDOWN_REQUESTED)){
+        raw |= SHUTDOWN_PENDING;
+    }
+    if(isSet(UpsSnapshot::SHUTDOWN_IMMINENT)){
+        raw |= SHUTDOWN_IMMINENT;
+    }
+    if(isSet(UpsSnapshot::AWAITING_POWER)){
+        raw |= AWAITING_POWER;
+    }
+    if(known(UpsSnapshot::TEST_RESULT) && (snapshot.getValue(UpsSnapshot::TEST_RESULT) == static_cast<int32_t>(SelfTestResult::InProgress))){
+        raw |= TEST_IN_PROGRESS;
+    }
+
+    //Thresholds are left only past the hysteresis
+    int32_t charge = percent(UpsSnapshot::REMAINING_CAPACITY);
+    if(isSet(UpsSnapshot::BELOW_CAPACITY_LIMIT)){
+        raw |= LOW_BATTERY;
+    }else if((lowBattery_ != 0) && (charge != INT32_MIN)){
+        int32_t limit = (previous & LOW_BATTERY) ? lowBattery_ + hysteresis_ : lowBattery_ + 1;
+        if(charge < limit){
+            raw |= LOW_BATTERY;
+        }
+    }
+    int32_t load = percent(UpsSnapshot::OUTPUT_LOAD);
+    if(isSet(UpsSnapshot::OVERLOAD)){
+        raw |= OVERLOAD;
+    }else if(load != INT32_MIN){
+        int32_t limit = (previous & OVERLOAD) ? UPS_STATE_OVERLOAD_LOAD - hysteresis_ : UPS_STATE_OVERLOAD_LOAD;
+        if(load > limit){
+            raw |= OVERLOAD;
+        }
+    }
+
+    if(upsDevices[index].isStale()){
+        raw |= COMMUNICATION_LOST;
+    }
+    return raw;
+}
+
+void UPSState::toJSON(uint8_t index, JsonObject ups) const
+{
+    if(index >= UPS_MAX_DEVICES){
+        return;
+    }
+    uint16_t flags = getFlags(index);
+    JsonArray state = ups["state"].to<JsonArray>();
+    for(uint8_t b=0;b<FLAG_COUNT;++b){
+        if(flags & (1u << b)){
+            state.add(flagToString(static_cast<Flag>(1u << b)));
+        }
+    }
+}
+
+void UPSState::devicesToJSON(JsonDocument& doc) const
+{
+    for(JsonObject ups : doc["UPS"].as<JsonArray>()){
+        unsigned index = ups["index"] | 0u;
+        if((index >= 1) && (index <= UPS_MAX_DEVICES)){
+            toJSON(index - 1, ups);
+        }
+    }
+}
@@ -8,6 +8,12 @@
 #include <esp_partition.h>
 #include <Configuration.hpp>
 #include <UPSHIDDevice.hpp>
+#include <UPSSelfTest.hpp>
+#include <UPSState.hpp>
+#include <UPSSNMP.hpp>
+#include <UPSEvents.hpp>
+#include <HIDUsages.hpp>
+#include <ReportCapture.hpp>
 #include <Temperature.hpp>
 #include <ETH.h>
 
@@ -207,17 +213,62 @@ esp_err_t Webserver::cfg_post_handler( httpd_req_t *req )
     return ESP_OK;
 }
 
-esp_err_t Webserver::status_get_handler( httpd_req_t *req )
+esp_err_t Webserver::command_post_handler( httpd_req_t *req )
 {
     Webserver* instance = static_cast<Webserver*>(req->user_ctx);
+    if(instance->checkAuthentication(req)){
+        size_t dataSize = std::min((size_t)512, req->content_len);
+        std::string content;
+        content.resize(dataSize);
+        int ret = httpd_req_recv(req, &content[0], dataSize);
+        if (ret <= 0) {
+            if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+                httpd_resp_send_408(req);
+            }
+            return ESP_FAIL;
+        }
+        //{"ups":1,"set":{"DelayBeforeShutdown":30,"AudibleAlarmControl":1}}
+        JsonDocument doc;
+        DeserializationError error = deserializeJson(doc, content);
+        unsigned ups = doc["ups"] | 1u;
+        if(error || (ups < 1) || (ups > UPS_MAX_DEVICES) || !doc["set"].is<JsonObject>()){
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expecting {\"ups\":<index>,\"set\":{\"<usage>\":<value>}}");
+            return ESP_OK;
+        }
+        JsonDocument result;
+        bool queued = true;
+        for(JsonPair command : doc["set"].as<JsonObject>()){
+            UPSCommandStatus status = UPSCommandStatus::UnknownUsage;
+            uint16_t usagePage, usage;
+            if(hidUsageFromName(command.key().c_str(), usagePage, usage) && command.value().is<float>()){
+                //Values in SI units, integers are sent as is
+                if(command.value().is<int32_t>()){
+                    status = upsDevices[ups - 1].sendCommand(usagePage, usage, command.value().as<int32_t>(), 0);
+                }else{
+                    status = upsDevices[ups - 1].sendCommand(usagePage, usage, lround(command.value().as<double>() * 1000), -3);
+                }
+            }
+            queued &= (status == UPSCommandStatus::Queued);
+            result[command.key()] = upsCommandStatusToString(status);
+        }
+        std::string resp;
+        serializeJson(result, resp);
+        httpd_resp_set_status( req, queued ? HTTPD_200 : HTTPD_400 );
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_send(req, resp.c_str(), resp.length());
+    }
+    return ESP_OK;
+}
 
-    httpd_resp_set_status( req, HTTPD_200 );
-    httpd_resp_set_hdr( req, "Connection", "keep-alive" );
-    httpd_resp_set_type(req, "application/json");
+void Webserver::statusToJSONString(std::string& status)
+{
     //Build a JSON with UPS status
     JsonDocument doc;
     //Sets UPS status to JSON file
-    upsDevice.statusToJSON(doc);
+    UPSHIDDevice::devicesToJSON(doc);
+    upsState.devicesToJSON(doc);
+    upsSelfTest.devicesToJSON(doc);
+    snmpAgent.countersToJSON(doc);
 
     // //Adds some info from the configuration
     // std::string devName;
@@ -243,13 +294,131 @@ esp_err_t Webserver::status_get_handler( httpd_req_t *req )
     doc["MAC_address"] = ETH.macAddress();
     doc["cpuTemperature"] = tempProbe.getInternalTemperature();
     
+    serializeJson(doc, status);
+}
+
+esp_err_t Webserver::status_get_handler( httpd_req_t *req )
+{
+    Webserver* instance = static_cast<Webserver*>(req->user_ctx);
+
+    httpd_resp_set_status( req, HTTPD_200 );
+    httpd_resp_set_hdr( req, "Connection", "keep-alive" );
+    httpd_resp_set_type(req, "application/json");
     std::string upsStatusJSON;
-    serializeJson(doc, upsStatusJSON);
+    statusToJSONString(upsStatusJSON);
     httpd_resp_send( req, upsStatusJSON.c_str(), upsStatusJSON.length());
     return ESP_OK;
 }
 
-Webserver::Webserver() : server_(nullptr)
+esp_err_t Webserver::capture_get_handler( httpd_req_t *req )
+{
+    Webserver* instance = static_cast<Webserver*>(req->user_ctx);
+    if(!instance->checkAuthentication(req)){
+        return ESP_OK;
+    }
+    if(!reportCapture.isEnabled()){
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Report capture disabled (no PSRAM)");
+        return ESP_OK;
+    }
+    httpd_resp_set_status( req, HTTPD_200 );
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr( req, "Content-Disposition", "attachment; filename=\"ups_capture.bin\"" );
+    bool sent = reportCapture.dump([](void* context, const uint8_t* data, size_t len)->bool{
+        return httpd_resp_send_chunk(static_cast<httpd_req_t*>(context), (const char*)data, len) == ESP_OK;
+    }, req);
+    if(!sent){
+        ESP_LOGW(TAG, "Capture download aborted");
+        return ESP_FAIL;
+    }
+    //Ends the chunked response
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+esp_err_t Webserver::status_ws_handler( httpd_req_t *req )
+{
+    httpd_ws_frame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    if(req->method == HTTP_GET){
+        //Handshake done, sends the current status then changes are pushed
+        ESP_LOGI(TAG, "Status push client connected");
+        std::string status;
+        statusToJSONString(status);
+        frame.type = HTTPD_WS_TYPE_TEXT;
+        frame.payload = (uint8_t*)status.c_str();
+        frame.len = status.length();
+        return httpd_ws_send_frame(req, &frame);
+    }
+    //Client frames are not used, drain them
+    esp_err_t ret = httpd_ws_recv_frame(req, &frame, 0);
+    if((ret != ESP_OK) || (frame.len == 0)){
+        return ret;
+    }
+    if(frame.len > 128){
+        return ESP_FAIL;
+    }
+    uint8_t payload[128];
+    frame.payload = payload;
+    return httpd_ws_recv_frame(req, &frame, frame.len);
+}
+
+void Webserver::statusPushTask(void* param)
+{
+    Webserver* instance = static_cast<Webserver*>(param);
+    UPSEventBus::Subscriber events = upsEvents.subscribe(UPSEventBus::CONNECTION | UPSEventBus::VALUES,
+                                                            xTaskGetCurrentTaskHandle(), WEB_PUSH_HOLDOFF_MS);
+    for(;;){
+        if(upsEvents.wait(events, portMAX_DELAY) == 0){
+            continue;
+        }
+        //Status is only built if someone listens
+        httpd_handle_t server = instance->server_;
+        if(!server || !hasStatusPushClients(server)){
+            continue;
+        }
+        PushWork* work = new PushWork{server, std::string()};
+        statusToJSONString(work->status);
+        if(httpd_queue_work(server, statusPushWork, work) != ESP_OK){
+            delete work;
+        }
+    }
+}
+
+bool Webserver::hasStatusPushClients(httpd_handle_t server)
+{
+    int fds[WEB_PUSH_MAX_CLIENTS];
+    size_t clients = WEB_PUSH_MAX_CLIENTS;
+    if(httpd_get_client_list(server, &clients, fds) != ESP_OK){
+        return false;
+    }
+    for(size_t i=0;i<clients;++i){
+        if(httpd_ws_get_fd_info(server, fds[i]) == HTTPD_WS_CLIENT_WEBSOCKET){
+            return true;
+        }
+    }
+    return false;
+}
+
+void Webserver::statusPushWork(void* arg)
+{
+    PushWork* work = static_cast<PushWork*>(arg);
+    int fds[WEB_PUSH_MAX_CLIENTS];
+    size_t clients = WEB_PUSH_MAX_CLIENTS;
+    if(httpd_get_client_list(work->server, &clients, fds) == ESP_OK){
+        httpd_ws_frame_t frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.type = HTTPD_WS_TYPE_TEXT;
+        frame.payload = (uint8_t*)work->status.c_str();
+        frame.len = work->status.length();
+        for(size_t i=0;i<clients;++i){
+            if(httpd_ws_get_fd_info(work->server, fds[i]) == HTTPD_WS_CLIENT_WEBSOCKET){
+                httpd_ws_send_frame_async(work->server, fds[i], &frame);
+            }
+        }
+    }
+    delete work;
+}
+
+Webserver::Webserver() : server_(nullptr), pushTask_(nullptr)
 {
 }
 
@@ -257,6 +426,7 @@ void Webserver::start()
 {
     if(!server_){
         httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+        config.max_uri_handlers = 12;
 
         // Start the httpd server
         ESP_LOGI(TAG, "Starting server on port: '%d'", config.server_port);
@@ -307,6 +477,37 @@ void Webserver::start()
                 .user_ctx  = this,
             };
             httpd_register_uri_handler(server_, &status_get);
+
+            //UPS commands
+            httpd_uri_t command_post =
+            {
+                .uri       = "/command",
+                .method    = HTTP_POST,
+                .handler   = command_post_handler,
+                .user_ctx  = this,
+            };
+            httpd_register_uri_handler(server_, &command_post);
+
+            //Raw HID reports capture
+            httpd_uri_t capture_get =
+            {
+                .uri       = "/capture",
+                .method    = HTTP_GET,
+                .handler   = capture_get_handler,
+                .user_ctx  = this,
+            };
+            httpd_register_uri_handler(server_, &capture_get);
+
+            //Status pushed on UPS changes
+            httpd_uri_t status_ws =
+            {
+                .uri       = "/ws",
+                .method    = HTTP_GET,
+                .handler   = status_ws_handler,
+                .user_ctx  = this,
+                .is_websocket = true,
+            };
+            httpd_register_uri_handler(server_, &status_ws);
             return;
         }
         ESP_LOGI(TAG, "Error starting server!");
@@ -324,7 +525,15 @@ void Webserver::stop()
 
 void Webserver::setup()
 {
-
+    if(pushTask_ == nullptr){
+        xTaskCreate(
+            statusPushTask,
+            "webPushTask",
+            4096,
+            (void*)this,
+            1, &pushTask_
+        );
+    }
 }
 
 void Webserver::setCredentials(const char* userName, const char* password)
@@ -10,6 +10,10 @@
 
 #include "UPSSNMP.hpp"
 #include "UPSHIDDevice.hpp"
+#include "UPSEvents.hpp"
+#include "ReportCapture.hpp"
+#include "UPSSelfTest.hpp"
+#include "UPSState.hpp"
 #include "Configuration.hpp"
 #include "Temperature.hpp"
 #include "OLED.hpp"
@@ -19,6 +23,33 @@
 #ifdef RGB_LED_PIN
 #include <UserLed.hpp>
 static UserLed userLed;
+static UPSEventBus::Subscriber ledEvents = UPSEventBus::INVALID_SUBSCRIBER;
+
+/**
+ * Shows the worst state of the connected UPS on the user LED
+ * (error for a battery to replace or missing, warning when on battery)
+ */
+static void updateUserLed()
+{
+    bool error = false;
+    bool warning = false;
+    for(uint8_t i=0;i<UPS_MAX_DEVICES;++i){
+        uint16_t flags = upsState.getFlags(i);
+        if(flags & (UPSState::REPLACE_BATTERY | UPSState::NO_BATTERY)){
+            error = true;
+        }
+        if(flags & UPSState::ON_BATTERY){
+            warning = true;
+        }
+    }
+    if(error){
+        userLed.error();
+    }else if(warning){
+        userLed.warning();
+    }else{
+        userLed.clearError();
+    }
+}
 #endif
 
 
@@ -125,9 +156,22 @@ void setup()
 #ifdef RGB_LED_PIN
     //Starts the user led task
     userLed.begin();
+    ledEvents = upsEvents.subscribe(UPSEventBus::STATE, nullptr);
 #endif
+    //SNMP agent task, follows the UPS connections
+    snmpAgent.begin();
+
+    //Debounced UPS state from the readings
+    upsState.begin();
+
+    //Battery tests follow the UPS readings
+    upsSelfTest.begin();
+
+    //Raw reports recorder, before the first USB callback
+    reportCapture.begin();
+
     //Configure HID bridge
-    upsDevice.begin();
+    UPSHIDDevice::begin();
 
     //Setup the web server
     webServer.setup();
@@ -143,20 +187,15 @@ void setup()
 
 void loop()
 {
-    unsigned long now = millis();
 #ifdef RGB_LED_PIN
-    static unsigned long lastRGB = 0;
-    static float hue = 0.0f;
     userLed.loop();
-    if((now - lastRGB) >= 100){
-        userLed.customHSV(hue, 1.0, 0.2);
-        hue += 10;
-        if(hue > 360){
-          hue = 0;
-        }
-        lastRGB = now;
+    //UPS state changed
+    if(upsEvents.take(ledEvents) != 0){
+        updateUserLed();
     }
 #endif
-    snmpAgent.loop();
+    UPSHIDDevice::watchdog();
+    upsState.loop(millis());
+    upsSelfTest.loop(millis());
     Configuration.loop();
 }
@@ -0,0 +1,250 @@
+#include "LsusbFixture.hpp"
+#include "esp_log.h"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+
+static const char* TAG = "Fixture";
+
+/**
+ * Short item prefix of a lsusb item name (size bits cleared)
+ */
+struct LsusbItem {
+    const char* type;
+    const char* name;
+    uint8_t prefix;
+};
+
+static const LsusbItem LSUSB_ITEMS[] = {
+    {"Main", "Input", 0x80},
+    {"Main", "Output", 0x90},
+    {"Main", "Feature", 0xb0},
+    {"Main", "Collection", 0xa0},
+    {"Main", "End Collection", 0xc0},
+    {"Global", "Usage Page", 0x04},
+    {"Global", "Logical Minimum", 0x14},
+    {"Global", "Logical Maximum", 0x24},
+    {"Global", "Physical Minimum", 0x34},
+    {"Global", "Physical Maximum", 0x44},
+    {"Global", "Unit Exponent", 0x54},
+    {"Global", "Unit", 0x64},
+    {"Global", "Report Size", 0x74},
+    {"Global", "Report ID", 0x84},
+    {"Global", "Report Count", 0x94},
+    {"Global", "Push", 0xa4},
+    {"Global", "Pop", 0xb4},
+    {"Local", "Usage", 0x08},
+    {"Local", "Usage Minimum", 0x18},
+    {"Local", "Usage Maximum", 0x28},
+    {"Local", "Designator Index", 0x38},
+    {"Local", "Designator Minimum", 0x48},
+    {"Local", "Designator Maximum", 0x58},
+    {"Local", "String Index", 0x78},
+    {"Local", "String Minimum", 0x88},
+    {"Local", "String Maximum", 0x98},
+    {"Local", "Delimiter", 0xa8},
+};
+
+/**
+ * Trims leading and trailing blanks
+ */
+static std::string trim(const std::string& str)
+{
+    size_t first = str.find_first_not_of(" \t\r");
+    if(first == std::string::npos){
+        return "";
+    }
+    return str.substr(first, str.find_last_not_of(" \t\r") - first + 1);
+}
+
+/**
+ * Gets the value of a "  key   value" descriptor line
+ * @return false if the line is not about this key
+ */
+static bool lineValue(const std::string& line, const char* key, std::string& value)
+{
+    std::string content = trim(line);
+    size_t keyLen = strlen(key);
+    if((content.compare(0, keyLen, key) != 0) || (content.size() <= keyLen) || (content[keyLen] != ' ')){
+        return false;
+    }
+    value = trim(content.substr(keyLen));
+    return true;
+}
+
+/**
+ * Gets the string of a string descriptor line ("iProduct  2 Back-UPS")
+ */
+static std::string stringValue(const std::string& value)
+{
+    size_t space = value.find(' ');
+    return space == std::string::npos ? "" : trim(value.substr(space));
+}
+
+/**
+ * Parses a lsusb item line
+ * @param line Line to parse ("Item(Global): Report ID, data= [ 0x01 ] 1")
+ * @param descriptor Item bytes are appended here
+ * @param prefix Item prefix (size bits cleared)
+ * @param value Item data (little endian)
+ * @return false if the line is not a known item
+ */
+static bool parseItem(const std::string& line, std::vector<uint8_t>& descriptor, uint8_t& prefix, uint32_t& value)
+{
+    size_t open = line.find("Item(");
+    size_t close = line.find("): ", open);
+    size_t comma = line.find(", data=", close);
+    if((open == std::string::npos) || (close == std::string::npos) || (comma == std::string::npos)){
+        return false;
+    }
+    std::string type = trim(line.substr(open + 5, close - open - 5));
+    std::string name = line.substr(close + 3, comma - close - 3);
+    const LsusbItem* item = nullptr;
+    for(const LsusbItem& known : LSUSB_ITEMS){
+        if((type == known.type) && (name == known.name)){
+            item = &known;
+            break;
+        }
+    }
+    if(item == nullptr){
+        ESP_LOGW(TAG, "Unknown item %s", trim(line).c_str());
+        return false;
+    }
+    std::vector<uint8_t> data;
+    size_t bracket = line.find('[', comma);
+    if(bracket != std::string::npos){
+        const char* hex = line.c_str() + bracket + 1;
+        char* end = nullptr;
+        for(unsigned long byte=strtoul(hex, &end, 16);end!=hex;byte=strtoul(hex, &end, 16)){
+            data.push_back(byte);
+            hex = end;
+        }
+    }
+    if((data.size() == 3) || (data.size() > 4)){
+        ESP_LOGW(TAG, "Invalid item size %s", trim(line).c_str());
+        return false;
+    }
+    prefix = item->prefix;
+    descriptor.push_back(item->prefix | (data.size() == 4 ? 3 : data.size()));
+    descriptor.insert(descriptor.end(), data.begin(), data.end());
+    value = 0;
+    for(size_t i=0;i<data.size();++i){
+        value |= (uint32_t)data[i] << (i*8);
+    }
+    return true;
+}
+
+bool loadLsusbFixture(const char* path, LsusbFixture& fixture)
+{
+    std::ifstream file(path);
+    if(!file){
+        return false;
+    }
+    std::string base = path;
+    base = base.substr(base.find_last_of('/') + 1);
+    fixture = LsusbFixture();
+    fixture.name = base.substr(0, base.find_last_of('.'));
+
+    LsusbFixture device;
+    size_t length = 0;
+    bool inDescriptor = false;
+    uint8_t reportId = 0;
+    uint32_t reportSize = 0;
+    uint32_t reportCount = 0;
+    std::map<uint8_t, uint32_t> inputBits;
+    std::map<uint8_t, uint32_t> featureBits;
+    std::string line;
+    std::string value;
+    while(std::getline(file, line)){
+        if(inDescriptor){
+            if(line.find("Item(") == std::string::npos){
+                //Item description lines
+                continue;
+            }
+            uint8_t prefix;
+            uint32_t data;
+            if(!parseItem(line, fixture.descriptor, prefix, data)){
+                return false;
+            }
+            switch(prefix){
+                case 0x74:
+                    reportSize = data;
+                    break;
+                case 0x84:
+                    reportId = data;
+                    break;
+                case 0x94:
+                    reportCount = data;
+                    break;
+                case 0x80:
+                    inputBits[reportId] += reportSize * reportCount;
+                    break;
+                case 0xb0:
+                    featureBits[reportId] += reportSize * reportCount;
+                    break;
+            }
+            if(fixture.descriptor.size() >= length){
+                break;
+            }
+        }else if(lineValue(line, "idVendor", value)){
+            device = LsusbFixture();
+            device.idVendor = strtoul(value.c_str(), nullptr, 16);
+        }else if(lineValue(line, "idProduct", value)){
+            device.idProduct = strtoul(value.c_str(), nullptr, 16);
+        }else if(lineValue(line, "bcdDevice", value)){
+            //Printed as major.minor in BCD
+            unsigned major = 0;
+            unsigned minor = 0;
+            sscanf(value.c_str(), "%x.%x", &major, &minor);
+            device.bcdDevice = (major << 8) | minor;
+        }else if(lineValue(line, "iManufacturer", value)){
+            device.manufacturer = stringValue(value);
+        }else if(lineValue(line, "iProduct", value)){
+            device.product = stringValue(value);
+        }else if(lineValue(line, "iSerial", value)){
+            device.serial = stringValue(value);
+        }else if(line.find("Report Descriptor: (length is ") != std::string::npos){
+            length = strtoul(line.c_str() + line.find("is ") + 3, nullptr, 10);
+            inDescriptor = length > 0;
+            fixture.idVendor = device.idVendor;
+            fixture.idProduct = device.idProduct;
+            fixture.bcdDevice = device.bcdDevice;
+            fixture.manufacturer = device.manufacturer;
+            fixture.product = device.product;
+            fixture.serial = device.serial;
+        }
+    }
+    if(!inDescriptor || (fixture.descriptor.size() != length)){
+        ESP_LOGW(TAG, "%s: no complete report descriptor", path);
+        return false;
+    }
+    //Report ID byte is only sent when report IDs are used
+    for(const auto& report : inputBits){
+        fixture.inputReports.push_back({report.first, (report.second + 7) / 8 + (report.first != 0 ? 1 : 0)});
+    }
+    for(const auto& report : featureBits){
+        fixture.featureReports.push_back({report.first, (report.second + 7) / 8 + (report.first != 0 ? 1 : 0)});
+    }
+    return true;
+}
+
+bool loadDescriptor(const char* path, std::vector<uint8_t>& data)
+{
+    size_t len = strlen(path);
+    if((len > 4) && (strcmp(path + len - 4, ".txt") == 0)){
+        LsusbFixture fixture;
+        if(!loadLsusbFixture(path, fixture)){
+            return false;
+        }
+        data = fixture.descriptor;
+        return true;
+    }
+    std::ifstream file(path, std::ios::binary);
+    if(!file){
+        return false;
+    }
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
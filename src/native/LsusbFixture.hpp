@@ -0,0 +1,44 @@
+#ifndef _LSUSB_FIXTURE_HPP__
+#define _LSUSB_FIXTURE_HPP__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+
+/**
+ * UPS described by a "lsusb -v" dump (see docs/)
+ * The report descriptor is rebuilt from the decoded items
+ */
+struct LsusbFixture {
+    std::string name;                   //File name without directory and extension
+    uint16_t idVendor;
+    uint16_t idProduct;
+    uint16_t bcdDevice;
+    std::string manufacturer;
+    std::string product;
+    std::string serial;
+    std::vector<uint8_t> descriptor;    //Report descriptor bytes
+    std::vector<std::pair<uint8_t, uint16_t>> inputReports;   //Input report ID and size in bytes (report ID included)
+    std::vector<std::pair<uint8_t, uint16_t>> featureReports; //Feature report ID and size in bytes (report ID included)
+
+    LsusbFixture() : idVendor(0), idProduct(0), bcdDevice(0) {};
+};
+
+/**
+ * Loads the first HID report descriptor of a lsusb dump
+ * @param path Dump file
+ * @param fixture Destination
+ * @return false if the file can't be read or holds no valid descriptor
+ */
+bool loadLsusbFixture(const char* path, LsusbFixture& fixture);
+
+/**
+ * Loads a report descriptor, lsusb dump (.txt) or raw bytes
+ * @param path Descriptor file
+ * @param data Destination buffer
+ * @return false if the file can't be read
+ */
+bool loadDescriptor(const char* path, std::vector<uint8_t>& data);
+
+#endif
@@ -0,0 +1,432 @@
+#include "VirtualUps.hpp"
+#include "UPSHIDDevice.hpp"
+#include "esp_log.h"
+#include <algorithm>
+#include <cmath>
+
+static const char* TAG = "VirtualUPS";
+
+static constexpr uint16_t TEST_PAGE = 0x84;         //Power device Test usage
+static constexpr uint16_t TEST_USAGE = 0x58;
+static constexpr double TEST_QUICK = 1;             //Written values
+static constexpr double TEST_DEEP = 2;
+static constexpr double TEST_PASSED = 1;            //Reported values
+static constexpr double TEST_ABORTED = 4;
+static constexpr double TEST_IN_PROGRESS = 5;
+static constexpr uint32_t QUICK_TEST_MS = 10000;
+static constexpr uint32_t DEEP_TEST_MS = 60000;
+
+VirtualUps::VirtualUps(uint8_t device, const LsusbFixture& fixture) :
+    device_(device), fixture_(fixture), nextInput_(0), reportCount_(0), plugged_(false), hung_(false), testEndMs_(0), idleDuration_(-1)
+{
+    makeStringDescriptor(fixture_.manufacturer, strings_[0]);
+    makeStringDescriptor(fixture_.product, strings_[1]);
+    makeStringDescriptor(fixture_.serial, strings_[2]);
+    parseDescriptor();
+}
+
+void VirtualUps::plug()
+{
+    if(plugged_){
+        return;
+    }
+    plugged_ = true;
+    usb_device_desc_t deviceDesc = {
+        sizeof(usb_device_desc_t), USB_B_DESCRIPTOR_TYPE_DEVICE, 0x0200, 0, 0, 0, 64,
+        fixture_.idVendor, fixture_.idProduct, fixture_.bcdDevice, 1, 2, 3, 1
+    };
+    if(hidBridge.onDeviceDescriptorReceived){
+        hidBridge.onDeviceDescriptorReceived(device_, &deviceDesc);
+    }
+    usb_config_desc_t configDesc = {
+        sizeof(usb_config_desc_t), USB_B_DESCRIPTOR_TYPE_CONFIGURATION, 0x0022, 1, 1, 0, 0x80, 50
+    };
+    if(hidBridge.onConfigDescriptorReceived){
+        hidBridge.onConfigDescriptorReceived(device_, &configDesc);
+    }
+    usb_device_info_t info = {
+        USB_SPEED_LOW, (uint8_t)(device_ + 1), 64, 1,
+        (const usb_str_desc_t*)strings_[0].data(), (const usb_str_desc_t*)strings_[1].data(), (const usb_str_desc_t*)strings_[2].data()
+    };
+    if(hidBridge.onDeviceInfoReceived){
+        hidBridge.onDeviceInfoReceived(device_, &info);
+    }
+    deliver(hidBridge.onHidReportDescriptorReceived, fixture_.descriptor.data(), fixture_.descriptor.size(), true);
+    featureDue_.clear();
+    //Device default rate until the host sets one
+    idleDuration_ = -1;
+    sentInputs_.assign(inputReports_.size(), std::vector<uint8_t>());
+    sentInputMs_.assign(inputReports_.size(), 0);
+}
+
+void VirtualUps::serviceReset()
+{
+    if(!hidBridge.resetRequests[device_].exchange(false) || !plugged_){
+        return;
+    }
+    //Enumerating again clears the hang, like a USB stack stuck in the UPS
+    ESP_LOGI(TAG, "%s: reset by the host", fixture_.name.c_str());
+    unplug();
+    hung_ = false;
+    plug();
+}
+
+void VirtualUps::unplug()
+{
+    if(!plugged_){
+        return;
+    }
+    plugged_ = false;
+    if(hidBridge.onDeviceRemoved){
+        hidBridge.onDeviceRemoved(device_);
+    }
+    hidBridge.clearFeatureReports(device_);
+}
+
+size_t VirtualUps::setValue(uint16_t usagePage, uint16_t usage, double value)
+{
+    size_t count = 0;
+    for(Field& field : fields_){
+        if((field.usagePage == usagePage) && (field.usage == usage)){
+            field.value = value;
+            encode(field);
+            ++count;
+        }
+    }
+    return count;
+}
+
+double VirtualUps::getValue(uint16_t usagePage, uint16_t usage) const
+{
+    for(const Field& field : fields_){
+        if((field.usagePage == usagePage) && (field.usage == usage)){
+            return field.value;
+        }
+    }
+    return 0.0;
+}
+
+void VirtualUps::sendInputReport(uint32_t nowMs)
+{
+    if(!plugged_ || hung_ || inputReports_.empty()){
+        return;
+    }
+    for(size_t n=0;n<inputReports_.size();++n){
+        size_t input = nextInput_;
+        const Report& report = reports_[inputReports_[input]];
+        nextInput_ = (nextInput_ + 1) % inputReports_.size();
+        if(idleDuration_ >= 0){
+            bool expired = (idleDuration_ > 0) && (nowMs - sentInputMs_[input] >= (uint32_t)idleDuration_ * 4);
+            if(!expired && (report.data == sentInputs_[input])){
+                continue;
+            }
+            sentInputs_[input] = report.data;
+            sentInputMs_[input] = nowMs;
+        }
+        ++reportCount_;
+        deliver(hidBridge.onReportReceived, report.data.data(), report.data.size(), false);
+        return;
+    }
+}
+
+void VirtualUps::serviceSetIdle()
+{
+    int16_t duration = hidBridge.idleRequests[device_].exchange(-1);
+    if(!plugged_ || hung_ || (duration < 0)){
+        return;
+    }
+    ESP_LOGI(TAG, "%s: idle rate %d ms", fixture_.name.c_str(), duration * 4);
+    idleDuration_ = duration;
+    if(hidBridge.onSetIdleDone){
+        hidBridge.onSetIdleDone(device_, duration, true);
+    }
+}
+
+void VirtualUps::sendReport(const uint8_t* data, size_t len, bool feature)
+{
+    if(!plugged_){
+        return;
+    }
+    ++reportCount_;
+    deliver(feature ? hidBridge.onFeatureReportReceived : hidBridge.onReportReceived, data, len, feature);
+}
+
+void VirtualUps::serviceFeatureReports(uint32_t nowMs)
+{
+    if(!plugged_ || hung_){
+        return;
+    }
+    const UsbHostHidBridge::FeatureSchedule& schedule = hidBridge.featureSchedules[device_];
+    featureDue_.resize(schedule.count, nowMs);
+    for(uint8_t i=0;i<schedule.count;++i){
+        const UsbHostHidBridge::FeatureReportSlot& slot = schedule.reports[i];
+        if((int32_t)(nowMs - featureDue_[i]) < 0){
+            continue;
+        }
+        featureDue_[i] = nowMs + slot.interval * portTICK_PERIOD_MS;
+        for(const Report& report : reports_){
+            if((static_cast<uint8_t>(report.type) == slot.reportType) && (report.reportId == slot.reportId)){
+                //Device answers with at most the requested length
+                ++reportCount_;
+                deliver(hidBridge.onFeatureReportReceived, report.data.data(), std::min<size_t>(slot.length, report.data.size()), true,
+                            (slot.reportType << 8) | slot.reportId);
+                break;
+            }
+        }
+    }
+}
+
+void VirtualUps::serviceSetReports(uint32_t nowMs)
+{
+    if((testEndMs_ != 0) && (nowMs >= testEndMs_)){
+        testEndMs_ = 0;
+        setValue(TEST_PAGE, TEST_USAGE, TEST_PASSED);
+    }
+    while(plugged_ && !hung_ && hidBridge.setReportRequests[device_]){
+        hidBridge.setReportRequests[device_] = false;
+        uint8_t data[FEATURE_REPORT_MAX_SIZE];
+        uint8_t type = 0;
+        uint16_t length = sizeof(data);
+        if((hidBridge.onSetReportRequired == nullptr) || !hidBridge.onSetReportRequired(device_, &type, data, &length) || (length == 0)){
+            break;
+        }
+        hidBridge.setReportRequests[device_] = true;
+        uint16_t index = UINT16_MAX;
+        for(uint16_t j=0;j<reports_.size();++j){
+            if((static_cast<uint8_t>(reports_[j].type) == type) && (reports_[j].reportId == data[0])){
+                index = j;
+                break;
+            }
+        }
+        if(index == UINT16_MAX){
+            ESP_LOGW(TAG, "%s: SET_REPORT of unknown report 0x%02x (type %u)", fixture_.name.c_str(), data[0], type);
+            continue;
+        }
+        //Report ID is not on the wire when 0
+        Report& rep = reports_[index];
+        size_t skip = rep.reportId != 0 ? 0 : 1;
+        std::copy(data + skip, data + std::min<size_t>(length, skip + rep.data.size()), rep.data.begin());
+        for(const Field& field : fields_){
+            if(field.report != index){
+                continue;
+            }
+            double value = decode(field);
+            if((field.usagePage == TEST_PAGE) && (field.usage == TEST_USAGE)){
+                //Test command (written even when equal to the last result), the field then reports the test state
+                ESP_LOGI(TAG, "%s: test command %g", fixture_.name.c_str(), value);
+                bool start = (value == TEST_QUICK) || (value == TEST_DEEP);
+                testEndMs_ = start ? nowMs + (value == TEST_QUICK ? QUICK_TEST_MS : DEEP_TEST_MS) : 0;
+                setValue(field.usagePage, field.usage, start ? TEST_IN_PROGRESS : TEST_ABORTED);
+            }else if(value != field.value){
+                ESP_LOGI(TAG, "%s: 0x%04x:0x%04x set to %g", fixture_.name.c_str(), field.usagePage, field.usage, value);
+                //Input fields of the usage report the new value too
+                setValue(field.usagePage, field.usage, value);
+            }
+        }
+        if(rep.type == ReportType::Feature){
+            ++reportCount_;
+            deliver(hidBridge.onFeatureReportReceived, rep.data.data(), rep.data.size(), true);
+        }
+    }
+}
+
+void VirtualUps::parseDescriptor()
+{
+    struct Globals {
+        uint16_t usagePage = 0;
+        int32_t logicalMin = 0;
+        int32_t logicalMax = 0;
+        int32_t physicalMin = 0;
+        int32_t physicalMax = 0;
+        uint32_t reportSize = 0;
+        uint32_t reportCount = 0;
+        uint8_t reportId = 0;
+    } globals;
+    std::vector<Globals> stack;
+    std::vector<uint32_t> usages;
+    uint32_t usageMin = 0;
+    uint32_t usageMax = 0;
+    bool usageRange = false;
+    std::vector<uint32_t> bitOffsets(3 * 256, 0);
+
+    const std::vector<uint8_t>& desc = fixture_.descriptor;
+    for(size_t i=0;i<desc.size();){
+        uint8_t prefix = desc[i];
+        if(prefix == 0xfe){
+            //Long item
+            i += (i + 1 < desc.size()) ? 3 + desc[i+1] : desc.size();
+            continue;
+        }
+        size_t size = (prefix & 0x3) == 3 ? 4 : (prefix & 0x3);
+        if(i + 1 + size > desc.size()){
+            break;
+        }
+        uint32_t data = 0;
+        for(size_t b=0;b<size;++b){
+            data |= (uint32_t)desc[i+1+b] << (b*8);
+        }
+        int32_t sdata = data;
+        if((size > 0) && (size < 4) && (desc[i+size] & 0x80)){
+            sdata = data | (0xFFFFFFFFu << (size*8));
+        }
+        i += 1 + size;
+        switch(prefix & 0xfc){
+            //Global items
+            case 0x04: globals.usagePage = data; break;
+            case 0x14: globals.logicalMin = sdata; break;
+            case 0x24: globals.logicalMax = sdata; break;
+            case 0x34: globals.physicalMin = sdata; break;
+            case 0x44: globals.physicalMax = sdata; break;
+            case 0x74: globals.reportSize = data; break;
+            case 0x84: globals.reportId = data; break;
+            case 0x94: globals.reportCount = data; break;
+            case 0xa4: stack.push_back(globals); break;
+            case 0xb4:
+                if(!stack.empty()){
+                    globals = stack.back();
+                    stack.pop_back();
+                }
+                break;
+            //Local items
+            case 0x08: usages.push_back(size == 4 ? data : (data & 0xFFFF)); break;
+            case 0x18: usageMin = data; usageRange = true; break;
+            case 0x28: usageMax = data; usageRange = true; break;
+            //Main items
+            case 0x80:
+            case 0x90:
+            case 0xb0:
+                {
+                    ReportType type = (prefix & 0xfc) == 0x80 ? ReportType::Input : ((prefix & 0xfc) == 0x90 ? ReportType::Output : ReportType::Feature);
+                    uint32_t& bitOffset = bitOffsets[(static_cast<uint8_t>(type) - 1) * 256 + globals.reportId];
+                    uint16_t index = report(type, globals.reportId);
+                    for(uint32_t k=0;(k<globals.reportCount) && (globals.reportSize > 0) && (globals.reportSize <= 32);++k){
+                        uint32_t usage = 0;
+                        if(!usages.empty()){
+                            usage = usages[std::min<size_t>(k, usages.size() - 1)];
+                        }else if(usageRange){
+                            usage = std::min(usageMin + k, usageMax);
+                        }
+                        //Page in high word only for extended usages
+                        if((usage >> 16) == 0){
+                            usage |= (uint32_t)globals.usagePage << 16;
+                        }
+                        //Constant (padding) items have no usage
+                        if(((data & 0x1) == 0) && ((usage & 0xFFFF) != 0)){
+                            fields_.push_back({(uint16_t)(usage >> 16), (uint16_t)(usage & 0xFFFF), index,
+                                                bitOffset + k * globals.reportSize, (uint8_t)globals.reportSize,
+                                                globals.logicalMin, globals.logicalMax, globals.physicalMin, globals.physicalMax, 0.0});
+                        }
+                    }
+                    bitOffset += globals.reportSize * globals.reportCount;
+                }
+                break;
+        }
+        if((prefix & 0x0c) == 0x00){
+            //Main items reset local items
+            usages.clear();
+            usageRange = false;
+        }
+    }
+    //Allocate report buffers, report ID byte first if used
+    for(Report& rep : reports_){
+        uint32_t bits = bitOffsets[(static_cast<uint8_t>(rep.type) - 1) * 256 + rep.reportId];
+        rep.data.assign((bits + 7) / 8 + (rep.reportId != 0 ? 1 : 0), 0);
+        if(rep.reportId != 0){
+            rep.data[0] = rep.reportId;
+        }
+    }
+    for(uint16_t j=0;j<reports_.size();++j){
+        if((reports_[j].type == ReportType::Input) && (reports_[j].data.size() > 1)){
+            inputReports_.push_back(j);
+        }
+    }
+    ESP_LOGI(TAG, "%s: %u fields in %u reports (%u Input)", fixture_.name.c_str(),
+                (unsigned)fields_.size(), (unsigned)reports_.size(), (unsigned)inputReports_.size());
+}
+
+uint16_t VirtualUps::report(ReportType type, uint8_t reportId)
+{
+    for(uint16_t j=0;j<reports_.size();++j){
+        if((reports_[j].type == type) && (reports_[j].reportId == reportId)){
+            return j;
+        }
+    }
+    reports_.push_back({type, reportId, {}});
+    return reports_.size() - 1;
+}
+
+void VirtualUps::encode(const Field& field)
+{
+    //Physical to logical, physical is logical when not declared
+    double logical = field.value;
+    if(((field.physicalMin != 0) || (field.physicalMax != 0)) && (field.physicalMax != field.physicalMin)){
+        logical = (field.value - field.physicalMin) * ((double)field.logicalMax - field.logicalMin) /
+                    ((double)field.physicalMax - field.physicalMin) + field.logicalMin;
+    }
+    if(field.logicalMin < field.logicalMax){
+        logical = std::max<double>(field.logicalMin, std::min<double>(field.logicalMax, logical));
+    }
+    uint32_t bits = static_cast<uint32_t>(static_cast<int64_t>(std::lround(logical)));
+    Report& rep = reports_[field.report];
+    size_t base = rep.reportId != 0 ? 1 : 0;
+    for(uint8_t b=0;b<field.bitSize;++b){
+        size_t bit = field.bitOffset + b;
+        uint8_t& byte = rep.data[base + bit / 8];
+        if(bits & (1u << b)){
+            byte |= 1u << (bit % 8);
+        }else{
+            byte &= ~(1u << (bit % 8));
+        }
+    }
+}
+
+double VirtualUps::decode(const Field& field) const
+{
+    const Report& rep = reports_[field.report];
+    size_t base = rep.reportId != 0 ? 1 : 0;
+    uint32_t bits = 0;
+    for(uint8_t b=0;b<field.bitSize;++b){
+        size_t bit = field.bitOffset + b;
+        if(rep.data[base + bit / 8] & (1u << (bit % 8))){
+            bits |= 1u << b;
+        }
+    }
+    int64_t logical = bits;
+    if((field.logicalMin < 0) && (field.bitSize > 0) && (field.bitSize < 32) && (bits & (1u << (field.bitSize - 1)))){
+        logical -= (int64_t)1 << field.bitSize;
+    }
+    if(((field.physicalMin != 0) || (field.physicalMax != 0)) && (field.logicalMax != field.logicalMin)){
+        return (logical - field.logicalMin) * ((double)field.physicalMax - field.physicalMin) /
+                    ((double)field.logicalMax - field.logicalMin) + field.physicalMin;
+    }
+    return logical;
+}
+
+void VirtualUps::deliver(void (*callback)(uint8_t, usb_transfer_t*), const uint8_t* data, size_t len, bool control, uint16_t wValue)
+{
+    if(callback == nullptr){
+        return;
+    }
+    size_t offset = control ? USB_SETUP_PACKET_SIZE : 0;
+    transferBuffer_.assign(offset + len, 0);
+    std::copy(data, data + len, transferBuffer_.begin() + offset);
+    if(control){
+        reinterpret_cast<usb_setup_packet_t*>(transferBuffer_.data())->wValue = wValue;
+    }
+    usb_transfer_t transfer = {
+        transferBuffer_.data(), transferBuffer_.size(), (int)transferBuffer_.size(), (int)transferBuffer_.size(), 0,
+        nullptr, (uint8_t)(control ? 0x00 : 0x81), USB_TRANSFER_STATUS_COMPLETED, 0, nullptr, nullptr, 0
+    };
+    callback(device_, &transfer);
+}
+
+void VirtualUps::makeStringDescriptor(const std::string& str, std::vector<uint8_t>& desc)
+{
+    size_t len = std::min<size_t>(str.size(), 126);
+    desc.assign(2 + len * 2, 0);
+    desc[0] = desc.size();
+    desc[1] = USB_B_DESCRIPTOR_TYPE_STRING;
+    for(size_t i=0;i<len;++i){
+        desc[2 + i * 2] = str[i];
+    }
+}
@@ -0,0 +1,182 @@
+#ifndef _VIRTUAL_UPS_HPP__
+#define _VIRTUAL_UPS_HPP__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <usb/usb_host.h>
+#include "LsusbFixture.hpp"
+
+/**
+ * Software UPS playing a report descriptor through the bridge callbacks
+ * Values are set by usage in physical units and encoded in the reports
+ * the way the descriptor lays them out
+ */
+class VirtualUps
+{
+public:
+    /**
+     * @param device Device index in the bridge table
+     * @param fixture Descriptor and USB identification of the UPS
+     */
+    VirtualUps(uint8_t device, const LsusbFixture& fixture);
+    ~VirtualUps() = default;
+
+    /**
+     * Enumerates the UPS (device descriptor, strings and report descriptor)
+     */
+    void plug();
+
+    /**
+     * Removes the UPS
+     */
+    void unplug();
+
+    inline bool isPlugged() const { return plugged_; }
+
+    /**
+     * Stops answering the host (stuck firmware) until it is enumerated again
+     */
+    inline void hang() { hung_ = true; }
+
+    /**
+     * Enumerates the UPS again when the bridge was asked to reset it
+     */
+    void serviceReset();
+
+    /**
+     * Sets the value of all fields of a usage
+     * @param usagePage Usage page
+     * @param usage Usage ID
+     * @param value Value in physical units
+     * @return Number of fields updated
+     */
+    size_t setValue(uint16_t usagePage, uint16_t usage, double value);
+
+    /**
+     * Gets the value of the first field of a usage
+     * @return Value in physical units (0 if the usage is unknown)
+     */
+    double getValue(uint16_t usagePage, uint16_t usage) const;
+
+    /**
+     * Sends the next Input report (report IDs in turn) on the interrupt pipe
+     * Once an idle rate is set, a report is only sent when it changed or
+     * when its idle duration elapsed (never with a 0 duration)
+     * @param nowMs Current time in milliseconds
+     */
+    void sendInputReport(uint32_t nowMs);
+
+    /**
+     * Applies the idle rate the bridge was asked to set (SET_IDLE)
+     */
+    void serviceSetIdle();
+
+    /**
+     * Delivers a report as it was received (capture replay)
+     * @param data Report (report ID first)
+     * @param len Report length
+     * @param feature True for a GET_REPORT(Feature) answer, false for an Input report
+     */
+    void sendReport(const uint8_t* data, size_t len, bool feature);
+
+    /**
+     * Answers the GET_REPORT(Feature) requests the bridge scheduled
+     * @param nowMs Current time in milliseconds
+     */
+    void serviceFeatureReports(uint32_t nowMs);
+
+    /**
+     * Writes the reports the bridge was asked to send (SET_REPORT)
+     * Written values update the fields of their usages, a feature report
+     * is read back at once like the target bridge does. A quick (1) or deep (2)
+     * Test write runs a battery test reported in progress (5) then passed (1)
+     * @param nowMs Current time in milliseconds
+     */
+    void serviceSetReports(uint32_t nowMs);
+
+    /**
+     * Gets number of Input and Feature reports delivered
+     */
+    inline uint64_t getReportCount() const { return reportCount_; }
+
+private:
+    enum class ReportType : uint8_t {Input = 1, Output, Feature};
+
+    /**
+     * Field of a report, located once from the descriptor
+     */
+    struct Field {
+        uint16_t usagePage;
+        uint16_t usage;
+        uint16_t report;        //Index in reports_
+        uint32_t bitOffset;     //Report ID excluded
+        uint8_t bitSize;
+        int32_t logicalMin;
+        int32_t logicalMax;
+        int32_t physicalMin;
+        int32_t physicalMax;
+        double value;
+    };
+
+    struct Report {
+        ReportType type;
+        uint8_t reportId;
+        std::vector<uint8_t> data;  //Report ID first (if used)
+    };
+
+    /**
+     * Walks the report descriptor to locate all fields
+     */
+    void parseDescriptor();
+
+    /**
+     * Gets the report of a type and ID (created if needed)
+     */
+    uint16_t report(ReportType type, uint8_t reportId);
+
+    /**
+     * Writes a field value in its report
+     */
+    void encode(const Field& field);
+
+    /**
+     * Reads a field value from its report
+     * @return Value in physical units
+     */
+    double decode(const Field& field) const;
+
+    /**
+     * Calls a bridge callback with a transfer holding data
+     * @param callback Callback to call
+     * @param data Payload
+     * @param len Payload length
+     * @param control True for control transfers (payload follows the SETUP packet)
+     * @param wValue wValue of the SETUP packet (GET_REPORT type and ID)
+     */
+    void deliver(void (*callback)(uint8_t, usb_transfer_t*), const uint8_t* data, size_t len, bool control, uint16_t wValue = 0);
+
+    /**
+     * Builds a UTF-16 string descriptor
+     */
+    static void makeStringDescriptor(const std::string& str, std::vector<uint8_t>& desc);
+
+    uint8_t device_;
+    LsusbFixture fixture_;
+    std::vector<Field> fields_;
+    std::vector<Report> reports_;
+    std::vector<uint16_t> inputReports_;        //Index of Input reports in reports_
+    size_t nextInput_;
+    std::vector<uint32_t> featureDue_;          //Next answer time of each bridge feature slot
+    std::vector<uint8_t> strings_[3];           //Manufacturer, product and serial descriptors
+    std::vector<uint8_t> transferBuffer_;
+    uint64_t reportCount_;
+    bool plugged_;
+    bool hung_;                                 //Sends and answers nothing until reset
+    uint32_t testEndMs_;                        //End of the running battery test (0 if none)
+    int16_t idleDuration_;                      //SET_IDLE duration in 4 ms units (-1 reports at each call)
+    std::vector<std::vector<uint8_t>> sentInputs_;  //Input reports as last sent (idle rate set)
+    std::vector<uint32_t> sentInputMs_;         //Time each Input report was last sent
+};
+
+#endif
@@ -0,0 +1,173 @@
+/*
+**    HID parser benchmark (PlatformIO native_bench environment)
+**    Usage: program [-o corpus_dir] [lsusb.txt...]
+**    Rebuilds the report descriptors of lsusb dumps (.txt files of docs by default)
+**    and measures buildFromHIDReport and the Input/Feature report decode.
+**    With -o, descriptors are also written as raw files to seed the fuzzer corpus.
+*/
+#include <Arduino.h>
+#include <chrono>
+#include <dirent.h>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "UPSHIDDevice.hpp"
+#include "LsusbFixture.hpp"
+
+static const char* TAG = "Bench";
+
+static constexpr double MIN_RUN_TIME = 0.5;    //Seconds each measure runs at least
+
+/**
+ * Runs a function until MIN_RUN_TIME is reached
+ * @param run Function running the given number of iterations
+ * @return Time of one iteration in nanoseconds
+ */
+template<typename F>
+static double measure(F run)
+{
+    run(1);     //Warm up
+    for(uint64_t iterations=1;;iterations*=2){
+        auto start = std::chrono::steady_clock::now();
+        run(iterations);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if(elapsed.count() >= MIN_RUN_TIME){
+            return elapsed.count() * 1e9 / iterations;
+        }
+    }
+}
+
+/**
+ * Builds reports with random payloads
+ * @param layouts Report ID and size of each report
+ * @param reports Destination
+ */
+static void makeReports(const std::vector<std::pair<uint8_t, uint16_t>>& layouts, std::vector<std::vector<uint8_t>>& reports)
+{
+    std::mt19937 random(0x5550);
+    reports.clear();
+    for(const auto& layout : layouts){
+        std::vector<uint8_t> report(layout.second);
+        for(uint8_t& byte : report){
+            byte = random();
+        }
+        report[0] = layout.first;
+        reports.push_back(report);
+    }
+}
+
+/**
+ * Measures the decode of a set of reports
+ * @return Time of one report in nanoseconds
+ */
+static double measureDecode(UPSHIDDevice& device, const std::vector<std::vector<uint8_t>>& reports, bool feature)
+{
+    if(reports.empty()){
+        return 0.0;
+    }
+    return measure([&](uint64_t iterations){
+        for(uint64_t n=0;n<iterations;++n){
+            for(const std::vector<uint8_t>& report : reports){
+                if(feature){
+                    device.hidFeatureReportData(report.data(), report.size());
+                }else{
+                    device.hidReportData(report.data(), report.size());
+                }
+            }
+        }
+    }) / reports.size();
+}
+
+/**
+ * Lists the lsusb dumps of a directory
+ */
+static void listDumps(const char* directory, std::vector<std::string>& files)
+{
+    DIR* dir = opendir(directory);
+    if(dir == nullptr){
+        return;
+    }
+    for(struct dirent* entry=readdir(dir);entry!=nullptr;entry=readdir(dir)){
+        std::string name = entry->d_name;
+        if((name.size() > 4) && (name.compare(name.size() - 4, 4, ".txt") == 0)){
+            files.push_back(std::string(directory) + "/" + name);
+        }
+    }
+    closedir(dir);
+}
+
+/**
+ * Writes a descriptor to a corpus directory
+ */
+static void writeCorpus(const char* directory, const LsusbFixture& fixture)
+{
+    std::string path = std::string(directory) + "/" + fixture.name + ".bin";
+    for(char& c : path){
+        c = (c == ' ') ? '_' : c;
+    }
+    FILE* file = fopen(path.c_str(), "wb");
+    if(file == nullptr){
+        ESP_LOGE(TAG, "Unable to write %s", path.c_str());
+        return;
+    }
+    fwrite(fixture.descriptor.data(), 1, fixture.descriptor.size(), file);
+    fclose(file);
+}
+
+int main(int argc, char** argv)
+{
+    const char* corpus = nullptr;
+    std::vector<std::string> files;
+    for(int i=1;i<argc;++i){
+        if((strcmp(argv[i], "-o") == 0) && (i + 1 < argc)){
+            corpus = argv[++i];
+        }else{
+            files.push_back(argv[i]);
+        }
+    }
+    if(files.empty()){
+        listDumps("docs", files);
+    }
+    if(files.empty()){
+        fprintf(stderr, "Usage: %s [-o corpus_dir] [lsusb.txt...]\n", argv[0]);
+        return 1;
+    }
+    //LittleFS is not mounted so the layout cache is not part of the measure
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    UPSHIDDevice::begin();
+    UPSHIDDevice& device = upsDevices[0];
+
+    printf("%-28s %6s %7s %12s %12s %10s %12s %10s\n", "Fixture", "Bytes", "Fields",
+                "Build (us)", "Input (ns)", "Input/s", "Feature (ns)", "Feature/s");
+    for(const std::string& file : files){
+        LsusbFixture fixture;
+        if(!loadLsusbFixture(file.c_str(), fixture)){
+            ESP_LOGE(TAG, "No report descriptor in %s", file.c_str());
+            continue;
+        }
+        if(corpus != nullptr){
+            writeCorpus(corpus, fixture);
+        }
+        //Registry is reset before each build, a connected device skips known descriptors
+        double build = measure([&](uint64_t iterations){
+            for(uint64_t n=0;n<iterations;++n){
+                device.deviceRemoved();
+                device.buildFromHIDReport(fixture.descriptor.data(), fixture.descriptor.size());
+            }
+        });
+        UpsSnapshot snapshot;
+        device.getSnapshot(snapshot);
+
+        std::vector<std::vector<uint8_t>> inputs;
+        std::vector<std::vector<uint8_t>> features;
+        makeReports(fixture.inputReports, inputs);
+        makeReports(fixture.featureReports, features);
+        double input = measureDecode(device, inputs, false);
+        double feature = measureDecode(device, features, true);
+        printf("%-28.28s %6u %7u %12.2f %12.1f %10.0f %12.1f %10.0f\n", fixture.name.c_str(),
+                    (unsigned)fixture.descriptor.size(), snapshot.fieldCount, build / 1000.0,
+                    input, input > 0.0 ? 1e9 / input : 0.0, feature, feature > 0.0 ? 1e9 / feature : 0.0);
+    }
+    return 0;
+}
@@ -0,0 +1,769 @@
+/*
+**    Virtual UPS emulator (PlatformIO native_emulator environment)
+**    Usage: program [-r reports_per_s] [-f] [-n ups_count] [-j readers] [-q] [-c capture.bin] <lsusb.txt> <scenario.txt>
+**           program [-f] [-j readers] [-q] [-c capture.bin] <capture.bin>
+**    Plays the report descriptor of a lsusb dump and a scenario script through
+**    the bridge callbacks, so the whole decode to status JSON and SNMP agent
+**    paths run on the host. The agent listens on the loopback (SNMP_PORT of
+**    the build), any SNMP manager can query it while the scenario plays.
+**    A capture downloaded from /capture is replayed report by report instead.
+**      -r  Input reports per second and per UPS (default 10)
+**      -f  Fast forward, plays the scenario without waiting
+**      -n  Number of UPS behind the virtual hub (default 1)
+**      -j  Threads rendering the status JSON in a loop, like HTTP clients (default 0)
+**      -q  Only prints the final statistics
+**      -c  Writes the reports capture of the run (same format as /capture)
+**
+**    Scenario lines are "<time_ms> <action> [arguments]", # starts a comment:
+**      plug                                    Enumerates the UPS
+**      unplug                                  Removes the UPS
+**      hang                                    Stops the UPS answering until the watchdog resets it
+**      set <page>:<usage> <value>              Sets a value (physical units)
+**      ramp <page>:<usage> <value> <time_ms>   Moves a value linearly
+**      command <page>:<usage> <value>          Sends a command to the UPS (SI units)
+**      selftest quick|deep                     Starts a battery test (scheduled tests follow
+**                                              the Self_test_interval of config.json)
+**      snmp get|getnext <oid>...               Sends a request to the agent and prints the answer
+**      snmp getbulk <max_repetitions> <oid>... (SNMPv2c, read community)
+**      end                                     Ends the scenario
+*/
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "UPSHIDDevice.hpp"
+#include "UPSEvents.hpp"
+#include "ReportCapture.hpp"
+#include "UPSSelfTest.hpp"
+#include "UPSState.hpp"
+#include "Configuration.hpp"
+#include "LsusbFixture.hpp"
+#include "VirtualUps.hpp"
+#include "SNMPBer.hpp"
+#include "UPSSNMP.hpp"
+#include <lwip/sockets.h>
+#include <unistd.h>
+
+#define SNMP_CLIENT_TIMEOUT_MS  1000    // Wait for the answer of the agent
+#define SNMP_CLIENT_RETRIES     2       // Requests sent again without answer
+
+static const char* TAG = "Emulator";
+
+UPSSNMPAgent snmpAgent;
+
+/**
+ * Scenario script line
+ */
+struct ScenarioEvent {
+    enum class Action : uint8_t {Plug, Unplug, Hang, Set, Ramp, Command, SelfTest, Snmp, End};
+    uint32_t timeMs;
+    Action action;
+    uint16_t usagePage;
+    uint16_t usage;
+    double value;               //Max-repetitions of a GETBULK
+    uint32_t durationMs;
+    uint8_t pdu;                //SNMP request type
+    std::vector<SnmpOid> oids;  //SNMP request OID
+};
+
+/**
+ * SNMP manager of the scenario, queries the agent on the loopback
+ */
+struct SnmpClient {
+    int socket;
+    int32_t nextRequestId;
+    uint64_t requests;
+    uint64_t answers;
+    uint64_t timeouts;
+    uint64_t errors;            //Answers with an error status
+    double latency;             //Sum of the answer times (s)
+};
+
+/**
+ * Value moving linearly
+ */
+struct Ramp {
+    uint16_t usagePage;
+    uint16_t usage;
+    double from;
+    double to;
+    uint32_t startMs;
+    uint32_t durationMs;
+};
+
+/**
+ * Capture record loaded for replay
+ */
+struct CaptureRecord {
+    CaptureRecordHeader header;
+    std::vector<uint8_t> data;
+};
+
+/**
+ * Capture file loaded for replay
+ */
+struct CaptureFile {
+    std::vector<std::pair<uint8_t, LsusbFixture>> devices;   //Device index and enumeration data
+    std::vector<CaptureRecord> records;
+};
+
+/**
+ * Parses a "page:usage" pair
+ */
+static bool parseUsage(const std::string& str, uint16_t& usagePage, uint16_t& usage)
+{
+    size_t colon = str.find(':');
+    if(colon == std::string::npos){
+        return false;
+    }
+    usagePage = strtoul(str.substr(0, colon).c_str(), nullptr, 0);
+    usage = strtoul(str.substr(colon + 1).c_str(), nullptr, 0);
+    return true;
+}
+
+/**
+ * Loads a scenario script
+ * @param path Script file
+ * @param events Events sorted by time
+ * @return false on syntax error
+ */
+static bool loadScenario(const char* path, std::vector<ScenarioEvent>& events)
+{
+    std::ifstream file(path);
+    if(!file){
+        ESP_LOGE(TAG, "Unable to read %s", path);
+        return false;
+    }
+    std::string line;
+    for(unsigned lineNumber=1;std::getline(file, line);++lineNumber){
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        std::string action;
+        std::string usage;
+        ScenarioEvent event = {};
+        if(!(words >> event.timeMs)){
+            continue;
+        }
+        words >> action;
+        bool valid = true;
+        if(action == "plug"){
+            event.action = ScenarioEvent::Action::Plug;
+        }else if(action == "unplug"){
+            event.action = ScenarioEvent::Action::Unplug;
+        }else if(action == "hang"){
+            event.action = ScenarioEvent::Action::Hang;
+        }else if(action == "end"){
+            event.action = ScenarioEvent::Action::End;
+        }else if(action == "set"){
+            event.action = ScenarioEvent::Action::Set;
+            valid = (words >> usage >> event.value) && parseUsage(usage, event.usagePage, event.usage);
+        }else if(action == "ramp"){
+            event.action = ScenarioEvent::Action::Ramp;
+            valid = (words >> usage >> event.value >> event.durationMs) && parseUsage(usage, event.usagePage, event.usage);
+        }else if(action == "command"){
+            event.action = ScenarioEvent::Action::Command;
+            valid = (words >> usage >> event.value) && parseUsage(usage, event.usagePage, event.usage);
+        }else if(action == "selftest"){
+            std::string kind;
+            event.action = ScenarioEvent::Action::SelfTest;
+            valid = (words >> kind) && ((kind == "quick") || (kind == "deep"));
+            event.value = kind == "deep";
+        }else if(action == "snmp"){
+            std::string kind;
+            event.action = ScenarioEvent::Action::Snmp;
+            valid = (bool)(words >> kind);
+            if(kind == "get"){
+                event.pdu = PDU_GET;
+            }else if(kind == "getnext"){
+                event.pdu = PDU_GET_NEXT;
+            }else if(kind == "getbulk"){
+                event.pdu = PDU_GET_BULK;
+                valid = valid && (words >> event.value);
+            }else{
+                valid = false;
+            }
+            for(std::string oid;valid && (words >> oid);){
+                event.oids.emplace_back();
+                valid = event.oids.back().parse(oid.c_str());
+            }
+            valid = valid && !event.oids.empty();
+        }else{
+            valid = false;
+        }
+        if(!valid){
+            ESP_LOGE(TAG, "%s:%u: invalid line", path, lineNumber);
+            return false;
+        }
+        events.push_back(event);
+    }
+    std::stable_sort(events.begin(), events.end(), [](const ScenarioEvent& a, const ScenarioEvent& b){
+        return a.timeMs < b.timeMs;
+    });
+    return true;
+}
+
+/**
+ * Gets if a file is a reports capture
+ */
+static bool isCapture(const char* path)
+{
+    std::ifstream file(path, std::ios::binary);
+    char magic[sizeof(CaptureFileHeader::magic)];
+    return file.read(magic, sizeof(magic)) && (memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) == 0);
+}
+
+/**
+ * Loads a reports capture
+ * @param path Capture file
+ * @param capture Destination
+ * @return false if the file is truncated or not a capture
+ */
+static bool loadCapture(const char* path, CaptureFile& capture)
+{
+    std::ifstream file(path, std::ios::binary);
+    CaptureFileHeader fileHeader;
+    if(!file.read((char*)&fileHeader, sizeof(fileHeader)) || (memcmp(fileHeader.magic, CAPTURE_MAGIC, sizeof(fileHeader.magic)) != 0) ||
+        (fileHeader.version != CAPTURE_VERSION)){
+        ESP_LOGE(TAG, "%s is not a version %u capture", path, CAPTURE_VERSION);
+        return false;
+    }
+    for(uint8_t d=0;d<fileHeader.deviceCount;++d){
+        CaptureDeviceHeader deviceHeader;
+        if(!file.read((char*)&deviceHeader, sizeof(deviceHeader)) || (deviceHeader.device >= UPS_MAX_DEVICES)){
+            ESP_LOGE(TAG, "%s: invalid device section", path);
+            return false;
+        }
+        LsusbFixture fixture;
+        fixture.name = "capture";
+        fixture.idVendor = deviceHeader.idVendor;
+        fixture.idProduct = deviceHeader.idProduct;
+        fixture.bcdDevice = deviceHeader.bcdDevice;
+        fixture.manufacturer.resize(deviceHeader.manufacturerLength);
+        fixture.product.resize(deviceHeader.productLength);
+        fixture.serial.resize(deviceHeader.serialLength);
+        fixture.descriptor.resize(deviceHeader.descriptorLength);
+        if(!file.read(&fixture.manufacturer[0], fixture.manufacturer.size()) || !file.read(&fixture.product[0], fixture.product.size()) ||
+            !file.read(&fixture.serial[0], fixture.serial.size()) || !file.read((char*)fixture.descriptor.data(), fixture.descriptor.size())){
+            ESP_LOGE(TAG, "%s: truncated device section", path);
+            return false;
+        }
+        capture.devices.emplace_back(deviceHeader.device, fixture);
+    }
+    CaptureRecord record;
+    while(file.read((char*)&record.header, sizeof(record.header))){
+        record.data.resize(record.header.length);
+        if(!file.read((char*)record.data.data(), record.data.size())){
+            ESP_LOGE(TAG, "%s: truncated record", path);
+            return false;
+        }
+        capture.records.push_back(record);
+    }
+    ESP_LOGI(TAG, "%s: %u devices, %u records (%u captured)", path, (unsigned)capture.devices.size(),
+                (unsigned)capture.records.size(), fileHeader.captureCount);
+    return true;
+}
+
+/**
+ * Writes the reports capture of the run
+ */
+static bool saveCapture(const char* path)
+{
+    std::ofstream file(path, std::ios::binary);
+    bool ok = file && reportCapture.dump([](void* context, const uint8_t* data, size_t len)->bool{
+        return (bool)static_cast<std::ofstream*>(context)->write((const char*)data, len);
+    }, &file);
+    if(!ok){
+        ESP_LOGE(TAG, "Unable to write %s", path);
+    }
+    return ok;
+}
+
+/**
+ * Prints the status JSON if it changed
+ */
+static void printStatus(uint64_t nowUs, std::string& lastStatus)
+{
+    JsonDocument doc;
+    std::string status;
+    UPSHIDDevice::devicesToJSON(doc);
+    upsState.devicesToJSON(doc);
+    upsSelfTest.devicesToJSON(doc);
+    serializeJson(doc, status);
+    if(status != lastStatus){
+        printf("[%8.3f s] %s\n", nowUs / 1e6, status.c_str());
+        lastStatus = status;
+    }
+}
+
+/**
+ * Opens the socket of the SNMP manager
+ */
+static bool openSnmpClient(SnmpClient& client)
+{
+    client = {};
+    client.nextRequestId = 1;
+    client.socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(client.socket < 0){
+        ESP_LOGE(TAG, "Unable to create SNMP socket (%d)", errno);
+        return false;
+    }
+    timeval timeout = {};
+    timeout.tv_sec = SNMP_CLIENT_TIMEOUT_MS / 1000;
+    timeout.tv_usec = (SNMP_CLIENT_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(client.socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    sockaddr_in agent = {};
+    agent.sin_family = AF_INET;
+    agent.sin_port = htons(SNMP_PORT);
+    agent.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    //Connected, the answers of the agent only
+    return connect(client.socket, reinterpret_cast<sockaddr*>(&agent), sizeof(agent)) == 0;
+}
+
+/**
+ * Converts a variable binding value to text
+ * @param tag Tag of the value
+ * @param value Reader of the whole value TLV
+ */
+static std::string snmpValueToString(uint8_t tag, BerReader value)
+{
+    int64_t number;
+    const uint8_t* str;
+    size_t length;
+    SnmpOid oid;
+    switch(tag){
+        case BER_INTEGER:
+        case BER_COUNTER32:
+        case BER_GAUGE32:
+        case BER_TIMETICKS:
+            return value.readInteger(tag, number) ? std::to_string(number) : "?";
+        case BER_OCTET_STRING:
+            return value.readString(str, length) ? "\"" + std::string((const char*)str, length) + "\"" : "?";
+        case BER_OID:
+            return value.readOid(oid) ? oid.toString() : "?";
+        case BER_NULL:
+            return "NULL";
+        case BER_NO_SUCH_OBJECT:
+            return "noSuchObject";
+        case BER_NO_SUCH_INSTANCE:
+            return "noSuchInstance";
+        case BER_END_OF_MIB_VIEW:
+            return "endOfMibView";
+    }
+    return "tag 0x" + std::to_string(tag);
+}
+
+/**
+ * Sends a scenario request to the agent and prints its answer
+ */
+static void snmpRequest(SnmpClient& client, const ScenarioEvent& event, uint64_t nowUs, bool quiet)
+{
+    static const char* const PDU_NAMES[] = {"get", "getnext", "response", "set", "trap", "getbulk"};
+    const char* name = PDU_NAMES[event.pdu - PDU_GET];
+    uint8_t request[SNMP_MAX_MESSAGE];
+    uint8_t answer[SNMP_MAX_MESSAGE];
+    int32_t requestId = client.nextRequestId++;
+    BerWriter writer(request, sizeof(request));
+    size_t message = writer.begin(BER_SEQUENCE);
+    writer.writeInteger(BER_INTEGER, SNMP_VERSION_2C);
+    writer.writeString(SNMP_READ_COMMUNITY);
+    size_t pdu = writer.begin(event.pdu);
+    writer.writeInteger(BER_INTEGER, requestId);
+    //Non-repeaters and max-repetitions of a GETBULK
+    writer.writeInteger(BER_INTEGER, 0);
+    writer.writeInteger(BER_INTEGER, event.pdu == PDU_GET_BULK ? (int32_t)event.value : 0);
+    size_t list = writer.begin(BER_SEQUENCE);
+    for(const SnmpOid& oid : event.oids){
+        size_t varbind = writer.begin(BER_SEQUENCE);
+        writer.writeOid(oid);
+        writer.writeNull();
+        writer.end(varbind);
+    }
+    writer.end(list);
+    writer.end(pdu);
+    writer.end(message);
+    ++client.requests;
+
+    auto sent = std::chrono::steady_clock::now();
+    int length = -1;
+    for(uint8_t attempt=0;(attempt <= SNMP_CLIENT_RETRIES) && (length < 0);++attempt){
+        send(client.socket, writer.data(), writer.size(), 0);
+        //Answers of requests given up are skipped
+        for(;;){
+            length = recv(client.socket, answer, sizeof(answer), 0);
+            BerReader fields, answerPdu;
+            int32_t version, answerId;
+            const uint8_t* community;
+            size_t communityLength;
+            if((length < 0) || (BerReader(answer, length).enter(BER_SEQUENCE, fields) && fields.readInteger(version) &&
+                fields.readString(community, communityLength) && fields.enter(PDU_RESPONSE, answerPdu) &&
+                answerPdu.readInteger(answerId) && (answerId == requestId))){
+                break;
+            }
+        }
+    }
+    if(length < 0){
+        ++client.timeouts;
+        ESP_LOGW(TAG, "SNMP %s: no answer from the agent", name);
+        return;
+    }
+    std::chrono::duration<double> latency = std::chrono::steady_clock::now() - sent;
+    client.latency += latency.count();
+    ++client.answers;
+
+    BerReader fields, answerPdu, varbinds;
+    int32_t version, answerId, errorStatus, errorIndex;
+    const uint8_t* community;
+    size_t communityLength;
+    if(!BerReader(answer, length).enter(BER_SEQUENCE, fields) || !fields.readInteger(version) ||
+        !fields.readString(community, communityLength) || !fields.enter(PDU_RESPONSE, answerPdu) ||
+        !answerPdu.readInteger(answerId) || !answerPdu.readInteger(errorStatus) || !answerPdu.readInteger(errorIndex) ||
+        !answerPdu.enter(BER_SEQUENCE, varbinds)){
+        ++client.errors;
+        ESP_LOGW(TAG, "SNMP %s: malformed answer", name);
+        return;
+    }
+    if(errorStatus != SNMP_NO_ERROR){
+        ++client.errors;
+        ESP_LOGW(TAG, "SNMP %s: error %d at %d", name, errorStatus, errorIndex);
+    }
+    if(quiet){
+        return;
+    }
+    BerReader varbind;
+    while(varbinds.enter(BER_SEQUENCE, varbind)){
+        SnmpOid oid;
+        const uint8_t* value;
+        size_t valueLength;
+        if(!varbind.readOid(oid) || !varbind.readRaw(value, valueLength)){
+            break;
+        }
+        printf("[%8.3f s] SNMP %s %s = %s\n", nowUs / 1e6, name, oid.toString().c_str(),
+                    snmpValueToString(value[0], BerReader(value, valueLength)).c_str());
+    }
+}
+
+/**
+ * Plays a scenario
+ * @return Scenario end time in milliseconds
+ */
+static uint32_t playScenario(std::vector<std::unique_ptr<VirtualUps>>& upses, const std::vector<ScenarioEvent>& events,
+                                SnmpClient& snmp, uint32_t rate, bool fast, bool quiet)
+{
+    uint32_t endMs = events.empty() ? 0 : events.back().timeMs;
+    std::vector<Ramp> ramps;
+    std::string lastStatus;
+    size_t nextEvent = 0;
+    const uint64_t periodUs = 1000000 / rate;
+    auto start = std::chrono::steady_clock::now();
+    for(uint64_t nowUs=0;(nowUs / 1000) <= endMs;nowUs+=periodUs){
+        uint32_t nowMs = nowUs / 1000;
+        //Scenario events up to now
+        for(;(nextEvent < events.size()) && (events[nextEvent].timeMs <= nowMs);++nextEvent){
+            const ScenarioEvent& event = events[nextEvent];
+            switch(event.action){
+                case ScenarioEvent::Action::Plug:
+                    for(auto& ups : upses){
+                        ups->plug();
+                    }
+                    break;
+                case ScenarioEvent::Action::Unplug:
+                    for(auto& ups : upses){
+                        ups->unplug();
+                    }
+                    break;
+                case ScenarioEvent::Action::Hang:
+                    for(auto& ups : upses){
+                        ups->hang();
+                    }
+                    break;
+                case ScenarioEvent::Action::Set:
+                    ramps.erase(std::remove_if(ramps.begin(), ramps.end(), [&event](const Ramp& ramp){
+                        return (ramp.usagePage == event.usagePage) && (ramp.usage == event.usage);
+                    }), ramps.end());
+                    for(auto& ups : upses){
+                        if(ups->setValue(event.usagePage, event.usage, event.value) == 0){
+                            ESP_LOGW(TAG, "Usage 0x%04x:0x%04x not in the descriptor", event.usagePage, event.usage);
+                            break;
+                        }
+                    }
+                    break;
+                case ScenarioEvent::Action::Ramp:
+                    ramps.push_back({event.usagePage, event.usage, upses[0]->getValue(event.usagePage, event.usage),
+                                        event.value, event.timeMs, std::max(1u, event.durationMs)});
+                    break;
+                case ScenarioEvent::Action::Command:
+                    for(size_t u=0;u<upses.size();++u){
+                        if(upses[u]->isPlugged()){
+                            UPSCommandStatus status = upsDevices[u].sendCommand(event.usagePage, event.usage, std::lround(event.value * 1000), -3);
+                            ESP_LOGI(TAG, "UPS %u command 0x%04x:0x%04x = %g: %s", (unsigned)(u + 1), event.usagePage, event.usage,
+                                        event.value, upsCommandStatusToString(status));
+                        }
+                    }
+                    break;
+                case ScenarioEvent::Action::SelfTest:
+                    for(size_t u=0;u<upses.size();++u){
+                        if(upses[u]->isPlugged()){
+                            UPSCommandStatus status = upsSelfTest.start(u, event.value != 0);
+                            ESP_LOGI(TAG, "UPS %u %s test: %s", (unsigned)(u + 1), event.value != 0 ? "deep" : "quick",
+                                        upsCommandStatusToString(status));
+                        }
+                    }
+                    break;
+                case ScenarioEvent::Action::Snmp:
+                    snmpRequest(snmp, event, nowUs, quiet);
+                    break;
+                case ScenarioEvent::Action::End:
+                    endMs = event.timeMs;
+                    break;
+            }
+        }
+        for(auto it=ramps.begin();it!=ramps.end();){
+            double progress = std::min(1.0, (double)(nowMs - it->startMs) / it->durationMs);
+            for(auto& ups : upses){
+                ups->setValue(it->usagePage, it->usage, it->from + (it->to - it->from) * progress);
+            }
+            it = progress >= 1.0 ? ramps.erase(it) : it + 1;
+        }
+        //UPS traffic of this period
+        for(auto& ups : upses){
+            ups->serviceReset();
+            ups->serviceSetReports(nowMs);
+            ups->serviceSetIdle();
+            ups->sendInputReport(nowMs);
+            ups->serviceFeatureReports(nowMs);
+        }
+        UPSHIDDevice::watchdog();
+        upsState.loop(nowMs);
+        upsSelfTest.loop(nowMs);
+        if(!quiet){
+            printStatus(nowUs, lastStatus);
+        }
+        if(!fast){
+            std::this_thread::sleep_until(start + std::chrono::microseconds(nowUs + periodUs));
+        }
+    }
+    return endMs;
+}
+
+/**
+ * Replays a capture, report by report at the captured times
+ * @return Capture duration in milliseconds
+ */
+static uint32_t playCapture(std::vector<std::unique_ptr<VirtualUps>>& upses, const CaptureFile& capture, bool fast, bool quiet)
+{
+    VirtualUps* devices[UPS_MAX_DEVICES] = {};
+    for(const auto& device : capture.devices){
+        upses.emplace_back(new VirtualUps(device.first, device.second));
+        devices[device.first] = upses.back().get();
+    }
+    if(capture.records.empty()){
+        return 0;
+    }
+    std::string lastStatus;
+    bool seen[UPS_MAX_DEVICES] = {};
+    uint32_t firstMs = capture.records.front().header.timeMs;
+    uint32_t nowMs = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(const CaptureRecord& record : capture.records){
+        VirtualUps* ups = record.header.device < UPS_MAX_DEVICES ? devices[record.header.device] : nullptr;
+        if(ups == nullptr){
+            continue;
+        }
+        //Status of the previous instant, once all its reports are in
+        if(!quiet && (record.header.timeMs - firstMs != nowMs)){
+            printStatus((uint64_t)nowMs * 1000, lastStatus);
+        }
+        nowMs = record.header.timeMs - firstMs;
+        if(!fast){
+            std::this_thread::sleep_until(start + std::chrono::milliseconds(nowMs));
+        }
+        //Enumeration older than the ring, the device was already there
+        if(!seen[record.header.device] && (record.header.type != CaptureRecordHeader::PLUG)){
+            ups->plug();
+        }
+        seen[record.header.device] = true;
+        switch(record.header.type){
+            case CaptureRecordHeader::PLUG:
+                ups->unplug();
+                ups->plug();
+                break;
+            case CaptureRecordHeader::REMOVED:
+                ups->unplug();
+                break;
+            case CaptureRecordHeader::OUTPUT_REPORT:
+                //Written by the firmware, its effect is in the following reports
+                break;
+            case CaptureRecordHeader::INPUT_REPORT:
+            case CaptureRecordHeader::FEATURE_REPORT:
+                ups->sendReport(record.data.data(), record.data.size(), record.header.type == CaptureRecordHeader::FEATURE_REPORT);
+                break;
+            default:
+                ESP_LOGW(TAG, "Unknown record type %u", record.header.type);
+                break;
+        }
+    }
+    if(!quiet){
+        printStatus((uint64_t)nowMs * 1000, lastStatus);
+    }
+    return nowMs;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t rate = 10;
+    bool fast = false;
+    bool quiet = false;
+    unsigned upsCount = 1;
+    unsigned readers = 0;
+    const char* capturePath = nullptr;
+    std::vector<const char*> files;
+    for(int i=1;i<argc;++i){
+        std::string arg = argv[i];
+        if((arg == "-r") && (i + 1 < argc)){
+            rate = std::max(1ul, strtoul(argv[++i], nullptr, 10));
+        }else if((arg == "-n") && (i + 1 < argc)){
+            upsCount = std::min<unsigned long>(std::max(1ul, strtoul(argv[++i], nullptr, 10)), UPS_MAX_DEVICES);
+        }else if((arg == "-j") && (i + 1 < argc)){
+            readers = strtoul(argv[++i], nullptr, 10);
+        }else if((arg == "-c") && (i + 1 < argc)){
+            capturePath = argv[++i];
+        }else if(arg == "-f"){
+            fast = true;
+        }else if(arg == "-q"){
+            quiet = true;
+        }else{
+            files.push_back(argv[i]);
+        }
+    }
+    bool replay = (files.size() == 1) && isCapture(files[0]);
+    if((files.size() != 2) && !replay){
+        fprintf(stderr, "Usage: %s [-r reports_per_s] [-f] [-n ups_count] [-j readers] [-q] [-c capture.bin] <lsusb.txt> <scenario.txt>\n"
+                        "       %s [-f] [-j readers] [-q] [-c capture.bin] <capture.bin>\n", argv[0], argv[0]);
+        return 1;
+    }
+    LsusbFixture fixture;
+    std::vector<ScenarioEvent> events;
+    CaptureFile capture;
+    if(replay){
+        if(!loadCapture(files[0], capture)){
+            return 1;
+        }
+    }else{
+        if(!loadLsusbFixture(files[0], fixture)){
+            ESP_LOGE(TAG, "No report descriptor in %s", files[0]);
+            return 1;
+        }
+        if(!loadScenario(files[1], events)){
+            return 1;
+        }
+    }
+    if(quiet){
+        esp_log_level_set("*", ESP_LOG_WARN);
+    }
+    LittleFS.begin(true);
+    if(capturePath != nullptr){
+        reportCapture.begin();
+    }
+    //Self-test schedule from config.json of the LittleFS root (LITTLEFS_ROOT)
+    Configuration.load();
+    upsState.begin();
+    upsSelfTest.begin();
+    snmpAgent.begin();
+    snmpAgent.start();
+    UPSHIDDevice::begin();
+    SnmpClient snmp;
+    if(!openSnmpClient(snmp)){
+        return 1;
+    }
+    std::vector<std::unique_ptr<VirtualUps>> upses;
+    if(!replay){
+        for(unsigned u=0;u<upsCount;++u){
+            upses.emplace_back(new VirtualUps(u, fixture));
+        }
+    }
+
+    //Event bus subscriber, counts its wake-ups and the coalesced events
+    std::atomic<bool> running(true);
+    uint64_t wakes = 0;
+    uint64_t eventCounts[3] = {};
+    std::atomic<bool> subscribed(false);
+    std::thread subscriberThread([&running, &subscribed, &wakes, &eventCounts](){
+        UPSEventBus::Subscriber events = upsEvents.subscribe(UPSEventBus::DECODE, xTaskGetCurrentTaskHandle());
+        subscribed = true;
+        while(running){
+            uint32_t pending = upsEvents.wait(events, pdMS_TO_TICKS(100));
+            if(pending == 0){
+                continue;
+            }
+            ++wakes;
+            for(uint8_t i=0;i<UPS_MAX_DEVICES;++i){
+                uint8_t upsEvents = UPSEventBus::getEvents(pending, i);
+                for(uint8_t e=0;e<3;++e){
+                    eventCounts[e] += (upsEvents >> e) & 1;
+                }
+            }
+        }
+    });
+
+    while(!subscribed){
+        std::this_thread::yield();
+    }
+
+    //Front-ends rendering the status while reports are decoded
+    std::atomic<uint64_t> statusReads(0);
+    std::vector<std::thread> readerThreads;
+    for(unsigned r=0;r<readers;++r){
+        readerThreads.emplace_back([&running, &statusReads](){
+            while(running){
+                JsonDocument doc;
+                std::string str;
+                UPSHIDDevice::devicesToJSON(doc);
+                serializeJson(doc, str);
+                ++statusReads;
+            }
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    uint32_t endMs = replay ? playCapture(upses, capture, fast, quiet) : playScenario(upses, events, snmp, rate, fast, quiet);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    running = false;
+    for(std::thread& thread : readerThreads){
+        thread.join();
+    }
+    subscriberThread.join();
+
+    uint64_t reports = 0;
+    for(auto& ups : upses){
+        reports += ups->getReportCount();
+    }
+    printf("%s: %.3f s, played in %.3f s\n", replay ? "Capture" : "Scenario", endMs / 1000.0, elapsed.count());
+    printf("Reports: %llu (%.0f reports/s, %.0f ns/report)\n", (unsigned long long)reports,
+                reports / elapsed.count(), reports > 0 ? elapsed.count() * 1e9 / reports : 0.0);
+    printf("Event wake-ups: %llu (connection %llu, readings %llu, values %llu)\n", (unsigned long long)wakes,
+                (unsigned long long)eventCounts[0], (unsigned long long)eventCounts[1], (unsigned long long)eventCounts[2]);
+    if(readers > 0){
+        printf("Status reads: %llu (%.0f reads/s)\n", (unsigned long long)statusReads.load(), statusReads / elapsed.count());
+    }
+    if(snmp.requests > 0){
+        printf("SNMP requests: %llu (%llu answered, %llu timeouts, %llu errors, %.3f ms/answer)\n", (unsigned long long)snmp.requests,
+                    (unsigned long long)snmp.answers, (unsigned long long)snmp.timeouts, (unsigned long long)snmp.errors,
+                    snmp.answers > 0 ? snmp.latency * 1e3 / snmp.answers : 0.0);
+    }
+    //The agent task closes its socket at its next wakeup
+    snmpAgent.stop();
+    close(snmp.socket);
+    if((capturePath != nullptr) && !saveCapture(capturePath)){
+        return 1;
+    }
+    return 0;
+}
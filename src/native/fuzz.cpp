@@ -0,0 +1,49 @@
+/*
+**    libFuzzer target of the HID report descriptor parser (PlatformIO native_fuzz environment)
+**    The input is parsed as a report descriptor, then decoded as an Input
+**    and a Feature report against the layout it produced.
+**    Seed the corpus with the native_bench -o option.
+**    Built with -D FUZZ_REPLAY, the program runs the files given on the
+**    command line through the target (crash reproduction without libFuzzer).
+*/
+#include <Arduino.h>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "UPSHIDDevice.hpp"
+
+extern "C" int LLVMFuzzerInitialize(int* argc, char*** argv)
+{
+    //LittleFS is not mounted, the layout cache is never written
+    esp_log_level_set("*", ESP_LOG_NONE);
+    UPSHIDDevice::begin();
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    UPSHIDDevice& device = upsDevices[0];
+    device.deviceRemoved();
+    device.buildFromHIDReport(data, size);
+    device.hidReportData(data, size);
+    device.hidFeatureReportData(data, size);
+    std::string status;
+    device.statusToJSONString(status);
+    return 0;
+}
+
+#if defined(FUZZ_REPLAY)
+int main(int argc, char** argv)
+{
+    LLVMFuzzerInitialize(&argc, &argv);
+    for(int i=1;i<argc;++i){
+        std::ifstream file(argv[i], std::ios::binary);
+        std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        LLVMFuzzerTestOneInput(data.data(), data.size());
+        printf("%s: OK\n", argv[i]);
+    }
+    return 0;
+}
+#endif
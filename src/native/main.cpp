@@ -0,0 +1,86 @@
+/*
+**    Host entry point (PlatformIO native environment)
+**    Usage: program <report_descriptor.bin|lsusb.txt> [input_report.bin...]
+**    Parses a HID report descriptor (raw or lsusb -v dump) with the firmware code, feeds the
+**    raw input reports (report ID first) and prints the resulting JSON
+*/
+#include <Arduino.h>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "UPSHIDDevice.hpp"
+#include "Configuration.hpp"
+#include "LsusbFixture.hpp"
+
+static const char* TAG = "Native";
+
+/**
+ * Reads a whole file
+ * @param path File to read
+ * @param data Destination buffer
+ * @return false if the file can't be opened
+ */
+static bool readFile(const char* path, std::vector<uint8_t>& data)
+{
+    std::ifstream file(path, std::ios::binary);
+    if(!file){
+        return false;
+    }
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+/**
+ * Delivers data as the bridge would (control transfers carry the SETUP packet first)
+ * @param callback Bridge callback to call
+ * @param data Payload
+ * @param control True for a control transfer
+ */
+static void deliver(void (*callback)(uint8_t, usb_transfer_t*), const std::vector<uint8_t>& data, bool control)
+{
+    if(callback == nullptr){
+        return;
+    }
+    size_t offset = control ? USB_SETUP_PACKET_SIZE : 0;
+    std::vector<uint8_t> buffer(offset + data.size());
+    std::copy(data.begin(), data.end(), buffer.begin() + offset);
+    usb_transfer_t transfer = {
+        buffer.data(), buffer.size(), (int)buffer.size(), (int)buffer.size(), 0, nullptr, 0x81,
+        USB_TRANSFER_STATUS_COMPLETED, 0, nullptr, nullptr, 0
+    };
+    callback(0, &transfer);
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2){
+        fprintf(stderr, "Usage: %s <report_descriptor.bin|lsusb.txt> [input_report.bin...]\n", argv[0]);
+        return 1;
+    }
+    Configuration.begin();
+    Configuration.load();
+    std::string config;
+    Configuration.toJSONString(config);
+    printf("%s\n", config.c_str());
+
+    UPSHIDDevice::begin();
+    std::vector<uint8_t> data;
+    if(!loadDescriptor(argv[1], data)){
+        ESP_LOGE(TAG, "Unable to read %s", argv[1]);
+        return 1;
+    }
+    deliver(hidBridge.onHidReportDescriptorReceived, data, true);
+    for(int i=2;i<argc;++i){
+        if(!readFile(argv[i], data)){
+            ESP_LOGE(TAG, "Unable to read %s", argv[i]);
+            return 1;
+        }
+        deliver(hidBridge.onReportReceived, data, false);
+    }
+
+    std::string status;
+    upsDevices[0].statusToJSONString(status);
+    printf("%s\n", status.c_str());
+    return 0;
+}